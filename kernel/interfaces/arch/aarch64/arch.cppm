@@ -3,6 +3,7 @@
 export module arch:impl;
 
 import system.cpu.arch;
+import std;
 
 export namespace arch
 {
@@ -21,4 +22,13 @@ export namespace arch
     {
         return cpu::mrs<"daif">() == 0;
     }
+
+    // size is a multiple of 64. stnp hints that the lines won't be reused
+    void clear_nt(void *ptr, std::size_t size)
+    {
+        auto *bytes = static_cast<std::byte *>(ptr);
+        for (std::size_t i = 0; i < size; i += 16)
+            asm volatile ("stnp xzr, xzr, [%[dst]]" :: [dst]"r"(bytes + i) : "memory");
+        asm volatile ("dmb ishst" ::: "memory");
+    }
 } // export namespace arch
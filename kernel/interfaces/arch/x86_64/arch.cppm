@@ -27,4 +27,13 @@ export namespace arch
         );
         return rflags & (1 << 9);
     }
+
+    // size is a multiple of 64. movnti goes around the cache
+    void clear_nt(void *ptr, std::size_t size)
+    {
+        auto *qwords = static_cast<std::uint64_t *>(ptr);
+        for (std::size_t i = 0; i < size / sizeof(std::uint64_t); i++)
+            asm volatile ("movnti %[zero], %[dst]" : [dst]"=m"(qwords[i]) : [zero]"r"(0ul));
+        asm volatile ("sfence" ::: "memory");
+    }
 } // export namespace arch
@@ -12,14 +12,56 @@ import std;
 
 export namespace dev::block
 {
+    struct queue_t;
+    struct request_t;
+
+    // one chunk of a transfer, at most max_transfer_lba blocks. requests
+    // are built out of contiguous bios. done is called once, after which
+    // the queue does not touch the bio again
+    struct bio_t
+    {
+        bool write;
+        bool sync;
+        std::uint64_t lba;
+        std::uint64_t nlb;
+        arch::dma_buffer dma;
+        std::function<void (lib::expect<void>)> done;
+
+        // in the request it was merged into
+        lib::intrusive_list_hook<bio_t> hook;
+    };
+
+    struct queue_stats_t
+    {
+        std::uint64_t reads;
+        std::uint64_t writes;
+        std::uint64_t read_merges;
+        std::uint64_t write_merges;
+        std::uint64_t inflight_reads;
+        std::uint64_t inflight_writes;
+        std::uint64_t max_inflight;
+    };
+
     class drive_t
     {
         friend lib::expect<void> register_drive(
             const std::shared_ptr<drive_t> &drive, std::string_view part_prefix
         );
+        friend struct queue_t;
+        friend class plug_t;
 
         static std::uint64_t alloc_seq();
 
+        std::shared_ptr<queue_t> _queue;
+
+        void init_queue();
+        void submit(bio_t *bio);
+
+        // a slot for an asynchronous write of lba..lba + nlb, waiting while
+        // too many are in flight or one of them overlaps it
+        std::size_t async_begin(std::uint64_t lba, std::uint64_t nlb);
+        void async_end(std::size_t slot, const lib::expect<void> &res);
+
         protected:
         std::uint8_t _lba_shift;
         std::uint64_t _lba_count;
@@ -27,6 +69,11 @@ export namespace dev::block
 
         arch::dma_pool &_pool;
 
+        // hardware queues requests can be dispatched to and how many each
+        // takes at once. drivers set them before registering the drive
+        std::size_t _nr_hw_queues = 1;
+        std::size_t _queue_depth = 32;
+
         std::vector<std::shared_ptr<dev::device_t>> _parts;
         std::uint64_t _seq;
 
@@ -37,6 +84,16 @@ export namespace dev::block
             std::function<void (lib::expect<void>)> cb
         ) = 0;
 
+        // rw on hardware queue hwq, drivers with more than one override it
+        virtual void rw(
+            std::size_t hwq, bool write, bool sync, std::uint64_t lba,
+            arch::dma_buffer &buffer, std::function<void (lib::expect<void>)> cb
+        )
+        {
+            lib::unused(hwq);
+            rw(write, sync, lba, buffer, std::move(cb));
+        }
+
         lib::expect<void> rw(
             bool write, bool sync, std::uint64_t offset, std::size_t total_size,
             std::function_ref<lib::maybe_uspan<std::byte> (std::size_t)> getter
@@ -61,6 +118,21 @@ export namespace dev::block
         std::span<const std::shared_ptr<dev::device_t>> partitions() const { return _parts; }
         std::uint64_t seq() const { return _seq; }
 
+        // where the flusher for the drive's page cache lives
+        vmm::backing_dev *bdi() const;
+
+        std::size_t queue_depth() const { return _queue_depth; }
+        std::size_t nr_hw_queues() const { return _nr_hw_queues; }
+        queue_stats_t queue_stats() const;
+
+        // waits for the asynchronous writes in flight
+        void wait_writes();
+        // only for those that overlap lba..lba + nlb
+        void wait_writes(std::uint64_t lba, std::uint64_t nlb);
+        // wait_writes, then the first error one of them hit since the last
+        // call
+        lib::expect<void> drain();
+
         template<std::ranges::random_access_range Range>
             requires std::same_as<std::ranges::range_value_t<Range>, lib::maybe_uspan<std::byte>>
         lib::expect<void> rw(bool write, bool sync, std::uint64_t offset, Range &&range)
@@ -74,6 +146,34 @@ export namespace dev::block
         virtual lib::expect<void> flush() { return { }; };
     };
 
+    // holds back the requests the current thread submits until it is
+    // flushed or goes out of scope, so that a burst of them reaches the
+    // queues at once and contiguous ones are merged. only the outermost
+    // plug of a thread does anything. drive_t::rw flushes it before
+    // waiting, so it is fine to hold one across synchronous i/o
+    class plug_t
+    {
+        private:
+        std::vector<request_t *> _requests;
+        bool _active;
+
+        friend class drive_t;
+        void add(drive_t &drive, bio_t *bio);
+
+        public:
+        plug_t();
+        ~plug_t();
+
+        plug_t(const plug_t &) = delete;
+        plug_t &operator=(const plug_t &) = delete;
+
+        void flush();
+    };
+
+    // flushes the current thread's plug, if it has one
+    void flush_plug();
+
+    struct buffer_t;
     struct object_t : vmm::object
     {
         friend struct ops_t;
@@ -82,12 +182,18 @@ export namespace dev::block
         std::uint64_t lba_start;
         std::uint64_t lba_count;
 
+        // metadata buffers by byte offset into the device, see bread
+        lib::map::flat_hash<std::uint64_t, buffer_t *> buffers;
+
         lib::expect<void> fetch_pages(std::size_t idx, std::span<vmm::page *> pages) override;
         lib::expect<void> write_pages(std::size_t idx, std::span<vmm::page *> pages) override;
 
-        object_t(std::uint64_t lba_start, std::uint64_t lba_count, std::weak_ptr<drive_t> drive)
+        object_t(std::uint64_t lba_start, std::uint64_t lba_count, const std::shared_ptr<drive_t> &drive)
             : vmm::object { vmm::object_type::file },
-              drive { std::move(drive) }, lba_start { lba_start }, lba_count { lba_count } { }
+              drive { drive }, lba_start { lba_start }, lba_count { lba_count }
+        {
+            bdi = drive->bdi();
+        }
     };
 
     struct ops_t : vfs::ops_t
@@ -108,6 +214,16 @@ export namespace dev::block
 
         object_t &get_memory() { return static_cast<object_t &>(*memory); }
 
+        // synchronous i/o around the page cache, for filesystems that cache
+        // file data themselves. offset and the total length are in whole
+        // device blocks. cached copies of what is written are updated, so
+        // that writing back a page that shares blocks with it does not
+        // bring old data back
+        lib::expect<void> direct_rw(
+            bool write, std::uint64_t offset,
+            std::span<const lib::maybe_uspan<std::byte>> range
+        );
+
         lib::expect<std::size_t> read(
             const std::shared_ptr<vfs::file_t> &file, std::uint64_t offset,
             lib::maybe_uspan<std::byte> buffer
@@ -123,6 +239,73 @@ export namespace dev::block
         lib::expect<void> sync(const std::shared_ptr<vfs::file_t> &file, bool data) override;
     };
 
+    // one filesystem block of a device, pinned in the device's page cache.
+    // unused buffers stay hashed on an lru until there are too many or
+    // memory runs low, so that bitmaps, indirect blocks and inode tables
+    // are read from the disk once
+    struct buffer_t
+    {
+        // an object_t, pinned for as long as the buffer is hashed
+        vmm::object::ptr obj;
+        vmm::page *pg;
+        std::byte *data;
+        std::uint64_t offset;
+        std::uint32_t size;
+
+        // users, the lru holds none
+        std::uint32_t refcount;
+        lib::intrusive_list_hook<buffer_t> lru_hook;
+    };
+
+    class buffer_ref
+    {
+        private:
+        buffer_t *_buf = nullptr;
+
+        public:
+        buffer_ref() = default;
+        explicit buffer_ref(buffer_t *buf) : _buf { buf } { }
+
+        buffer_ref(const buffer_ref &) = delete;
+        buffer_ref &operator=(const buffer_ref &) = delete;
+
+        buffer_ref(buffer_ref &&rhs) : _buf { std::exchange(rhs._buf, nullptr) } { }
+        buffer_ref &operator=(buffer_ref &&rhs)
+        {
+            if (this != &rhs)
+            {
+                reset();
+                _buf = std::exchange(rhs._buf, nullptr);
+            }
+            return *this;
+        }
+
+        ~buffer_ref() { reset(); }
+
+        void reset();
+
+        explicit operator bool() const { return _buf != nullptr; }
+
+        std::span<std::byte> data() const { return { _buf->data, _buf->size }; }
+
+        template<typename Type>
+            requires std::is_trivially_copyable_v<Type>
+        Type *as(std::size_t offset = 0) const
+        {
+            lib::bug_on(offset + sizeof(Type) > _buf->size);
+            return reinterpret_cast<Type *>(_buf->data + offset);
+        }
+
+        // the device's flusher writes it back with the rest of its pages
+        void mark_dirty() const;
+        // writes it back now, for metadata that has to reach the disk in order
+        lib::expect<void> sync() const;
+    };
+
+    // block number block of the device behind ops, in blocks of block_size
+    // bytes. block_size has to divide the page size
+    lib::expect<buffer_ref> bread(ops_t &ops, std::uint64_t block, std::size_t block_size);
+
     namespace mbr
     {
         struct [[gnu::packed]] partition_t
@@ -38,4 +38,30 @@ export namespace lib
             return decompress(in, out);
         }
     };
+
+    // only lz4 for now. fails with no_buffer_space if out is too small
+    class compressor
+    {
+        private:
+        compression_format _fmt;
+        std::shared_ptr<void> _data;
+
+        compressor(compression_format fmt, std::shared_ptr<void> data)
+            : _fmt { fmt }, _data { std::move(data) } { }
+
+        public:
+        compressor(const compressor &) = delete;
+        compressor(compressor &&) = default;
+
+        compressor &operator=(const compressor &) = delete;
+        compressor &operator=(compressor &&) = default;
+
+        static expect<compressor> create(compression_format fmt);
+
+        expect<std::size_t> compress(std::span<const std::byte> in, std::span<std::byte> out);
+        expect<std::size_t> operator()(std::span<const std::byte> in, std::span<std::byte> out)
+        {
+            return compress(in, out);
+        }
+    };
 } // export namespace lib
@@ -169,6 +169,23 @@ export namespace lib
         {
             std::swap(_ptr, other._ptr);
         }
+
+        // new reference to ptr, or null if its last one is already gone
+        static intrusive_ptr try_from(Type *ptr)
+        {
+            intrusive_ptr ret;
+            auto &count = (ptr->*Hook)._count;
+
+            auto old = count.load(std::memory_order_relaxed);
+            do {
+                if (old == 0)
+                    return ret;
+            } while (!count.compare_exchange_weak(old, old + 1,
+                std::memory_order_acquire, std::memory_order_relaxed));
+
+            ret._ptr = ptr;
+            return ret;
+        }
     };
 
     template<typename Type1, auto Hook1, typename Type2, auto Hook2>
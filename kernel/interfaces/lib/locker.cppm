@@ -47,6 +47,9 @@ namespace lib::detail
             lock();
         }
 
+        locked(Type *_ptr, Lock &_lock, std::try_to_lock_t)
+            : _ptr { _ptr }, _lock { _lock }, _locked { _lock.try_lock() } { }
+
         ~locked()
         {
             unlock();
@@ -75,6 +78,8 @@ namespace lib::detail
 
         operator bool() const { return _ptr != nullptr; }
 
+        bool owns_lock() const { return _locked; }
+
         bool lock()
         {
             if (_locked)
@@ -249,6 +254,17 @@ export namespace lib
             };
         }
 
+        // check owns_lock() before touching the data
+        template<typename Self> requires detail::is_lock<Lock>
+        [[nodiscard]] auto try_lock(this Self &&self)
+        {
+            return detail::locked<Type, Lock, true> {
+                std::forward<Self>(self)._storage.get_data(),
+                std::forward<Self>(self)._storage.get_lock(),
+                std::try_to_lock
+            };
+        }
+
         template<typename Self> requires detail::is_rwlock<Lock>
         [[nodiscard]] auto read_lock(this Self &&self)
         {
@@ -321,6 +337,17 @@ export namespace lib
             };
         }
 
+        // check owns_lock() before touching the data
+        template<typename Self> requires detail::is_lock<Lock>
+        [[nodiscard]] auto try_lock(this Self &&self)
+        {
+            return detail::locked<Type, Lock, true> {
+                std::forward<Self>(self).valueptr(),
+                std::forward<Self>(self)._lock,
+                std::try_to_lock
+            };
+        }
+
         bool is_locked() const
         {
             return _lock.is_locked();
@@ -32,6 +32,11 @@ export namespace cpu
         std::atomic<std::uint64_t> asid_gen = 1;
         std::size_t next_asid = 1;
 
+        // a kernel thread is running on the last user pagemap. shootdowns
+        // for it skip this cpu and set tlb_stale instead
+        std::atomic_bool tlb_lazy = false;
+        std::atomic_bool tlb_stale = false;
+
         std::atomic_bool in_interrupt = false;
         std::atomic_bool in_hard_irq = false;
         std::atomic_bool sched_ready = false;
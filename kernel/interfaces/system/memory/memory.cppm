@@ -3,10 +3,15 @@
 export module system.memory;
 
 export import system.memory.phys;
+export import system.memory.numa;
 export import system.memory.virt;
 export import system.memory.va;
 export import system.memory.slab;
 export import system.memory.tlb;
+export import system.memory.vmstat;
+export import system.memory.reclaim;
+export import system.memory.zram;
+export import system.memory.oom;
 
 export namespace memory
 {
@@ -0,0 +1,66 @@
+// Copyright (C) 2024-2026  ilobilo
+
+export module system.memory.numa;
+
+import lib;
+import std;
+
+// memory and cpu locality from the acpi srat and slit. without them, or
+// with a single proximity domain, everything is node 0
+export namespace numa
+{
+    constexpr std::size_t max_nodes = 8;
+    constexpr std::uint8_t local_distance = 10;
+    constexpr std::uint8_t remote_distance = 20;
+
+    // one bit per node, like the masks mbind and set_mempolicy take
+    using nodemask_t = std::uint64_t;
+    static_assert(max_nodes <= sizeof(nodemask_t) * 8);
+
+    struct mem_range
+    {
+        std::uintptr_t base;
+        std::uintptr_t end;
+        std::size_t node;
+    };
+
+    // the values match linux MPOL_*
+    enum class policy_mode : std::uint8_t
+    {
+        default_ = 0,
+        preferred = 1,
+        bind = 2,
+        interleave = 3,
+        local = 4
+    };
+
+    struct mempolicy
+    {
+        policy_mode mode = policy_mode::default_;
+        nodemask_t nodes = 0;
+    };
+
+    std::size_t num_nodes();
+    std::uint8_t distance(std::size_t from, std::size_t to);
+
+    // every node, nearest first, starting with node itself
+    std::span<const std::size_t> fallback(std::size_t node);
+
+    // sorted and not overlapping. empty with a single node
+    std::span<const mem_range> memory_ranges();
+
+    std::size_t local_node();
+    std::size_t cpu_node(std::size_t cpu_idx);
+
+    // where an allocation under a policy goes. mask limits the fallback
+    // for bind, 0 lets it go anywhere
+    struct target
+    {
+        std::size_t node;
+        nodemask_t mask;
+    };
+    // ilx picks the node for interleave, usually the page index
+    target resolve(const mempolicy &pol, std::size_t ilx);
+
+    lib::initgraph::stage *initialised_stage();
+} // export namespace numa
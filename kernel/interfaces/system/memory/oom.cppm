@@ -0,0 +1,23 @@
+// Copyright (C) 2024-2026  ilobilo
+
+export module system.memory.oom;
+import std;
+
+export namespace oom
+{
+    constexpr int score_adj_min = -1000;
+    constexpr int score_adj_max = 1000;
+
+    // larger allocations fail instead of killing anything
+    constexpr std::size_t max_pages = 8;
+
+    // called once reclaim gave up on nr_pages. kills the process with the
+    // highest badness or gives the last victim time to exit. returns false
+    // if the allocation should fail instead of retrying
+    bool out_of_memory(std::size_t nr_pages);
+
+    // whether the current allocation may go below the min watermark.
+    // those that cannot reclaim may, and so may a victim on its way out,
+    // so that it does not fail an allocation that must not fail
+    bool may_use_reserve();
+} // export namespace oom
@@ -104,6 +104,8 @@ export namespace vmm
         static const std::uintptr_t valid_table_flags;
         static const std::uintptr_t new_user_table_flags;
         static const std::uintptr_t new_kernel_table_flags;
+        // set by the mmu on access, 0 if it doesn't track that
+        static const std::uintptr_t young_flag;
 
         class entry
         {
@@ -204,10 +206,14 @@ export namespace vmm
             bool allocate, bool split
         );
 
+        // large leaf starting at vaddr that fits entirely in length
+        auto whole_large(std::uintptr_t vaddr, std::size_t length) const
+            -> std::optional<std::pair<entry *, page_size>>;
+
         lib::expect<void> map_internal(
             std::uintptr_t vaddr, std::uintptr_t paddr, std::size_t length, pflag flags,
             std::optional<page_size> psize, caching cache,
-            flush_range &fr_out, flush_range &lfr_out
+            flush_range &fr_out, flush_range &lfr_out, table *&stale_out
         );
         lib::expect<void> protect_internal(
             std::uintptr_t vaddr, std::size_t length, pflag flags,
@@ -224,8 +230,18 @@ export namespace vmm
         public:
         auto get_arch_table(std::uintptr_t addr = 0) const -> table *;
 
-        void invalidate(std::uintptr_t vaddr, std::size_t length, bool only_local = false);
+        void invalidate(
+            std::uintptr_t vaddr, std::size_t length,
+            bool only_local = false, bool freed_tables = false
+        );
+        // every translation of this pagemap, on every cpu that may hold one
+        void invalidate_all();
         bool fault_permitted(std::uintptr_t vaddr, bool write, bool exec) const;
+        bool is_mapped(std::uintptr_t vaddr) const;
+        // leaf entries in the kernel half, indexed by page_size
+        std::array<std::size_t, 3> count_kernel_leaves() const;
+        // clears the accessed bit of the page at vaddr, true if it was set
+        bool test_and_clear_young(std::uintptr_t vaddr);
 
         bool has_asid_ctx() const { return _asid_ctx != nullptr; }
         std::optional<asid_ctx> cached_asid_ctx(std::size_t cpu_idx) const
@@ -272,6 +288,18 @@ export namespace vmm
             std::optional<page_size> psize = std::nullopt
         );
 
+        // the same, but what needs invalidating is added to fr and lfr
+        // (local only) for the caller to flush, see mmu_gather
+        lib::expect<void> protect(
+            std::uintptr_t vaddr, std::size_t length, pflag flags,
+            std::optional<page_size> psize, caching cache,
+            flush_range &fr, flush_range &lfr
+        );
+        lib::expect<void> unmap(
+            std::uintptr_t vaddr, std::size_t length,
+            std::optional<page_size> psize, flush_range &fr
+        );
+
         lib::expect<std::uintptr_t> translate(std::uintptr_t vaddr, page_size psize);
 
         void load() const;
@@ -1,6 +1,8 @@
 // Copyright (C) 2024-2026  ilobilo
 
 export module system.memory.phys;
+
+import system.memory.numa;
 import std;
 
 export namespace pmm
@@ -33,10 +35,34 @@ export namespace pmm
         normal
     };
 
+    // both shrink caches when the zones run dry, if the caller can sleep
     [[nodiscard]]
     std::uintptr_t alloc(std::size_t count = 1, bool clear = false, type tp = type::normal);
+    // returns 0 instead of panicking when memory is exhausted
+    [[nodiscard]]
+    std::uintptr_t try_alloc(std::size_t count = 1, bool clear = false, type tp = type::normal);
+    // from node, or the nearest node in mask that has memory. mask 0 means any
+    [[nodiscard]]
+    std::uintptr_t try_alloc_node(std::size_t count, bool clear, std::size_t node, numa::nodemask_t mask = 0);
     void free(std::uintptr_t addr, std::size_t count = 1);
 
+    // turn an allocated block into independently freeable pages
+    void split(std::uintptr_t addr, std::size_t count);
+
+    // return all per-cpu cached pages to the buddy allocator
+    void drain_pcp();
+
+    // in bytes. free does not count the per-cpu caches
+    struct node_memory
+    {
+        std::size_t total;
+        std::size_t free;
+    };
+    node_memory node_info(std::size_t node);
+
+    // tags every page with its node and moves free blocks onto their node
+    void assign_nodes();
+
     void reclaim_bootloader_memory();
     void init();
 } // export namespace pmm
@@ -0,0 +1,46 @@
+// Copyright (C) 2024-2026  ilobilo
+
+export module system.memory.reclaim;
+import std;
+
+export namespace reclaim
+{
+    // a cache that can give memory back when free memory runs low.
+    // scan is also called from allocations, where the caller may already
+    // hold locks the shrinker needs. it must only try_lock those unless
+    // may_block is set
+    struct shrinker
+    {
+        const std::string_view name;
+        // scans running right now, unregistering waits for them
+        std::atomic_size_t active = 0;
+
+        shrinker(std::string_view name) : name { name } { }
+        virtual ~shrinker() = default;
+
+        // objects that scan could free right now
+        virtual std::size_t count() = 0;
+        // free up to nr objects, returns how many went
+        virtual std::size_t scan(std::size_t nr, bool may_block) = 0;
+    };
+
+    void register_shrinker(shrinker *shr);
+    // waits for a scan of shr that is still running
+    void unregister_shrinker(shrinker *shr);
+
+    // in free pages
+    struct watermarks
+    {
+        std::size_t min;
+        std::size_t low;
+        std::size_t high;
+    };
+    watermarks get_watermarks();
+
+    // called by pmm after taking pages from the buddy allocator
+    void check_watermarks(std::size_t nr_free);
+
+    // shrink caches until nr_pages more are free. returns false if the
+    // current context cannot reclaim or nothing could be freed
+    bool direct_reclaim(std::size_t nr_pages);
+} // export namespace reclaim
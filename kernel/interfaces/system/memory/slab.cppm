@@ -9,5 +9,82 @@ export namespace slab
     void *realloc(void *oldptr, std::size_t size);
     void free(void *ptr);
 
+    // give cached magazines and spare slab pages back to pmm
+    void reap();
+
+    struct cache;
+
+    // ctor runs when an object is first carved out of a slab and dtor when its
+    // slab is released, so freed objects keep their constructed state
+    cache *create_cache(
+        std::string_view name, std::size_t size, std::size_t align,
+        void (*ctor)(void *) = nullptr, void (*dtor)(void *) = nullptr,
+        bool percpu = true
+    );
+
+    // create the cache stored in slot on first use
+    cache *get_cache(std::atomic<cache *> &slot, std::string_view name, std::size_t size, std::size_t align);
+
+    void *cache_alloc(cache *cache);
+    // objects from any cache may also be released with slab::free
+    void cache_free(cache *cache, void *ptr);
+
+    template<typename Type>
+    struct type_cache
+    {
+        static inline constinit std::atomic<cache *> instance = nullptr;
+
+        static cache *get(std::string_view name)
+        {
+            return get_cache(instance, name, sizeof(Type), alignof(Type));
+        }
+    };
+
+    // for class scope operator new
+    template<typename Type>
+    inline void *cache_new(std::string_view name, std::size_t size)
+    {
+        if (size != sizeof(Type))
+            return slab::alloc(size);
+        return cache_alloc(type_cache<Type>::get(name));
+    }
+
+    // for std::allocate_shared. every rebound type gets its own cache
+    template<typename Type>
+    class cache_allocator
+    {
+        template<typename>
+        friend class cache_allocator;
+
+        private:
+        std::string_view _name;
+
+        public:
+        using value_type = Type;
+
+        constexpr cache_allocator(std::string_view name) : _name { name } { }
+
+        template<typename Other>
+        constexpr cache_allocator(const cache_allocator<Other> &other) : _name { other._name } { }
+
+        Type *allocate(std::size_t n)
+        {
+            if (n != 1)
+                return static_cast<Type *>(slab::alloc(n * sizeof(Type)));
+            return static_cast<Type *>(cache_alloc(type_cache<Type>::get(_name)));
+        }
+
+        void deallocate(Type *ptr, std::size_t)
+        {
+            slab::free(ptr);
+        }
+
+        template<typename Other>
+        friend constexpr bool operator==(const cache_allocator &, const cache_allocator<Other> &)
+        {
+            return true;
+        }
+    };
+
     void init();
 } // export namespace slab
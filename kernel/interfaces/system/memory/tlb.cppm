@@ -23,6 +23,9 @@ export namespace tlb
         std::uintptr_t start;
         std::size_t pages;
         const vmm::pagemap *pmap;
+        // page tables in the range were freed. lazy cpus can still walk
+        // them speculatively, so they get the shootdown too
+        bool freed_tables = false;
     };
 
     void shootdown(const request_t &req);
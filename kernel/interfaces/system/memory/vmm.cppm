@@ -4,7 +4,10 @@ export module system.memory.virt;
 export import :pagemap;
 
 import system.memory.phys;
+import system.memory.numa;
+import system.memory.slab;
 import system.sched.mutex;
+import system.rcu;
 import lib;
 import std;
 
@@ -33,11 +36,28 @@ export namespace vmm
         fixed_noreplace = 0x100000,
 
         // custom
-        untouchable = 0x40
+        untouchable = 0x40,
+        seq_read = 0x10000000,
+        rand_read = 0x20000000,
+        hugepage = 0x40000000,
+        nohugepage = 0x80000000
     };
 
+    // set by madvise, not by mmap
+    constexpr flag_t advice_flags =
+        flag::seq_read | flag::rand_read |
+        flag::hugepage | flag::nohugepage;
+
     enum madv : madv_t
     {
+        normal = 0,
+        random = 1,
+        sequential = 2,
+        willneed = 3,
+        dontneed = 4,
+        free_ = 8,
+        hugepage_ = 14,
+        nohugepage_ = 15
     };
 
     constexpr page_size default_psize()
@@ -53,24 +73,122 @@ export namespace vmm
     struct page;
     struct anon
     {
+        // null while swapped out
         page *pg;
         lib::intrusive_ptr_hook hook;
+        // zram handle of a swapped out page, 0 if it reads back as zeroes
+        std::uint64_t swap = 0;
 
         ~anon();
 
+        static void *operator new(std::size_t size) { return slab::cache_new<anon>("vmm_anon", size); }
+        static void operator delete(void *ptr) { slab::free(ptr); }
+
         using ptr = lib::intrusive_ptr<anon, &anon::hook>;
     };
 
+    // sparse radix tree of anons keyed by page index. only the paths to
+    // populated slots are allocated, so untouched ranges cost nothing
     struct anon_map
     {
+        static constexpr std::size_t radix_bits = 6;
+        static constexpr std::size_t radix = 1uz << radix_bits;
+
+        private:
+        struct leaf
+        {
+            anon::ptr slots[radix] { };
+
+            static void *operator new(std::size_t size) { return slab::cache_new<leaf>("vmm_amap_leaf", size); }
+            static void operator delete(void *ptr) { slab::free(ptr); }
+        };
+
+        struct node
+        {
+            void *children[radix] { };
+
+            static void *operator new(std::size_t size) { return slab::cache_new<node>("vmm_amap_node", size); }
+            static void operator delete(void *ptr) { slab::free(ptr); }
+        };
+
+        // interior levels above the leaves
+        std::size_t _height;
+        void *_root = nullptr;
+
+        static void destroy(void *ptr, std::size_t level);
+        static bool clear(void *ptr, std::size_t level, std::size_t base, std::size_t first, std::size_t last);
+
+        template<typename Func>
+        static void for_each(void *ptr, std::size_t level, std::size_t base, std::size_t first, std::size_t last, Func &func)
+        {
+            const auto shift = level * radix_bits;
+
+            std::size_t i = first > base ? (first - base) >> shift : 0;
+            for (; i < radix; i++)
+            {
+                const auto cbase = base + (i << shift);
+                if (cbase >= last)
+                    break;
+
+                if (level == 0)
+                {
+                    auto &slot = static_cast<leaf *>(ptr)->slots[i];
+                    if (slot)
+                        func(cbase, slot);
+                    continue;
+                }
+
+                if (auto *child = static_cast<node *>(ptr)->children[i])
+                    for_each(child, level - 1, cbase, first, last, func);
+            }
+        }
+
+        public:
         sched::mutex_t lock;
         lib::intrusive_ptr_hook hook;
 
-        // TODO: some kind of tree
-        std::unique_ptr<anon::ptr []> slots;
-        std::size_t nslots;
+        const std::size_t nslots;
+
+        // set at fork. the parent and child both point here now, so neither
+        // may change a slot before taking its own copy
+        std::atomic_bool cow { false };
+
+        anon_map(std::size_t nslots);
+        ~anon_map();
+
+        anon_map(const anon_map &) = delete;
+        anon_map &operator=(const anon_map &) = delete;
+
+        // slot at idx or nullptr if it was never populated
+        anon::ptr *find(std::size_t idx) const;
+        anon *lookup(std::size_t idx) const
+        {
+            const auto *slot = find(idx);
+            return slot ? slot->get() : nullptr;
+        }
+
+        // allocates the path to idx if needed
+        anon::ptr &get(std::size_t idx);
+
+        // drops the anons in [first, first + count) and frees emptied nodes
+        void clear(std::size_t first, std::size_t count);
+
+        // func(idx, slot) for every populated slot in [first, first + count)
+        template<typename Func>
+        void for_each(std::size_t first, std::size_t count, Func &&func)
+        {
+            if (_root && count != 0)
+                for_each(_root, _height, 0, first, first + count, func);
+        }
+
+        static void *operator new(std::size_t size) { return slab::cache_new<anon_map>("vmm_anon_map", size); }
+        static void operator delete(void *ptr) { slab::free(ptr); }
 
         using ptr = lib::intrusive_ptr<anon_map, &anon_map::hook>;
+
+        // new amap sharing the anons in [first, first + count). pages are
+        // only copied when a shared anon is written to
+        ptr copy(std::size_t first, std::size_t count);
     };
 
     struct object;
@@ -81,7 +199,21 @@ export namespace vmm
             busy = (1 << 0),
             dirty = (1 << 1),
             file = (1 << 2),
-            anonymous = (1 << 3)
+            anonymous = (1 << 3),
+            // madvise(MADV_FREE)d, contents may be dropped until written again
+            lazyfree = (1 << 4),
+            // on one of the page cache lru lists
+            lru = (1 << 5),
+            // on the active list rather than the inactive one
+            active = (1 << 6),
+            // looked up again since reclaim last saw it
+            referenced = (1 << 7),
+            // mapped into a pagemap. nothing tracks those ptes, so reclaim
+            // leaves the page alone for as long as it stays cached
+            mapped = (1 << 8),
+            // first page of the asynchronous part of a readahead window.
+            // reading it starts the next window
+            readahead = (1 << 9)
         };
 
         std::atomic<std::uint16_t> flags;
@@ -91,6 +223,8 @@ export namespace vmm
             std::uint8_t allocated : 1;
             std::uint8_t listed : 1;
         } buddy;
+        // numa node of the frame, set once the srat has been read
+        std::uint8_t node;
 
         std::atomic<std::uint32_t> refcount;
 
@@ -113,9 +247,17 @@ export namespace vmm
             struct {
                 anon *anon_ptr;
             };
+
+            struct {
+                void *slab_ptr;
+            };
         };
+
+        // lru links as page frame numbers, 0 for none
+        std::uint32_t lru_prev;
+        std::uint32_t lru_next;
     };
-    static_assert(sizeof(page) == 24);
+    static_assert(sizeof(page) == 32);
 
     enum class object_type : std::uint8_t
     {
@@ -125,6 +267,19 @@ export namespace vmm
     };
 
     std::size_t cached_pages(object_type type);
+    // page cache pages on the active or inactive lru list
+    std::size_t lru_pages(bool active);
+
+    // a device page cache objects are written back to, with a flusher
+    // thread of its own that writes back objects whose pages have been
+    // dirty for longer than vm/dirty_expire_centisecs, and everything once
+    // dirty memory passes vm/dirty_background_ratio
+    struct backing_dev;
+    // the device named name, created on first use
+    backing_dev *bdi_get(std::string_view name);
+
+    // dirty page cache pages that have somewhere to be written back to
+    std::size_t dirty_pages();
 
     struct object
     {
@@ -143,20 +298,63 @@ export namespace vmm
 
         std::size_t apply_func(std::uint64_t offset, std::size_t size, auto func);
 
+        // num dirty pages were cleaned or dropped
+        void dirty_cleared(std::size_t num);
+        void bdi_forget();
+
         public:
         object_type type;
         std::atomic_bool shared_mapped;
         lib::intrusive_ptr_hook hook;
 
+        // set before the first page is cached for dirty pages to be counted
+        // and written back in the background. without one they are only
+        // written back when someone asks
+        backing_dev *bdi = nullptr;
+        // on the dirty list of bdi since dirtied_when, in ns. both belong
+        // to the bdi lock
+        lib::intrusive_list_hook<object> wb_hook;
+        std::uint64_t dirtied_when = 0;
+        bool wb_listed = false;
+
+        // the flusher wrote the object back. metadata can follow here
+        virtual void written_back() { }
+
+        // sets the dirty flag of pg, one of the object's cached pages
+        void set_dirty(page *pg);
+
         lib::expect<void> read_pages(std::uint64_t offp, std::span<page *> pages, std::size_t idx);
         lib::expect<void> write_back(std::uint64_t offp, std::size_t num_pages);
 
         void drop_cached(std::uint64_t offp, std::size_t num_pages);
         lib::expect<void> populate(std::size_t num_pages);
 
+        // sets vec[i] to 1 if page offp + i is in the cache
+        void resident(std::uint64_t offp, std::span<std::uint8_t> vec);
+        // pages in offp..offp + num_pages that are cached. 0 if the cache
+        // is locked by someone else
+        std::size_t try_count_resident(std::uint64_t offp, std::size_t num_pages);
+
+        // drop pg from the cache if nobody else uses it. reclaim holds a
+        // reference to pg on top of the cache's own
+        bool evict(page *pg, bool may_block);
+
+        struct probe_result
+        {
+            bool missing;
+            bool marker;
+        };
+        // whether a page in offp..offp + num_pages is not cached and whether
+        // one carries the readahead marker. the marker is cleared
+        probe_result probe(std::uint64_t offp, std::size_t num_pages);
+
         std::size_t read(std::uint64_t offset, lib::maybe_uspan<std::byte> buffer);
         std::size_t write(std::uint64_t offset, lib::maybe_uspan<std::byte> buffer);
         std::size_t clear(std::uint64_t offset, std::uint8_t value, std::size_t length);
+        // copies buffer into the pages of the range that are cached, without
+        // fetching the rest or dirtying anything. for writes that went
+        // around the cache
+        void update_cached(std::uint64_t offset, lib::maybe_uspan<std::byte> buffer);
 
         virtual std::optional<std::uintptr_t> direct_paddr(std::uint64_t offp)
         {
@@ -222,6 +420,46 @@ export namespace vmm
         }
     };
 
+    // per open file readahead, like linux's file_ra_state. a sequential
+    // stream keeps a window of pages ahead of the reader that grows with
+    // every async readahead, random access shrinks it back to nothing
+    struct ra_state
+    {
+        enum class hint : std::uint8_t
+        {
+            normal,
+            sequential,
+            random
+        };
+
+        // the current window and how much of its tail is read ahead
+        // asynchronously, starting at the marker page
+        std::uint64_t start = 0;
+        std::size_t size = 0;
+        std::size_t async_size = 0;
+
+        // last page read, to tell sequential access from random
+        std::uint64_t prev = ~0ul;
+
+        hint mode = hint::normal;
+    };
+    using ra_state_t = lib::locker<ra_state, lib::spinlock>;
+
+    // called after dirtying pages of obj. wakes its flusher past the
+    // background threshold and makes the caller sleep in proportion to how
+    // far dirty memory is past the midpoint towards vm/dirty_ratio
+    void balance_dirty_pages(object &obj);
+
+    // largest window in pages, from vm/max_readahead_kb
+    std::size_t readahead_pages();
+
+    // before reading pages idx..idx + count of obj. eof is the page index
+    // past the end of the data
+    void readahead(const object::ptr &obj, ra_state_t &ra, std::uint64_t idx, std::size_t count, std::uint64_t eof);
+    // read pages idx..idx + count in the background, like fadvise willneed.
+    // mark puts the readahead marker on the first of them
+    void force_readahead(const object::ptr &obj, std::uint64_t idx, std::size_t count, bool mark = false);
+
     struct entry
     {
         std::uintptr_t startp;
@@ -239,8 +477,69 @@ export namespace vmm
 
         lib::rbtree_hook<entry> hook;
         lib::interval_hook<std::uintptr_t> interval;
+
+        // page faults in progress. a writer sets the top bit with the tree
+        // locked and waits for them to finish before changing the entry
+        std::atomic<std::uint32_t> users { 0 };
+
+        // from mbind. the default falls through to the thread's policy
+        numa::mempolicy policy { };
+
+        static void *operator new(std::size_t size) { return slab::cache_new<entry>("vmm_entry", size); }
+        static void operator delete(void *ptr) { slab::free(ptr); }
     };
 
+    // one operation on a vmspace collects the ranges it unmaps or write
+    // protects here and flushes them with a single shootdown at the end.
+    // anons it drops are released after that, once no cpu can still reach
+    // their pages through a stale tlb entry. they are collected in a fixed
+    // batch, a full one flushes early rather than growing under the tree lock
+    class mmu_gather
+    {
+        private:
+        static constexpr std::size_t batch_size = 64;
+
+        pagemap &_pmap;
+        flush_range _fr;
+        flush_range _lfr;
+        bool _full = false;
+        std::array<anon::ptr, batch_size> _anons;
+        std::size_t _nr_anons = 0;
+
+        public:
+        explicit mmu_gather(pagemap &pmap) : _pmap { pmap } { }
+
+        mmu_gather(const mmu_gather &) = delete;
+        mmu_gather &operator=(const mmu_gather &) = delete;
+
+        ~mmu_gather() { finish(); }
+
+        lib::expect<void> unmap(std::uintptr_t vaddr, std::size_t length, std::optional<page_size> psize)
+        {
+            return _pmap.unmap(vaddr, length, psize, _fr);
+        }
+
+        lib::expect<void> protect(std::uintptr_t vaddr, std::size_t length, pflag flags, std::optional<page_size> psize)
+        {
+            return _pmap.protect(vaddr, length, flags, psize, caching::normal, _fr, _lfr);
+        }
+
+        // the whole address space is going away
+        void flush_all() { _full = true; }
+
+        void defer(anon::ptr an)
+        {
+            _anons[_nr_anons++] = std::move(an);
+            if (_nr_anons == batch_size)
+                finish();
+        }
+
+        // flushes what was gathered so far and releases the anons
+        void finish();
+    };
+
+    struct entry_index;
+
     struct vmspace
     {
         private:
@@ -264,8 +563,15 @@ export namespace vmm
             sched::mutex_t
         > tree;
 
-        std::uintptr_t brk_start;
-        std::uintptr_t current_brk;
+        // sorted snapshot of the tree for lookups under rcu. republished
+        // after every structural change, so faults never take the tree lock
+        rcu::pointer<entry_index> index;
+
+        std::uintptr_t brk_start = 0;
+        std::uintptr_t current_brk = 0;
+
+        // on the list of vmspaces that swap walks
+        lib::intrusive_list_hook<vmspace> swap_hook;
 
         lib::expect<std::uintptr_t> map(
             std::uintptr_t hint, std::size_t length,
@@ -274,6 +580,27 @@ export namespace vmm
         );
         lib::expect<void> unmap(std::uintptr_t address, std::size_t length);
         lib::expect<void> protect(std::uintptr_t address, std::size_t length, prot_t prot);
+        lib::expect<void> advise(std::uintptr_t address, std::size_t length, madv_t advice);
+        // set the numa policy for faults in the range. mapped pages stay put
+        lib::expect<void> mbind(std::uintptr_t address, std::size_t length, const numa::mempolicy &policy);
+
+        // write back shared file pages in the range. without wait the
+        // writes are only queued. invalidate also drops the cached pages
+        lib::expect<void> sync(std::uintptr_t address, std::size_t length, bool wait, bool invalidate);
+        // one byte per page starting at address, 1 if it is in memory
+        lib::expect<void> resident(std::uintptr_t address, std::span<std::uint8_t> vec);
+
+        // in pages
+        struct usage_t
+        {
+            std::size_t anon;
+            std::size_t swap;
+            std::size_t shmem;
+            std::size_t pgtables;
+        };
+        // only try_locks, so that the oom killer can call it from an
+        // allocation. comes up short while the vmspace is busy
+        usage_t try_usage();
 
         struct remap_options
         {
@@ -290,14 +617,8 @@ export namespace vmm
 
         std::shared_ptr<vmspace> fork(std::shared_ptr<vmm::pagemap> cpmap);
 
-        ~vmspace()
-        {
-            lib::panic_if(pmap.use_count() != 1);
-            tree.lock()->clear([](entry *x) {
-                // object and anon free their pages
-                delete x;
-            });
-        }
+        explicit vmspace(std::shared_ptr<pagemap> pmap = nullptr);
+        ~vmspace();
     };
 
     page *page_for(std::uintptr_t addr);
@@ -0,0 +1,46 @@
+// Copyright (C) 2024-2026  ilobilo
+
+export module system.memory.vmstat;
+import std;
+
+export namespace vmstat
+{
+    // event counters shown in /proc/vmstat
+    enum class item : std::size_t
+    {
+        thp_fault_alloc,
+        thp_fault_fallback,
+        thp_split_pmd,
+
+        pgscan_kswapd,
+        pgscan_direct,
+        pgsteal_kswapd,
+        pgsteal_direct,
+        allocstall,
+        pageoutrun,
+
+        pswpin,
+        pswpout,
+
+        oom_kill,
+
+        pgzero_hit,
+        pgzero_miss,
+        pgzero_fill,
+        zero_page_map,
+
+        // page cache writeback. nr_dirty and nr_writeback are the pages
+        // dirty and being written right now, the rest count events
+        nr_dirty,
+        nr_writeback,
+        nr_dirtied,
+        nr_written,
+        dirty_throttle,
+
+        count
+    };
+
+    void add(item it, std::size_t num = 1);
+    void sub(item it, std::size_t num = 1);
+    std::size_t get(item it);
+} // export namespace vmstat
@@ -0,0 +1,31 @@
+// Copyright (C) 2024-2026  ilobilo
+
+export module system.memory.zram;
+import std;
+
+// compressed swap in ram. anonymous pages are lz4 compressed into a pool of
+// size classes, several to a page, the way zsmalloc packs them
+export namespace zram
+{
+    using handle = std::uint64_t;
+
+    // nullopt if the device is full, the page doesn't compress well enough
+    // or, without may_block, someone else is using the compressor
+    std::optional<handle> store(std::uintptr_t paddr, bool may_block);
+    // decompress into the page at paddr. the handle stays valid
+    bool load(handle hdl, std::uintptr_t paddr);
+    void release(handle hdl);
+
+    struct stats
+    {
+        // bytes of uncompressed pages the device takes
+        std::size_t disksize;
+        std::size_t stored_pages;
+        std::size_t compr_bytes;
+        std::size_t pool_pages;
+    };
+    stats get_stats();
+
+    // pages store could still take
+    std::size_t free_pages();
+} // export namespace zram
@@ -110,6 +110,13 @@ export namespace sched
         std::atomic<dumpable_t> dumpable = dumpable_t::user;
         std::atomic<int> pdeathsig = 0;
 
+        // -1000 never gets oom killed, 1000 goes first
+        std::atomic<int> oom_score_adj = 0;
+        // killed by the oom killer but not exiting, so pick another
+        std::atomic_bool oom_skip = false;
+        // killed by the oom killer, its allocations may use the reserve
+        std::atomic_bool oom_victim = false;
+
         int exit_code = 0;
         int term_signal = 0;
         int exit_signal = 0;
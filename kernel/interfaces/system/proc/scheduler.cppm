@@ -183,6 +183,8 @@ export namespace sched
     std::size_t process_count();
 
     void for_each_process(std::function_ref<bool (const std::shared_ptr<process_t> &)> func);
+    // same, but gives up and returns false if the process list is locked
+    bool try_for_each_process(std::function_ref<bool (const std::shared_ptr<process_t> &)> func);
 
     // called from a timer interrupt
     void tick(bool from_user);
@@ -6,6 +6,7 @@ import system.sched.thread_base;
 import system.sched.wait_queue;
 
 import system.memory.virt;
+import system.memory.numa;
 import system.cpu.local;
 import system.cpu.regs;
 import magic_enum;
@@ -107,6 +108,16 @@ export namespace sched
 
         lib::bitmap affinity;
 
+        // from set_mempolicy, for mappings without a policy of their own
+        numa::mempolicy mempolicy { };
+
+        // the outermost dev::block::plug_t of the thread, if any
+        void *blk_plug = nullptr;
+
+        // in a shrinker. what it allocates to free memory may use the
+        // reserve, and it does not reclaim again
+        bool in_reclaim = false;
+
         std::uintptr_t clear_child_tid = 0;
         std::uintptr_t set_child_tid = 0;
 
@@ -18,6 +18,9 @@ export namespace syscall::memory
 
     int madvise(void *addr, std::size_t length, int advice);
 
+    int mbind(void *addr, std::size_t len, int mode, const unsigned long __user *nodemask, unsigned long maxnode, unsigned flags);
+    int set_mempolicy(int mode, const unsigned long __user *nodemask, unsigned long maxnode);
+
     int msync(void *addr, std::size_t length, int flags);
     int mlock(void *addr, std::size_t length);
     int munlock(void *addr, std::size_t length);
@@ -9,6 +9,7 @@ import system.sched.wait_queue;
 import system.sched.mutex;
 import system.sched.cred;
 import system.memory.virt;
+import system.memory.slab;
 import system.rcu;
 import lib;
 import std;
@@ -225,6 +226,10 @@ export namespace vfs
     {
         virtual bool truncable() const { return false; }
         virtual bool seekable() const { return true; }
+        // regular file data is read and written through the inode's
+        // mapping, read and write below only fill and write back its
+        // pages. growing a file goes through trunc
+        virtual bool page_cached() const { return false; }
 
         virtual lib::expect<void> open(const std::shared_ptr<file_t> &file, int flags, pid_t pid)
         {
@@ -276,6 +281,19 @@ export namespace vfs
 
         virtual lib::expect<vmm::object::ptr> map(const std::shared_ptr<file_t> &file);
 
+        // fill and write back pages idx.. of a page cached file, all in one
+        // call so that contiguous blocks go to the disk together. the
+        // defaults do one read or write per page. pages past the end of the
+        // file read as zeroes and are not written
+        virtual lib::expect<void> read_pages(
+            const std::shared_ptr<file_t> &file, std::size_t idx,
+            std::span<vmm::page *> pages
+        );
+        virtual lib::expect<void> write_pages(
+            const std::shared_ptr<file_t> &file, std::size_t idx,
+            std::span<vmm::page *> pages
+        );
+
         virtual lib::expect<void> sync(const std::shared_ptr<file_t> &file, bool data)
         {
             lib::unused(file, data);
@@ -354,6 +372,10 @@ export namespace vfs
                 return true;
             }
 
+            // unused dentries can be dropped under memory pressure and
+            // looked up again later. not for filesystems that only live in them
+            virtual bool can_drop_dentries() const { return false; }
+
             virtual bool permission(
                 std::shared_ptr<dentry_t> dentry,
                 const std::shared_ptr<sched::cred_t> &cred,
@@ -567,6 +589,9 @@ export namespace vfs
         lib::locker<children, sched::mutex_t> children;
 
         lib::locker<lib::list<std::weak_ptr<mount_t>>, sched::mutex_t> child_mounts;
+
+        dentry_t();
+        ~dentry_t();
     };
 
     struct file_t : std::enable_shared_from_this<file_t>
@@ -578,6 +603,8 @@ export namespace vfs
         std::size_t offset;
         int flags;
 
+        vmm::ra_state_t ra;
+
         std::shared_ptr<void> private_data;
 
         ~file_t()
@@ -622,7 +649,7 @@ export namespace vfs
             if (!ops->seekable())
                 return ops->read(shared_from_this(), offset, buffer);
             const std::unique_lock _ { lock };
-            const auto ret = ops->read(shared_from_this(), offset, buffer);
+            const auto ret = do_read(offset, buffer);
             if (ret.has_value())
                 offset += *ret;
             return ret;
@@ -635,13 +662,9 @@ export namespace vfs
             if (!ops->seekable())
                 return ops->write(shared_from_this(), offset, buffer);
             const std::unique_lock _ { lock };
-            const auto ret = ops->write(shared_from_this(), offset, buffer);
+            const auto ret = do_write(offset, buffer);
             if (ret.has_value())
-            {
-                if (path.dentry && path.dentry->inode)
-                    path.dentry->inode->invalidate_pcache(offset, *ret);
                 offset += *ret;
-            }
             return ret;
         }
 
@@ -649,17 +672,14 @@ export namespace vfs
         {
             if (!ops)
                 return std::unexpected { lib::err::invalid_device_or_address };
-            return ops->read(shared_from_this(), offset, buffer);
+            return do_read(offset, buffer);
         }
 
         lib::expect<std::size_t> pwrite(std::uint64_t offset, lib::maybe_uspan<std::byte> buffer)
         {
             if (!ops)
                 return std::unexpected { lib::err::invalid_device_or_address };
-            const auto ret = ops->write(shared_from_this(), offset, buffer);
-            if (ret.has_value() && path.dentry && path.dentry->inode)
-                path.dentry->inode->invalidate_pcache(offset, *ret);
-            return ret;
+            return do_write(offset, buffer);
         }
 
         lib::expect<void> trunc(std::size_t size)
@@ -674,6 +694,17 @@ export namespace vfs
 
         lib::expect<std::size_t> getdents(lib::maybe_uspan<std::byte> buffer);
 
+        // through the page cache for page_cached ops, straight to ops
+        // otherwise. o_direct bypasses the cache after writing it back
+        lib::expect<std::size_t> do_read(std::uint64_t offset, lib::maybe_uspan<std::byte> buffer);
+        lib::expect<std::size_t> do_write(std::uint64_t offset, lib::maybe_uspan<std::byte> buffer);
+        // writes back the dirty cached pages of the file
+        lib::expect<void> sync_pcache();
+
+        // fadvise willneed and dontneed on the page cache
+        lib::expect<void> willneed(std::uint64_t offset, std::size_t length);
+        lib::expect<void> dontneed(std::uint64_t offset, std::size_t length);
+
         lib::expect<std::uint16_t> poll(poll_table_t *pt)
         {
             if (!ops)
@@ -700,6 +731,9 @@ export namespace vfs
             if (!ops)
                 return std::unexpected { lib::err::invalid_device_or_address };
 
+            if (auto ret = sync_pcache(); !ret.has_value())
+                return ret;
+
             if (auto ret = ops->sync(shared_from_this(), data); !ret.has_value())
                 return ret;
 
@@ -740,7 +774,7 @@ export namespace vfs
 
         static std::shared_ptr<file_t> create(vfs::path_t path, std::size_t offset, int flags)
         {
-            auto file = std::make_shared<vfs::file_t>();
+            auto file = std::allocate_shared<vfs::file_t>(slab::cache_allocator<vfs::file_t> { "vfs_file" });
             file->opened = false;
             file->path = std::move(path);
             file->offset = offset;
@@ -48,6 +48,8 @@ namespace vmm
     const std::uintptr_t pagemap::valid_table_flags = arch::valid | arch::table;
     const std::uintptr_t pagemap::new_kernel_table_flags = arch::valid | arch::table;
     const std::uintptr_t pagemap::new_user_table_flags = arch::valid | arch::table;
+    // af is always set when mapping and there is no fault handler to set it again
+    const std::uintptr_t pagemap::young_flag = 0;
 
     bool pagemap::entry::accessor::is_large() const
     {
@@ -21,6 +21,7 @@ namespace vmm
                 user = (1 << 2),
                 pwt = (1 << 3),
                 pcd = (1 << 4),
+                accessed = (1 << 5),
                 lpages = (1 << 7),
                 pat = (1 << 7),
                 global = (1 << 8),
@@ -45,6 +46,7 @@ namespace vmm
     const std::uintptr_t pagemap::valid_table_flags = arch::flag::present;
     const std::uintptr_t pagemap::new_kernel_table_flags = arch::flag::present | arch::flag::write;
     const std::uintptr_t pagemap::new_user_table_flags = pagemap::new_kernel_table_flags | arch::flag::user;
+    const std::uintptr_t pagemap::young_flag = arch::flag::accessed;
 
     bool pagemap::entry::accessor::is_large() const
     {
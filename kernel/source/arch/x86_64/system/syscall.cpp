@@ -205,6 +205,8 @@ namespace x86_64::syscall
         [232] = { "epoll_wait", vfs::epoll_wait, true },
         [233] = { "epoll_ctl", vfs::epoll_ctl },
         [234] = { "tgkill", proc::tgkill },
+        [237] = { "mbind", memory::mbind },
+        [238] = { "set_mempolicy", memory::set_mempolicy },
         [247] = { "waitid", proc::waitid, true },
         [253] = { "inotify_init", vfs::inotify_init, true },
         [254] = { "inotify_add_watch", vfs::inotify_add_watch, true },
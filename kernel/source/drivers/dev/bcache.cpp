@@ -0,0 +1,196 @@
+// Copyright (C) 2024-2026  ilobilo
+
+module drivers.dev.block;
+
+import system.memory.reclaim;
+import system.memory.phys;
+import lib;
+
+namespace dev::block
+{
+    namespace
+    {
+        // unused buffers kept before the oldest is dropped
+        constexpr std::size_t max_unused = 4096;
+
+        // every device's hash and the lru together
+        constinit lib::spinlock lock;
+        constinit lib::intrusive_list<buffer_t, &buffer_t::lru_hook> lru;
+
+        void put_page(vmm::page *pg)
+        {
+            if (pg->unref())
+                pmm::free(vmm::paddr_from(pg), vmm::default_npsize() / pmm::page_size);
+        }
+
+        // takes the oldest unused buffer off the lru and out of its hash
+        buffer_t *isolate_locked()
+        {
+            auto *buf = lru.pop_front();
+            if (buf)
+                static_cast<object_t &>(*buf->obj).buffers.erase(buf->offset);
+            return buf;
+        }
+
+        void destroy(buffer_t *buf)
+        {
+            put_page(buf->pg);
+            delete buf;
+        }
+
+        struct bcache_shrinker : reclaim::shrinker
+        {
+            bcache_shrinker() : reclaim::shrinker { "buffer_cache" } { }
+
+            std::size_t count() override
+            {
+                const std::unique_lock _ { lock };
+                return lru.size();
+            }
+
+            std::size_t scan(std::size_t nr, bool may_block) override
+            {
+                lib::unused(may_block);
+
+                std::size_t freed = 0;
+                while (freed < nr)
+                {
+                    buffer_t *buf;
+                    {
+                        const std::unique_lock _ { lock };
+                        buf = isolate_locked();
+                    }
+                    if (!buf)
+                        break;
+
+                    // the page itself stays in the device's page cache for
+                    // reclaim to find once it is clean
+                    destroy(buf);
+                    freed++;
+                }
+                return freed;
+            }
+        };
+
+        lib::initgraph::task shrinker_task
+        {
+            "block.bcache.shrinker.register",
+            lib::initgraph::postsched_init_engine,
+            [] {
+                static bcache_shrinker shrinker { };
+                reclaim::register_shrinker(&shrinker);
+            }
+        };
+    } // namespace
+
+    void buffer_ref::reset()
+    {
+        if (!_buf)
+            return;
+
+        buffer_t *evict = nullptr;
+        {
+            const std::unique_lock _ { lock };
+            if (--_buf->refcount == 0)
+            {
+                lru.push_back(_buf);
+                if (lru.size() > max_unused)
+                    evict = isolate_locked();
+            }
+        }
+        _buf = nullptr;
+
+        if (evict)
+            destroy(evict);
+    }
+
+    void buffer_ref::mark_dirty() const
+    {
+        _buf->obj->set_dirty(_buf->pg);
+    }
+
+    lib::expect<void> buffer_ref::sync() const
+    {
+        auto &mem = static_cast<object_t &>(*_buf->obj);
+        if (const auto ret = mem.write_back(_buf->pg->offp, 1); !ret)
+            return ret;
+
+        // write_back only queues it
+        if (auto drv = mem.drive.lock())
+            return drv->drain();
+        return std::unexpected { lib::err::invalid_device_or_address };
+    }
+
+    lib::expect<buffer_ref> bread(ops_t &ops, std::uint64_t block, std::size_t block_size)
+    {
+        const auto npsize = vmm::default_npsize();
+        if (block_size == 0 || npsize % block_size != 0)
+            return std::unexpected { lib::err::invalid_argument };
+
+        auto &mem = ops.get_memory();
+        auto drv = mem.drive.lock();
+        if (!drv)
+            return std::unexpected { lib::err::invalid_device_or_address };
+
+        const auto dev_size = mem.lba_count * drv->block_size();
+        if (block >= dev_size / block_size)
+            return std::unexpected { lib::err::invalid_argument };
+
+        const auto offset = mem.lba_start * drv->block_size() + block * block_size;
+
+        const auto lookup = [&] -> buffer_t * {
+            const auto it = mem.buffers.find(offset);
+            if (it == mem.buffers.end())
+                return nullptr;
+
+            auto *buf = it->second;
+            if (buf->refcount++ == 0)
+                lru.remove(buf);
+            return buf;
+        };
+
+        {
+            const std::unique_lock _ { lock };
+            if (auto *buf = lookup())
+            {
+                lib::bug_on(buf->size != block_size);
+                return buffer_ref { buf };
+            }
+        }
+
+        vmm::page *pg = nullptr;
+        if (const auto ret = mem.read_pages(offset / npsize, { &pg, 1 }, 0); !ret)
+        {
+            if (pg)
+                put_page(pg);
+            return std::unexpected { ret.error() };
+        }
+
+        auto *buf = new buffer_t {
+            .obj = object_t::ptr { &mem },
+            .pg = pg,
+            .data = reinterpret_cast<std::byte *>(lib::tohh(vmm::paddr_from(pg))) + offset % npsize,
+            .offset = offset,
+            .size = static_cast<std::uint32_t>(block_size),
+            .refcount = 1,
+            .lru_hook = { }
+        };
+
+        buffer_t *found;
+        {
+            const std::unique_lock _ { lock };
+            found = lookup();
+            if (!found)
+                mem.buffers.insert({ offset, buf });
+        }
+
+        // someone else read it in the meantime
+        if (found)
+        {
+            destroy(buf);
+            lib::bug_on(found->size != block_size);
+            return buffer_ref { found };
+        }
+        return buffer_ref { buf };
+    }
+} // namespace dev::block
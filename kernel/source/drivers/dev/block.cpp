@@ -114,8 +114,46 @@ namespace dev::block
                     }, nullptr, "removable", 0444
                 };
 
+                // like linux, reads then writes
+                static drive_attribute_t inflight {
+                    [](device_t &, std::shared_ptr<drive_t> drv) -> lib::expect<std::string> {
+                        const auto stats = drv->queue_stats();
+                        return fmt::format("{:8} {:8}\n", stats.inflight_reads, stats.inflight_writes);
+                    }, nullptr, "inflight", 0444
+                };
+                static drive_attribute_t requests {
+                    [](device_t &, std::shared_ptr<drive_t> drv) -> lib::expect<std::string> {
+                        const auto stats = drv->queue_stats();
+                        return fmt::format("{} {}\n", stats.reads, stats.writes);
+                    }, nullptr, "requests", 0444
+                };
+                // bios that joined a request instead of becoming their own
+                static drive_attribute_t merges {
+                    [](device_t &, std::shared_ptr<drive_t> drv) -> lib::expect<std::string> {
+                        const auto stats = drv->queue_stats();
+                        return fmt::format("{} {}\n", stats.read_merges, stats.write_merges);
+                    }, nullptr, "merges", 0444
+                };
+                static drive_attribute_t max_inflight {
+                    [](device_t &, std::shared_ptr<drive_t> drv) -> lib::expect<std::string> {
+                        return fmt::format("{}\n", drv->queue_stats().max_inflight);
+                    }, nullptr, "max_inflight", 0444
+                };
+                static drive_attribute_t nr_requests {
+                    [](device_t &, std::shared_ptr<drive_t> drv) -> lib::expect<std::string> {
+                        return fmt::format("{}\n", drv->queue_depth());
+                    }, nullptr, "nr_requests", 0444
+                };
+                static drive_attribute_t nr_hw_queues {
+                    [](device_t &, std::shared_ptr<drive_t> drv) -> lib::expect<std::string> {
+                        return fmt::format("{}\n", drv->nr_hw_queues());
+                    }, nullptr, "nr_hw_queues", 0444
+                };
+
                 static attribute_t *list[] {
                     &size, &diskseq, &ro, &removable,
+                    &inflight, &requests, &merges, &max_inflight,
+                    &nr_requests, &nr_hw_queues,
                     dev_attribute()
                 };
                 static const attribute_group_t group_list[] {
@@ -289,7 +327,7 @@ namespace dev::block
 
         struct chunk_t
         {
-            arch::dma_buffer dma;
+            std::unique_ptr<bio_t> bio;
             std::span<std::byte> dma_span;
             std::size_t win_idx;
             std::size_t win_off;
@@ -338,15 +376,25 @@ namespace dev::block
         std::size_t buf_idx = 0;
         std::size_t buf_off = 0;
 
+        // the chunks reach the queue together
+        plug_t plug;
+
         while (nlb != 0)
         {
             const auto chunk = std::min(nlb, _max_transfer_lba);
 
             auto &st = chunks.emplace_back();
-            st.dma = arch::dma_buffer { &_pool, chunk << _lba_shift };
+            st.bio = std::make_unique<bio_t>(bio_t {
+                .write = write,
+                .sync = sync,
+                .lba = lba,
+                .nlb = chunk,
+                .dma = arch::dma_buffer { &_pool, chunk << _lba_shift },
+                .done = { }
+            });
             st.dma_span = std::span {
-                st.dma.byte_data() + misalign,
-                std::min(st.dma.size() - misalign, remaining)
+                st.bio->dma.byte_data() + misalign,
+                std::min(st.bio->dma.size() - misalign, remaining)
             };
 
             st.win_idx = buf_idx;
@@ -376,22 +424,35 @@ namespace dev::block
                 break;
             }
 
-            num.fetch_add(1, std::memory_order_relaxed);
-
-            rw(write, sync, lba, st.dma, [&, pst = &st](lib::expect<void> res) {
-                if (!sync)
-                    return;
+            if (!sync)
+            {
+                // nobody waits for it, the bio frees itself. errors show
+                // up in the next drain
+                const auto slot = async_begin(lba, chunk);
+                auto *bio = st.bio.release();
+                bio->done = [this, slot, bio](lib::expect<void> res) {
+                    async_end(slot, res);
+                    delete bio;
+                };
+                submit(bio);
+            }
+            else
+            {
+                num.fetch_add(1, std::memory_order_relaxed);
 
-                if (!res)
-                {
-                    if (!failed.exchange(true, std::memory_order_acq_rel))
-                        first_error = res.error();
-                }
+                st.bio->done = [&, pst = &st](lib::expect<void> res) {
+                    if (!res)
+                    {
+                        if (!failed.exchange(true, std::memory_order_acq_rel))
+                            first_error = res.error();
+                    }
 
-                pst->done.store(true, std::memory_order_release);
-                num.fetch_sub(1, std::memory_order_acq_rel);
-                drain.wake_all();
-            });
+                    pst->done.store(true, std::memory_order_release);
+                    num.fetch_sub(1, std::memory_order_acq_rel);
+                    drain.wake_all();
+                };
+                submit(st.bio.get());
+            }
 
             lba += chunk;
             nlb -= chunk;
@@ -401,6 +462,10 @@ namespace dev::block
 
         if (sync)
         {
+            // ours or an outer plug could be holding them. async ones stay
+            // plugged to be merged with what the caller submits next
+            flush_plug();
+
             if (!write)
             {
                 for (const auto &st : chunks)
@@ -439,6 +504,11 @@ namespace dev::block
         return { };
     }
 
+    vmm::backing_dev *drive_t::bdi() const
+    {
+        return vmm::bdi_get(fmt::format("blk{}", _seq));
+    }
+
     lib::expect<void> object_t::fetch_pages(std::size_t idx, std::span<vmm::page *> pages)
     {
         auto drv = drive.lock();
@@ -454,6 +524,9 @@ namespace dev::block
             ).value();
         });
 
+        // a page dropped while its write was in flight would read back
+        // stale
+        drv->wait_writes();
         return drv->rw(false, true, idx * npsize, range);
     }
 
@@ -472,7 +545,9 @@ namespace dev::block
             ).value();
         });
 
-        return drv->rw(true, true, idx * npsize, range);
+        // the data is copied out before rw returns, so the pages can be
+        // clean while the write is in flight. sync and o_sync drain it
+        return drv->rw(true, false, idx * npsize, range);
     }
 
     lib::expect<std::size_t> ops_t::read(
@@ -494,11 +569,21 @@ namespace dev::block
 
         if (file->flags & vfs::o_direct)
         {
+            drv->wait_writes();
             if (const auto ret = drv->rw(false, true, offset,
                     std::views::single(buffer.subspan(0, real_size))); !ret)
                 return std::unexpected { ret.error() };
             return real_size;
         }
+
+        const auto npsize = vmm::default_npsize();
+        const auto first = offset / npsize;
+        const auto end = (mem.lba_start + mem.lba_count) * drv->block_size();
+        vmm::readahead(
+            memory, file->ra, first,
+            lib::div_roundup(offset + real_size, npsize) - first,
+            lib::div_roundup(end, npsize)
+        );
         return mem.read(offset, buffer.subspan(0, real_size));
     }
 
@@ -522,12 +607,68 @@ namespace dev::block
         const bool sync = (file->flags & vfs::o_sync) != 0;
         if (file->flags & vfs::o_direct)
         {
+            // not to be overtaken by an older write of the same blocks
+            drv->wait_writes();
             if (const auto ret = drv->rw(true, sync, offset,
                     std::views::single(buffer.subspan(0, real_size))); !ret)
                 return std::unexpected { ret.error() };
             return real_size;
         }
-        return mem.write(offset, buffer.subspan(0, real_size)); // TODO: sync
+
+        const auto ret = mem.write(offset, buffer.subspan(0, real_size));
+        if (ret == 0 && real_size != 0)
+            return std::unexpected { lib::err::io_error };
+
+        if (sync)
+        {
+            const auto npsize = vmm::default_npsize();
+            const auto first = offset / npsize;
+            const auto last = lib::div_roundup(offset + ret, npsize);
+            if (const auto wret = mem.write_back(first, last - first); !wret)
+                return std::unexpected { wret.error() };
+            if (const auto dret = drv->drain(); !dret)
+                return std::unexpected { dret.error() };
+            if (const auto fret = drv->flush(); !fret)
+                return std::unexpected { fret.error() };
+        }
+        else vmm::balance_dirty_pages(mem);
+        return ret;
+    }
+
+    lib::expect<void> ops_t::direct_rw(
+        bool write, std::uint64_t offset,
+        std::span<const lib::maybe_uspan<std::byte>> range
+    )
+    {
+        auto &mem = get_memory();
+        auto drv = mem.drive.lock();
+        if (!drv)
+            return std::unexpected { lib::err::invalid_device_or_address };
+
+        std::size_t total = 0;
+        for (const auto &span : range)
+            total += span.size();
+        if (total == 0)
+            return { };
+
+        const auto bsize = drv->block_size();
+        if (offset % bsize || total % bsize || offset + total > mem.lba_count * bsize)
+            return std::unexpected { lib::err::invalid_argument };
+        offset += mem.lba_start * bsize;
+
+        if (write)
+        {
+            auto at = offset;
+            for (const auto &span : range)
+            {
+                mem.update_cached(at, span);
+                at += span.size();
+            }
+        }
+
+        // not to be overtaken by an older write of the same blocks
+        drv->wait_writes(offset / bsize, total / bsize);
+        return drv->rw(write, true, offset, range);
     }
 
     lib::expect<vmm::object::ptr> ops_t::map(const std::shared_ptr<vfs::file_t> &file)
@@ -550,7 +691,13 @@ namespace dev::block
         const auto first = mem.lba_start * bs / npsize;
         const auto last = lib::div_roundup((mem.lba_start + mem.lba_count) * bs, npsize);
 
-        if (const auto ret = mem.write_back(first, last - first); !ret)
+        {
+            // the runs of dirty pages reach the queue together
+            plug_t plug;
+            if (const auto ret = mem.write_back(first, last - first); !ret)
+                return ret;
+        }
+        if (const auto ret = drv->drain(); !ret)
             return ret;
         return drv->flush();
     }
@@ -559,6 +706,9 @@ namespace dev::block
         const std::shared_ptr<drive_t> &drive, std::string_view part_prefix
     )
     {
+        // the partition table is read through it
+        drive->init_queue();
+
         drive->dev->add_ref_fn = [](auto &ref, auto &dev) {
             ref.add_link(root("/block"), dev.name, dev.path());
         };
@@ -1092,7 +1092,11 @@ namespace dev
                 install("char", dev);
                 install("block", dev);
                 install("virtual", devices);
+                install("system", devices);
                 install("fs");
+
+                const auto kernel = install("kernel");
+                install("mm", kernel);
             }
         };
 
@@ -0,0 +1,569 @@
+// Copyright (C) 2024-2026  ilobilo
+
+module drivers.dev.block;
+
+import system.cpu.local;
+import system.cpu.call;
+import system.cpu;
+import system.sched;
+import lib;
+
+namespace dev::block
+{
+    struct request_t : cpu::call_t
+    {
+        queue_t *queue;
+
+        bool write;
+        bool sync;
+        std::uint64_t lba;
+        std::uint64_t nlb;
+
+        // in lba order. linked through the bios so merging never allocates
+        // under the software queue lock
+        lib::intrusive_list<bio_t, &bio_t::hook> bios;
+        // only for merged requests, single bios use their own
+        arch::dma_buffer dma;
+
+        // where it was submitted and where it completes
+        std::size_t cpu;
+        lib::expect<void> result;
+
+        lib::intrusive_list_hook<request_t> hook;
+    };
+
+    struct queue_t
+    {
+        // pending requests are merged against this many of the newest
+        static constexpr std::size_t merge_scan = 8;
+        // a plug is flushed early once it holds this many requests
+        static constexpr std::size_t max_plugged = 32;
+        // background writes in flight before writers have to wait, each
+        // holds a copy of its data
+        static constexpr std::size_t max_async_writes = 64;
+
+        struct sw_queue_t
+        {
+            lib::spinlock_irq lock;
+            lib::intrusive_list<request_t, &request_t::hook> pending;
+            std::size_t hwq;
+            // just this cpu, for the completion ipi
+            lib::bitmap mask;
+        };
+
+        struct hw_queue_t
+        {
+            std::atomic_size_t queued = 0;
+            std::atomic_size_t inflight = 0;
+            std::atomic_bool running = false;
+            std::atomic_bool again = false;
+            std::size_t next_sw = 0;
+        };
+
+        drive_t *drive;
+        std::size_t depth;
+
+        std::size_t nr_sw;
+        std::unique_ptr<sw_queue_t []> sw;
+        std::size_t nr_hw;
+        std::unique_ptr<hw_queue_t []> hw;
+
+        std::atomic_uint64_t reads = 0;
+        std::atomic_uint64_t writes = 0;
+        std::atomic_uint64_t read_merges = 0;
+        std::atomic_uint64_t write_merges = 0;
+        std::atomic_uint64_t inflight_reads = 0;
+        std::atomic_uint64_t inflight_writes = 0;
+        std::atomic_uint64_t max_inflight = 0;
+
+        // writes nobody waits for, by the blocks they cover so that a block
+        // is never written twice at once. the first error one of them hit
+        // is kept for drain
+        struct async_range_t
+        {
+            std::uint64_t lba;
+            std::uint64_t nlb;
+        };
+        lib::spinlock_irq async_lock;
+        std::array<async_range_t, max_async_writes> async_ranges { };
+        std::atomic_size_t async_writes = 0;
+        sched::wait_queue_t async_wq;
+        std::atomic_bool async_failed = false;
+        lib::err async_error;
+
+        queue_t(drive_t *drive)
+            : drive { drive }, depth { std::max<std::size_t>(drive->_queue_depth, 1) },
+              nr_sw { cpu::count() }, sw { std::make_unique<sw_queue_t []>(nr_sw) },
+              nr_hw { std::clamp<std::size_t>(drive->_nr_hw_queues, 1, nr_sw) },
+              hw { std::make_unique<hw_queue_t []>(nr_hw) }
+        {
+            for (std::size_t i = 0; i < nr_sw; i++)
+            {
+                sw[i].hwq = i % nr_hw;
+                sw[i].mask = lib::bitmap { nr_sw };
+                sw[i].mask.set(i, true);
+            }
+        }
+
+        static std::size_t this_cpu()
+        {
+            return cpu::self().read<std::size_t, &cpu::processor::idx>();
+        }
+
+        request_t *make_request(bio_t *bio)
+        {
+            auto *req = new request_t { };
+            req->queue = this;
+            req->write = bio->write;
+            req->sync = bio->sync;
+            req->lba = bio->lba;
+            req->nlb = bio->nlb;
+            req->bios.push_back(bio);
+            return req;
+        }
+
+        // moves the bios of rhs into lhs if they are contiguous and fit in
+        // one transfer. rhs is left empty for the caller to delete, which
+        // may be under a spinlock
+        bool try_merge(request_t *lhs, request_t *rhs)
+        {
+            if (lhs->queue != rhs->queue || lhs->write != rhs->write || lhs->sync != rhs->sync)
+                return false;
+            if (lhs->nlb + rhs->nlb > drive->_max_transfer_lba)
+                return false;
+
+            const auto merged = rhs->bios.size();
+            if (lhs->lba + lhs->nlb == rhs->lba)
+            {
+                while (auto *bio = rhs->bios.pop_front())
+                    lhs->bios.push_back(bio);
+            }
+            else if (rhs->lba + rhs->nlb == lhs->lba)
+            {
+                while (auto *bio = rhs->bios.pop_back())
+                    lhs->bios.push_front(bio);
+                lhs->lba = rhs->lba;
+            }
+            else return false;
+
+            lhs->nlb += rhs->nlb;
+            (lhs->write ? write_merges : read_merges).fetch_add(merged, std::memory_order_relaxed);
+            return true;
+        }
+
+        void insert(request_t *req)
+        {
+            sched::preempt_disable();
+            const auto cpu = this_cpu();
+            auto &sq = sw[cpu];
+            bool merged = false;
+            {
+                const std::unique_lock _ { sq.lock };
+
+                const auto size = sq.pending.size();
+                std::size_t idx = 0;
+                for (auto it = sq.pending.begin(); it != sq.pending.end(); ++it, idx++)
+                {
+                    if (idx + merge_scan < size)
+                        continue;
+
+                    if (try_merge(it.value(), req))
+                    {
+                        merged = true;
+                        break;
+                    }
+                }
+
+                if (!merged)
+                {
+                    req->cpu = cpu;
+                    sq.pending.push_back(req);
+                    hw[sq.hwq].queued.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            sched::preempt_enable();
+
+            // emptied by the merge, freed with interrupts and preemption on
+            if (merged)
+                delete req;
+        }
+
+        request_t *pop(std::size_t hwq)
+        {
+            auto &hq = hw[hwq];
+            for (std::size_t i = 0; i < nr_sw; i++)
+            {
+                auto &sq = sw[(hq.next_sw + i) % nr_sw];
+                if (sq.hwq != hwq)
+                    continue;
+
+                const std::unique_lock _ { sq.lock };
+                if (auto *req = sq.pending.pop_front())
+                {
+                    hq.next_sw = (hq.next_sw + i + 1) % nr_sw;
+                    hq.queued.fetch_sub(1, std::memory_order_relaxed);
+                    return req;
+                }
+            }
+            return nullptr;
+        }
+
+        void issue(std::size_t hwq, request_t *req)
+        {
+            const auto shift = drive->_lba_shift;
+
+            auto *buffer = &req->bios.front()->dma;
+            if (req->bios.size() > 1)
+            {
+                req->dma = arch::dma_buffer { &drive->_pool, req->nlb << shift };
+                if (req->write)
+                {
+                    for (const auto &bio : req->bios)
+                    {
+                        std::memcpy(
+                            req->dma.byte_data() + ((bio.lba - req->lba) << shift),
+                            bio.dma.byte_data(), bio.nlb << shift
+                        );
+                    }
+                }
+                buffer = &req->dma;
+            }
+
+            (req->write ? writes : reads).fetch_add(1, std::memory_order_relaxed);
+            (req->write ? inflight_writes : inflight_reads).fetch_add(1, std::memory_order_relaxed);
+
+            drive->rw(hwq, req->write, req->sync, req->lba, *buffer, [this, hwq, req](lib::expect<void> res) {
+                complete(hwq, req, std::move(res));
+            });
+        }
+
+        // hands pending requests to the driver while there is room.
+        // may sleep, never called from completions directly
+        void run(std::size_t hwq)
+        {
+            auto &hq = hw[hwq];
+
+            hq.again.store(true);
+            while (hq.again.load())
+            {
+                // whoever is running it sees again and goes around once more
+                if (hq.running.exchange(true))
+                    return;
+                hq.again.store(false);
+
+                while (true)
+                {
+                    auto inflight = hq.inflight.load(std::memory_order_relaxed);
+                    if (inflight >= depth)
+                        break;
+
+                    auto *req = pop(hwq);
+                    if (!req)
+                        break;
+
+                    inflight = hq.inflight.fetch_add(1, std::memory_order_relaxed) + 1;
+                    auto max = max_inflight.load(std::memory_order_relaxed);
+                    while (inflight > max && !max_inflight.compare_exchange_weak(max, inflight, std::memory_order_relaxed))
+                        ;
+
+                    issue(hwq, req);
+                }
+
+                hq.running.store(false);
+            }
+        }
+
+        void run_all()
+        {
+            for (std::size_t i = 0; i < nr_hw; i++)
+            {
+                if (hw[i].queued.load(std::memory_order_relaxed) != 0)
+                    run(i);
+            }
+        }
+
+        static void finish(request_t *req)
+        {
+            const auto shift = req->queue->drive->_lba_shift;
+            const bool copy = !req->write && req->result && req->bios.size() > 1;
+
+            while (auto *bio = req->bios.pop_front())
+            {
+                if (copy)
+                {
+                    std::memcpy(
+                        bio->dma.byte_data(),
+                        req->dma.byte_data() + ((bio->lba - req->lba) << shift),
+                        bio->nlb << shift
+                    );
+                }
+
+                // bio may be gone once done returns
+                auto done = std::move(bio->done);
+                if (done)
+                    done(req->result);
+            }
+            delete req;
+        }
+
+        void complete(std::size_t hwq, request_t *req, lib::expect<void> res)
+        {
+            (req->write ? inflight_writes : inflight_reads).fetch_sub(1, std::memory_order_relaxed);
+            hw[hwq].inflight.fetch_sub(1, std::memory_order_relaxed);
+
+            req->result = std::move(res);
+
+            // finish on the cpu that submitted it, where the waiter most
+            // likely is and the bios are still in cache
+            sched::preempt_disable();
+            const auto cpu = req->cpu;
+            if (cpu == this_cpu() || !cpu::local::nth(cpu)->online.load(std::memory_order_acquire))
+                finish(req);
+            else
+            {
+                req->func = [](cpu::call_t *call) {
+                    finish(static_cast<request_t *>(call));
+                    // freed, nothing waits on done
+                    return false;
+                };
+                cpu::queue(cpu, req);
+                cpu::notify(sw[cpu].mask);
+            }
+            sched::preempt_enable();
+
+            // the slot that freed up goes to what is left behind
+            if (hw[hwq].queued.load(std::memory_order_relaxed) != 0)
+            {
+                sched::schedule_work([queue = drive->_queue, hwq] {
+                    queue->run(hwq);
+                });
+            }
+        }
+    };
+
+    namespace
+    {
+        plug_t *current_plug()
+        {
+            if (!sched::is_ready())
+                return nullptr;
+            return static_cast<plug_t *>(sched::current_thread()->blk_plug);
+        }
+    } // namespace
+
+    void drive_t::init_queue()
+    {
+        if (!_queue)
+            _queue = std::make_shared<queue_t>(this);
+    }
+
+    void drive_t::submit(bio_t *bio)
+    {
+        lib::bug_on(!_queue);
+        lib::bug_on(bio->nlb == 0 || bio->nlb > _max_transfer_lba);
+
+        if (auto *plug = current_plug())
+        {
+            plug->add(*this, bio);
+            return;
+        }
+
+        _queue->insert(_queue->make_request(bio));
+        _queue->run(_queue->sw[queue_t::this_cpu()].hwq);
+    }
+
+    std::size_t drive_t::async_begin(std::uint64_t lba, std::uint64_t nlb)
+    {
+        auto &q = *_queue;
+        while (true)
+        {
+            const auto gen = q.async_wq.snapshot_gen();
+            {
+                const std::unique_lock _ { q.async_lock };
+
+                std::size_t free = queue_t::max_async_writes;
+                bool overlaps = false;
+                for (std::size_t i = 0; i < queue_t::max_async_writes; i++)
+                {
+                    const auto &range = q.async_ranges[i];
+                    if (range.nlb == 0)
+                    {
+                        if (free == queue_t::max_async_writes)
+                            free = i;
+                    }
+                    else if (range.lba < lba + nlb && lba < range.lba + range.nlb)
+                    {
+                        overlaps = true;
+                        break;
+                    }
+                }
+
+                if (!overlaps && free != queue_t::max_async_writes)
+                {
+                    q.async_ranges[free] = { lba, nlb };
+                    q.async_writes.fetch_add(1, std::memory_order_acq_rel);
+                    return free;
+                }
+            }
+
+            // what is held back cannot complete
+            flush_plug();
+            q.async_wq.wait_unkillable_prepared(gen);
+        }
+    }
+
+    void drive_t::async_end(std::size_t slot, const lib::expect<void> &res)
+    {
+        auto &q = *_queue;
+        if (!res && !q.async_failed.exchange(true, std::memory_order_acq_rel))
+            q.async_error = res.error();
+
+        {
+            const std::unique_lock _ { q.async_lock };
+            q.async_ranges[slot] = { };
+        }
+        q.async_writes.fetch_sub(1, std::memory_order_acq_rel);
+        q.async_wq.wake_all();
+    }
+
+    void drive_t::wait_writes()
+    {
+        if (!_queue)
+            return;
+
+        auto &q = *_queue;
+        if (q.async_writes.load(std::memory_order_acquire) == 0)
+            return;
+
+        flush_plug();
+        while (q.async_writes.load(std::memory_order_acquire) != 0)
+        {
+            const auto gen = q.async_wq.snapshot_gen();
+            if (q.async_writes.load(std::memory_order_acquire) == 0)
+                break;
+            q.async_wq.wait_unkillable_prepared(gen);
+        }
+    }
+
+    void drive_t::wait_writes(std::uint64_t lba, std::uint64_t nlb)
+    {
+        if (!_queue)
+            return;
+
+        auto &q = *_queue;
+        const auto overlapping = [&] {
+            const std::unique_lock _ { q.async_lock };
+            return std::ranges::any_of(q.async_ranges, [&](const auto &range) {
+                return range.nlb != 0 && range.lba < lba + nlb && lba < range.lba + range.nlb;
+            });
+        };
+
+        if (q.async_writes.load(std::memory_order_acquire) == 0 || !overlapping())
+            return;
+
+        flush_plug();
+        while (true)
+        {
+            const auto gen = q.async_wq.snapshot_gen();
+            if (!overlapping())
+                break;
+            q.async_wq.wait_unkillable_prepared(gen);
+        }
+    }
+
+    lib::expect<void> drive_t::drain()
+    {
+        if (!_queue)
+            return { };
+
+        wait_writes();
+        if (_queue->async_failed.exchange(false, std::memory_order_acq_rel))
+            return std::unexpected { _queue->async_error };
+        return { };
+    }
+
+    queue_stats_t drive_t::queue_stats() const
+    {
+        if (!_queue)
+            return { };
+
+        const auto &q = *_queue;
+        return {
+            .reads = q.reads.load(std::memory_order_relaxed),
+            .writes = q.writes.load(std::memory_order_relaxed),
+            .read_merges = q.read_merges.load(std::memory_order_relaxed),
+            .write_merges = q.write_merges.load(std::memory_order_relaxed),
+            .inflight_reads = q.inflight_reads.load(std::memory_order_relaxed),
+            .inflight_writes = q.inflight_writes.load(std::memory_order_relaxed),
+            .max_inflight = q.max_inflight.load(std::memory_order_relaxed)
+        };
+    }
+
+    plug_t::plug_t() : _active { false }
+    {
+        if (!sched::is_ready())
+            return;
+
+        auto *thread = sched::current_thread();
+        if (thread->blk_plug)
+            return;
+
+        thread->blk_plug = this;
+        _active = true;
+    }
+
+    plug_t::~plug_t()
+    {
+        if (!_active)
+            return;
+
+        flush();
+        sched::current_thread()->blk_plug = nullptr;
+    }
+
+    void plug_t::add(drive_t &drive, bio_t *bio)
+    {
+        auto &q = *drive._queue;
+        auto *req = q.make_request(bio);
+
+        // plugs are usually filled in order, the newest is the best bet
+        for (auto it = _requests.rbegin(); it != _requests.rend(); ++it)
+        {
+            if (q.try_merge(*it, req))
+            {
+                delete req;
+                return;
+            }
+        }
+
+        _requests.push_back(req);
+        if (_requests.size() >= queue_t::max_plugged)
+            flush();
+    }
+
+    void plug_t::flush()
+    {
+        if (_requests.empty())
+            return;
+
+        const auto requests = std::exchange(_requests, { });
+
+        std::vector<queue_t *> queues;
+        for (auto *req : requests)
+        {
+            auto *q = req->queue;
+            q->insert(req);
+            if (std::ranges::find(queues, q) == queues.end())
+                queues.push_back(q);
+        }
+
+        for (auto *q : queues)
+            q->run_all();
+    }
+
+    void flush_plug()
+    {
+        if (auto *plug = current_plug())
+            plug->flush();
+    }
+} // namespace dev::block
@@ -75,4 +75,47 @@ namespace lib
         lib::panic("invalid decompressor format");
         std::unreachable();
     }
+
+    expect<compressor> compressor::create(compression_format fmt)
+    {
+        switch (fmt)
+        {
+            case compression_format::zlib:
+                return std::unexpected { lib::err::not_supported };
+            // the state is too big for the stack
+            case compression_format::lz4:
+                return compressor { fmt, std::make_shared<LZ4_stream_t>() };
+        }
+        return std::unexpected { lib::err::invalid_argument };
+    }
+
+    expect<std::size_t> compressor::compress(
+        std::span<const std::byte> in, std::span<std::byte> out
+    )
+    {
+        switch (_fmt)
+        {
+            case compression_format::zlib:
+                return std::unexpected { lib::err::not_supported };
+            case compression_format::lz4:
+            {
+                constexpr auto max = std::numeric_limits<int>::max();
+                if (in.size() > max || out.size() > max)
+                    return std::unexpected { lib::err::invalid_argument };
+
+                const auto result = LZ4_compress_fast_extState(
+                    _data.get(),
+                    reinterpret_cast<const char *>(in.data()),
+                    reinterpret_cast<char *>(out.data()),
+                    in.size(), out.size(), 1
+                );
+
+                if (result <= 0)
+                    return std::unexpected { lib::err::no_buffer_space };
+                return result;
+            }
+        }
+        lib::panic("invalid compressor format");
+        std::unreachable();
+    }
 } // namespace lib
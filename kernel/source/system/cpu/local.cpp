@@ -37,25 +37,22 @@ namespace cpu
                 reinterpret_cast<std::uintptr_t>(__end_percpu) -
                 reinterpret_cast<std::uintptr_t>(__start_percpu);
 
-            const auto psize = vmm::page_size::small;
-            const auto npsize = vmm::pagemap::from_page_size(psize);
             const auto flags = vmm::pflag::rwg;
 
-            for (std::size_t offset = 0; offset < size; offset += npsize)
+            // one contiguous block and one call, so the area gets the
+            // largest pages its alignment allows
+            const auto pages = lib::div_roundup(size, pmm::page_size);
+            const auto paddr = pmm::alloc(pages, true);
+            const auto ret = vmm::kernel_pagemap->map(
+                base, paddr, pages * pmm::page_size,
+                flags, std::nullopt, vmm::caching::normal
+            );
+            if (!ret)
             {
-                const auto paddr = pmm::alloc(npsize / pmm::page_size, true);
-                const auto ret = vmm::kernel_pagemap->map(
-                    base + offset, paddr,
-                    npsize, flags, psize,
-                    vmm::caching::normal
+                lib::panic(
+                    "cpu: could not map percpu area: {}",
+                    lib::error_name(ret.error())
                 );
-                if (!ret)
-                {
-                    lib::panic(
-                        "cpu: could not map percpu area: {}",
-                        lib::error_name(ret.error())
-                    );
-                }
             }
 
             for (auto func = __start_percpu_init; func < __end_percpu_init; func++)
@@ -0,0 +1,482 @@
+// Copyright (C) 2024-2026  ilobilo
+
+module;
+
+#include <uacpi/tables.h>
+#include <uacpi/acpi.h>
+
+module system.memory.numa;
+
+import system.memory.phys;
+import system.cpu.local;
+import system.acpi;
+import system.cpu;
+import drivers.dev;
+import lib;
+import fmt;
+
+namespace numa
+{
+    namespace
+    {
+        struct [[gnu::packed]] srat_table
+        {
+            acpi_sdt_hdr hdr;
+            std::uint32_t table_revision;
+            std::uint64_t reserved;
+            char entries[];
+        };
+
+        struct [[gnu::packed]] srat_entry
+        {
+            std::uint8_t type;
+            std::uint8_t length;
+        };
+
+        struct [[gnu::packed]] srat_lapic
+        {
+            srat_entry hdr;
+            std::uint8_t domain_lo;
+            std::uint8_t apic_id;
+            std::uint32_t flags;
+            std::uint8_t sapic_eid;
+            std::uint8_t domain_hi[3];
+            std::uint32_t clock_domain;
+        };
+
+        struct [[gnu::packed]] srat_memory
+        {
+            srat_entry hdr;
+            std::uint32_t domain;
+            std::uint16_t reserved0;
+            std::uint64_t base;
+            std::uint64_t length;
+            std::uint32_t reserved1;
+            std::uint32_t flags;
+            std::uint64_t reserved2;
+        };
+
+        struct [[gnu::packed]] srat_x2apic
+        {
+            srat_entry hdr;
+            std::uint16_t reserved0;
+            std::uint32_t domain;
+            std::uint32_t x2apic_id;
+            std::uint32_t flags;
+            std::uint32_t clock_domain;
+            std::uint32_t reserved1;
+        };
+
+        struct [[gnu::packed]] slit_table
+        {
+            acpi_sdt_hdr hdr;
+            std::uint64_t localities;
+            std::uint8_t entries[];
+        };
+
+        enum srat_type : std::uint8_t
+        {
+            lapic_affinity = 0,
+            memory_affinity = 1,
+            x2apic_affinity = 2
+        };
+        constexpr std::uint32_t srat_enabled = (1 << 0);
+
+        constexpr std::size_t no_node = -1;
+
+        struct cpu_affinity
+        {
+            std::size_t arch_id;
+            std::size_t node;
+        };
+
+        // nr_nodes only changes once everything else is set up, allocations
+        // may already be looking at it from other cpus
+        constinit std::atomic<std::size_t> nr_nodes = 1;
+        constinit std::size_t nr_domains = 0;
+        constinit std::array<std::uint32_t, max_nodes> domains { };
+        constinit auto distances = [] {
+            std::array<std::array<std::uint8_t, max_nodes>, max_nodes> ret { };
+            for (std::size_t i = 0; i < max_nodes; i++)
+            {
+                for (std::size_t j = 0; j < max_nodes; j++)
+                    ret[i][j] = (i == j) ? local_distance : remote_distance;
+            }
+            return ret;
+        } ();
+        constinit std::size_t fallbacks[max_nodes][max_nodes] { };
+
+        std::vector<mem_range> ranges;
+        std::vector<cpu_affinity> cpus;
+
+        cpu_local(std::size_t, cached_node, no_node);
+
+        // dense node ids in the order the srat first mentions each domain
+        std::size_t node_for(std::uint32_t domain)
+        {
+            for (std::size_t i = 0; i < nr_domains; i++)
+            {
+                if (domains[i] == domain)
+                    return i;
+            }
+
+            if (nr_domains == max_nodes)
+            {
+                lib::warn("numa: too many proximity domains, folding {} into node 0", domain);
+                return 0;
+            }
+
+            domains[nr_domains] = domain;
+            return nr_domains++;
+        }
+
+        bool parse_srat()
+        {
+            uacpi_table table;
+            if (uacpi_table_find_by_signature("SRAT", &table) != UACPI_STATUS_OK)
+                return false;
+
+            const auto srat = static_cast<srat_table *>(table.ptr);
+            const auto end = reinterpret_cast<std::uintptr_t>(srat) + srat->hdr.length;
+
+            auto ptr = reinterpret_cast<std::uintptr_t>(srat->entries);
+            while (ptr + sizeof(srat_entry) <= end)
+            {
+                const auto hdr = reinterpret_cast<srat_entry *>(ptr);
+                if (hdr->length < sizeof(srat_entry) || ptr + hdr->length > end)
+                    break;
+
+                switch (hdr->type)
+                {
+                    case lapic_affinity:
+                    {
+                        const auto ent = reinterpret_cast<srat_lapic *>(ptr);
+                        if (!(ent->flags & srat_enabled))
+                            break;
+
+                        const auto domain = ent->domain_lo |
+                            (ent->domain_hi[0] << 8) |
+                            (ent->domain_hi[1] << 16) |
+                            (ent->domain_hi[2] << 24);
+                        cpus.push_back({ ent->apic_id, node_for(domain) });
+                        break;
+                    }
+                    case memory_affinity:
+                    {
+                        const auto ent = reinterpret_cast<srat_memory *>(ptr);
+                        if (!(ent->flags & srat_enabled) || ent->length == 0)
+                            break;
+
+                        ranges.push_back({ ent->base, ent->base + ent->length, node_for(ent->domain) });
+                        break;
+                    }
+                    case x2apic_affinity:
+                    {
+                        const auto ent = reinterpret_cast<srat_x2apic *>(ptr);
+                        if (!(ent->flags & srat_enabled))
+                            break;
+
+                        cpus.push_back({ ent->x2apic_id, node_for(ent->domain) });
+                        break;
+                    }
+                    default:
+                        break;
+                }
+                ptr += hdr->length;
+            }
+            uacpi_table_unref(&table);
+            return true;
+        }
+
+        void parse_slit()
+        {
+            uacpi_table table;
+            if (uacpi_table_find_by_signature("SLIT", &table) != UACPI_STATUS_OK)
+                return;
+
+            const auto slit = static_cast<slit_table *>(table.ptr);
+            const auto num = slit->localities;
+            if (sizeof(slit_table) + num * num > slit->hdr.length)
+            {
+                lib::warn("numa: slit is truncated, ignoring it");
+                uacpi_table_unref(&table);
+                return;
+            }
+
+            for (std::size_t i = 0; i < nr_domains; i++)
+            {
+                for (std::size_t j = 0; j < nr_domains; j++)
+                {
+                    if (i == j || domains[i] >= num || domains[j] >= num)
+                        continue;
+
+                    // anything that claims to be as close as local memory is bogus
+                    const auto dist = slit->entries[domains[i] * num + domains[j]];
+                    if (dist > local_distance)
+                        distances[i][j] = dist;
+                }
+            }
+            uacpi_table_unref(&table);
+        }
+
+        void build_fallbacks()
+        {
+            for (std::size_t node = 0; node < nr_domains; node++)
+            {
+                auto &list = fallbacks[node];
+                std::iota(list, list + nr_domains, 0uz);
+                std::stable_sort(list, list + nr_domains, [node](std::size_t a, std::size_t b) {
+                    if (distances[node][a] != distances[node][b])
+                        return distances[node][a] < distances[node][b];
+                    return a == node && b != node;
+                });
+            }
+        }
+
+        void sort_ranges()
+        {
+            std::ranges::sort(ranges, { }, &mem_range::base);
+
+            std::vector<mem_range> merged;
+            for (const auto &range : ranges)
+            {
+                if (!merged.empty() && merged.back().node == range.node && merged.back().end >= range.base)
+                    merged.back().end = std::max(merged.back().end, range.end);
+                else
+                    merged.push_back(range);
+            }
+            ranges = std::move(merged);
+        }
+
+        std::size_t arch_node(std::size_t arch_id)
+        {
+            for (const auto &cpu : cpus)
+            {
+                if (cpu.arch_id == arch_id)
+                    return cpu.node;
+            }
+            return 0;
+        }
+    } // namespace
+
+    std::size_t num_nodes()
+    {
+        return nr_nodes.load(std::memory_order_acquire);
+    }
+
+    std::uint8_t distance(std::size_t from, std::size_t to)
+    {
+        lib::bug_on(from >= num_nodes() || to >= num_nodes());
+        return distances[from][to];
+    }
+
+    std::span<const std::size_t> fallback(std::size_t node)
+    {
+        lib::bug_on(node >= num_nodes());
+        return { fallbacks[node], num_nodes() };
+    }
+
+    std::span<const mem_range> memory_ranges()
+    {
+        return ranges;
+    }
+
+    std::size_t local_node()
+    {
+        if (num_nodes() == 1)
+            return 0;
+
+        auto &self = cpu::self().unsafe_get();
+        auto &cached = cached_node.unsafe_get();
+        if (cached == no_node)
+            cached = arch_node(self.arch_id);
+        return cached;
+    }
+
+    std::size_t cpu_node(std::size_t cpu_idx)
+    {
+        if (num_nodes() == 1)
+            return 0;
+        return arch_node(cpu::local::nth(cpu_idx)->arch_id);
+    }
+
+    target resolve(const mempolicy &pol, std::size_t ilx)
+    {
+        if (num_nodes() == 1)
+            return { 0, 0 };
+
+        const auto valid = pol.nodes & ((1ul << num_nodes()) - 1);
+        switch (pol.mode)
+        {
+            case policy_mode::preferred:
+                if (valid != 0)
+                    return { static_cast<std::size_t>(std::countr_zero(valid)), 0 };
+                break;
+            case policy_mode::bind:
+            {
+                if (valid == 0)
+                    break;
+
+                // nearest allowed node to this cpu
+                for (const auto node : fallback(local_node()))
+                {
+                    if (valid & (1ul << node))
+                        return { node, valid };
+                }
+                break;
+            }
+            case policy_mode::interleave:
+            {
+                if (valid == 0)
+                    break;
+
+                auto nth = ilx % std::popcount(valid);
+                auto mask = valid;
+                while (nth--)
+                    mask &= mask - 1;
+                return { static_cast<std::size_t>(std::countr_zero(mask)), 0 };
+            }
+            default:
+                break;
+        }
+        return { local_node(), 0 };
+    }
+
+    lib::initgraph::stage *initialised_stage()
+    {
+        static lib::initgraph::stage stage
+        {
+            "numa.initialised",
+            lib::initgraph::presched_init_engine
+        };
+        return &stage;
+    }
+
+    namespace
+    {
+        lib::initgraph::task init_task
+        {
+            "numa.init",
+            lib::initgraph::presched_init_engine,
+            lib::initgraph::require { acpi::tables_stage() },
+            lib::initgraph::entail { initialised_stage() },
+            [] {
+                if (!parse_srat() || nr_domains <= 1)
+                {
+                    lib::info("numa: single node");
+                    ranges.clear();
+                    cpus.clear();
+                    return;
+                }
+
+                sort_ranges();
+                parse_slit();
+                build_fallbacks();
+                nr_nodes.store(nr_domains, std::memory_order_release);
+
+                lib::info("numa: {} nodes", nr_domains);
+                for (const auto &range : ranges)
+                    lib::debug("numa: node {}: 0x{:X} - 0x{:X}", range.node, range.base, range.end);
+
+                for (std::size_t i = 0; i < nr_domains; i++)
+                {
+                    std::string line;
+                    for (std::size_t j = 0; j < nr_domains; j++)
+                        fmt::format_to(std::back_inserter(line), " {:>3}", distances[i][j]);
+                    lib::debug("numa: node {} distances:{}", i, line);
+                }
+
+                pmm::assign_nodes();
+            }
+        };
+
+        std::optional<std::size_t> node_of(const dev::kobject_t &kobj)
+        {
+            std::size_t node = 0;
+            const auto str = std::string_view { kobj.name } .substr(4);
+            const auto res = std::from_chars(str.data(), str.data() + str.size(), node);
+            if (res.ec != std::errc { } || node >= num_nodes())
+                return std::nullopt;
+            return node;
+        }
+
+        struct meminfo_attr_t : dev::attribute_t
+        {
+            meminfo_attr_t() : dev::attribute_t { "meminfo", 0444 } { }
+
+            lib::expect<std::string> show(dev::kobject_t &kobj) override
+            {
+                const auto node = node_of(kobj);
+                if (!node)
+                    return std::unexpected { lib::err::invalid_argument };
+
+                const auto info = pmm::node_info(*node);
+                return fmt::format(
+                    "Node {} MemTotal:       {} kB\n"
+                    "Node {} MemFree:        {} kB\n"
+                    "Node {} MemUsed:        {} kB\n",
+                    *node, info.total / 1024,
+                    *node, info.free / 1024,
+                    *node, (info.total - info.free) / 1024
+                );
+            }
+        };
+
+        struct distance_attr_t : dev::attribute_t
+        {
+            distance_attr_t() : dev::attribute_t { "distance", 0444 } { }
+
+            lib::expect<std::string> show(dev::kobject_t &kobj) override
+            {
+                const auto node = node_of(kobj);
+                if (!node)
+                    return std::unexpected { lib::err::invalid_argument };
+
+                std::string out;
+                for (std::size_t i = 0; i < num_nodes(); i++)
+                    fmt::format_to(std::back_inserter(out), "{}{}", i ? " " : "", distances[*node][i]);
+                out += '\n';
+                return out;
+            }
+        };
+
+        struct node_ktype_t : dev::ktype_t
+        {
+            std::span<const dev::attribute_group_t> groups() const override
+            {
+                static meminfo_attr_t meminfo { };
+                static distance_attr_t distance { };
+
+                static dev::attribute_t *attrs[] {
+                    &meminfo,
+                    &distance
+                };
+                static const dev::attribute_group_t group_list[] {
+                    { .attributes = attrs }
+                };
+                return group_list;
+            }
+        };
+
+        lib::initgraph::task sysfs_task
+        {
+            "numa.sysfs.register",
+            lib::initgraph::postsched_init_engine,
+            lib::initgraph::require { dev::core_registered_stage() },
+            [] {
+                static node_ktype_t ktype { };
+
+                const auto parent = dev::kobject_t::create(
+                    "node", dev::empty_ktype(), dev::root("/devices/system")
+                );
+                lib::bug_on(!dev::register_kobject(parent));
+
+                for (std::size_t i = 0; i < num_nodes(); i++)
+                {
+                    const auto kobj = dev::kobject_t::create(fmt::format("node{}", i), ktype, parent);
+                    lib::bug_on(!dev::register_kobject(kobj));
+                }
+            }
+        };
+    } // namespace
+} // namespace numa
@@ -0,0 +1,187 @@
+// Copyright (C) 2024-2026  ilobilo
+
+module system.memory.oom;
+
+import system.memory.vmstat;
+import system.memory.phys;
+import system.memory.virt;
+import system.memory.zram;
+import system.sched;
+import arch;
+import lib;
+
+namespace oom
+{
+    namespace
+    {
+        // a victim gets this many waits to exit before another one is picked
+        constexpr std::size_t max_victim_waits = 100;
+        constexpr std::uint64_t victim_wait_ns = 10'000'000;
+
+        sched::mutex_t oom_lock;
+
+        std::weak_ptr<sched::process_t> victim;
+        std::size_t victim_waits = 0;
+
+        struct candidate
+        {
+            std::shared_ptr<sched::process_t> proc;
+            vmm::vmspace::usage_t usage;
+            long points;
+        };
+
+        bool can_kill()
+        {
+            if (!sched::is_ready() || sched::is_preempt_disabled())
+                return false;
+            return arch::int_status() && !sched::in_hard_irq();
+        }
+
+        // memory and swap together, what score_adj is a fraction of
+        std::size_t total_pages()
+        {
+            return (pmm::info().usable + zram::get_stats().disksize) / pmm::page_size;
+        }
+
+        // pages the process would give back by exiting, shifted by its
+        // adjustment in thousandths of all memory
+        std::optional<candidate> evaluate(const std::shared_ptr<sched::process_t> &proc, std::size_t totalpages)
+        {
+            // never init or the kernel
+            if (proc->pid <= 1)
+                return std::nullopt;
+
+            const std::unique_lock lock { proc->lock, std::try_to_lock };
+            if (!lock.owns_lock())
+                return std::nullopt;
+
+            const auto adj = proc->oom_score_adj.load(std::memory_order_relaxed);
+            if (adj == score_adj_min || proc->is_zombie || !proc->vmspace)
+                return std::nullopt;
+            if (proc->oom_skip.load(std::memory_order_relaxed))
+                return std::nullopt;
+
+            const auto usage = proc->vmspace->try_usage();
+            auto points = static_cast<long>(usage.anon + usage.swap + usage.shmem + usage.pgtables);
+            points += static_cast<long>(adj) * static_cast<long>(totalpages / 1000);
+
+            return candidate { proc, usage, std::max(points, 1l) };
+        }
+
+        void report(const candidate &cand, std::size_t nr_pages)
+        {
+            constexpr auto kib = pmm::page_size / 1024;
+
+            const auto mem = pmm::info();
+            const auto zst = zram::get_stats();
+            lib::warn(
+                "oom: out of memory for {} page{}. free: {} KiB, file: {} KiB, shmem: {} KiB, swap: {}/{} KiB",
+                nr_pages, nr_pages == 1 ? "" : "s",
+                (mem.usable - mem.used) / 1024,
+                (vmm::lru_pages(true) + vmm::lru_pages(false)) * kib,
+                vmm::cached_pages(vmm::object_type::shmem) * kib,
+                zst.stored_pages * kib, zst.disksize / 1024
+            );
+
+            const auto &proc = cand.proc;
+            lib::warn(
+                "oom: killed process {} ({}) score {} adj {}, anon-rss: {} KiB, swap: {} KiB, shmem-rss: {} KiB, pgtables: {} KiB",
+                proc->pid, sched::comm_of(proc.get()), cand.points,
+                proc->oom_score_adj.load(std::memory_order_relaxed),
+                cand.usage.anon * kib, cand.usage.swap * kib,
+                cand.usage.shmem * kib, cand.usage.pgtables * kib
+            );
+        }
+    } // namespace
+
+    bool out_of_memory(std::size_t nr_pages)
+    {
+        if (nr_pages > max_pages || !can_kill())
+            return false;
+
+        auto *self = sched::current_process();
+
+        std::unique_lock lock { oom_lock, std::try_to_lock };
+        if (!lock.owns_lock())
+        {
+            // someone else is choosing a victim already
+            lib::unused(sched::sleep_for_ns(victim_wait_ns));
+            return true;
+        }
+
+        if (auto proc = victim.lock(); proc && !proc->is_zombie)
+        {
+            // the victim itself, and even the reserve ran out
+            if (proc.get() == self)
+                return false;
+
+            if (victim_waits++ < max_victim_waits)
+            {
+                lock.unlock();
+                lib::unused(sched::sleep_for_ns(victim_wait_ns));
+                return true;
+            }
+
+            // stuck somewhere. let it be and pick someone else
+            proc->oom_skip.store(true, std::memory_order_relaxed);
+        }
+        victim.reset();
+
+        const auto totalpages = total_pages();
+
+        std::optional<candidate> chosen;
+        const bool walked = sched::try_for_each_process([&](const auto &proc) {
+            auto cand = evaluate(proc, totalpages);
+            if (cand && (!chosen || cand->points > chosen->points))
+                chosen = std::move(cand);
+            return true;
+        });
+
+        // the process list is ours, or there is nobody left to kill
+        if (!walked || !chosen)
+        {
+            if (walked)
+                lib::error("oom: out of memory and no killable processes");
+            return false;
+        }
+
+        const sched::siginfo_t info {
+            .signo = sched::sigkill,
+            .code = sched::si_kernel,
+            .err = 0,
+            .pid = 0,
+            .uid = 0,
+            .status = 0,
+            .addr = 0,
+            .value = 0,
+        };
+        chosen->proc->oom_victim.store(true, std::memory_order_relaxed);
+        sched::send_signal(chosen->proc.get(), info);
+
+        vmstat::add(vmstat::item::oom_kill);
+        report(*chosen, nr_pages);
+
+        victim = chosen->proc;
+        victim_waits = 0;
+
+        // retry right away, from the reserve this time
+        if (chosen->proc.get() == self)
+            return true;
+
+        lock.unlock();
+        lib::unused(sched::sleep_for_ns(victim_wait_ns));
+        return true;
+    }
+
+    bool may_use_reserve()
+    {
+        if (!can_kill())
+            return true;
+
+        if (sched::current_thread()->in_reclaim)
+            return true;
+
+        auto *self = sched::current_process();
+        return self && self->oom_victim.load(std::memory_order_relaxed);
+    }
+} // namespace oom
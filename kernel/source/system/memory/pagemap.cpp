@@ -8,6 +8,7 @@ module system.memory.virt;
 
 import system.memory.tlb;
 import system.memory.va;
+import system.memory.vmstat;
 import system.cpu.local;
 import system.sched;
 import magic_enum;
@@ -68,8 +69,11 @@ namespace vmm
 
                 accessor.clear()
                     .setaddr(reinterpret_cast<std::uintptr_t>(ret))
-                    .setflags(valid_table_flags, true)
+                    .setflags(user ? new_user_table_flags : new_kernel_table_flags, true)
                     .write();
+
+                if (user)
+                    vmstat::add(vmstat::item::thp_split_pmd);
             }
             else ret = reinterpret_cast<table *>(addr);
         }
@@ -138,10 +142,28 @@ namespace vmm
         return ret->first;
     }
 
+    auto pagemap::whole_large(std::uintptr_t vaddr, std::size_t length) const
+        -> std::optional<std::pair<entry *, page_size>>
+    {
+        const auto min_large = from_page_size(page_size::medium);
+        if (vaddr % min_large || length < min_large)
+            return std::nullopt;
+
+        const auto ret = walk(vaddr, std::nullopt, false, false);
+        if (!ret.has_value() || ret->second == page_size::small)
+            return std::nullopt;
+
+        const auto npsize = from_page_size(ret->second);
+        if (vaddr % npsize || length < npsize)
+            return std::nullopt;
+
+        return *ret;
+    }
+
     lib::expect<void> pagemap::map_internal(
         std::uintptr_t vaddr, std::uintptr_t paddr, std::size_t length,
         pflag flags, std::optional<page_size> psize, caching cache,
-        flush_range &fr_out, flush_range &lfr_out
+        flush_range &fr_out, flush_range &lfr_out, table *&stale_out
     )
     {
         auto current_vaddr = vaddr;
@@ -150,7 +172,8 @@ namespace vmm
 
         while (remaining > 0)
         {
-            const auto max_psize = fixpsize(max_page_size(current_vaddr, remaining));
+            // both sides have to be aligned for a large leaf
+            const auto max_psize = fixpsize(max_page_size(current_vaddr | current_paddr, remaining));
             const auto use_psize = psize.has_value() ? psize.value() : max_psize;
             const auto npsize = from_page_size(use_psize);
 
@@ -177,12 +200,24 @@ namespace vmm
             const bool needs_invl = addr && is_canonical(addr);
             lib::bug_on(needs_invl && !accessor.getflags(valid_table_flags));
 
+            // a medium page replacing a page table. the table can only be
+            // freed once no cpu can walk through it anymore
+            const bool drops_table = needs_invl && use_psize == page_size::medium && !accessor.is_large();
+
             accessor.clear()
                 .setaddr(current_paddr)
                 .setflags(aflags, true)
                 .write();
 
-            if (needs_invl)
+            if (drops_table)
+            {
+                const auto tbl = reinterpret_cast<table *>(addr);
+                *reinterpret_cast<table **>(lib::tohh(tbl)) = stale_out;
+                stale_out = tbl;
+                fr_out.extend(current_vaddr, current_vaddr + npsize);
+            }
+
+            if (needs_invl && !drops_table)
             {
                 const bool local_only = addr == current_paddr &&
                     is_upgrade(from_arch(old_flags, use_psize), from_arch(aflags, use_psize));
@@ -219,17 +254,25 @@ namespace vmm
         }
 
         flush_range fr, lfr;
+        table *stale = nullptr;
         lib::expect<void> result;
         {
             const std::unique_lock _ { _lock };
-            result = map_internal(vaddr, paddr, length, flags, psize, cache, fr, lfr);
+            result = map_internal(vaddr, paddr, length, flags, psize, cache, fr, lfr, stale);
         }
 
         if (fr.valid())
-            invalidate(fr.start, fr.length());
+            invalidate(fr.start, fr.length(), false, stale != nullptr);
         if (lfr.valid())
             invalidate(lfr.start, lfr.length(), true);
 
+        while (stale != nullptr)
+        {
+            const auto next = *reinterpret_cast<table **>(lib::tohh(stale));
+            free_table(stale);
+            stale = next;
+        }
+
         return result;
     }
 
@@ -244,6 +287,31 @@ namespace vmm
 
         while (remaining > 0)
         {
+            // don't split large leaves that are covered entirely
+            if (const auto large = whole_large(current_vaddr, remaining))
+            {
+                const auto [pte, lpsize] = *large;
+                const auto lnpsize = from_page_size(lpsize);
+
+                auto accessor = pte->access();
+                const auto old_flags = accessor.getflags();
+                const auto aflags = to_arch(flags, cache, lpsize);
+
+                accessor.clearflags()
+                    .setflags(aflags, true)
+                    .write();
+
+                const bool local_only = is_upgrade(
+                    from_arch(old_flags, lpsize),
+                    from_arch(aflags, lpsize)
+                );
+                (local_only ? lfr_out : fr_out).extend(current_vaddr, current_vaddr + lnpsize);
+
+                current_vaddr += lnpsize;
+                remaining -= lnpsize;
+                continue;
+            }
+
             const auto max_psize = fixpsize(max_page_size(current_vaddr, remaining));
             const auto use_psize = psize.has_value() ? psize.value() : max_psize;
             const auto npsize = from_page_size(use_psize);
@@ -296,6 +364,23 @@ namespace vmm
         std::uintptr_t vaddr, std::size_t length, pflag flags,
         std::optional<page_size> psize, caching cache
     )
+    {
+        flush_range fr, lfr;
+        const auto result = protect(vaddr, length, flags, psize, cache, fr, lfr);
+
+        if (fr.valid())
+            invalidate(fr.start, fr.length());
+        if (lfr.valid())
+            invalidate(lfr.start, lfr.length(), true);
+
+        return result;
+    }
+
+    lib::expect<void> pagemap::protect(
+        std::uintptr_t vaddr, std::size_t length, pflag flags,
+        std::optional<page_size> psize, caching cache,
+        flush_range &fr, flush_range &lfr
+    )
     {
         lib::bug_on(!magic_enum::enum_contains(cache));
 
@@ -311,19 +396,8 @@ namespace vmm
                 return std::unexpected { lib::err::invalid_argument };
         }
 
-        flush_range fr, lfr;
-        lib::expect<void> result;
-        {
-            const std::unique_lock _ { _lock };
-            result = protect_internal(vaddr, length, flags, psize, cache, fr, lfr);
-        }
-
-        if (fr.valid())
-            invalidate(fr.start, fr.length());
-        if (lfr.valid())
-            invalidate(lfr.start, lfr.length(), true);
-
-        return result;
+        const std::unique_lock _ { _lock };
+        return protect_internal(vaddr, length, flags, psize, cache, fr, lfr);
     }
 
     lib::expect<void> pagemap::unmap_internal(
@@ -336,6 +410,19 @@ namespace vmm
 
         while (remaining > 0)
         {
+            if (const auto large = whole_large(current_vaddr, remaining))
+            {
+                const auto [pte, lpsize] = *large;
+                const auto lnpsize = from_page_size(lpsize);
+
+                pte->access().clear().write();
+                fr_out.extend(current_vaddr, current_vaddr + lnpsize);
+
+                current_vaddr += lnpsize;
+                remaining -= lnpsize;
+                continue;
+            }
+
             const auto max_psize = fixpsize(max_page_size(current_vaddr, remaining));
             const auto use_psize = psize.has_value() ? psize.value() : max_psize;
             const auto npsize = from_page_size(use_psize);
@@ -367,6 +454,20 @@ namespace vmm
         std::uintptr_t vaddr, std::size_t length,
         std::optional<page_size> psize
     )
+    {
+        flush_range fr;
+        const auto result = unmap(vaddr, length, psize, fr);
+
+        if (fr.valid())
+            invalidate(fr.start, fr.length());
+
+        return result;
+    }
+
+    lib::expect<void> pagemap::unmap(
+        std::uintptr_t vaddr, std::size_t length,
+        std::optional<page_size> psize, flush_range &fr
+    )
     {
         if (length == 0)
             return { };
@@ -380,17 +481,8 @@ namespace vmm
                 return std::unexpected { lib::err::invalid_argument };
         }
 
-        flush_range fr;
-        lib::expect<void> result;
-        {
-            const std::unique_lock _ { _lock };
-            result = unmap_internal(vaddr, length, psize, fr);
-        }
-
-        if (fr.valid())
-            invalidate(fr.start, fr.length());
-
-        return result;
+        const std::unique_lock _ { _lock };
+        return unmap_internal(vaddr, length, psize, fr);
     }
 
     lib::expect<std::uintptr_t> pagemap::translate(std::uintptr_t vaddr, page_size psize)
@@ -426,7 +518,10 @@ namespace vmm
         return self.next_asid++;
     }
 
-    void pagemap::invalidate(std::uintptr_t vaddr, std::size_t length, bool only_local)
+    void pagemap::invalidate(
+        std::uintptr_t vaddr, std::size_t length,
+        bool only_local, bool freed_tables
+    )
     {
         if (length == 0)
             return;
@@ -439,6 +534,7 @@ namespace vmm
             .start = vaddr,
             .pages = length / npsize,
             .pmap = kernel ? nullptr : this,
+            .freed_tables = freed_tables
         };
 
         if (only_local)
@@ -447,6 +543,19 @@ namespace vmm
             tlb::shootdown(req);
     }
 
+    void pagemap::invalidate_all()
+    {
+        const bool kernel = (_asid_ctx == nullptr);
+
+        const tlb::request_t req {
+            .sc = kernel ? tlb::scope::kernel_full : tlb::scope::user_full,
+            .start = 0,
+            .pages = 0,
+            .pmap = kernel ? nullptr : this,
+        };
+        tlb::shootdown(req);
+    }
+
     bool pagemap::fault_permitted(std::uintptr_t vaddr, bool write, bool exec) const
     {
         const auto ret = walk(vaddr, std::nullopt, false, false);
@@ -463,6 +572,30 @@ namespace vmm
         return true;
     }
 
+    bool pagemap::is_mapped(std::uintptr_t vaddr) const
+    {
+        return walk(vaddr, std::nullopt, false, false).has_value();
+    }
+
+    // no tlb flush. a stale entry only means the page looks old a bit later
+    bool pagemap::test_and_clear_young(std::uintptr_t vaddr)
+    {
+        if (young_flag == 0)
+            return false;
+
+        const std::unique_lock _ { _lock };
+        const auto ret = walk(vaddr, std::nullopt, false, false);
+        if (!ret.has_value())
+            return false;
+
+        auto accessor = ret->first->access();
+        if (!accessor.getflags(young_flag))
+            return false;
+
+        accessor.setflags(young_flag, false).write();
+        return true;
+    }
+
     void pagemap::unload() const
     {
         if (!_asid_ctx)
@@ -515,6 +648,41 @@ namespace vmm
         sched::preempt_enable();
     }
 
+    std::array<std::size_t, 3> pagemap::count_kernel_leaves() const
+    {
+        static constexpr std::size_t shift_start = 12 + (levels - 1) * 9;
+
+        const auto kstart = kernel_range().first;
+        std::array<std::size_t, 3> ret { };
+
+        [&ret](this auto self, table *ptr, std::size_t start, std::size_t level) -> void
+        {
+            const auto psize = static_cast<page_size>(level - 1);
+            for (std::size_t i = start; i < 512; i++)
+            {
+                auto &ent = ptr->entries[i];
+                if (level > 1)
+                {
+                    if (const auto lvl = getlvl(ent, false, false, psize, false))
+                    {
+                        self(lvl, 0, level - 1);
+                        continue;
+                    }
+                }
+
+                const auto accessor = ent.access();
+                if (accessor.value == 0 || (level > 1 && !accessor.is_large()))
+                    continue;
+
+                const auto pflags = from_arch(accessor.getflags(), psize).first;
+                if ((pflags & pflag::read) != pflag::none)
+                    ret[std::to_underlying(psize)]++;
+            }
+        } (lib::tohh(get_arch_table(kstart)), (kstart >> shift_start) & 0x1FF, levels);
+
+        return ret;
+    }
+
     pagemap::~pagemap()
     {
         [](this auto self, table *ptr, std::size_t start, std::size_t end, std::size_t level)
@@ -549,6 +717,24 @@ namespace vmm
             const auto memmaps = boot::requests::memmap.response->entries;
             const std::size_t num = boot::requests::memmap.response->entry_count;
 
+            // adjacent entries with the same caching are mapped as one range
+            // so that their boundaries do not break up large pages
+            std::uintptr_t run_start = 0;
+            std::uintptr_t run_end = 0;
+            auto run_cache = caching::normal;
+
+            const auto flush_run = [&] {
+                if (run_start == run_end)
+                    return;
+
+                const auto vaddr = lib::tohh(run_start);
+                const auto len = run_end - run_start;
+                if (const auto ret = kernel_pagemap->map(vaddr, run_start, len, pflag::rw, std::nullopt, run_cache); !ret)
+                    lib::panic("could not map virtual memory: {}", lib::error_name(ret.error()));
+
+                run_start = run_end = 0;
+            };
+
             for (std::size_t i = 0; i < num; i++)
             {
                 const auto memmap = memmaps[i];
@@ -577,9 +763,15 @@ namespace vmm
                     magic_enum::enum_name(type), len, memmap->base, vaddr
                 );
 
-                if (const auto ret = kernel_pagemap->map(vaddr, paddr, len, pflag::rw, std::nullopt, cache); !ret)
-                    lib::panic("could not map virtual memory: {}", lib::error_name(ret.error()));
+                if (run_start == run_end || paddr != run_end || cache != run_cache)
+                {
+                    flush_run();
+                    run_start = paddr;
+                    run_cache = cache;
+                }
+                run_end = paddr + len;
             }
+            flush_run();
         }
         {
             static constexpr auto cache = caching::normal;
@@ -627,6 +819,19 @@ namespace vmm
 
         lib::debug("vmm: loading the pagemap");
         kernel_pagemap->load();
+
+        const auto leaves = kernel_pagemap->count_kernel_leaves();
+        for (std::size_t i = leaves.size(); i-- > 0; )
+        {
+            const auto psize = static_cast<page_size>(i);
+            if (fixpsize(psize) != psize)
+                continue;
+
+            lib::info(
+                "vmm: {} kernel mappings of {} KiB",
+                leaves[i], from_page_size(psize) / 1024
+            );
+        }
     }
 
     void init_vspaces()
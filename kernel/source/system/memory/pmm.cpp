@@ -4,7 +4,17 @@ module system.memory.phys;
 
 import drivers.fs.procfs;
 import drivers.initramfs;
+import system.memory.reclaim;
+import system.memory.numa;
+import system.memory.vmstat;
+import system.memory.oom;
 import system.memory.virt;
+import system.memory.zram;
+import system.cpu.local;
+import system.chrono;
+import system.sched;
+import system.cpu;
+import arch;
 import magic_enum;
 import frigg;
 import boot;
@@ -19,6 +29,25 @@ namespace pmm
         constinit memory mem;
         constinit bool initialised = false;
 
+        // pages on each node that has a page struct, once the srat is read
+        constinit std::size_t node_total[numa::max_nodes] { };
+
+        // where the node piece holding addr ends, so that no block spans nodes
+        std::uintptr_t node_piece_end(std::uintptr_t addr, std::uintptr_t end)
+        {
+            for (const auto &range : numa::memory_ranges())
+            {
+                const auto base = lib::align_down(range.base, page_size);
+                if (addr < base)
+                    return std::min(end, base);
+
+                const auto rend = lib::align_down(range.end, page_size);
+                if (addr < rend)
+                    return std::min(end, rend);
+            }
+            return end;
+        }
+
         template<std::uintptr_t Start, std::uintptr_t End>
         struct allocator
         {
@@ -26,7 +55,9 @@ namespace pmm
             static constexpr std::uintptr_t end = End;
 
             struct list { list *prev = nullptr; list *next = nullptr; };
-            list lists[max_order + 1] { };
+            // blocks never span nodes, each one sits on its own node's lists
+            list lists[numa::max_nodes][max_order + 1] { };
+            std::size_t node_free[numa::max_nodes] { };
 
             static bool in_range(const auto ptr)
             {
@@ -81,29 +112,36 @@ namespace pmm
 
             void put(std::size_t order, list *pg)
             {
-                vmm::page_for(pg)->buddy.listed = 1;
+                auto *page = vmm::page_for(pg);
+                page->buddy.listed = 1;
 
-                pg->next = lists[order].next;
+                auto &head = lists[page->node][order];
+                pg->next = head.next;
                 pg->prev = nullptr;
-                if (lists[order].next)
-                    lists[order].next->prev = pg;
-                lists[order].next = pg;
+                if (head.next)
+                    head.next->prev = pg;
+                head.next = pg;
+
+                node_free[page->node] += 1uz << order;
             }
 
-            void *rem(std::size_t order)
+            void *rem(std::size_t node, std::size_t order)
             {
-                const auto ret = lists[order].next;
+                auto &head = lists[node][order];
+                const auto ret = head.next;
                 vmm::page_for(ret)->buddy.listed = 0;
 
-                lists[order].next = ret->next;
-                if (lists[order].next)
-                    lists[order].next->prev = nullptr;
+                head.next = ret->next;
+                if (head.next)
+                    head.next->prev = nullptr;
+
+                node_free[node] -= 1uz << order;
                 return ret;
             }
 
-            bool has_pages(std::size_t order)
+            bool has_pages(std::size_t node, std::size_t order)
             {
-                return lists[order].next != nullptr;
+                return lists[node][order].next != nullptr;
             }
 
             std::size_t add_range(std::uintptr_t base, std::size_t size)
@@ -143,10 +181,10 @@ namespace pmm
                 return size;
             }
 
-            void split_to(std::size_t target)
+            void split_to(std::size_t node, std::size_t target)
             {
                 auto current = target + 1;
-                while (lists[current].next == nullptr)
+                while (lists[node][current].next == nullptr)
                 {
                     current++;
                     if (current > max_order)
@@ -155,7 +193,7 @@ namespace pmm
 
                 while (current > target)
                 {
-                    const auto pg = static_cast<list *>(rem(current));
+                    const auto pg = static_cast<list *>(rem(node, current));
                     const auto pgaddr = reinterpret_cast<std::uintptr_t>(pg);
 
                     current--;
@@ -180,7 +218,7 @@ namespace pmm
                 }
             }
 
-            void coalesce_to(std::size_t target)
+            void coalesce_to(std::size_t node, std::size_t target)
             {
                 if (target == 0)
                     return;
@@ -190,9 +228,9 @@ namespace pmm
                 for (std::size_t order = 0; order < target; order++)
                 {
                     const auto next_block_size = page_size * lib::pow2(order + 1);
-                    auto curr = lists[order].next;
+                    auto curr = lists[node][order].next;
 
-                    while (has_pages(order))
+                    while (has_pages(node, order))
                     {
                         while (get_phys(curr) % next_block_size ||
                             !buddy_valid(get_phys(curr), order))
@@ -210,7 +248,8 @@ namespace pmm
                         const auto buddy_page = vmm::page_for(buddy_addr);
 
                         // if it's not allocated or listed, then it's not a fren
-                        if (!buddy_page->buddy.listed || buddy_page->buddy.order != order)
+                        if (!buddy_page->buddy.listed || buddy_page->buddy.order != order ||
+                            buddy_page->node != node)
                         {
                             // cannot coalesce :(
                             curr = curr->next;
@@ -221,17 +260,19 @@ namespace pmm
 
                         lib::bug_on(buddy_page->buddy.allocated != 0);
 
-                        auto remove = [this, &order](auto pg)
+                        auto remove = [this, &node, &order](auto pg)
                         {
                             vmm::page_for(pg)->buddy.listed = 0;
 
                             if (pg->prev)
                                 pg->prev->next = pg->next;
                             else
-                                lists[order].next = pg->next;
+                                lists[node][order].next = pg->next;
 
                             if (pg->next)
                                 pg->next->prev = pg->prev;
+
+                            node_free[node] -= 1uz << order;
                         };
 
                         remove(curr);
@@ -243,7 +284,7 @@ namespace pmm
                         merged_page->buddy.order = order + 1;
                         put(order + 1, merged);
 
-                        curr = lists[order].next;
+                        curr = lists[node][order].next;
                     }
                     end:
                 }
@@ -273,7 +314,7 @@ namespace pmm
                 return size;
             }
 
-            std::pair<std::uintptr_t, std::size_t> alloc(std::size_t npages)
+            std::pair<std::uintptr_t, std::size_t> alloc(std::size_t node, std::size_t npages)
             {
                 const auto size = npages * page_size;
                 const auto order = next_order_from(size);
@@ -282,22 +323,22 @@ namespace pmm
                 if (order < 0 || static_cast<std::size_t>(order) > max_order)
                     return { 0, 0 };
 
-                if (!has_pages(order))
+                if (!has_pages(node, order))
                 {
                     if (order == max_order)
                     {
-                        coalesce_to(max_order);
-                        if (!has_pages(order))
+                        coalesce_to(node, max_order);
+                        if (!has_pages(node, order))
                             return { 0, 0 };
                         goto found;
                     }
-                    split_to(order);
-                    if (!has_pages(order))
+                    split_to(node, order);
+                    if (!has_pages(node, order))
                     {
                         if (order != 0)
                         {
-                            coalesce_to(order);
-                            if (!has_pages(order))
+                            coalesce_to(node, order);
+                            if (!has_pages(node, order))
                                 return { 0, 0 };
                             goto found;
                         }
@@ -305,7 +346,7 @@ namespace pmm
                     }
                 }
                 found:
-                const auto ret = reinterpret_cast<std::uintptr_t>(rem(order));
+                const auto ret = reinterpret_cast<std::uintptr_t>(rem(node, order));
 
                 auto *pg = vmm::page_for(ret);
                 lib::bug_on(
@@ -322,12 +363,121 @@ namespace pmm
 
                 return { ret, real_size };
             }
+
+            // everything starts out on node 0. move each block to the node
+            // its pages turned out to be on, splitting those that straddle two
+            void rebucket()
+            {
+                list *chain = nullptr;
+                for (std::size_t order = 0; order <= max_order; order++)
+                {
+                    while (has_pages(0, order))
+                    {
+                        const auto pg = static_cast<list *>(rem(0, order));
+                        pg->next = chain;
+                        chain = pg;
+                    }
+                }
+
+                while (chain)
+                {
+                    const auto pg = chain;
+                    chain = chain->next;
+
+                    const auto base = get_phys(pg);
+                    const auto end = base + (page_size << vmm::page_for(pg)->buddy.order);
+                    for (auto piece = base; piece < end; )
+                    {
+                        const auto piece_end = node_piece_end(piece, end);
+                        lib::bug_on(add_range(piece, piece_end - piece) != 0);
+                        piece = piece_end;
+                    }
+                }
+            }
+
+            std::size_t free_on(std::size_t node) const
+            {
+                return node_free[node];
+            }
         };
 
         constinit allocator<page_size, lib::mib(1)> sub1mib { };
         constinit allocator<lib::mib(1), lib::gib(4)> sub4gib { };
         constinit allocator<lib::gib(4), (1ul << paddr_bits)> normal { };
 
+        // per-cpu page caches for small orders. blocks in these lists are
+        // still marked as allocated in the buddy allocator and counted in mem.used
+        constexpr std::size_t pcp_max_order = 3;
+        constexpr std::size_t pcp_batch = 32;
+        constexpr std::size_t pcp_high = pcp_batch * 6;
+        // a list below this gets a batch before it runs dry
+        constexpr std::size_t pcp_low = pcp_batch / 4;
+
+        constexpr std::size_t pcp_batch_for(std::size_t order)
+        {
+            return std::max(pcp_batch >> order, 2uz);
+        }
+
+        constexpr std::size_t pcp_low_for(std::size_t order)
+        {
+            return std::max(pcp_low >> order, 1uz);
+        }
+
+        constexpr std::size_t pcp_high_for(std::size_t order)
+        {
+            return std::max(pcp_high >> order, pcp_batch_for(order) * 2);
+        }
+
+        constexpr std::size_t pcp_order(std::size_t count)
+        {
+            return std::bit_width(count - 1);
+        }
+
+        // single pages zeroed in the background, taken by clear allocations.
+        // zerod tops a cpu up to high once it drops below low
+        constexpr std::size_t zeroed_low = 64;
+        constexpr std::size_t zeroed_high = 256;
+
+        struct pcp_t
+        {
+            struct block { block *next; };
+
+            struct list_t
+            {
+                block *head = nullptr;
+                std::size_t count = 0;
+
+                std::size_t hits = 0;
+                std::size_t misses = 0;
+                std::size_t refills = 0;
+                std::size_t drains = 0;
+            };
+
+            lib::spinlock_irq lock;
+            list_t lists[pcp_max_order + 1] { };
+            list_t zeroed { };
+
+            std::size_t cpu_idx = 0;
+            bool registered = false;
+            pcp_t *next = nullptr;
+        };
+
+        cpu_local(pcp_t, pcpu);
+
+        std::atomic<pcp_t *> pcp_head = nullptr;
+        std::atomic<std::size_t> pcp_pages = 0;
+
+        sched::wait_queue_t zerod_wq;
+        constinit std::atomic_bool zerod_started = false;
+        constinit std::atomic_bool zerod_wanted = false;
+
+        // pages in per-cpu caches count as free
+        std::size_t free_pages()
+        {
+            const auto cached = pcp_pages.load(std::memory_order_relaxed) * page_size;
+            return (mem.usable - mem.used + cached) / page_size;
+        }
+
         void add_range(std::uintptr_t base, std::size_t size, bool freeing)
         {
             if (size == 0)
@@ -362,11 +512,14 @@ namespace pmm
             std::size_t wasted = 0;
             const auto check_and_add = [=, &wasted](auto &alloc)
             {
-                if (const auto [s, e] = alloc.range_intersection(base, base + size); s < e)
+                const auto [s, e] = alloc.range_intersection(base, base + size);
+                for (auto piece = s; piece < e; )
                 {
-                    const auto ret = alloc.add_range(s, e - s);
-                    lib::bug_on(ret == e - s);
+                    const auto piece_end = node_piece_end(piece, e);
+                    const auto ret = alloc.add_range(piece, piece_end - piece);
+                    lib::bug_on(ret == piece_end - piece);
                     wasted += ret;
+                    piece = piece_end;
                 }
             };
 
@@ -383,10 +536,52 @@ namespace pmm
         std::size_t bootstrap_memmap_idx = -1;
         boot::limine_memmap_entry bootstrap_memmap;
 
-        std::uintptr_t bootstrap_alloc(std::size_t npages)
+        // memory above this only gets page structs once the scheduler runs,
+        // from one thread per cpu. the bootstrap entry keeps its top part so
+        // that there is something to allocate from until then
+        constexpr std::uintptr_t defer_above = lib::gib(4);
+        constexpr std::size_t defer_chunk = lib::mib(128);
+        constexpr std::size_t bootstrap_keep = lib::mib(256);
+        constexpr std::size_t max_deferred = 64;
+
+        // 2 MiB aligned, so no pfndb page is shared with anything else
+        constexpr std::size_t defer_align = lib::mib(2);
+        static_assert(defer_align / page_size * sizeof(vmm::page) % page_size == 0);
+
+        struct deferred_range
+        {
+            std::size_t idx;
+            std::uintptr_t base;
+            std::uintptr_t end;
+        };
+        constinit std::array<deferred_range, max_deferred> deferred { };
+        constinit std::size_t nr_deferred = 0;
+        constinit std::size_t deferred_chunks = 0;
+
+        constinit std::atomic<std::size_t> deferred_next = 0;
+        constinit std::atomic<std::size_t> deferred_done = 0;
+        constinit std::atomic<std::uint64_t> deferred_start = 0;
+        sched::wait_queue_t deferred_wq;
+
+        // set while a cpu is initialising a chunk, allocations it makes
+        // then must not try to grow into the next one
+        cpu_local(bool, deferring, false);
+
+        constinit std::uint64_t early_cycles = 0;
+
+        // the part of memmap entry idx that is left for later, empty if none
+        std::pair<std::uintptr_t, std::uintptr_t> deferred_part(std::size_t idx)
         {
-            lib::bug_on(npages != 1);
+            for (std::size_t i = 0; i < nr_deferred; i++)
+            {
+                if (deferred[i].idx == idx)
+                    return { deferred[i].base, deferred[i].end };
+            }
+            return { 0, 0 };
+        }
 
+        std::uintptr_t bootstrap_alloc(std::size_t npages)
+        {
             // first called when allocating the pagemap
             [[maybe_unused]]
             static const auto once = [] {
@@ -417,7 +612,10 @@ namespace pmm
                 return true;
             } ();
 
-            if (bootstrap_memmap.length < npages * page_size)
+            // never below the part that is deferred
+            const auto floor = deferred_part(bootstrap_memmap_idx).second;
+            if (bootstrap_memmap.length < npages * page_size ||
+                bootstrap_memmap.base + bootstrap_memmap.length - npages * page_size < floor)
                 lib::panic("pmm: bootstrap allocator is out of memory");
 
             const auto ret = bootstrap_memmap.base + bootstrap_memmap.length - (npages * page_size);
@@ -430,32 +628,50 @@ namespace pmm
             return lib::tohh(ret);
         }
 
-        void pfndb_add(std::size_t idx)
+        std::uintptr_t pfndb_addr(std::uintptr_t paddr)
+        {
+            return reinterpret_cast<std::uintptr_t>(vmm::page_for(paddr));
+        }
+
+        // backs the page structs of [base, end) with zeroed pages, a run of
+        // them per allocation and map call
+        void pfndb_map(std::uintptr_t base, std::uintptr_t end)
         {
-            const auto *memmaps = boot::requests::memmap.response->entries;
-            const auto *memmap = memmaps[idx];
+            constexpr std::size_t max_run = 512;
 
-            const auto pg = reinterpret_cast<std::uintptr_t>(vmm::page_for(memmap->base));
-            const auto vstart = lib::align_down(pg, page_size);
+            if (base >= end)
+                return;
 
-            const auto max_length = lib::align_up(memmap->length / page_size * sizeof(vmm::page), page_size) + page_size;
+            const auto vstart = lib::align_down(pfndb_addr(base), page_size);
+            const auto vend = lib::align_up(pfndb_addr(end), page_size);
 
             const auto psize = vmm::page_size::small;
             const auto flags = vmm::pflag::rwg;
 
-            for (std::size_t vaddr = vstart; vaddr < vstart + max_length; vaddr += page_size)
-            {
-                if (idx == bootstrap_memmap_idx && bootstrap_memmap.length < page_size * 5 /* 5? */)
-                    lib::panic("pmm: could not map pfndb: out of memory");
+            const auto mapped = [&](std::uintptr_t vaddr) {
+                const auto ret = vmm::kernel_pagemap->translate(vaddr, psize);
+                return ret && ret.value() != 0;
+            };
 
-                if (const auto ret = vmm::kernel_pagemap->translate(vaddr, psize); ret && ret.value() != 0)
+            for (std::uintptr_t vaddr = vstart; vaddr < vend; )
+            {
+                if (mapped(vaddr))
+                {
+                    vaddr += page_size;
                     continue;
+                }
 
-                const auto paddr = alloc(1, true);
-                if (const auto ret = vmm::kernel_pagemap->map(vaddr, paddr, page_size, flags, psize); !ret)
+                std::size_t run = 1;
+                while (run < max_run && vaddr + run * page_size < vend && !mapped(vaddr + run * page_size))
+                    run++;
+
+                const auto paddr = alloc(run, true);
+                if (const auto ret = vmm::kernel_pagemap->map(vaddr, paddr, run * page_size, flags, psize); !ret)
                     lib::panic("pmm: could not map pfndb: {}", lib::error_name(ret.error()));
+
+                vaddr += run * page_size;
             }
-        };
+        }
 
         void pfndb_fill_holes()
         {
@@ -473,6 +689,16 @@ namespace pmm
                 if (const auto ret = vmm::kernel_pagemap->translate(vaddr, psize); ret && ret.value() != 0)
                     continue;
 
+                // mapped for real once the range is initialised
+                const bool is_deferred = std::ranges::any_of(
+                    std::span { deferred.data(), nr_deferred },
+                    [vaddr](const deferred_range &range) {
+                        return vaddr >= pfndb_addr(range.base) && vaddr < pfndb_addr(range.end);
+                    }
+                );
+                if (is_deferred)
+                    continue;
+
                 if (const auto ret = vmm::kernel_pagemap->map(vaddr, zero, page_size, flags, psize); !ret)
                     lib::panic("pmm: could not map pfndb hole: {}", lib::error_name(ret.error()));
 
@@ -483,58 +709,683 @@ namespace pmm
         }
     } // namespace
 
-    memory info() { return mem; }
-
-    [[nodiscard]]
-    std::uintptr_t alloc(std::size_t count, bool clear, type tp)
+    namespace
     {
-        if (count == 0)
-            return 0;
-
-        const std::unique_lock _ { lock };
-        const auto size = count * page_size;
+        // tries node and then the others by distance. a non-zero mask
+        // skips the nodes not in it
+        auto first_fit(std::size_t node, numa::nodemask_t mask, auto &&func)
+        {
+            for (const auto nd : numa::fallback(node))
+            {
+                if (mask != 0 && !(mask & (1ul << nd)))
+                    continue;
+                if (const auto ret = func(nd); ret.first != 0)
+                    return ret;
+            }
+            return std::pair<std::uintptr_t, std::size_t> { 0, 0 };
+        }
 
-        std::pair<std::uintptr_t, std::size_t> ret { 0, 0 };
-        if (initialised)
+        // called with lock held
+        std::pair<std::uintptr_t, std::size_t> alloc_locked(std::size_t count, type tp, std::size_t node, numa::nodemask_t mask)
         {
-            switch (tp)
+            const auto size = count * page_size;
+
+            std::pair<std::uintptr_t, std::size_t> ret { 0, 0 };
+            if (initialised)
             {
-                case type::normal:
-                    ret = normal.alloc(count);
-                    if (!ret.first && bootstrap_memmap_idx != static_cast<std::size_t>(-1))
-                        ret = { bootstrap_alloc(count), size };
-                    if (!ret.first)
-                        ret = sub4gib.alloc(count);
+                switch (tp)
+                {
+                    case type::normal:
+                        ret = first_fit(node, mask, [&](std::size_t nd) {
+                            auto ret = normal.alloc(nd, count);
+                            if (!ret.first && bootstrap_memmap_idx != static_cast<std::size_t>(-1))
+                                ret = { bootstrap_alloc(count), size };
+                            if (!ret.first)
+                                ret = sub4gib.alloc(nd, count);
 #if !defined(__x86_64__)
-                    if (!ret.first)
-                        ret = sub1mib.alloc(count);
+                            if (!ret.first)
+                                ret = sub1mib.alloc(nd, count);
 #endif
-                    break;
-                case type::sub4gib:
-                    ret = sub4gib.alloc(count);
-                    break;
-                case type::sub1mib:
-                    ret = sub1mib.alloc(count);
-                    break;
-                default:
-                    lib::panic("pmm: unknown allocation type {}", magic_enum::enum_name(tp));
+                            return ret;
+                        });
+                        break;
+                    case type::sub4gib:
+                        ret = first_fit(node, mask, [&](std::size_t nd) { return sub4gib.alloc(nd, count); });
+                        break;
+                    case type::sub1mib:
+                        ret = first_fit(node, mask, [&](std::size_t nd) { return sub1mib.alloc(nd, count); });
+                        break;
+                    default:
+                        lib::panic("pmm: unknown allocation type {}", magic_enum::enum_name(tp));
+                }
+            }
+            else ret = { bootstrap_alloc(count), size };
+
+            mem.used += ret.second;
+            return ret;
+        }
+
+        // called with lock held
+        void free_locked(std::uintptr_t addr, std::size_t count)
+        {
+            if (sub1mib.in_range(addr))
+                mem.used -= sub1mib.free(addr, count);
+            else if (sub4gib.in_range(addr))
+                mem.used -= sub4gib.free(addr, count);
+            else if (normal.in_range(addr))
+                mem.used -= normal.free(addr, count);
+            else
+                lib::panic("pmm: attempted to free memory outside managed ranges: 0x{:X}", addr);
+        }
+
+        // called with pcp.lock held
+        bool pcp_usable(pcp_t &pcp)
+        {
+            if (pcp.registered) [[likely]]
+                return true;
+
+            // migrated between picking the cache and locking it
+            if (std::addressof(pcpu.unsafe_get()) != std::addressof(pcp))
+                return false;
+
+            pcp.cpu_idx = cpu::self().unsafe_get().idx;
+            pcp.registered = true;
+
+            auto old = pcp_head.load(std::memory_order_relaxed);
+            do {
+                pcp.next = old;
+            } while (!pcp_head.compare_exchange_weak(old, &pcp,
+                std::memory_order_release, std::memory_order_relaxed));
+
+            return true;
+        }
+
+        pcp_t *local_pcp()
+        {
+            if (!initialised)
+                return nullptr;
+
+            if (!cpu::self().unsafe_get().online.load(std::memory_order_relaxed))
+                return nullptr;
+
+            return std::addressof(pcpu.unsafe_get());
+        }
+
+        void pcp_push(pcp_t::list_t &list, std::uintptr_t addr)
+        {
+            const auto blk = reinterpret_cast<pcp_t::block *>(lib::tohh(addr));
+            blk->next = list.head;
+            list.head = blk;
+            list.count++;
+        }
+
+        std::uintptr_t pcp_pop(pcp_t::list_t &list)
+        {
+            const auto blk = list.head;
+            list.head = blk->next;
+            list.count--;
+            return reinterpret_cast<std::uintptr_t>(blk);
+        }
+
+        // the pages below the min watermark are kept for those allowed to use
+        // the reserve. called with lock held
+        bool above_reserve(std::size_t count, bool reserve)
+        {
+            if (reserve)
+                return true;
+            return (mem.usable - mem.used) / page_size >= reclaim::get_watermarks().min + count;
+        }
+
+        // called with pcp.lock held
+        bool pcp_refill(pcp_t &pcp, std::size_t order, bool reserve)
+        {
+            auto &list = pcp.lists[order];
+            const auto npages = 1uz << order;
+            const auto batch = pcp_batch_for(order);
+
+            // only local pages go in the caches, remote ones come from the zones
+            const auto node = numa::local_node();
+
+            std::size_t num = 0;
+            {
+                const std::unique_lock _ { lock };
+                for (; num < batch && above_reserve(npages, reserve); num++)
+                {
+                    const auto [addr, size] = alloc_locked(npages, type::normal, node, 1ul << node);
+                    if (addr == 0)
+                        break;
+                    pcp_push(list, addr);
+                }
+            }
+
+            if (num == 0)
+                return false;
+
+            reclaim::check_watermarks(free_pages());
+
+            list.refills++;
+            pcp_pages.fetch_add(num * npages, std::memory_order_relaxed);
+            return true;
+        }
+
+        // called with the pcp lock held
+        void pcp_drain(pcp_t::list_t &list, std::size_t order, std::size_t num)
+        {
+            const auto npages = 1uz << order;
+
+            num = std::min(num, list.count);
+            if (num == 0)
+                return;
+
+            {
+                const std::unique_lock _ { lock };
+                for (std::size_t i = 0; i < num; i++)
+                    free_locked(lib::fromhh(pcp_pop(list)), npages);
+            }
+
+            list.drains++;
+            pcp_pages.fetch_sub(num * npages, std::memory_order_relaxed);
+        }
+
+        std::uintptr_t pcp_alloc(std::size_t count, bool reserve)
+        {
+            const auto pcp = local_pcp();
+            if (pcp == nullptr)
+                return 0;
+
+            const auto order = pcp_order(count);
+
+            const std::unique_lock _ { pcp->lock };
+            if (!pcp_usable(*pcp))
+                return 0;
+
+            auto &list = pcp->lists[order];
+            if (list.head == nullptr)
+            {
+                list.misses++;
+                if (!pcp_refill(*pcp, order, reserve))
+                    return 0;
+            }
+            else list.hits++;
+
+            pcp_pages.fetch_sub(1uz << order, std::memory_order_relaxed);
+            const auto addr = pcp_pop(list);
+
+            // top up early so the next allocations do not miss
+            if (list.count < pcp_low_for(order))
+                lib::unused(pcp_refill(*pcp, order, reserve));
+            return addr;
+        }
+
+        void wake_zerod()
+        {
+            if (!zerod_started.load(std::memory_order_acquire))
+                return;
+
+            if (!zerod_wanted.exchange(true, std::memory_order_acq_rel))
+                zerod_wq.wake_one();
+        }
+
+        std::uintptr_t pcp_alloc_zeroed()
+        {
+            const auto pcp = local_pcp();
+            if (pcp == nullptr)
+                return 0;
+
+            std::uintptr_t addr = 0;
+            bool refill = true;
+            {
+                const std::unique_lock _ { pcp->lock };
+                if (!pcp_usable(*pcp))
+                    return 0;
+
+                auto &list = pcp->zeroed;
+                if (list.head != nullptr)
+                {
+                    list.hits++;
+                    pcp_pages.fetch_sub(1, std::memory_order_relaxed);
+                    addr = pcp_pop(list);
+                    refill = list.count < zeroed_low;
+                }
+                else list.misses++;
+            }
+
+            vmstat::add(addr != 0 ? vmstat::item::pgzero_hit : vmstat::item::pgzero_miss);
+            if (refill)
+                wake_zerod();
+            return addr;
+        }
+
+        // zeroes pages for pcp until it has zeroed_high or free memory
+        // gets low. the stores bypass the cache, nobody reads these soon
+        void fill_zeroed(pcp_t &pcp)
+        {
+            while (true)
+            {
+                {
+                    const std::unique_lock _ { pcp.lock };
+                    if (pcp.zeroed.count >= zeroed_high)
+                        return;
+                }
+
+                if (free_pages() <= reclaim::get_watermarks().high)
+                    return;
+
+                const auto node = numa::cpu_node(pcp.cpu_idx);
+
+                std::uintptr_t addr = 0;
+                {
+                    const std::unique_lock _ { lock };
+                    addr = alloc_locked(1, type::normal, node, 1ul << node).first;
+                }
+                if (addr == 0)
+                    return;
+
+                arch::clear_nt(reinterpret_cast<void *>(addr), page_size);
+                vmstat::add(vmstat::item::pgzero_fill);
+
+                {
+                    const std::unique_lock _ { pcp.lock };
+                    pcp_push(pcp.zeroed, addr);
+                    pcp.zeroed.refills++;
+                }
+                pcp_pages.fetch_add(1, std::memory_order_relaxed);
+
+                // only ever runs when nothing else wants the cpu
+                lib::unused(sched::yield());
+            }
+        }
+
+        [[noreturn]] void zerod()
+        {
+            while (true)
+            {
+                const auto gen = zerod_wq.snapshot_gen();
+                if (!zerod_wanted.exchange(false, std::memory_order_acq_rel))
+                {
+                    zerod_wq.wait_prepared(gen);
+                    continue;
+                }
+
+                for (auto pcp = pcp_head.load(std::memory_order_acquire); pcp; pcp = pcp->next)
+                    fill_zeroed(*pcp);
+            }
+        }
+
+        bool pcp_free(std::uintptr_t addr, std::size_t count)
+        {
+            // keep low memory in the zones so sub1mib requests can always see it
+            if (sub1mib.in_range(addr))
+                return false;
+
+            // and remote pages, the caches only hand out local ones
+            if (vmm::page_for(addr)->node != numa::local_node())
+                return false;
+
+            const auto pcp = local_pcp();
+            if (pcp == nullptr)
+                return false;
+
+            const auto order = pcp_order(count);
+
+            auto *pg = vmm::page_for(addr);
+            lib::bug_on(
+                pg->buddy.allocated == 0,
+                "pmm::free: not allocated: addr=0x{:X} npages={} order={} pg->order={}",
+                addr, count, order, static_cast<std::size_t>(pg->buddy.order)
+            );
+            lib::bug_on(
+                pg->buddy.order != order,
+                "pmm::free: order mismatch: addr=0x{:X} npages={} expected order={} pg->order={}",
+                addr, count, order, static_cast<std::size_t>(pg->buddy.order)
+            );
+
+            const std::unique_lock _ { pcp->lock };
+            if (!pcp_usable(*pcp))
+                return false;
+
+            auto &list = pcp->lists[order];
+            pcp_push(list, addr);
+            pcp_pages.fetch_add(1uz << order, std::memory_order_relaxed);
+
+            if (list.count > pcp_high_for(order))
+                pcp_drain(list, order, pcp_batch_for(order));
+
+            return true;
+        }
+
+        std::size_t node_at(std::uintptr_t addr)
+        {
+            for (const auto &range : numa::memory_ranges())
+            {
+                if (addr >= range.base && addr < range.end)
+                    return range.node;
+            }
+            return 0;
+        }
+
+        // page structs for [base, end) and then into the buddy allocator.
+        // the pfndb pages behind it come out of the start of the range
+        void init_deferred(std::uintptr_t base, std::uintptr_t end)
+        {
+            const auto vstart = pfndb_addr(base);
+            const auto npages = (pfndb_addr(end) - vstart) / page_size;
+
+            std::memset(reinterpret_cast<void *>(lib::tohh(base)), 0, npages * page_size);
+
+            const auto flags = vmm::pflag::rwg;
+            const auto psize = vmm::page_size::small;
+            if (const auto ret = vmm::kernel_pagemap->map(vstart, base, npages * page_size, flags, psize); !ret)
+                lib::panic("pmm: could not map deferred pfndb: {}", lib::error_name(ret.error()));
+
+            std::size_t node_pages[numa::max_nodes] { };
+            for (auto addr = base; addr < end; )
+            {
+                const auto piece_end = node_piece_end(addr, end);
+                const auto node = node_at(addr);
+
+                node_pages[node] += (piece_end - addr) / page_size;
+                if (node != 0)
+                {
+                    for (; addr < piece_end; addr += page_size)
+                        vmm::page_for(addr)->node = node;
+                }
+                addr = piece_end;
+            }
+
+            const std::unique_lock _ { lock };
+            add_range(base + npages * page_size, end - base - npages * page_size, true);
+            for (std::size_t i = 0; i < numa::max_nodes; i++)
+                node_total[i] += node_pages[i];
+        }
+
+        // initialise the next deferred chunk on this cpu. false once all
+        // of them have been taken
+        bool deferred_step()
+        {
+            const auto idx = deferred_next.fetch_add(1, std::memory_order_relaxed);
+            if (idx >= deferred_chunks)
+                return false;
+
+            auto nth = idx;
+            for (std::size_t i = 0; i < nr_deferred; i++)
+            {
+                const auto &range = deferred[i];
+                const auto chunks = lib::div_roundup(range.end - range.base, defer_chunk);
+                if (nth >= chunks)
+                {
+                    nth -= chunks;
+                    continue;
+                }
+
+                const auto base = range.base + nth * defer_chunk;
+                const auto end = std::min(base + defer_chunk, range.end);
+
+                sched::preempt_disable();
+                deferring.unsafe_get() = true;
+                init_deferred(base, end);
+                deferring.unsafe_get() = false;
+                sched::preempt_enable();
+                break;
+            }
+
+            if (deferred_done.fetch_add(1, std::memory_order_acq_rel) + 1 == deferred_chunks)
+            {
+                std::size_t bytes = 0;
+                for (std::size_t i = 0; i < nr_deferred; i++)
+                    bytes += deferred[i].end - deferred[i].base;
+
+                if (const auto start = deferred_start.load(std::memory_order_acquire); start != 0)
+                {
+                    const auto ns = chrono::now(chrono::monotonic).to_ns() - start;
+                    lib::info(
+                        "pmm: deferred pfndb init of {} MiB took {}.{:03} ms",
+                        bytes / lib::mib(1), ns / 1'000'000, ns / 1'000 % 1'000
+                    );
+                }
+                else lib::info("pmm: deferred pfndb init of {} MiB done on demand", bytes / lib::mib(1));
+
+                deferred_wq.wake_all();
             }
+            return true;
         }
-        else ret = { bootstrap_alloc(count), size };
 
-        if (!ret.first)
+        // an allocation ran dry while some memory has no page structs yet.
+        // take a chunk ourselves, or wait for the ones in flight if we can
+        bool grow_deferred()
         {
+            if (deferred_done.load(std::memory_order_acquire) == deferred_chunks)
+                return false;
+
+            if (deferring.unsafe_get())
+                return false;
+
+            if (deferred_step())
+                return true;
+
+            if (!sched::is_ready() || sched::is_preempt_disabled() || !arch::int_status() || sched::in_hard_irq())
+                return false;
+
+            while (true)
+            {
+                const auto gen = deferred_wq.snapshot_gen();
+                if (deferred_done.load(std::memory_order_acquire) == deferred_chunks)
+                    return true;
+                deferred_wq.wait_unkillable_prepared(gen);
+            }
+        }
+
+        [[noreturn]] void deferred_worker()
+        {
+            while (deferred_step())
+                lib::unused(sched::yield());
+            sched::thread_exit(0);
+        }
+
+        std::uintptr_t buddy_alloc(std::size_t count, type tp, bool may_fail, std::size_t node, numa::nodemask_t mask)
+        {
+            // fragmentation can keep a large block out of reach however
+            // much reclaim frees, so give up after a few rounds
+            constexpr std::size_t max_reclaim_rounds = 8;
+
+            bool drained = false;
+            for (std::size_t round = 0; ; )
+            {
+                // after the oom killer picked us this can change
+                const bool reserve = oom::may_use_reserve();
+
+                std::uintptr_t addr = 0;
+                {
+                    const std::unique_lock _ { lock };
+                    if (above_reserve(count, reserve))
+                        addr = alloc_locked(count, tp, node, mask).first;
+                }
+
+                if (addr != 0)
+                {
+                    reclaim::check_watermarks(free_pages());
+                    return addr;
+                }
+
+                // deferred memory is all in the normal zone
+                if (tp == type::normal && grow_deferred())
+                    continue;
+
+                if (!drained && pcp_pages.load(std::memory_order_relaxed) != 0)
+                {
+                    drain_pcp();
+                    drained = true;
+                    continue;
+                }
+
+                // caches may give some back. drain again whatever they freed
+                if (round++ == max_reclaim_rounds || !reclaim::direct_reclaim(count))
+                {
+                    // then a process, and try again once it has exited
+                    if (!oom::out_of_memory(count))
+                        break;
+                    round = 0;
+                }
+                drained = false;
+            }
+
+            if (may_fail)
+                return 0;
+
             lib::panic(
                 "pmm: could not allocate {} page{}. type: {}",
                 count, count == 1 ? "" : "s", magic_enum::enum_name(tp)
             );
+            std::unreachable();
+        }
+
+        std::uintptr_t do_alloc(std::size_t count, bool clear, type tp, bool may_fail, std::size_t node, numa::nodemask_t mask)
+        {
+            if (count == 0)
+                return 0;
+
+            // the per-cpu caches only hold pages from this cpu's node
+            const bool cacheable = tp == type::normal && node == numa::local_node();
+
+            std::uintptr_t addr = 0;
+            bool zeroed = false;
+            if (clear && cacheable && count == 1)
+                zeroed = (addr = pcp_alloc_zeroed()) != 0;
+
+            if (addr == 0 && cacheable && count <= (1uz << pcp_max_order))
+                addr = pcp_alloc(count, oom::may_use_reserve());
+
+            if (addr == 0)
+                addr = buddy_alloc(count, tp, may_fail, node, mask);
+            if (addr == 0)
+                return 0;
+
+            if (clear && !zeroed)
+                std::memset(reinterpret_cast<void *>(addr), 0, count * page_size);
+
+            return lib::fromhh(addr);
+        }
+    } // namespace
+
+    memory info()
+    {
+        auto ret = mem;
+        ret.used -= pcp_pages.load(std::memory_order_relaxed) * page_size;
+        return ret;
+    }
+
+    [[nodiscard]]
+    std::uintptr_t alloc(std::size_t count, bool clear, type tp)
+    {
+        return do_alloc(count, clear, tp, false, numa::local_node(), 0);
+    }
+
+    [[nodiscard]]
+    std::uintptr_t try_alloc(std::size_t count, bool clear, type tp)
+    {
+        return do_alloc(count, clear, tp, true, numa::local_node(), 0);
+    }
+
+    [[nodiscard]]
+    std::uintptr_t try_alloc_node(std::size_t count, bool clear, std::size_t node, numa::nodemask_t mask)
+    {
+        lib::bug_on(node >= numa::num_nodes());
+        return do_alloc(count, clear, type::normal, true, node, mask);
+    }
+
+    node_memory node_info(std::size_t node)
+    {
+        lib::bug_on(node >= numa::num_nodes());
+
+        if (numa::num_nodes() == 1)
+        {
+            const auto cur = info();
+            return { cur.usable, cur.usable - cur.used };
+        }
+
+        const std::unique_lock _ { lock };
+        const auto free = sub1mib.free_on(node) + sub4gib.free_on(node) + normal.free_on(node);
+        return { node_total[node] * page_size, free * page_size };
+    }
+
+    void assign_nodes()
+    {
+        if (numa::num_nodes() == 1)
+            return;
+
+        // the caches go back as node 0 pages and get moved with the rest
+        drain_pcp();
+
+        const auto *memmaps = boot::requests::memmap.response->entries;
+        const std::size_t num = boot::requests::memmap.response->entry_count;
+
+        const std::unique_lock _ { lock };
+
+        // only entries with page structs, the rest of pfndb is the zero page
+        for (std::size_t i = 0; i < num; i++)
+        {
+            const auto *memmap = memmaps[i];
+            const auto type = static_cast<boot::memmap>(memmap->type);
+            if (type != boot::memmap::usable && type != boot::memmap::bootloader && type != boot::memmap::kernel_and_modules)
+                continue;
+
+            // deferred parts are done when they get their page structs
+            const auto [dbase, dend] = deferred_part(i);
+
+            const auto end = lib::align_down(memmap->base + memmap->length, page_size);
+            for (auto addr = lib::align_up(memmap->base, page_size); addr < end; )
+            {
+                if (addr == dbase && dbase < dend)
+                {
+                    addr = dend;
+                    continue;
+                }
+
+                auto piece_end = node_piece_end(addr, end);
+                if (addr < dbase && dbase < dend)
+                    piece_end = std::min(piece_end, dbase);
+
+                const auto node = node_at(addr);
+                node_total[node] += (piece_end - addr) / page_size;
+                for (; addr < piece_end; addr += page_size)
+                    vmm::page_for(addr)->node = node;
+            }
+        }
+
+        sub1mib.rebucket();
+        sub4gib.rebucket();
+        normal.rebucket();
+
+        for (std::size_t i = 0; i < numa::num_nodes(); i++)
+        {
+            lib::info(
+                "pmm: node {}: {} MiB, {} MiB free", i,
+                node_total[i] * page_size / lib::mib(1),
+                (sub1mib.free_on(i) + sub4gib.free_on(i) + normal.free_on(i)) * page_size / lib::mib(1)
+            );
         }
+    }
 
-        if (clear)
-            std::memset(reinterpret_cast<void *>(ret.first), 0, size);
+    void split(std::uintptr_t addr, std::size_t count)
+    {
+        const auto order = pcp_order(count);
+        const auto npages = 1uz << order;
+
+        const std::unique_lock _ { lock };
+
+        const auto *head = vmm::page_for(addr);
+        lib::bug_on(
+            head->buddy.allocated == 0 || head->buddy.order != order,
+            "pmm::split: bad block: addr=0x{:X} npages={} order={} pg->order={}",
+            addr, count, order, static_cast<std::size_t>(head->buddy.order)
+        );
 
-        mem.used += ret.second;
-        return lib::fromhh(ret.first);
+        for (std::size_t i = 0; i < npages; i++)
+        {
+            auto *pg = vmm::page_for(addr + i * page_size);
+            pg->buddy.order = 0;
+            pg->buddy.allocated = 1;
+        }
     }
 
     void free(std::uintptr_t addr, std::size_t count)
@@ -544,20 +1395,26 @@ namespace pmm
 
         if (initialised)
         {
-            const std::unique_lock _ { lock };
+            if (count <= (1uz << pcp_max_order) && pcp_free(addr, count))
+                return;
 
-            if (sub1mib.in_range(addr))
-                mem.used -= sub1mib.free(addr, count);
-            else if (sub4gib.in_range(addr))
-                mem.used -= sub4gib.free(addr, count);
-            else if (normal.in_range(addr))
-                mem.used -= normal.free(addr, count);
-            else
-                lib::panic("pmm: attempted to free memory outside managed ranges: 0x{:X}", addr);
+            const std::unique_lock _ { lock };
+            free_locked(addr, count);
         }
         else lib::panic("pmm: attempted to free bootstrap memory");
     }
 
+    void drain_pcp()
+    {
+        for (auto pcp = pcp_head.load(std::memory_order_acquire); pcp; pcp = pcp->next)
+        {
+            const std::unique_lock _ { pcp->lock };
+            for (std::size_t order = 0; order <= pcp_max_order; order++)
+                pcp_drain(pcp->lists[order], order, pcp->lists[order].count);
+            pcp_drain(pcp->zeroed, 0, pcp->zeroed.count);
+        }
+    }
+
     void reclaim_bootloader_memory()
     {
         lib::debug("pmm: reclaiming bootloader memory");
@@ -596,9 +1453,32 @@ namespace pmm
             mem.usable_top = std::max(mem.usable_top, end);
         }
 
+        // split off what can wait for the other cpus
+        std::size_t deferred_bytes = 0;
+        for (std::size_t i = 0; i < num && nr_deferred < max_deferred; i++)
+        {
+            const auto *memmap = memmaps[i];
+            if (static_cast<boot::memmap>(memmap->type) != boot::memmap::usable)
+                continue;
+
+            const auto base = lib::align_up(std::max<std::uintptr_t>(memmap->base, defer_above), defer_chunk);
+            auto end = memmap->base + memmap->length;
+            if (i == bootstrap_memmap_idx)
+                end = (end > bootstrap_keep) ? end - bootstrap_keep : 0;
+            end = lib::align_down(end, defer_align);
+
+            if (base >= end)
+                continue;
+
+            deferred[nr_deferred++] = { i, base, end };
+            deferred_chunks += lib::div_roundup(end - base, defer_chunk);
+            deferred_bytes += end - base;
+        }
+
         std::size_t pfndb_used_total = 0;
         {
             lib::info("pmm: setting up pfndb");
+            const auto cycles = arch::cycle_count();
 
             mem.pfndb_base = lib::tohh(lib::align_up(mem.top, lib::gib(1)));
             lib::debug("pmm: pfndb base: 0x{:X}", mem.pfndb_base);
@@ -616,15 +1496,36 @@ namespace pmm
                 if (type != boot::memmap::usable && type != boot::memmap::bootloader && type != boot::memmap::kernel_and_modules)
                     continue;
 
-                pfndb_add(i);
+                const auto end = memmap->base + memmap->length;
+                if (const auto [dbase, dend] = deferred_part(i); dbase < dend)
+                {
+                    pfndb_map(memmap->base, dbase);
+                    pfndb_map(dend, end);
+                }
+                else pfndb_map(memmap->base, end);
             }
 
             pfndb_fill_holes();
+            early_cycles = arch::cycle_count() - cycles;
 
             pfndb_used_total = mem.used - start;
             lib::debug("pmm: pfndb size: {} KiB", pfndb_used_total / lib::kib(1));
+            if (deferred_bytes != 0)
+                lib::info("pmm: deferring page structs for {} MiB", deferred_bytes / lib::mib(1));
         }
 
+        // deferred memory counts as used until it is initialised
+        const auto add_early = [](std::size_t idx, std::uintptr_t base, std::uintptr_t end) {
+            const auto [dbase, dend] = deferred_part(idx);
+            if (dbase >= dend)
+                return add_range(base, end - base, false);
+
+            add_range(base, dbase - base, false);
+            mem.usable += dend - dbase;
+            mem.used += dend - dbase;
+            add_range(dend, end - dend, false);
+        };
+
         lib::info("pmm: initialising the physical memory allocator");
 
         for (std::size_t i = 0; i < num; i++)
@@ -645,18 +1546,58 @@ namespace pmm
                 continue;
             }
 
-            add_range(memmap->base, memmap->length, false);
+            add_early(i, memmap->base, memmap->base + memmap->length);
         }
 
         initialised = true;
 
         lib::debug("pmm: adding bootstrap memory to allocator");
         *memmaps[bootstrap_memmap_idx] = bootstrap_memmap;
-        add_range(bootstrap_memmap.base, bootstrap_memmap.length, false);
+        add_early(bootstrap_memmap_idx, bootstrap_memmap.base, bootstrap_memmap.base + bootstrap_memmap.length);
 
         bootstrap_memmap_idx = -1;
     }
 
+    lib::initgraph::task deferred_task
+    {
+        "pmm.deferred-init",
+        lib::initgraph::postsched_init_engine,
+        [] {
+            // early cycles to time, against the clock that runs now
+            const auto c0 = arch::cycle_count();
+            const auto t0 = chrono::now(chrono::monotonic).to_ns();
+            lib::unused(chrono::stall_ns(1'000'000));
+            const auto cycles = arch::cycle_count() - c0;
+            const auto ns = chrono::now(chrono::monotonic).to_ns() - t0;
+
+            if (cycles != 0)
+            {
+                const auto early_us = early_cycles * ns / cycles / 1'000;
+                lib::info("pmm: early pfndb init took {}.{:03} ms", early_us / 1'000, early_us % 1'000);
+            }
+
+            if (deferred_chunks == 0)
+                return;
+
+            deferred_start.store(chrono::now(chrono::monotonic).to_ns(), std::memory_order_release);
+
+            const auto nthreads = std::min(cpu::count(), deferred_chunks);
+            for (std::size_t i = 0; i < nthreads; i++)
+                sched::spawn(deferred_worker);
+        }
+    };
+
+    lib::initgraph::task zerod_task
+    {
+        "pmm.zerod.create-thread",
+        lib::initgraph::postsched_init_engine,
+        [] {
+            sched::spawn(zerod, 0, 19);
+            zerod_started.store(true, std::memory_order_release);
+            wake_zerod();
+        }
+    };
+
     lib::initgraph::task procfs_register_task
     {
         "pmm.procfs.register",
@@ -666,7 +1607,7 @@ namespace pmm
             using namespace ::fs::procfs;
             lib::bug_on(!register_global("meminfo",
                 make_file_ops([](auto) {
-                    // TODO: Active/Inactive/Slab/AnonPages/Mapped/correct MemAvailable
+                    // TODO: Slab/AnonPages/Mapped
                     const auto mem = info();
                     const auto kb = [](std::size_t bytes) { return bytes / 1024; };
 
@@ -676,24 +1617,77 @@ namespace pmm
                     const auto cached_bytes = (shmem_pages + file_pages) * pmm::page_size;
                     const auto free_bytes = mem.usable - mem.used;
 
+                    // shmem has nowhere to go, only file pages can be reclaimed
+                    const auto active_bytes = vmm::lru_pages(true) * pmm::page_size;
+                    const auto inactive_bytes = vmm::lru_pages(false) * pmm::page_size;
+
+                    // Zswapped / Zswap is the compression ratio
+                    const auto swap = zram::get_stats();
+                    const auto swapped_bytes = swap.stored_pages * pmm::page_size;
+                    const auto swap_free = swap.disksize > swapped_bytes ? swap.disksize - swapped_bytes : 0;
+
                     return fmt::format(
                         "MemTotal:       {} kB\n"
                         "MemFree:        {} kB\n"
                         "MemAvailable:   {} kB\n"
                         "Buffers:        {} kB\n"
                         "Cached:         {} kB\n"
+                        "Active(file):   {} kB\n"
+                        "Inactive(file): {} kB\n"
                         "Shmem:          {} kB\n"
                         "SwapTotal:      {} kB\n"
-                        "SwapFree:       {} kB\n",
+                        "SwapFree:       {} kB\n"
+                        "Zswap:          {} kB\n"
+                        "Zswapped:       {} kB\n",
                         kb(mem.usable),
                         kb(free_bytes),
-                        kb(free_bytes + cached_bytes),
+                        kb(free_bytes + active_bytes + inactive_bytes),
                         0uz,
                         kb(cached_bytes),
+                        kb(active_bytes),
+                        kb(inactive_bytes),
                         kb(shmem_bytes),
-                        0uz,
-                        0uz
+                        kb(swap.disksize),
+                        kb(swap_free),
+                        kb(swap.pool_pages * pmm::page_size),
+                        kb(swapped_bytes)
+                    );
+                }), node_type::file, 0444
+            ));
+
+            lib::bug_on(!register_global("pcpinfo",
+                make_file_ops([](auto) {
+                    std::string out = fmt::format(
+                        "{:>4} {:>5} {:>6} {:>5} {:>5} {:>5} {:>12} {:>10} {:>10} {:>10}\n",
+                        "cpu", "order", "count", "low", "high", "batch",
+                        "hits", "misses", "refills", "drains"
                     );
+
+                    auto it = std::back_inserter(out);
+                    for (auto pcp = pcp_head.load(std::memory_order_acquire); pcp; pcp = pcp->next)
+                    {
+                        const std::unique_lock _ { pcp->lock };
+                        for (std::size_t order = 0; order <= pcp_max_order; order++)
+                        {
+                            const auto &list = pcp->lists[order];
+                            fmt::format_to(it,
+                                "{:>4} {:>5} {:>6} {:>5} {:>5} {:>5} {:>12} {:>10} {:>10} {:>10}\n",
+                                pcp->cpu_idx, order, list.count, pcp_low_for(order),
+                                pcp_high_for(order), pcp_batch_for(order),
+                                list.hits, list.misses, list.refills, list.drains
+                            );
+                        }
+
+                        // no batch, zerod tops it up a page at a time. hits are
+                        // clear allocations served, refills pages zeroed
+                        const auto &list = pcp->zeroed;
+                        fmt::format_to(it,
+                            "{:>4} {:>5} {:>6} {:>5} {:>5} {:>5} {:>12} {:>10} {:>10} {:>10}\n",
+                            pcp->cpu_idx, "zero", list.count, zeroed_low, zeroed_high, "-",
+                            list.hits, list.misses, list.refills, list.drains
+                        );
+                    }
+                    return out;
                 }), node_type::file, 0444
             ));
         }
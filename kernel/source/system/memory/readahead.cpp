@@ -0,0 +1,167 @@
+// Copyright (C) 2024-2026  ilobilo
+
+module system.memory.virt;
+
+import system.sysctl;
+import system.sched;
+import lib;
+
+namespace vmm
+{
+    namespace
+    {
+        constexpr std::size_t max_readahead_default = 512;
+        constinit std::atomic<std::size_t> max_readahead_kb = max_readahead_default;
+
+        // round the first read up and start at four times that while the
+        // window is small, like linux
+        std::size_t init_size(std::size_t count, std::size_t max)
+        {
+            auto size = std::bit_ceil(std::max<std::size_t>(count, 1));
+            if (size <= max / 32)
+                size *= 4;
+            else if (size <= max / 4)
+                size *= 2;
+            return std::min(size, max);
+        }
+
+        std::size_t next_size(std::size_t cur, std::size_t max)
+        {
+            if (cur < max / 16)
+                return std::min(cur * 4, max);
+            return std::min(cur * 2, max);
+        }
+
+        // marker is the page that gets the readahead flag, ~0 for none
+        void read_window(object &obj, std::uint64_t start, std::size_t size, std::uint64_t marker)
+        {
+            const auto num_alloc_pages = default_npsize() / pmm::page_size;
+
+            for (std::size_t i = 0; i < size; i += object::max_readahead)
+            {
+                page *chunk[object::max_readahead] { };
+                std::span<page *> pages { chunk, std::min(object::max_readahead, size - i) };
+
+                const auto ret = obj.read_pages(start + i, pages, 0);
+                for (std::size_t j = 0; j < pages.size(); j++)
+                {
+                    auto *pg = pages[j];
+                    if (!pg)
+                        continue;
+
+                    if (start + i + j == marker)
+                        pg->flags.fetch_or(page::flag::readahead, std::memory_order_relaxed);
+                    if (pg->unref())
+                        pmm::free(paddr_from(pg), num_alloc_pages);
+                }
+
+                if (!ret.has_value())
+                    break;
+            }
+        }
+
+        void read_window_async(const object::ptr &obj, std::uint64_t start, std::size_t size, std::uint64_t marker)
+        {
+            sched::schedule_work([obj, start, size, marker] {
+                read_window(*obj, start, size, marker);
+            });
+        }
+
+        lib::initgraph::task readahead_sysctl_task
+        {
+            "vmm.readahead.sysctl.register",
+            lib::initgraph::postsched_init_engine,
+            [] {
+                lib::bug_on(!sysctl::register_int("vm/max_readahead_kb",
+                    [] { return static_cast<int>(max_readahead_kb.load(std::memory_order_relaxed)); },
+                    [](int val) -> lib::expect<void> {
+                        // 0 turns readahead off, up to 16 MiB otherwise
+                        if (val < 0 || val > 16384)
+                            return std::unexpected { lib::err::invalid_argument };
+                        max_readahead_kb.store(static_cast<std::size_t>(val), std::memory_order_relaxed);
+                        return { };
+                    }
+                ));
+            }
+        };
+    } // namespace
+
+    std::size_t readahead_pages()
+    {
+        return max_readahead_kb.load(std::memory_order_relaxed) * 1024 / default_npsize();
+    }
+
+    void readahead(const object::ptr &obj, ra_state_t &ra, std::uint64_t idx, std::size_t count, std::uint64_t eof)
+    {
+        if (count == 0 || idx >= eof)
+            return;
+        count = std::min<std::size_t>(count, eof - idx);
+
+        const auto [missing, marker] = obj->probe(idx, count);
+        if (!missing && !marker)
+        {
+            ra.lock()->prev = idx + count - 1;
+            return;
+        }
+
+        const auto max = readahead_pages();
+
+        // the pages asked for are read by the caller, this only starts
+        // reading what lies ahead of them
+        std::uint64_t start = 0;
+        std::size_t size = 0;
+        {
+            auto locked = ra.lock();
+            const auto prev = std::exchange(locked->prev, idx + count - 1);
+
+            if (locked->mode == ra_state::hint::random || max == 0)
+            {
+                locked->size = locked->async_size = 0;
+                return;
+            }
+
+            const bool sequential =
+                locked->mode == ra_state::hint::sequential ||
+                idx == 0 || idx == prev || idx == prev + 1;
+
+            if (marker && locked->size != 0)
+            {
+                // the reader caught up with the async part. the next
+                // window follows this one and all of it is read ahead
+                locked->start += locked->size;
+                locked->size = next_size(locked->size, max);
+                locked->async_size = locked->size;
+            }
+            else if (sequential)
+            {
+                // a miss in a stream, or its first read
+                const auto base = locked->size != 0 && idx == locked->start + locked->size
+                    ? next_size(locked->size, max) : init_size(count, max);
+                locked->start = idx;
+                locked->size = std::max(base, count);
+                locked->async_size = locked->size - count;
+            }
+            else
+            {
+                // random access reads only what it needs
+                locked->size = locked->async_size = 0;
+                return;
+            }
+
+            start = locked->start + locked->size - locked->async_size;
+            size = locked->async_size;
+        }
+
+        if (start >= eof || size == 0)
+            return;
+
+        // the first page read ahead is the marker for the next window
+        read_window_async(obj, start, std::min<std::size_t>(size, eof - start), start);
+    }
+
+    void force_readahead(const object::ptr &obj, std::uint64_t idx, std::size_t count, bool mark)
+    {
+        if (count != 0)
+            read_window_async(obj, idx, count, mark ? idx : ~0ul);
+    }
+} // namespace vmm
@@ -0,0 +1,250 @@
+// Copyright (C) 2024-2026  ilobilo
+
+module system.memory.reclaim;
+
+import system.memory.vmstat;
+import system.memory.phys;
+import system.sysctl;
+import system.sched;
+import arch;
+import lib;
+
+namespace reclaim
+{
+    namespace
+    {
+        // scan everything at priority 0, 1/4096th of each cache at the start
+        constexpr std::size_t max_priority = 12;
+        constexpr std::size_t scan_batch = 128;
+
+        // allocations retry this many times after making progress
+        constexpr std::size_t max_direct_passes = 4;
+
+        lib::locker<std::vector<shrinker *>, sched::mutex_t> shrinkers;
+        sched::wait_queue_t unregister_wq;
+
+        constinit std::atomic<std::size_t> min_free_kbytes = 0;
+        constinit std::atomic<std::size_t> wmark_min = 0;
+        constinit std::atomic<std::size_t> wmark_low = 0;
+        constinit std::atomic<std::size_t> wmark_high = 0;
+
+        sched::wait_queue_t kswapd_wq;
+        constinit std::atomic_bool kswapd_started = false;
+        constinit std::atomic_bool kswapd_wanted = false;
+
+        std::size_t free_pages()
+        {
+            const auto mem = pmm::info();
+            return (mem.usable - mem.used) / pmm::page_size;
+        }
+
+        void set_min_free(std::size_t kbytes)
+        {
+            const auto min = kbytes / (pmm::page_size / 1024);
+            min_free_kbytes.store(kbytes, std::memory_order_relaxed);
+            wmark_min.store(min, std::memory_order_relaxed);
+            wmark_low.store(min + min / 4, std::memory_order_relaxed);
+            wmark_high.store(min + min / 2, std::memory_order_relaxed);
+        }
+
+        std::size_t isqrt(std::size_t val)
+        {
+            std::size_t lo = 0, hi = 1uz << 32;
+            while (lo + 1 < hi)
+            {
+                const auto mid = (lo + hi) / 2;
+                if (mid * mid <= val)
+                    lo = mid;
+                else
+                    hi = mid;
+            }
+            return lo;
+        }
+
+        // sleeping on a lock is only fine with nothing held that disables
+        // preemption, and never from interrupt context
+        bool can_reclaim()
+        {
+            if (!sched::is_ready() || sched::is_preempt_disabled())
+                return false;
+            if (!arch::int_status() || sched::in_hard_irq())
+                return false;
+            return !sched::current_thread()->in_reclaim;
+        }
+
+        // one pass over every shrinker, each scanned in proportion to its size.
+        // the list lock is only held to pick the next one, scans can block
+        // for long and direct reclaim must not find it taken meanwhile
+        std::size_t shrink_all(std::size_t priority, bool may_block)
+        {
+            auto *thread = sched::current_thread();
+            const bool was_reclaiming = std::exchange(thread->in_reclaim, true);
+
+            std::size_t freed = 0;
+            for (std::size_t i = 0; ; i++)
+            {
+                shrinker *shr;
+                {
+                    auto locked = may_block ? shrinkers.lock() : shrinkers.try_lock();
+                    if (!locked.owns_lock() || i >= locked->size())
+                        break;
+
+                    shr = (*locked)[i];
+                    shr->active.fetch_add(1, std::memory_order_acquire);
+                }
+
+                if (const auto count = shr->count(); count != 0)
+                {
+                    const auto nr = std::max(count >> priority, std::min(count, scan_batch));
+                    freed += shr->scan(nr, may_block);
+                }
+
+                if (shr->active.fetch_sub(1, std::memory_order_release) == 1)
+                    unregister_wq.wake_all();
+            }
+
+            thread->in_reclaim = was_reclaiming;
+            return freed;
+        }
+
+        [[noreturn]] void kswapd()
+        {
+            while (true)
+            {
+                const auto gen = kswapd_wq.snapshot_gen();
+                if (!kswapd_wanted.exchange(false, std::memory_order_acq_rel))
+                {
+                    kswapd_wq.wait_prepared(gen);
+                    continue;
+                }
+
+                vmstat::add(vmstat::item::pageoutrun);
+
+                // keep going until the high watermark so that allocations
+                // do not wake us again right away
+                const auto high = wmark_high.load(std::memory_order_relaxed);
+                for (std::size_t prio = max_priority; free_pages() < high; prio--)
+                {
+                    lib::unused(shrink_all(prio, true));
+                    if (prio == 0)
+                        break;
+                }
+            }
+        }
+    } // namespace
+
+    void register_shrinker(shrinker *shr)
+    {
+        lib::bug_on(!shr);
+        shrinkers.lock()->push_back(shr);
+    }
+
+    void unregister_shrinker(shrinker *shr)
+    {
+        std::erase(*shrinkers.lock(), shr);
+
+        while (true)
+        {
+            const auto gen = unregister_wq.snapshot_gen();
+            if (shr->active.load(std::memory_order_acquire) == 0)
+                break;
+            unregister_wq.wait_prepared(gen);
+        }
+    }
+
+    watermarks get_watermarks()
+    {
+        return {
+            .min = wmark_min.load(std::memory_order_relaxed),
+            .low = wmark_low.load(std::memory_order_relaxed),
+            .high = wmark_high.load(std::memory_order_relaxed)
+        };
+    }
+
+    void check_watermarks(std::size_t nr_free)
+    {
+        if (nr_free >= wmark_low.load(std::memory_order_relaxed))
+            return;
+
+        if (!kswapd_started.load(std::memory_order_acquire))
+            return;
+
+        if (!kswapd_wanted.exchange(true, std::memory_order_acq_rel))
+            kswapd_wq.wake_one();
+    }
+
+    bool direct_reclaim(std::size_t nr_pages)
+    {
+        if (!can_reclaim())
+            return false;
+
+        vmstat::add(vmstat::item::allocstall);
+        check_watermarks(0);
+
+        const auto target = free_pages() + nr_pages;
+        for (std::size_t pass = 0; pass < max_direct_passes; pass++)
+        {
+            for (std::size_t prio = max_priority; ; prio--)
+            {
+                lib::unused(shrink_all(prio, false));
+                if (free_pages() >= target)
+                    return true;
+                if (prio == 0)
+                    break;
+            }
+
+            // someone else holds what we need. give kswapd a chance
+            sched::yield();
+            if (free_pages() >= target)
+                return true;
+        }
+        return false;
+    }
+
+    lib::initgraph::task kswapd_task
+    {
+        "reclaim.kswapd.create-thread",
+        lib::initgraph::postsched_init_engine,
+        [] {
+            // sqrt(lowmem * 16) like linux, between 128 KiB and 64 MiB
+            const auto kbytes = pmm::info().usable / 1024;
+            set_min_free(std::clamp<std::size_t>(isqrt(kbytes * 16), 128, 65536));
+
+            sched::spawn(kswapd);
+            kswapd_started.store(true, std::memory_order_release);
+
+            lib::bug_on(!sysctl::register_int("vm/min_free_kbytes",
+                [] { return static_cast<int>(min_free_kbytes.load(std::memory_order_relaxed)); },
+                [](int val) -> lib::expect<void> {
+                    if (val < 0)
+                        return std::unexpected { lib::err::invalid_argument };
+                    set_min_free(static_cast<std::size_t>(val));
+                    return { };
+                }
+            ));
+
+            // 1 drops the page cache, 2 everything else, 3 both. all of
+            // them go through the shrinkers, so only clean unused pages go
+            lib::bug_on(!sysctl::register_int("vm/drop_caches",
+                [] { return 0; },
+                [](int val) -> lib::expect<void> {
+                    if (val < 1 || val > 3)
+                        return std::unexpected { lib::err::invalid_argument };
+
+                    const auto locked = shrinkers.lock();
+                    for (auto *shr : *locked)
+                    {
+                        // swapping out is not dropping a cache
+                        if (shr->name == "anon")
+                            continue;
+
+                        const bool is_pcache = shr->name == "page_cache";
+                        if ((is_pcache && (val & 1)) || (!is_pcache && (val & 2)))
+                            lib::unused(shr->scan(shr->count(), true));
+                    }
+                    return { };
+                }, 0200
+            ));
+        }
+    };
+} // namespace reclaim
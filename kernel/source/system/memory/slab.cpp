@@ -2,18 +2,59 @@
 
 module system.memory.slab;
 
+import drivers.fs.procfs;
+import system.memory.reclaim;
 import system.memory.phys;
 import system.memory.virt;
+import system.cpu.local;
+import system.cpu;
 import frigg;
 import lib;
+import fmt;
 
 namespace slab
 {
     struct policy
     {
+        // physically contiguous blocks are used through the hhdm, which is
+        // mapped with large pages. only fall back to mapping single pages
+        // when memory is too fragmented for that
+        static std::uintptr_t map_direct(std::size_t length, std::size_t alignment)
+        {
+            const auto pages = lib::div_roundup(length, pmm::page_size);
+            if (pages > (1uz << pmm::max_order))
+                return 0;
+
+            const auto paddr = pmm::try_alloc(pages, true);
+            if (paddr == 0)
+                return 0;
+
+            const auto vaddr = lib::tohh(paddr);
+            if (alignment != 0 && vaddr % alignment != 0)
+            {
+                pmm::free(paddr, pages);
+                return 0;
+            }
+
+            // these are hhdm addresses too. keep owned() from taking them for
+            // objects of a cache
+            for (std::size_t i = 0; i < pages; i++)
+                vmm::page_for(paddr + i * pmm::page_size)->slab_ptr = nullptr;
+
+            return vaddr;
+        }
+
+        static bool is_direct(std::uintptr_t addr)
+        {
+            return addr < pmm::info().pfndb_base;
+        }
+
         // TODO: some issues on a certain laptop
         static std::uintptr_t map(std::size_t length, std::size_t alignment)
         {
+            if (const auto vaddr = map_direct(length, alignment))
+                return vaddr;
+
             const auto psize = vmm::page_size::small;
             const auto npsize = vmm::pagemap::from_page_size(psize);
 
@@ -43,6 +84,12 @@ namespace slab
 
         static void unmap(std::uintptr_t addr, std::size_t length)
         {
+            if (is_direct(addr))
+            {
+                pmm::free(lib::fromhh(addr), lib::div_roundup(length, pmm::page_size));
+                return;
+            }
+
             const auto psize = vmm::page_size::small;
             const auto npsize = vmm::pagemap::from_page_size(psize);
 
@@ -80,19 +127,614 @@ namespace slab
     constinit frg::manual_box<frg::slab_pool<policy, lib::spinlock_irq>> pool;
     constinit frg::manual_box<frg::slab_allocator<policy, lib::spinlock_irq>> kalloc;
 
+    namespace
+    {
+        // small generic allocations are carved out of hhdm slabs so that the
+        // owning cache can be found through the pfndb. larger sizes go to frigg
+        constexpr std::array class_sizes {
+            16uz, 32uz, 48uz, 64uz, 96uz, 128uz, 192uz, 256uz, 384uz, 512uz
+        };
+        constexpr std::size_t num_classes = class_sizes.size();
+        constexpr std::size_t max_class_size = class_sizes.back();
+
+        constexpr std::size_t slab_max_order = 3;
+        constexpr std::size_t slab_min_objs = 8;
+
+        constexpr std::size_t mag_size = 30;
+        // full magazines kept in the depot before frees go back to the slabs
+        constexpr std::size_t depot_max_full = 8;
+
+        // caches beyond this many run without per-cpu magazines
+        constexpr std::size_t max_percpu_slots = 64;
+        constexpr std::size_t no_slot = -1uz;
+
+        struct magazine_t
+        {
+            magazine_t *next;
+            std::size_t rounds;
+            void *objs[mag_size];
+
+            bool empty() const { return rounds == 0; }
+            bool full() const { return rounds == mag_size; }
+
+            void push(void *obj) { objs[rounds++] = obj; }
+            void *pop() { return objs[--rounds]; }
+        };
+
+        // lives at the start of each slab
+        struct slab_t
+        {
+            lib::intrusive_list_hook<slab_t> hook;
+            cache *owner;
+            void *freelist;
+            std::uint32_t inuse;
+            std::uint32_t total;
+        };
+
+        struct cpu_cache_t
+        {
+            magazine_t *loaded;
+            magazine_t *previous;
+        };
+
+        struct cpu_caches_t
+        {
+            cpu_cache_t slots[max_percpu_slots];
+        };
+
+        cpu_local(cpu_caches_t, pcache);
+
+        constinit std::uintptr_t hhdm_end = 0;
+        constinit std::atomic_size_t next_slot = 0;
+
+        bool percpu_ready()
+        {
+            return cpu::self().unsafe_get().online.load(std::memory_order_relaxed);
+        }
+
+        magazine_t *new_magazine()
+        {
+            const auto mag = static_cast<magazine_t *>(kalloc->allocate(sizeof(magazine_t)));
+            if (mag != nullptr)
+            {
+                mag->next = nullptr;
+                mag->rounds = 0;
+            }
+            return mag;
+        }
+
+        struct depot_t
+        {
+            magazine_t *head = nullptr;
+            std::size_t count = 0;
+
+            void push(magazine_t *mag)
+            {
+                mag->next = head;
+                head = mag;
+                count++;
+            }
+
+            magazine_t *pop()
+            {
+                const auto mag = head;
+                if (mag != nullptr)
+                {
+                    head = mag->next;
+                    count--;
+                }
+                return mag;
+            }
+        };
+    } // namespace
+
+    struct cache
+    {
+        private:
+        lib::spinlock_irq _lock;
+
+        std::string_view _name;
+        std::size_t _size;
+        std::size_t _align;
+
+        // freelist link lives past the object when it must keep constructed state
+        std::size_t _link_off;
+        std::size_t _stride;
+
+        std::size_t _order;
+        std::size_t _start;
+        std::size_t _objs_per_slab;
+
+        void (*_ctor)(void *);
+        void (*_dtor)(void *);
+
+        std::size_t _slot;
+
+        depot_t _full;
+        depot_t _empty;
+        std::size_t _depot_objs = 0;
+
+        lib::intrusive_list<slab_t, &slab_t::hook> _partial;
+        slab_t *_spare = nullptr;
+
+        std::size_t _slabs = 0;
+        std::size_t _inuse = 0;
+
+        static slab_t *slab_of(const void *obj)
+        {
+            return static_cast<slab_t *>(vmm::page_for(obj)->slab_ptr);
+        }
+
+        void *&link(void *obj) const
+        {
+            return *reinterpret_cast<void **>(reinterpret_cast<std::uintptr_t>(obj) + _link_off);
+        }
+
+        std::size_t slab_bytes() const { return pmm::page_size << _order; }
+
+        // called with _lock held
+        slab_t *grow()
+        {
+            if (const auto slab = std::exchange(_spare, nullptr))
+                return slab;
+
+            const auto npages = 1uz << _order;
+            const auto paddr = pmm::alloc(npages, false);
+            const auto base = lib::tohh(paddr);
+
+            const auto slab = new (reinterpret_cast<void *>(base)) slab_t { };
+            slab->owner = this;
+
+            for (std::size_t i = 0; i < npages; i++)
+                vmm::page_for(paddr + i * pmm::page_size)->slab_ptr = slab;
+
+            void *prev = nullptr;
+            for (std::size_t i = _objs_per_slab; i > 0; i--)
+            {
+                const auto obj = reinterpret_cast<void *>(base + _start + (i - 1) * _stride);
+                if (_ctor != nullptr)
+                    _ctor(obj);
+                link(obj) = prev;
+                prev = obj;
+            }
+            slab->freelist = prev;
+            slab->total = _objs_per_slab;
+
+            _slabs++;
+            return slab;
+        }
+
+        // called with _lock held
+        void release(slab_t *slab)
+        {
+            const auto base = reinterpret_cast<std::uintptr_t>(slab);
+            if (_dtor != nullptr)
+            {
+                for (std::size_t i = 0; i < _objs_per_slab; i++)
+                    _dtor(reinterpret_cast<void *>(base + _start + i * _stride));
+            }
+
+            const auto paddr = lib::fromhh(base);
+            const auto npages = 1uz << _order;
+            for (std::size_t i = 0; i < npages; i++)
+                vmm::page_for(paddr + i * pmm::page_size)->slab_ptr = nullptr;
+
+            _slabs--;
+            pmm::free(paddr, npages);
+        }
+
+        // called with _lock held
+        void *get_locked()
+        {
+            auto slab = _partial.front();
+            if (slab == nullptr)
+            {
+                slab = grow();
+                _partial.push_back(slab);
+            }
+
+            const auto obj = slab->freelist;
+            slab->freelist = link(obj);
+            if (++slab->inuse == slab->total)
+                _partial.remove(slab);
+
+            _inuse++;
+            return obj;
+        }
+
+        // called with _lock held
+        void put_locked(void *obj)
+        {
+            const auto slab = slab_of(obj);
+            lib::bug_on(slab == nullptr || slab->owner != this,
+                "slab: {} freed to the wrong cache '{}'", obj, _name);
+            lib::bug_on(slab->inuse == 0, "slab: double free of {} in '{}'", obj, _name);
+
+            if (slab->inuse-- == slab->total)
+                _partial.push_front(slab);
+
+            link(obj) = slab->freelist;
+            slab->freelist = obj;
+            _inuse--;
+
+            if (slab->inuse != 0)
+                return;
+
+            _partial.remove(slab);
+            if (_spare == nullptr)
+                _spare = slab;
+            else
+                release(slab);
+        }
+
+        // called with _lock held
+        void flush_locked(magazine_t *mag)
+        {
+            while (!mag->empty())
+                put_locked(mag->pop());
+        }
+
+        // called with _lock held
+        void push_full(magazine_t *mag)
+        {
+            if (_full.count >= depot_max_full)
+            {
+                flush_locked(mag);
+                _empty.push(mag);
+                return;
+            }
+            _depot_objs += mag->rounds;
+            _full.push(mag);
+        }
+
+        // interrupts disabled
+        void *alloc_local(cpu_cache_t &cc)
+        {
+            if (cc.loaded && !cc.loaded->empty())
+                return cc.loaded->pop();
+
+            if (cc.previous && !cc.previous->empty())
+            {
+                std::swap(cc.loaded, cc.previous);
+                return cc.loaded->pop();
+            }
+
+            const std::unique_lock _ { _lock };
+            if (const auto full = _full.pop())
+            {
+                _depot_objs -= full->rounds;
+                if (cc.previous)
+                    _empty.push(cc.previous);
+                cc.previous = cc.loaded;
+                cc.loaded = full;
+                return cc.loaded->pop();
+            }
+
+            // depot is dry, refill half a magazine straight from the slabs
+            if (cc.loaded == nullptr)
+                return get_locked();
+
+            for (std::size_t i = 0; i < mag_size / 2; i++)
+                cc.loaded->push(get_locked());
+            return cc.loaded->pop();
+        }
+
+        // interrupts disabled
+        bool free_local(cpu_cache_t &cc, void *obj)
+        {
+            if (cc.loaded && !cc.loaded->full())
+            {
+                cc.loaded->push(obj);
+                return true;
+            }
+
+            if (cc.previous && !cc.previous->full())
+            {
+                std::swap(cc.loaded, cc.previous);
+                cc.loaded->push(obj);
+                return true;
+            }
+
+            const std::unique_lock _ { _lock };
+            const auto empty = _empty.pop();
+            if (empty == nullptr)
+                return false;
+
+            if (cc.previous)
+                push_full(cc.previous);
+            cc.previous = cc.loaded;
+            cc.loaded = empty;
+            cc.loaded->push(obj);
+            return true;
+        }
+
+        public:
+        cache *next = nullptr;
+
+        cache(std::string_view name, std::size_t size, std::size_t align,
+            void (*ctor)(void *), void (*dtor)(void *), bool percpu)
+            : _name { name }, _ctor { ctor }, _dtor { dtor }, _slot { no_slot }
+        {
+            _size = std::max(size, sizeof(void *));
+            _align = std::max(align, alignof(void *));
+            lib::bug_on(!std::has_single_bit(_align));
+
+            _link_off = (ctor || dtor) ? lib::align_up(_size, alignof(void *)) : 0;
+            _stride = lib::align_up(std::max(_size, _link_off + sizeof(void *) * (_link_off != 0)), _align);
+            _start = lib::align_up(sizeof(slab_t), _align);
+
+            for (_order = 0; _order < slab_max_order; _order++)
+            {
+                const auto bytes = slab_bytes();
+                if (bytes < _start + _stride)
+                    continue;
+
+                const auto num = (bytes - _start) / _stride;
+                const auto waste = bytes - num * _stride;
+                if (num >= slab_min_objs && waste * 8 <= bytes)
+                    break;
+            }
+
+            lib::bug_on(slab_bytes() < _start + _stride,
+                "slab: object size {} too large for cache '{}'", size, name);
+            _objs_per_slab = (slab_bytes() - _start) / _stride;
+
+            if (percpu)
+            {
+                const auto slot = next_slot.fetch_add(1, std::memory_order_relaxed);
+                if (slot < max_percpu_slots)
+                    _slot = slot;
+            }
+        }
+
+        std::string_view name() const { return _name; }
+        std::size_t size() const { return _size; }
+
+        void *alloc()
+        {
+            if (_slot != no_slot && percpu_ready())
+            {
+                lib::lock::acquire_irq();
+                const auto obj = alloc_local(pcache.unsafe_get().slots[_slot]);
+                lib::lock::release_irq();
+                return obj;
+            }
+
+            const std::unique_lock _ { _lock };
+            return get_locked();
+        }
+
+        void free(void *obj)
+        {
+            if (_slot != no_slot && percpu_ready())
+            {
+                lib::lock::acquire_irq();
+                const bool done = free_local(pcache.unsafe_get().slots[_slot], obj);
+                lib::lock::release_irq();
+                if (done)
+                    return;
+
+                // no empty magazine anywhere. allocate one with interrupts enabled
+                if (auto mag = new_magazine())
+                {
+                    lib::lock::acquire_irq();
+                    auto &cc = pcache.unsafe_get().slots[_slot];
+                    if (!free_local(cc, obj))
+                    {
+                        if (cc.previous)
+                        {
+                            const std::unique_lock _ { _lock };
+                            push_full(cc.previous);
+                        }
+                        cc.previous = cc.loaded;
+                        cc.loaded = std::exchange(mag, nullptr);
+                        cc.loaded->push(obj);
+                    }
+                    lib::lock::release_irq();
+
+                    if (mag != nullptr)
+                        kalloc->free(mag);
+                    return;
+                }
+            }
+
+            const std::unique_lock _ { _lock };
+            put_locked(obj);
+        }
+
+        // return depot contents and the spare slab to the system.
+        // returns the number of pages freed
+        std::size_t reap()
+        {
+            magazine_t *mags = nullptr;
+            std::size_t released = 0;
+            {
+                const std::unique_lock _ { _lock };
+                const auto slabs = _slabs;
+                while (const auto mag = _full.pop())
+                {
+                    flush_locked(mag);
+                    _empty.push(mag);
+                }
+                _depot_objs = 0;
+
+                while (const auto mag = _empty.pop())
+                {
+                    mag->next = mags;
+                    mags = mag;
+                }
+
+                if (const auto slab = std::exchange(_spare, nullptr))
+                    release(slab);
+
+                released = (slabs - _slabs) << _order;
+            }
+
+            while (mags != nullptr)
+                kalloc->free(std::exchange(mags, mags->next));
+            return released;
+        }
+
+        // rough number of pages reap would give back
+        std::size_t reapable()
+        {
+            const std::unique_lock _ { _lock };
+            auto ret = (_depot_objs * _stride) / pmm::page_size;
+            if (_spare != nullptr)
+                ret += 1uz << _order;
+            return ret;
+        }
+
+        struct stats_t
+        {
+            std::size_t active;
+            std::size_t total;
+            std::size_t slabs;
+            std::size_t objsize;
+            std::size_t objperslab;
+            std::size_t pagesperslab;
+        };
+
+        stats_t stats()
+        {
+            const std::unique_lock _ { _lock };
+            return {
+                // objects in per-cpu magazines are counted as active
+                .active = _inuse - _depot_objs,
+                .total = _slabs * _objs_per_slab,
+                .slabs = _slabs,
+                .objsize = _size,
+                .objperslab = _objs_per_slab,
+                .pagesperslab = 1uz << _order
+            };
+        }
+    };
+
+    namespace
+    {
+        constinit lib::spinlock caches_lock;
+        constinit cache *caches_head = nullptr;
+
+        constinit std::array<cache *, num_classes> kmalloc_caches { };
+
+        cache *new_cache(std::string_view name, std::size_t size, std::size_t align,
+            void (*ctor)(void *), void (*dtor)(void *), bool percpu)
+        {
+            const auto mem = kalloc->allocate(sizeof(cache));
+            if (mem == nullptr)
+                lib::panic("slab: could not allocate cache '{}'", name);
+
+            const auto ret = new (mem) cache { name, size, align, ctor, dtor, percpu };
+
+            const std::unique_lock _ { caches_lock };
+            ret->next = caches_head;
+            caches_head = ret;
+            return ret;
+        }
+
+        bool owned(const void *ptr)
+        {
+            const auto addr = reinterpret_cast<std::uintptr_t>(ptr);
+            if (!lib::ishh(addr) || addr >= hhdm_end)
+                return false;
+            // large frigg slabs live in the hhdm as well
+            return vmm::page_for(lib::fromhh(addr))->slab_ptr != nullptr;
+        }
+
+        cache *class_for(std::size_t size)
+        {
+            if (size == 0 || size > max_class_size || hhdm_end == 0)
+                return nullptr;
+
+            const auto it = std::ranges::lower_bound(class_sizes, size);
+            return kmalloc_caches[it - class_sizes.begin()];
+        }
+
+        cache *cache_of(const void *ptr)
+        {
+            const auto slab = static_cast<slab_t *>(vmm::page_for(ptr)->slab_ptr);
+            lib::bug_on(slab == nullptr, "slab: {} was not allocated from a cache", ptr);
+            return slab->owner;
+        }
+    } // namespace
+
     void *alloc(std::size_t size)
     {
+        if (const auto cache = class_for(size))
+            return cache->alloc();
         return kalloc->allocate(size);
     }
 
     void *realloc(void *oldptr, std::size_t size)
     {
-        return kalloc->reallocate(oldptr, size);
+        if (oldptr == nullptr)
+            return alloc(size);
+
+        if (!owned(oldptr))
+            return kalloc->reallocate(oldptr, size);
+
+        const auto cache = cache_of(oldptr);
+        if (size != 0 && size <= cache->size())
+            return oldptr;
+
+        const auto newptr = alloc(size);
+        if (newptr != nullptr)
+            std::memcpy(newptr, oldptr, std::min(size, cache->size()));
+        cache->free(oldptr);
+        return newptr;
     }
 
     void free(void *ptr)
     {
-        kalloc->free(ptr);
+        if (ptr == nullptr)
+            return;
+
+        if (owned(ptr))
+            cache_of(ptr)->free(ptr);
+        else
+            kalloc->free(ptr);
+    }
+
+    void reap()
+    {
+        const std::unique_lock _ { caches_lock };
+        for (auto cache = caches_head; cache; cache = cache->next)
+            lib::unused(cache->reap());
+    }
+
+    cache *create_cache(
+        std::string_view name, std::size_t size, std::size_t align,
+        void (*ctor)(void *), void (*dtor)(void *), bool percpu)
+    {
+        lib::bug_on(hhdm_end == 0, "slab: cache '{}' created before slab::init()", name);
+        return new_cache(name, size, align, ctor, dtor, percpu);
+    }
+
+    cache *get_cache(std::atomic<cache *> &slot, std::string_view name, std::size_t size, std::size_t align)
+    {
+        if (const auto ret = slot.load(std::memory_order_acquire))
+            return ret;
+
+        static constinit lib::spinlock lock;
+        const std::unique_lock _ { lock };
+
+        if (const auto ret = slot.load(std::memory_order_relaxed))
+            return ret;
+
+        const auto ret = create_cache(name, size, align, nullptr, nullptr, true);
+        slot.store(ret, std::memory_order_release);
+        return ret;
+    }
+
+    void *cache_alloc(cache *cache)
+    {
+        return cache->alloc();
+    }
+
+    void cache_free(cache *cache, void *ptr)
+    {
+        if (ptr != nullptr)
+            cache->free(ptr);
     }
 
     void init()
@@ -101,5 +743,93 @@ namespace slab
 
         pool.initialize(valloc);
         kalloc.initialize(pool.get());
+
+        for (std::size_t i = 0; i < num_classes; i++)
+        {
+            static constexpr std::array names {
+                "kmalloc-16", "kmalloc-32", "kmalloc-48", "kmalloc-64", "kmalloc-96",
+                "kmalloc-128", "kmalloc-192", "kmalloc-256", "kmalloc-384", "kmalloc-512"
+            };
+            static_assert(names.size() == num_classes);
+
+            const auto size = class_sizes[i];
+            kmalloc_caches[i] = new_cache(
+                names[i], size, 1uz << std::countr_zero(size),
+                nullptr, nullptr, true
+            );
+        }
+
+        hhdm_end = pmm::info().pfndb_base;
     }
+
+    namespace
+    {
+        // slab locks disable interrupts, so reclaim never runs with one held
+        struct slab_shrinker : reclaim::shrinker
+        {
+            slab_shrinker() : reclaim::shrinker { "slab" } { }
+
+            std::size_t count() override
+            {
+                std::size_t ret = 0;
+                const std::unique_lock _ { caches_lock };
+                for (auto cache = caches_head; cache; cache = cache->next)
+                    ret += cache->reapable();
+                return ret;
+            }
+
+            std::size_t scan(std::size_t nr, bool may_block) override
+            {
+                lib::unused(may_block);
+
+                std::size_t freed = 0;
+                const std::unique_lock _ { caches_lock };
+                for (auto cache = caches_head; cache && freed < nr; cache = cache->next)
+                    freed += cache->reap();
+                return freed;
+            }
+        };
+
+        lib::initgraph::task shrinker_register_task
+        {
+            "slab.shrinker.register",
+            lib::initgraph::postsched_init_engine,
+            [] {
+                static slab_shrinker shrinker { };
+                reclaim::register_shrinker(&shrinker);
+            }
+        };
+    } // namespace
+
+    lib::initgraph::task procfs_register_task
+    {
+        "slab.procfs.register",
+        lib::initgraph::postsched_init_engine,
+        lib::initgraph::require { fs::procfs::registered_stage() },
+        [] {
+            using namespace ::fs::procfs;
+            lib::bug_on(!register_global("slabinfo",
+                make_file_ops([](auto) {
+                    std::string out = fmt::format(
+                        "{:<24} {:>10} {:>10} {:>8} {:>10} {:>12} {:>8}\n",
+                        "# name", "active_objs", "num_objs", "objsize",
+                        "objperslab", "pagesperslab", "slabs"
+                    );
+
+                    auto it = std::back_inserter(out);
+                    const std::unique_lock _ { caches_lock };
+                    for (auto cache = caches_head; cache; cache = cache->next)
+                    {
+                        const auto st = cache->stats();
+                        fmt::format_to(it,
+                            "{:<24} {:>10} {:>10} {:>8} {:>10} {:>12} {:>8}\n",
+                            cache->name(), st.active, st.total, st.objsize,
+                            st.objperslab, st.pagesperslab, st.slabs
+                        );
+                    }
+                    return out;
+                }), node_type::file, 0444
+            ));
+        }
+    };
 } // namespace slab
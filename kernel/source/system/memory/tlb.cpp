@@ -2,12 +2,15 @@
 
 module system.memory.tlb;
 
+import drivers.fs.procfs;
 import system.memory.phys;
 import system.cpu.local;
 import system.cpu.call;
 import system.cpu;
 import system.sched;
 import arch;
+import lib;
+import fmt;
 
 namespace tlb
 {
@@ -27,11 +30,28 @@ namespace tlb
 
         cpu_local(cpu::batch_t<payload_t>, batch);
 
+        // read by other cpus for tlbinfo
+        struct stats_t
+        {
+            std::atomic<std::size_t> shootdowns;
+            std::atomic<std::size_t> ipis_sent;
+            std::atomic<std::size_t> ipis_received;
+            std::atomic<std::size_t> full_flushes;
+            std::atomic<std::size_t> lazy_skips;
+        };
+        cpu_local(stats_t, stats);
+
+        void count(std::atomic<std::size_t> stats_t::*item, std::size_t n = 1)
+        {
+            (stats.unsafe_get().*item).fetch_add(n, std::memory_order_relaxed);
+        }
+
         void do_flush(scope sc, vmm::asid_t asid, std::uintptr_t start, std::size_t pages)
         {
             const auto threshold = max_pages * (cpu::tlb::has_asids() ? 1 : 4);
             if (sc == scope::user_full || sc == scope::kernel_full || pages > threshold)
             {
+                count(&stats_t::full_flushes);
                 if (cpu::tlb::has_asids())
                     cpu::tlb::flush_asid(asid);
                 else
@@ -76,6 +96,7 @@ namespace tlb
             const bool is_user = pl.sc == scope::user_range || pl.sc == scope::user_full;
             if (is_user && pl.asid_gen == 0)
             {
+                count(&stats_t::full_flushes);
                 cpu::tlb::flush_all();
                 return;
             }
@@ -133,10 +154,23 @@ namespace tlb
                 return true;
             }
 
+            auto proc = cpu::local::nth(i);
             const auto ctx = req.pmap->cached_asid_ctx(i);
-            if (!ctx || ctx->gen != cpu::local::nth(i)->asid_gen.load(std::memory_order_acquire))
+            if (!ctx || ctx->gen != proc->asid_gen.load(std::memory_order_acquire))
                 return false;
 
+            // a lazy cpu only runs kernel code on this pagemap. it flushes
+            // when it goes back to user, unless it left before seeing stale
+            if (!req.freed_tables && proc->tlb_lazy.load(std::memory_order_seq_cst))
+            {
+                proc->tlb_stale.store(true, std::memory_order_seq_cst);
+                if (proc->tlb_lazy.load(std::memory_order_seq_cst))
+                {
+                    count(&stats_t::lazy_skips);
+                    return false;
+                }
+            }
+
             pl.asid_gen = ctx->gen;
             pl.asid = ctx->asid;
             return true;
@@ -148,9 +182,13 @@ namespace tlb
             return;
         }
 
+        count(&stats_t::shootdowns);
+        count(&stats_t::ipis_sent, bt.size());
+
         bt.dispatch([](cpu::call_t *call) {
             const auto rec = static_cast<cpu::batch_t<payload_t>::record_t *>(call);
             const auto gen = cpu::self().unsafe_get().asid_gen.load(std::memory_order_acquire);
+            count(&stats_t::ipis_received);
             apply(rec->payload, gen);
             return true;
         });
@@ -161,4 +199,36 @@ namespace tlb
 
         sched::preempt_enable();
     }
+
+    lib::initgraph::task procfs_register_task
+    {
+        "tlb.procfs.register",
+        lib::initgraph::postsched_init_engine,
+        lib::initgraph::require { fs::procfs::registered_stage() },
+        [] {
+            using namespace ::fs::procfs;
+            lib::bug_on(!register_global("tlbinfo",
+                make_file_ops([](auto) {
+                    std::string out = fmt::format(
+                        "{:>4} {:>12} {:>12} {:>12} {:>12} {:>12}\n",
+                        "cpu", "shootdowns", "ipis_sent", "ipis_recv", "full_flushes", "lazy_skips"
+                    );
+
+                    auto it = std::back_inserter(out);
+                    for (std::size_t i = 0; i < cpu::count(); i++)
+                    {
+                        const auto &st = stats.unsafe_get(cpu::local::nth_base(i));
+                        fmt::format_to(it, "{:>4} {:>12} {:>12} {:>12} {:>12} {:>12}\n", i,
+                            st.shootdowns.load(std::memory_order_relaxed),
+                            st.ipis_sent.load(std::memory_order_relaxed),
+                            st.ipis_received.load(std::memory_order_relaxed),
+                            st.full_flushes.load(std::memory_order_relaxed),
+                            st.lazy_skips.load(std::memory_order_relaxed)
+                        );
+                    }
+                    return out;
+                }), node_type::file, 0444
+            ));
+        }
+    };
 } // namespace tlb
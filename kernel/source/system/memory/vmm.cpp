@@ -2,9 +2,16 @@
 
 module system.memory.virt;
 
+import system.memory.reclaim;
+import system.memory.vmstat;
+import system.memory.zram;
 import system.memory.va;
+import system.cmdline;
+import system.chrono;
+import system.sysctl;
 import system.sched;
 import system.cpu;
+import drivers.dev;
 import magic_enum;
 
 import :pagemap;
@@ -54,6 +61,154 @@ namespace vmm
             return cached;
         }
 
+        // page cache lru. new pages start on the inactive list, those used
+        // again while there get promoted when reclaim passes by and the active
+        // list is aged back whenever it grows past the inactive one.
+        // lock order: object cache, then lru_lock
+        struct lru_list
+        {
+            std::uint32_t head = 0;
+            std::uint32_t tail = 0;
+            std::size_t count = 0;
+        };
+
+        constinit lib::spinlock lru_lock;
+        constinit lru_list lru_inactive;
+        constinit lru_list lru_active;
+
+        std::uint32_t pfn_of(page *pg)
+        {
+            return static_cast<std::uint32_t>(paddr_from(pg) >> pmm::page_bits);
+        }
+
+        page *pfn_page(std::uint32_t pfn)
+        {
+            if (pfn == 0)
+                return nullptr;
+            return reinterpret_cast<page *>(pfndb_base() + (pfn * sizeof(page)));
+        }
+
+        lru_list &lru_for(std::uint16_t flags)
+        {
+            return (flags & page::flag::active) ? lru_active : lru_inactive;
+        }
+
+        // with lru_lock held
+        void lru_link(page *pg, bool active)
+        {
+            auto &list = active ? lru_active : lru_inactive;
+            const auto pfn = pfn_of(pg);
+
+            pg->lru_prev = 0;
+            pg->lru_next = list.head;
+            if (auto *next = pfn_page(list.head))
+                next->lru_prev = pfn;
+            else
+                list.tail = pfn;
+            list.head = pfn;
+            list.count++;
+
+            auto old = pg->flags.load(std::memory_order_relaxed);
+            std::uint16_t set = page::flag::lru;
+            if (active)
+                set |= page::flag::active;
+            while (!pg->flags.compare_exchange_weak(old, (old & ~page::flag::active) | set, std::memory_order_relaxed));
+        }
+
+        // with lru_lock held
+        void lru_unlink(page *pg)
+        {
+            const auto flags = pg->flags.fetch_and(
+                ~(page::flag::lru | page::flag::active),
+                std::memory_order_relaxed
+            );
+            lib::bug_on(!(flags & page::flag::lru));
+            auto &list = lru_for(flags);
+
+            if (auto *prev = pfn_page(pg->lru_prev))
+                prev->lru_next = pg->lru_next;
+            else
+                list.head = pg->lru_next;
+
+            if (auto *next = pfn_page(pg->lru_next))
+                next->lru_prev = pg->lru_prev;
+            else
+                list.tail = pg->lru_prev;
+
+            pg->lru_prev = pg->lru_next = 0;
+            list.count--;
+        }
+
+        void lru_add(page *pg)
+        {
+            const std::unique_lock _ { lru_lock };
+            const auto flags = pg->flags.load(std::memory_order_relaxed);
+            if (!(flags & (page::flag::lru | page::flag::mapped)))
+                lru_link(pg, false);
+        }
+
+        // with the object cache locked, right after pg leaves it
+        void lru_forget(page *pg)
+        {
+            const std::unique_lock _ { lru_lock };
+            if (pg->flags.load(std::memory_order_relaxed) & page::flag::lru)
+                lru_unlink(pg);
+            pg->obj_ptr = nullptr;
+        }
+
+        // cache pages have no reverse map, so reclaim can't unmap them
+        void mark_mapped(page *pg)
+        {
+            if (pg->flags.load(std::memory_order_relaxed) & page::flag::file)
+                pg->flags.fetch_or(page::flag::mapped, std::memory_order_relaxed);
+        }
+
+        // every user vmspace, rotated as swap walks them
+        lib::locker<
+            lib::intrusive_list<vmspace, &vmspace::swap_hook>,
+            sched::mutex_t
+        > vmspaces;
+
+        // an anon can be in several amaps, each with its own lock
+        sched::mutex_t swap_in_lock;
+
+        // brings a swapped out anon back. with its amap locked
+        bool swap_in(anon &an)
+        {
+            // only swap_in sets pg of an anon that is shared
+            if (std::atomic_ref { an.pg }.load(std::memory_order_acquire))
+                return true;
+
+            const std::unique_lock _ { swap_in_lock };
+            if (an.pg)
+                return true;
+
+            const auto num_alloc_pages = default_npsize() / pmm::page_size;
+            const bool zeroes = an.swap == 0;
+
+            const auto paddr = pmm::try_alloc(num_alloc_pages, zeroes);
+            if (paddr == 0)
+                return false;
+
+            if (!zeroes)
+            {
+                if (!zram::load(an.swap, paddr))
+                {
+                    pmm::free(paddr, num_alloc_pages);
+                    return false;
+                }
+                zram::release(std::exchange(an.swap, 0));
+                vmstat::add(vmstat::item::pswpin);
+            }
+
+            auto *pg = page_for(paddr);
+            pg->refcount.store(1, std::memory_order_relaxed);
+            pg->flags.store(page::flag::anonymous, std::memory_order_relaxed);
+            pg->anon_ptr = &an;
+            std::atomic_ref { an.pg }.store(pg, std::memory_order_release);
+            return true;
+        }
+
         pflag prot_to_pflags(prot_t prot)
         {
             auto ret = pflag::user;
@@ -71,6 +226,312 @@ namespace vmm
             return length <= vmspace::vspace_top && address >= vmspace::mmap_min &&
                 address <= vmspace::vspace_top - length;
         }
+
+        // drops the anons of a range that was just unmapped. they are only
+        // released once tlb has flushed
+        void release_anons(mmu_gather &tlb, anon_map &amap, std::size_t first, std::size_t count)
+        {
+            const std::unique_lock _ { amap.lock };
+            amap.for_each(first, count, [&](std::size_t, anon::ptr &slot) {
+                tlb.defer(std::move(slot));
+            });
+            amap.clear(first, count);
+        }
+
+        // ptes that stay read only until the first store faults
+        bool needs_write_fault(const entry &ent)
+        {
+            if (ent.flags & flag::private_)
+                return true;
+            return ent.obj && ent.obj->type == object_type::file;
+        }
+
+        // what reads of untouched private anonymous memory map. never freed
+        std::uintptr_t zero_page()
+        {
+            static const auto paddr = pmm::alloc(default_npsize() / pmm::page_size, true);
+            return paddr;
+        }
+
+        enum class thp_mode { always, madvise, never };
+        constinit std::atomic<thp_mode> thp_enabled = thp_mode::madvise;
+
+        bool thp_allowed(flag_t flags)
+        {
+            if (flags & flag::nohugepage)
+                return false;
+
+            switch (thp_enabled.load(std::memory_order_relaxed))
+            {
+                case thp_mode::always:
+                    return true;
+                case thp_mode::madvise:
+                    return (flags & flag::hugepage) != 0;
+                default:
+                    return false;
+            }
+        }
+
+        // how much of the object cache around a read fault gets mapped
+        constexpr std::size_t fault_around_default = 64 * 1024;
+        constinit std::atomic<std::size_t> fault_around_bytes = fault_around_default;
+
+        lib::initgraph::task fault_around_sysctl_task
+        {
+            "vmm.fault-around.sysctl.register",
+            lib::initgraph::postsched_init_engine,
+            [] {
+                lib::bug_on(!sysctl::register_int("vm/fault_around_bytes",
+                    [] { return static_cast<int>(fault_around_bytes.load(std::memory_order_relaxed)); },
+                    [](int val) -> lib::expect<void> {
+                        const auto max = object::max_readahead * default_npsize();
+                        if (val < 0 || static_cast<std::size_t>(val) > max)
+                            return std::unexpected { lib::err::invalid_argument };
+
+                        // whole pages, power of two so the window stays aligned
+                        auto bytes = static_cast<std::size_t>(val);
+                        if (bytes != 0)
+                            bytes = std::bit_floor(bytes);
+                        fault_around_bytes.store(bytes, std::memory_order_relaxed);
+                        return { };
+                    }
+                ));
+            }
+        };
+    } // namespace
+
+    struct entry_index : rcu::obj_base<entry_index>
+    {
+        // sorted by startp
+        std::vector<entry *> entries;
+        // removed by the change that replaced this index
+        std::vector<entry *> dead;
+
+        ~entry_index()
+        {
+            for (auto *ent : dead)
+                delete ent;
+        }
+    };
+
+    namespace
+    {
+        constexpr std::uint32_t entry_locked = 1u << 31;
+
+        bool entry_get(entry *ent)
+        {
+            auto val = ent->users.load(std::memory_order_relaxed);
+            do {
+                if (val & entry_locked)
+                    return false;
+            } while (!ent->users.compare_exchange_weak(
+                val, val + 1, std::memory_order_acquire, std::memory_order_relaxed
+            ));
+            return true;
+        }
+
+        std::size_t hash_entry(entry *ent)
+        {
+            return (reinterpret_cast<std::uintptr_t>(ent) / sizeof(entry)) % num_waitqueues;
+        }
+
+        void entry_put(entry *ent)
+        {
+            // the last fault out wakes the writer waiting for it
+            if (ent->users.fetch_sub(1, std::memory_order_release) == (entry_locked | 1))
+                waitqueues[hash_entry(ent)].wake_all();
+        }
+
+        void entry_unlock(entry *ent)
+        {
+            ent->users.fetch_and(~entry_locked, std::memory_order_release);
+        }
+
+        // keeps an entry from changing while a fault works on it
+        class entry_ref
+        {
+            private:
+            entry *_ent = nullptr;
+
+            public:
+            entry_ref() = default;
+            explicit entry_ref(entry *ent) : _ent { ent } { }
+
+            entry_ref(entry_ref &&rhs) : _ent { std::exchange(rhs._ent, nullptr) } { }
+            entry_ref &operator=(entry_ref &&rhs)
+            {
+                if (this != &rhs)
+                {
+                    reset();
+                    _ent = std::exchange(rhs._ent, nullptr);
+                }
+                return *this;
+            }
+
+            ~entry_ref() { reset(); }
+
+            void reset()
+            {
+                if (_ent)
+                    entry_put(std::exchange(_ent, nullptr));
+            }
+
+            entry *get() const { return _ent; }
+            entry *operator->() const { return _ent; }
+            explicit operator bool() const { return _ent != nullptr; }
+        };
+
+        // structural change to a vmspace, made with the tree locked. entries
+        // are locked against faults before they are touched, removed ones are
+        // freed after a grace period and the index is republished at the end
+        // if entries came or went. entries go in and out of the tree through
+        // insert and remove so that it knows
+        template<typename Locked>
+        class tree_update
+        {
+            private:
+            struct removed_t
+            {
+                entry *ent;
+                std::uintptr_t startp;
+                std::uintptr_t endp;
+            };
+
+            vmspace &_vms;
+            Locked &_locked;
+
+            std::vector<entry *> _held;
+            std::vector<entry *> _dead;
+            std::vector<removed_t> _removed;
+            bool _changed = false;
+
+            public:
+            tree_update(vmspace &vms, Locked &locked) : _vms { vms }, _locked { locked } { }
+
+            tree_update(const tree_update &) = delete;
+            tree_update &operator=(const tree_update &) = delete;
+
+            ~tree_update()
+            {
+                // removed entries stay locked, so stale lookups can't hold them
+                for (auto *ent : _held)
+                {
+                    if (std::ranges::find(_dead, ent) == _dead.end())
+                        entry_unlock(ent);
+                }
+
+                // entries that were only trimmed keep their place in the index
+                const bool changed = _changed || !_removed.empty() || !_dead.empty();
+                if (!changed && _vms.index.unsafe_load())
+                    return;
+
+                auto *next = new entry_index;
+                next->entries.reserve(_locked->size());
+                for (auto &ent : *_locked)
+                    next->entries.push_back(std::addressof(ent));
+
+                auto *old = _vms.index.exchange(next);
+                if (!old && !_dead.empty())
+                    old = new entry_index;
+
+                if (old)
+                {
+                    old->dead = std::move(_dead);
+                    old->retire();
+                }
+            }
+
+            void lock(entry *ent)
+            {
+                if (ent->users.fetch_or(entry_locked, std::memory_order_acquire) & entry_locked)
+                    return;
+
+                // faults can hold it across i/o, sleep until the last one
+                // puts it
+                auto &wq = waitqueues[hash_entry(ent)];
+                while (true)
+                {
+                    const auto gen = wq.snapshot_gen();
+                    if ((ent->users.load(std::memory_order_acquire) & ~entry_locked) == 0)
+                        break;
+                    wq.wait_unkillable_prepared(gen);
+                }
+
+                _held.push_back(ent);
+            }
+
+            void insert(entry *ent)
+            {
+                _locked->insert(ent);
+
+                const auto it = std::ranges::find(_removed, ent, &removed_t::ent);
+                if (it == _removed.end())
+                {
+                    _changed = true;
+                    return;
+                }
+
+                // still sorted if it starts where it used to be
+                if (ent->startp < it->startp || ent->startp >= it->endp)
+                    _changed = true;
+                _removed.erase(it);
+            }
+
+            void remove(entry *ent)
+            {
+                _locked->remove(ent);
+                _removed.push_back({ ent, ent->startp, ent->endp });
+            }
+
+            // instead of delete, once ent is out of the tree
+            void retire(entry *ent)
+            {
+                lock(ent);
+                _dead.push_back(ent);
+            }
+        };
+
+        entry *find_entry(vmspace &vms, std::uintptr_t page)
+        {
+            const rcu::read_guard _;
+
+            const auto *idx = vms.index.dereference();
+            if (!idx)
+                return nullptr;
+
+            const auto it = std::ranges::upper_bound(
+                idx->entries, page, { },
+                [](const entry *ent) { return ent->startp; }
+            );
+            if (it == idx->entries.begin())
+                return nullptr;
+
+            auto *ent = *std::prev(it);
+            if (!entry_get(ent))
+                return nullptr;
+            return ent;
+        }
+
+        // lockless lookup first. the tree lock only when the index is stale
+        // or the entry is being changed
+        entry_ref hold_entry(vmspace &vms, std::uintptr_t page)
+        {
+            if (entry_ref ref { find_entry(vms, page) })
+            {
+                if (ref->startp <= page && page < ref->endp)
+                    return ref;
+            }
+
+            auto locked = vms.tree.lock();
+            const auto ret = locked->overlapping(page, page + 1);
+            if (ret.empty())
+                return { };
+
+            auto *ent = ret.begin().value();
+            if (!entry_get(ent))
+                return { };
+            return entry_ref { ent };
+        }
     } // namespace
 
     std::size_t cached_pages(object_type type)
@@ -78,6 +539,12 @@ namespace vmm
         return stats_for(type).load(std::memory_order_relaxed);
     }
 
+    std::size_t lru_pages(bool active)
+    {
+        const std::unique_lock _ { lru_lock };
+        return active ? lru_active.count : lru_inactive.count;
+    }
+
     page *page_for(std::uintptr_t addr)
     {
         const auto idx = lib::fromhh(addr) / pmm::page_size;
@@ -124,11 +591,14 @@ namespace vmm
                         i--;
                         continue;
                     }
+
+                    if (!(pg->flags.load(std::memory_order_relaxed) & page::flag::referenced))
+                        pg->flags.fetch_or(page::flag::referenced, std::memory_order_relaxed);
                     pages[i] = pg;
                     continue;
                 }
 
-                const auto paddr = pmm::alloc(num_alloc_pages, true); // zeroed out
+                const auto paddr = pmm::try_alloc(num_alloc_pages, true); // zeroed out
                 if (paddr == 0)
                 {
                     if (i > idx)
@@ -155,7 +625,7 @@ namespace vmm
                         {
                             locked->erase(it);
                             stats_for(type).fetch_sub(1, std::memory_order_relaxed);
-                            pg->obj_ptr = nullptr;
+                            lru_forget(pg);
                         }
 
                         pg->flags.fetch_and(~page::flag::busy, std::memory_order_release);
@@ -179,6 +649,8 @@ namespace vmm
 
                 locked->insert({ start_idx + i, pg });
                 stats_for(type).fetch_add(1, std::memory_order_relaxed);
+                if (type == object_type::file)
+                    lru_add(pg);
                 pages[i] = pg;
                 needs_fetch[i] = true;
             }
@@ -220,7 +692,7 @@ namespace vmm
                     {
                         locked->erase(it);
                         stats_for(type).fetch_sub(1, std::memory_order_relaxed);
-                        pg->obj_ptr = nullptr;
+                        lru_forget(pg);
                     }
 
                     pg->flags.fetch_and(~page::flag::busy, std::memory_order_release);
@@ -336,12 +808,16 @@ namespace vmm
             std::span<page *> pages { chunk, chunk_size };
             const auto chunk_off = i;
 
+            dirty_cleared(chunk_size);
+            vmstat::add(vmstat::item::nr_writeback, chunk_size);
+
             auto res = write_pages(chunk_off, pages);
+            vmstat::sub(vmstat::item::nr_writeback, chunk_size);
             if (!res.has_value())
             {
                 for (auto *pg : pages)
                 {
-                    pg->flags.fetch_or(page::flag::dirty, std::memory_order_relaxed);
+                    set_dirty(pg);
                     pg->flags.fetch_and(~page::flag::busy, std::memory_order_release);
 
                     auto &wq = waitqueues[hash_page(pg)];
@@ -353,6 +829,7 @@ namespace vmm
                 return res;
             }
 
+            vmstat::add(vmstat::item::nr_written, chunk_size);
             for (auto *pg : pages)
             {
                 pg->flags.fetch_and(~page::flag::busy, std::memory_order_release);
@@ -405,13 +882,91 @@ namespace vmm
             offp = it->first + 1;
             locked->erase(it->first);
             stats_for(type).fetch_sub(1, std::memory_order_relaxed);
-            pg->obj_ptr = nullptr;
+            lru_forget(pg);
+
+            if (pg->flags.load(std::memory_order_relaxed) & page::flag::dirty)
+                dirty_cleared(1);
 
             if (pg->unref())
                 pmm::free(paddr_from(pg), num_alloc_pages);
         }
     }
 
+    void object::resident(std::uint64_t offp, std::span<std::uint8_t> vec)
+    {
+        const auto end_idx = offp + vec.size();
+
+        const auto locked = cache.lock();
+        for (auto it = locked->lower_bound(offp); it != locked->end() && it->first < end_idx; ++it)
+            vec[it->first - offp] = 1;
+    }
+
+    std::size_t object::try_count_resident(std::uint64_t offp, std::size_t num_pages)
+    {
+        const auto end_idx = offp + num_pages;
+
+        const auto locked = cache.try_lock();
+        if (!locked.owns_lock())
+            return 0;
+
+        std::size_t ret = 0;
+        for (auto it = locked->lower_bound(offp); it != locked->end() && it->first < end_idx; ++it)
+            ret++;
+        return ret;
+    }
+
+    bool object::evict(page *pg, bool may_block)
+    {
+        auto locked = may_block ? cache.lock() : cache.try_lock();
+        if (!locked.owns_lock())
+            return false;
+
+        const auto it = locked->find(pg->offp);
+        if (it == locked->end() || it->second != pg)
+            return false;
+
+        constexpr std::uint16_t keep =
+            page::flag::busy | page::flag::dirty |
+            page::flag::mapped | page::flag::referenced;
+        if (pg->flags.load(std::memory_order_acquire) & keep)
+            return false;
+
+        // the cache and the caller. new users only come through the cache
+        if (pg->refcount.load(std::memory_order_acquire) != 2)
+            return false;
+
+        locked->erase(it);
+        stats_for(type).fetch_sub(1, std::memory_order_relaxed);
+        lru_forget(pg);
+
+        lib::bug_on(pg->unref());
+        return true;
+    }
+
+    object::probe_result object::probe(std::uint64_t offp, std::size_t num_pages)
+    {
+        probe_result ret { false, false };
+
+        const auto locked = cache.lock();
+        auto it = locked->lower_bound(offp);
+        for (std::size_t i = 0; i < num_pages; i++, ++it)
+        {
+            if (it == locked->end() || it->first != offp + i)
+            {
+                ret.missing = true;
+                break;
+            }
+
+            auto *pg = it->second;
+            if (pg->flags.load(std::memory_order_relaxed) & page::flag::readahead)
+            {
+                if (pg->flags.fetch_and(~page::flag::readahead, std::memory_order_relaxed) & page::flag::readahead)
+                    ret.marker = true;
+            }
+        }
+        return ret;
+    }
+
     lib::expect<void> object::populate(std::size_t num_pages)
     {
         const auto npsize = default_npsize();
@@ -536,14 +1091,14 @@ namespace vmm
             return 0;
 
         return apply_func(offset, buffer.size(),
-            [&buffer](page *pg, std::size_t progress, std::uintptr_t addr, std::size_t len)
+            [this, &buffer](page *pg, std::size_t progress, std::uintptr_t addr, std::size_t len)
             {
                 const std::span<std::byte> dest {
                     reinterpret_cast<std::byte *>(addr), len
                 };
                 bool ret = buffer.subspan(progress, len).copy_to(dest);
                 if (ret)
-                    pg->flags.fetch_or(page::flag::dirty, std::memory_order_relaxed);
+                    set_dirty(pg);
                 return ret;
             }
         );
@@ -555,28 +1110,61 @@ namespace vmm
             return 0;
 
         return apply_func(offset, length,
-            [value](page *pg, std::size_t progress, std::uintptr_t addr, std::size_t len)
+            [this, value](page *pg, std::size_t progress, std::uintptr_t addr, std::size_t len)
             {
                 lib::unused(progress);
                 std::memset(reinterpret_cast<std::byte *>(addr), value, len);
-                pg->flags.fetch_or(page::flag::dirty, std::memory_order_relaxed);
+                set_dirty(pg);
                 return true;
             }
         );
     }
 
+    void object::update_cached(std::uint64_t offset, lib::maybe_uspan<std::byte> buffer)
+    {
+        if (buffer.empty())
+            return;
+
+        const auto npsize = default_npsize();
+        const auto end = offset + buffer.size();
+        const auto end_idx = lib::div_roundup(end, npsize);
+
+        const auto locked = cache.lock();
+        for (auto it = locked->lower_bound(offset / npsize); it != locked->end() && it->first < end_idx; ++it)
+        {
+            const auto pstart = it->first * npsize;
+            const auto from = std::max(offset, pstart);
+            const auto to = std::min(end, pstart + npsize);
+
+            const std::span<std::byte> dest {
+                reinterpret_cast<std::byte *>(lib::tohh(paddr_from(it->second))) + (from - pstart),
+                to - from
+            };
+            lib::unused(buffer.subspan(from - offset, to - from).copy_to(dest));
+        }
+    }
+
     object::~object()
     {
         const auto npsize = default_npsize();
         const auto num_alloc_pages = npsize / pmm::page_size;
 
+        bdi_forget();
+
         auto locked = cache.lock();
         if (!locked->empty())
             stats_for(type).fetch_sub(locked->size(), std::memory_order_relaxed);
 
         for (auto &[_, page] : *locked)
         {
-            if (page && page->unref())
+            if (!page)
+                continue;
+
+            if (page->flags.load(std::memory_order_relaxed) & vmm::page::flag::dirty)
+                dirty_cleared(1);
+
+            lru_forget(page);
+            if (page->unref())
                 pmm::free(paddr_from(page), num_alloc_pages);
         }
     }
@@ -633,9 +1221,7 @@ namespace vmm
 
         if ((flags & flag::private_) && !is_mmio)
         {
-            target_amap = new anon_map { };
-            target_amap->nslots = length / npsize;
-            target_amap->slots = std::make_unique<anon::ptr []>(target_amap->nslots);
+            target_amap = new anon_map { length / npsize };
         }
         else if ((flags & flag::shared) && (flags & flag::anonymous))
             target_obj = new memobject { };
@@ -644,6 +1230,8 @@ namespace vmm
         std::uintptr_t endp = 0;
 
         auto locked = tree.lock();
+        tree_update update { *this, locked };
+        mmu_gather tlb { *pmap };
 
         if ((flags & flag::fixed) || (flags & flag::fixed_noreplace))
         {
@@ -677,6 +1265,7 @@ namespace vmm
                     break;
 
                 auto *ent = it.value();
+                update.lock(ent);
 
                 const auto overlap_start = std::max(startp, ent->startp);
                 const auto overlap_end = std::min(endp, ent->endp);
@@ -684,10 +1273,17 @@ namespace vmm
                 const auto unmap_vaddr = overlap_start * npsize;
                 const auto unmap_length = (overlap_end - overlap_start) * npsize;
 
-                if (const auto ret = pmap->unmap(unmap_vaddr, unmap_length, psize); !ret)
+                if (const auto ret = tlb.unmap(unmap_vaddr, unmap_length, psize); !ret)
                     return std::unexpected { ret.error() };
 
-                locked->remove(ent);
+                update.remove(ent);
+
+                // nothing else indexes these slots unless the amap is still shared after fork
+                if (ent->amap && !ent->amap->cow.load(std::memory_order_acquire))
+                {
+                    const auto first = ent->anon_idx + (overlap_start - ent->startp);
+                    release_anons(tlb, *ent->amap, first, overlap_end - overlap_start);
+                }
 
                 if (ent->endp > endp)
                 {
@@ -696,7 +1292,7 @@ namespace vmm
                     const auto obj_offp = ent->obj ? ent->offp + pages : 0;
                     const auto anon_idx = ent->amap ? ent->anon_idx + pages : 0;
 
-                    locked->insert(new entry {
+                    update.insert(new entry {
                         .startp = endp,
                         .endp = ent->endp,
                         .obj = ent->obj,
@@ -707,16 +1303,17 @@ namespace vmm
                         .max_prot = ent->max_prot,
                         .flags = ent->flags,
                         .hook = { },
-                        .interval = { }
+                        .interval = { },
+                        .policy = ent->policy
                     });
                 }
 
                 if (ent->startp < startp)
                 {
                     ent->endp = startp;
-                    locked->insert(ent);
+                    update.insert(ent);
                 }
-                else delete ent;
+                else update.retire(ent);
             }
         }
         else
@@ -729,7 +1326,7 @@ namespace vmm
             endp = (*ret + length) / npsize;
         }
 
-        locked->insert(new entry {
+        update.insert(new entry {
             .startp = startp,
             .endp = endp,
             .obj = std::move(target_obj),
@@ -768,6 +1365,8 @@ namespace vmm
         const auto endp = (address + length) / npsize;
 
         auto locked = tree.lock();
+        tree_update update { *this, locked };
+        mmu_gather tlb { *pmap };
         {
             const auto overlapping = locked->overlapping(startp, endp);
 
@@ -787,6 +1386,7 @@ namespace vmm
                 break;
 
             auto *ent = it.value();
+            update.lock(ent);
 
             const auto overlap_start = std::max(startp, ent->startp);
             const auto overlap_end = std::min(endp, ent->endp);
@@ -794,10 +1394,17 @@ namespace vmm
             const auto unmap_vaddr = overlap_start * npsize;
             const auto unmap_length = (overlap_end - overlap_start) * npsize;
 
-            if (const auto ret = pmap->unmap(unmap_vaddr, unmap_length, psize); !ret)
+            if (const auto ret = tlb.unmap(unmap_vaddr, unmap_length, psize); !ret)
                 return std::unexpected { ret.error() };
 
-            locked->remove(ent);
+            update.remove(ent);
+
+            // nothing else indexes these slots unless the amap is still shared after fork
+            if (ent->amap && !ent->amap->cow.load(std::memory_order_acquire))
+            {
+                const auto first = ent->anon_idx + (overlap_start - ent->startp);
+                release_anons(tlb, *ent->amap, first, overlap_end - overlap_start);
+            }
 
             if (ent->endp > overlap_end)
             {
@@ -806,7 +1413,7 @@ namespace vmm
                 const auto obj_offp = ent->obj ? ent->offp + pages : 0;
                 const auto anon_idx = ent->amap ? ent->anon_idx + pages : 0;
 
-                locked->insert(new entry {
+                update.insert(new entry {
                     .startp = overlap_end,
                     .endp = ent->endp,
                     .obj = ent->obj,
@@ -817,13 +1424,14 @@ namespace vmm
                     .max_prot = ent->max_prot,
                     .flags = ent->flags,
                     .hook = { },
-                    .interval = { }
+                    .interval = { },
+                    .policy = ent->policy
                 });
             }
 
             if (ent->startp < overlap_start)
             {
-                locked->insert(new entry {
+                update.insert(new entry {
                     .startp = ent->startp,
                     .endp = overlap_start,
                     .obj = ent->obj,
@@ -834,11 +1442,12 @@ namespace vmm
                     .max_prot = ent->max_prot,
                     .flags = ent->flags,
                     .hook = { },
-                    .interval = { }
+                    .interval = { },
+                    .policy = ent->policy
                 });
             }
 
-            delete ent;
+            update.retire(ent);
         }
 
         return { };
@@ -866,6 +1475,8 @@ namespace vmm
         const auto endp = (address + length) / npsize;
 
         auto locked = tree.lock();
+        tree_update update { *this, locked };
+        mmu_gather tlb { *pmap };
         {
             const auto overlapping = locked->overlapping(startp, endp);
 
@@ -900,11 +1511,12 @@ namespace vmm
                 break;
 
             auto *ent = it.value();
+            update.lock(ent);
 
             const auto overlap_start = std::max(startp, ent->startp);
             const auto overlap_end = std::min(endp, ent->endp);
 
-            locked->remove(ent);
+            update.remove(ent);
 
             if (ent->endp > overlap_end)
             {
@@ -913,7 +1525,7 @@ namespace vmm
                 const auto obj_offp = ent->obj ? ent->offp + pages : 0;
                 const auto anon_idx = ent->amap ? ent->anon_idx + pages : 0;
 
-                locked->insert(new entry {
+                update.insert(new entry {
                     .startp = overlap_end,
                     .endp = ent->endp,
                     .obj = ent->obj,
@@ -924,13 +1536,14 @@ namespace vmm
                     .max_prot = ent->max_prot,
                     .flags = ent->flags,
                     .hook = { },
-                    .interval = { }
+                    .interval = { },
+                    .policy = ent->policy
                 });
             }
 
             if (ent->startp < overlap_start)
             {
-                locked->insert(new entry {
+                update.insert(new entry {
                     .startp = ent->startp,
                     .endp = overlap_start,
                     .obj = ent->obj,
@@ -941,7 +1554,8 @@ namespace vmm
                     .max_prot = ent->max_prot,
                     .flags = ent->flags,
                     .hook = { },
-                    .interval = { }
+                    .interval = { },
+                    .policy = ent->policy
                 });
             }
 
@@ -955,16 +1569,17 @@ namespace vmm
                 ent->anon_idx += pages;
             ent->prot = prot;
 
-            locked->insert(ent);
+            update.insert(ent);
 
+            // private pages copy on write, shared file pages get dirtied
             auto tgt_prot = prot;
-            if ((ent->flags & flag::private_) && (tgt_prot & prot::write))
+            if (needs_write_fault(*ent) && (tgt_prot & prot::write))
                 tgt_prot &= ~prot::write;
 
             const auto vaddr = overlap_start * npsize;
             const auto len = (overlap_end - overlap_start) * npsize;
 
-            if (const auto ret = pmap->protect(vaddr, len, prot_to_pflags(tgt_prot), psize); !ret)
+            if (const auto ret = tlb.protect(vaddr, len, prot_to_pflags(tgt_prot), psize); !ret)
             {
                 if (ret.error() != lib::err::invalid_address)
                     return std::unexpected { ret.error() };
@@ -976,7 +1591,620 @@ namespace vmm
         return { };
     }
 
-    lib::expect<std::uintptr_t> vmspace::remap(const remap_options &opts)
+    lib::expect<void> vmspace::mbind(std::uintptr_t address, std::size_t length, const numa::mempolicy &policy)
+    {
+        if (length == 0)
+            return std::unexpected { lib::err::invalid_argument };
+
+        const auto npsize = pagemap::from_page_size(default_psize());
+        if (address % npsize)
+            return std::unexpected { lib::err::invalid_argument };
+
+        const auto orig_length = length;
+        length = lib::align_up(length, npsize);
+        if (length < orig_length || !valid_user_range(address, length))
+            return std::unexpected { lib::err::invalid_argument };
+
+        auto startp = address / npsize;
+        const auto endp = (address + length) / npsize;
+
+        auto locked = tree.lock();
+        tree_update update { *this, locked };
+        {
+            const auto overlapping = locked->overlapping(startp, endp);
+
+            const auto total_pages = std::accumulate(
+                std::ranges::begin(overlapping), std::ranges::end(overlapping), 0uz,
+                [startp, endp](std::size_t acc, const entry &ent) {
+                    const auto overlap_start = std::max(startp, ent.startp);
+                    const auto overlap_end = std::min(endp, ent.endp);
+                    return acc + (overlap_end - overlap_start);
+                }
+            );
+
+            // linux says efault for holes
+            if (total_pages < (endp - startp))
+                return std::unexpected { lib::err::invalid_address };
+        }
+
+        while (startp < endp)
+        {
+            const auto overlapping = locked->overlapping(startp, endp);
+
+            auto it = overlapping.begin();
+            if (it == overlapping.end())
+                break;
+
+            auto *ent = it.value();
+            const auto overlap_start = std::max(startp, ent->startp);
+            const auto overlap_end = std::min(endp, ent->endp);
+
+            if (ent->policy.mode == policy.mode && ent->policy.nodes == policy.nodes)
+            {
+                startp = overlap_end;
+                continue;
+            }
+
+            update.lock(ent);
+            update.remove(ent);
+
+            if (ent->endp > overlap_end)
+            {
+                const auto pages = overlap_end - ent->startp;
+
+                const auto obj_offp = ent->obj ? ent->offp + pages : 0;
+                const auto anon_idx = ent->amap ? ent->anon_idx + pages : 0;
+
+                update.insert(new entry {
+                    .startp = overlap_end,
+                    .endp = ent->endp,
+                    .obj = ent->obj,
+                    .offp = obj_offp,
+                    .amap = ent->amap,
+                    .anon_idx = anon_idx,
+                    .prot = ent->prot,
+                    .max_prot = ent->max_prot,
+                    .flags = ent->flags,
+                    .hook = { },
+                    .interval = { },
+                    .policy = ent->policy
+                });
+            }
+
+            if (ent->startp < overlap_start)
+            {
+                update.insert(new entry {
+                    .startp = ent->startp,
+                    .endp = overlap_start,
+                    .obj = ent->obj,
+                    .offp = ent->offp,
+                    .amap = ent->amap,
+                    .anon_idx = ent->anon_idx,
+                    .prot = ent->prot,
+                    .max_prot = ent->max_prot,
+                    .flags = ent->flags,
+                    .hook = { },
+                    .interval = { },
+                    .policy = ent->policy
+                });
+            }
+
+            const auto pages = overlap_start - ent->startp;
+
+            ent->startp = overlap_start;
+            ent->endp = overlap_end;
+            if (ent->obj)
+                ent->offp += pages;
+            if (ent->amap)
+                ent->anon_idx += pages;
+            ent->policy = policy;
+
+            update.insert(ent);
+            startp = overlap_end;
+        }
+
+        return { };
+    }
+
+    namespace
+    {
+        // start reading the file pages behind the range into the page cache
+        lib::expect<void> advise_willneed(vmspace &vms, std::uintptr_t startp, std::uintptr_t endp)
+        {
+            const auto locked = vms.tree.lock();
+            for (const auto &ent : locked->overlapping(startp, endp))
+            {
+                if (!ent.obj || ent.obj->type != object_type::file)
+                    continue;
+
+                const auto overlap_start = std::max(startp, ent.startp);
+                const auto overlap_end = std::min(endp, ent.endp);
+
+                sched::schedule_work([
+                    obj = ent.obj,
+                    first = ent.offp + (overlap_start - ent.startp),
+                    count = overlap_end - overlap_start
+                ] {
+                    const auto num_alloc_pages = default_npsize() / pmm::page_size;
+                    for (std::size_t i = 0; i < count; i += object::max_readahead)
+                    {
+                        page *chunk[object::max_readahead] { };
+                        std::span<page *> pages { chunk, std::min(object::max_readahead, count - i) };
+
+                        if (!obj->read_pages(first + i, pages, 0))
+                            break;
+
+                        for (auto *pg : pages)
+                        {
+                            if (pg && pg->unref())
+                                pmm::free(paddr_from(pg), num_alloc_pages);
+                        }
+                    }
+                });
+            }
+            return { };
+        }
+
+        // dontneed drops private pages right away and zaps the ptes of shared
+        // ones. free only marks exclusive anonymous pages so that reclaim can
+        // drop them as long as nobody writes to them first
+        lib::expect<void> advise_discard(vmspace &vms, std::uintptr_t startp, std::uintptr_t endp, bool lazy)
+        {
+            const auto psize = default_psize();
+            const auto npsize = pagemap::from_page_size(psize);
+
+            auto locked = vms.tree.lock();
+            {
+                for (const auto &ent : locked->overlapping(startp, endp))
+                {
+                    if (ent.flags & flag::untouchable)
+                        return std::unexpected { lib::err::invalid_argument };
+                    if (ent.obj && ent.obj->type == object_type::mmio)
+                        return std::unexpected { lib::err::invalid_argument };
+                    if (lazy && !((ent.flags & flag::anonymous) && (ent.flags & flag::private_)))
+                        return std::unexpected { lib::err::invalid_argument };
+                }
+            }
+
+            tree_update update { vms, locked };
+            mmu_gather tlb { *vms.pmap };
+            for (auto &ent : locked->overlapping(startp, endp))
+            {
+                update.lock(std::addressof(ent));
+
+                const auto overlap_start = std::max(startp, ent.startp);
+                const auto overlap_end = std::min(endp, ent.endp);
+
+                const auto vaddr = overlap_start * npsize;
+                const auto len = (overlap_end - overlap_start) * npsize;
+
+                const auto count = overlap_end - overlap_start;
+
+                if (lazy)
+                {
+                    // never written to, nothing to free
+                    if (!ent.amap)
+                        continue;
+
+                    // the other side of a fork still sees these pages and
+                    // their swap slots, a hint is free to leave them be
+                    if (ent.amap.use_count() != 1 || ent.amap->cow.load(std::memory_order_acquire))
+                        continue;
+
+                    const auto first = ent.anon_idx + (overlap_start - ent.startp);
+                    {
+                        const std::unique_lock _ { ent.amap->lock };
+                        ent.amap->for_each(first, count, [](std::size_t, anon::ptr &slot) {
+                            if (slot.use_count() != 1)
+                                return;
+
+                            // no need to keep the compressed copy either
+                            auto *pg = slot->pg;
+                            if (!pg)
+                            {
+                                if (slot->swap != 0)
+                                    zram::release(std::exchange(slot->swap, 0));
+                                return;
+                            }
+
+                            if (pg->refcount.load(std::memory_order_acquire) == 1)
+                                pg->flags.fetch_or(page::flag::lazyfree, std::memory_order_relaxed);
+                        });
+                    }
+
+                    // the next store has to fault to take the page back
+                    if (ent.prot & prot::write)
+                    {
+                        const auto pflags = prot_to_pflags(ent.prot & ~prot::write);
+                        if (const auto ret = tlb.protect(vaddr, len, pflags, psize); !ret)
+                        {
+                            if (ret.error() != lib::err::invalid_address)
+                                return std::unexpected { ret.error() };
+                        }
+                    }
+                    continue;
+                }
+
+                if (const auto ret = tlb.unmap(vaddr, len, psize); !ret)
+                {
+                    if (ret.error() != lib::err::invalid_address)
+                        return std::unexpected { ret.error() };
+                }
+
+                if (!ent.amap)
+                    continue;
+
+                // the other side of a fork keeps seeing the old pages
+                if (ent.amap->cow.load(std::memory_order_acquire) && ent.amap.use_count() != 1)
+                {
+                    anon_map::ptr copy;
+                    {
+                        const std::unique_lock _ { ent.amap->lock };
+                        copy = ent.amap->copy(ent.anon_idx, ent.endp - ent.startp);
+                    }
+                    ent.amap = std::move(copy);
+                    ent.anon_idx = 0;
+                }
+                else ent.amap->cow.store(false, std::memory_order_release);
+
+                release_anons(tlb, *ent.amap, ent.anon_idx + (overlap_start - ent.startp), count);
+            }
+            return { };
+        }
+    } // namespace
+
+    lib::expect<void> vmspace::advise(std::uintptr_t address, std::size_t length, madv_t advice)
+    {
+        const auto npsize = default_npsize();
+        if (address % npsize)
+            return std::unexpected { lib::err::invalid_argument };
+
+        const auto orig_length = length;
+        length = lib::align_up(length, npsize);
+        if (length < orig_length)
+            return std::unexpected { lib::err::invalid_argument };
+
+        if (length == 0)
+            return { };
+
+        if (!valid_user_range(address, length))
+            return std::unexpected { lib::err::out_of_memory };
+
+        auto startp = address / npsize;
+        const auto endp = (address + length) / npsize;
+
+        flag_t set = 0;
+        flag_t clear = 0;
+        switch (advice)
+        {
+            case madv::normal:
+                clear = flag::seq_read | flag::rand_read;
+                break;
+            case madv::random:
+                set = flag::rand_read;
+                clear = flag::seq_read;
+                break;
+            case madv::sequential:
+                set = flag::seq_read;
+                clear = flag::rand_read;
+                break;
+            case madv::hugepage_:
+                set = flag::hugepage;
+                clear = flag::nohugepage;
+                break;
+            case madv::nohugepage_:
+                set = flag::nohugepage;
+                clear = flag::hugepage;
+                break;
+            case madv::willneed:
+                return advise_willneed(*this, startp, endp);
+            case madv::dontneed:
+                return advise_discard(*this, startp, endp, false);
+            case madv::free_:
+                return advise_discard(*this, startp, endp, true);
+            default:
+                return std::unexpected { lib::err::invalid_argument };
+        }
+
+        auto locked = tree.lock();
+        tree_update update { *this, locked };
+        while (startp < endp)
+        {
+            const auto overlapping = locked->overlapping(startp, endp);
+
+            auto it = overlapping.begin();
+            if (it == overlapping.end())
+                break;
+
+            auto *ent = it.value();
+            update.lock(ent);
+
+            const auto overlap_start = std::max(startp, ent->startp);
+            const auto overlap_end = std::min(endp, ent->endp);
+
+            const auto new_flags = (ent->flags & ~clear) | set;
+            if (new_flags == ent->flags)
+            {
+                startp = overlap_end;
+                continue;
+            }
+
+            update.remove(ent);
+
+            if (ent->endp > overlap_end)
+            {
+                const auto pages = overlap_end - ent->startp;
+
+                const auto obj_offp = ent->obj ? ent->offp + pages : 0;
+                const auto anon_idx = ent->amap ? ent->anon_idx + pages : 0;
+
+                update.insert(new entry {
+                    .startp = overlap_end,
+                    .endp = ent->endp,
+                    .obj = ent->obj,
+                    .offp = obj_offp,
+                    .amap = ent->amap,
+                    .anon_idx = anon_idx,
+                    .prot = ent->prot,
+                    .max_prot = ent->max_prot,
+                    .flags = ent->flags,
+                    .hook = { },
+                    .interval = { },
+                    .policy = ent->policy
+                });
+            }
+
+            if (ent->startp < overlap_start)
+            {
+                update.insert(new entry {
+                    .startp = ent->startp,
+                    .endp = overlap_start,
+                    .obj = ent->obj,
+                    .offp = ent->offp,
+                    .amap = ent->amap,
+                    .anon_idx = ent->anon_idx,
+                    .prot = ent->prot,
+                    .max_prot = ent->max_prot,
+                    .flags = ent->flags,
+                    .hook = { },
+                    .interval = { },
+                    .policy = ent->policy
+                });
+            }
+
+            const auto pages = overlap_start - ent->startp;
+
+            ent->startp = overlap_start;
+            ent->endp = overlap_end;
+            if (ent->obj)
+                ent->offp += pages;
+            if (ent->amap)
+                ent->anon_idx += pages;
+            ent->flags = new_flags;
+
+            update.insert(ent);
+            startp = overlap_end;
+        }
+
+        return { };
+    }
+
+    lib::expect<void> vmspace::sync(std::uintptr_t address, std::size_t length, bool wait, bool invalidate)
+    {
+        const auto psize = default_psize();
+        const auto npsize = pagemap::from_page_size(psize);
+        if (address % npsize)
+            return std::unexpected { lib::err::invalid_argument };
+
+        const auto orig_length = length;
+        length = lib::align_up(length, npsize);
+        if (length < orig_length)
+            return std::unexpected { lib::err::out_of_memory };
+
+        if (length == 0)
+            return { };
+
+        if (!valid_user_range(address, length))
+            return std::unexpected { lib::err::out_of_memory };
+
+        const auto startp = address / npsize;
+        const auto endp = (address + length) / npsize;
+
+        struct range
+        {
+            object::ptr obj;
+            std::uint64_t offp;
+            std::size_t count;
+            bool write;
+        };
+        std::vector<range> ranges;
+
+        {
+            auto locked = tree.lock();
+            const auto overlapping = locked->overlapping(startp, endp);
+
+            const auto total_pages = std::accumulate(
+                std::ranges::begin(overlapping), std::ranges::end(overlapping), 0uz,
+                [startp, endp](std::size_t acc, const entry &ent) {
+                    const auto overlap_start = std::max(startp, ent.startp);
+                    const auto overlap_end = std::min(endp, ent.endp);
+                    return acc + (overlap_end - overlap_start);
+                }
+            );
+
+            if (total_pages < (endp - startp))
+                return std::unexpected { lib::err::out_of_memory };
+
+            tree_update update { *this, locked };
+            mmu_gather tlb { *pmap };
+            for (auto &ent : locked->overlapping(startp, endp))
+            {
+                if (!ent.obj || ent.obj->type != object_type::file)
+                    continue;
+
+                const bool write = (ent.flags & flag::shared) != 0;
+                if (!write && !invalidate)
+                    continue;
+
+                update.lock(std::addressof(ent));
+
+                const auto overlap_start = std::max(startp, ent.startp);
+                const auto overlap_end = std::min(endp, ent.endp);
+
+                const auto vaddr = overlap_start * npsize;
+                const auto len = (overlap_end - overlap_start) * npsize;
+
+                // stores made after this point fault and dirty the page again
+                lib::expect<void> ret { };
+                if (invalidate)
+                    ret = tlb.unmap(vaddr, len, psize);
+                else if (ent.prot & prot::write)
+                    ret = tlb.protect(vaddr, len, prot_to_pflags(ent.prot & ~prot::write), psize);
+
+                if (!ret && ret.error() != lib::err::invalid_address)
+                    return std::unexpected { ret.error() };
+
+                ranges.push_back({
+                    .obj = ent.obj,
+                    .offp = ent.offp + (overlap_start - ent.startp),
+                    .count = overlap_end - overlap_start,
+                    .write = write
+                });
+            }
+        }
+
+        const auto flush = [invalidate](const range &rng) -> lib::expect<void> {
+            if (rng.write)
+            {
+                if (const auto ret = rng.obj->write_back(rng.offp, rng.count); !ret)
+                    return ret;
+            }
+            if (invalidate)
+                rng.obj->drop_cached(rng.offp, rng.count);
+            return { };
+        };
+
+        for (const auto &rng : ranges)
+        {
+            if (!wait)
+            {
+                sched::schedule_work([rng, flush] { lib::unused(flush(rng)); });
+                continue;
+            }
+
+            if (const auto ret = flush(rng); !ret)
+                return ret;
+        }
+        return { };
+    }
+
+    lib::expect<void> vmspace::resident(std::uintptr_t address, std::span<std::uint8_t> vec)
+    {
+        const auto npsize = default_npsize();
+        if (address % npsize)
+            return std::unexpected { lib::err::invalid_argument };
+
+        if (vec.empty())
+            return { };
+
+        if (vec.size() > vspace_top / npsize || !valid_user_range(address, vec.size() * npsize))
+            return std::unexpected { lib::err::out_of_memory };
+
+        const auto startp = address / npsize;
+        const auto endp = startp + vec.size();
+
+        std::ranges::fill(vec, 0);
+
+        const auto locked = tree.lock();
+        const auto overlapping = locked->overlapping(startp, endp);
+
+        std::size_t total_pages = 0;
+        for (const auto &ent : overlapping)
+        {
+            const auto overlap_start = std::max(startp, ent.startp);
+            const auto overlap_end = std::min(endp, ent.endp);
+            total_pages += overlap_end - overlap_start;
+
+            const auto count = overlap_end - overlap_start;
+            const auto sub = vec.subspan(overlap_start - startp, count);
+
+            // device memory is always there
+            if (ent.obj && ent.obj->type == object_type::mmio)
+            {
+                std::ranges::fill(sub, 1);
+                continue;
+            }
+
+            if (ent.obj)
+                ent.obj->resident(ent.offp + (overlap_start - ent.startp), sub);
+
+            if (ent.amap)
+            {
+                const auto first = ent.anon_idx + (overlap_start - ent.startp);
+                const std::unique_lock _ { ent.amap->lock };
+                ent.amap->for_each(first, count, [&](std::size_t idx, anon::ptr &slot) {
+                    sub[idx - first] = slot->pg != nullptr;
+                });
+            }
+
+            // read but never written, the zero page is mapped with no slot
+            if ((ent.flags & flag::anonymous) && (ent.flags & flag::private_))
+            {
+                for (std::size_t i = 0; i < count; i++)
+                {
+                    if (sub[i])
+                        continue;
+
+                    const auto vaddr = (overlap_start + i) * npsize;
+                    if (const auto ret = pmap->translate(vaddr, default_psize()); ret && *ret == zero_page())
+                        sub[i] = 1;
+                }
+            }
+        }
+
+        if (total_pages < vec.size())
+            return std::unexpected { lib::err::out_of_memory };
+
+        return { };
+    }
+
+    vmspace::usage_t vmspace::try_usage()
+    {
+        // a leaf table maps 512 pages
+        constexpr std::size_t ptes_per_table = 512;
+
+        usage_t ret { };
+
+        const auto locked = tree.try_lock();
+        if (!locked.owns_lock())
+            return ret;
+
+        for (const auto &ent : *locked)
+        {
+            const auto count = ent.endp - ent.startp;
+            ret.pgtables += lib::div_roundup(count, ptes_per_table);
+
+            if (ent.obj && ent.obj->type == object_type::shmem)
+                ret.shmem += ent.obj->try_count_resident(ent.offp, count);
+
+            if (!ent.amap)
+                continue;
+
+            const std::unique_lock alock { ent.amap->lock, std::try_to_lock };
+            if (!alock.owns_lock())
+                continue;
+
+            ent.amap->for_each(ent.anon_idx, count, [&](std::size_t, anon::ptr &slot) {
+                if (slot->pg)
+                    ret.anon++;
+                else if (slot->swap != 0)
+                    ret.swap++;
+            });
+        }
+        return ret;
+    }
+
+    lib::expect<std::uintptr_t> vmspace::remap(const remap_options &opts)
     {
         if (opts.old_len == 0 || opts.new_len == 0)
             return std::unexpected { lib::err::invalid_argument };
@@ -1006,6 +2234,8 @@ namespace vmm
         const auto old_endp = (opts.old_addr + old_len) / npsize;
 
         auto locked = tree.lock();
+        tree_update update { *this, locked };
+        mmu_gather tlb { *pmap };
         entry *src = nullptr;
         {
             auto overlapping = locked->overlapping(old_startp, old_endp);
@@ -1023,6 +2253,8 @@ namespace vmm
                 return std::unexpected { lib::err::not_permitted };
         }
 
+        update.lock(src);
+
         if (new_len == old_len && !opts.fixed)
             return opts.old_addr;
 
@@ -1033,12 +2265,15 @@ namespace vmm
             const auto vaddr = drop_start * npsize;
             const auto length = drop_pages * npsize;
 
-            if (const auto ret = pmap->unmap(vaddr, length, psize); !ret)
+            if (const auto ret = tlb.unmap(vaddr, length, psize); !ret)
                 return std::unexpected { ret.error() };
 
-            locked->remove(src);
+            if (src->amap && !src->amap->cow.load(std::memory_order_acquire))
+                release_anons(tlb, *src->amap, src->anon_idx + (drop_start - old_startp), drop_pages);
+
+            update.remove(src);
             src->endp = drop_start;
-            locked->insert(src);
+            update.insert(src);
 
             return opts.old_addr;
         }
@@ -1068,6 +2303,7 @@ namespace vmm
                 if (it == overlap.end())
                     break;
                 auto *ent = it.value();
+                update.lock(ent);
 
                 const auto ovs = std::max(target_startp, ent->startp);
                 const auto ove = std::min(target_endp, ent->endp);
@@ -1075,17 +2311,21 @@ namespace vmm
                 const auto unmap_vaddr = ovs * npsize;
                 const auto unmap_length = (ove - ovs) * npsize;
 
-                if (const auto ret = pmap->unmap(unmap_vaddr, unmap_length, psize); !ret)
+                if (const auto ret = tlb.unmap(unmap_vaddr, unmap_length, psize); !ret)
                     return std::unexpected { ret.error() };
 
-                locked->remove(ent);
+                update.remove(ent);
+
+                // nothing else indexes these slots unless the amap is still shared after fork
+                if (ent->amap && !ent->amap->cow.load(std::memory_order_acquire))
+                    release_anons(tlb, *ent->amap, ent->anon_idx + (ovs - ent->startp), ove - ovs);
 
                 if (ent->endp > target_endp)
                 {
                     const auto pages = target_endp - ent->startp;
                     const auto obj_offp = ent->obj ? ent->offp + pages : 0;
                     const auto anon_idx = ent->amap ? ent->anon_idx + pages : 0;
-                    locked->insert(new entry {
+                    update.insert(new entry {
                         .startp = target_endp,
                         .endp = ent->endp,
                         .obj = ent->obj,
@@ -1096,15 +2336,16 @@ namespace vmm
                         .max_prot = ent->max_prot,
                         .flags = ent->flags,
                         .hook = { },
-                        .interval = { }
+                        .interval = { },
+                        .policy = ent->policy
                     });
                 }
                 if (ent->startp < target_startp)
                 {
                     ent->endp = target_startp;
-                    locked->insert(ent);
+                    update.insert(ent);
                 }
-                else delete ent;
+                else update.retire(ent);
             }
             dst_startp = target_startp;
         }
@@ -1125,42 +2366,41 @@ namespace vmm
 
             if (src->obj && !src->amap)
             {
-                locked->remove(src);
+                update.remove(src);
                 src->endp = grow_end;
-                locked->insert(src);
+                update.insert(src);
             }
             else
             {
                 const auto src_pages = old_len / npsize;
                 const auto total_pages = src_pages + grow_pages;
 
-                anon_map::ptr merged_amap { new anon_map { } };
-                merged_amap->nslots = total_pages;
-                merged_amap->slots = std::make_unique<anon::ptr []>(total_pages);
+                anon_map::ptr merged_amap { new anon_map { total_pages } };
 
                 if (src->amap)
                 {
                     const std::unique_lock _ { src->amap->lock };
-                    for (std::size_t i = 0; i < src_pages; i++)
-                    {
-                        auto &slot = src->amap->slots[src->anon_idx + i];
-                        if (!slot)
-                            continue;
-
+                    src->amap->for_each(src->anon_idx, src_pages, [&](std::size_t idx, anon::ptr &slot) {
                         auto *pg = slot->pg;
+                        if (!pg)
+                        {
+                            // shared like after fork, copied when written to
+                            merged_amap->get(idx - src->anon_idx) = slot;
+                            return;
+                        }
                         pg->ref();
-                        merged_amap->slots[i] = new anon {
+                        merged_amap->get(idx - src->anon_idx) = new anon {
                             .pg = pg,
                             .hook = { }
                         };
-                    }
+                    });
                 }
 
-                locked->remove(src);
+                update.remove(src);
                 src->amap = std::move(merged_amap);
                 src->anon_idx = 0;
                 src->endp = grow_end;
-                locked->insert(src);
+                update.insert(src);
             }
             return opts.old_addr;
         }
@@ -1176,53 +2416,52 @@ namespace vmm
         const auto dst_endp = dst_startp + (new_len / npsize);
         const auto dst_old_endp = dst_startp + src_pages;
 
-        if (const auto ret = pmap->unmap(opts.old_addr, old_len, psize); !ret)
+        if (const auto ret = tlb.unmap(opts.old_addr, old_len, psize); !ret)
             return std::unexpected { ret.error() };
 
-        locked->remove(src);
+        update.remove(src);
         src->startp = dst_startp;
         src->endp = dst_old_endp;
-        locked->insert(src);
+        update.insert(src);
 
         if (new_len > old_len)
         {
             if (src->obj && !src->amap)
             {
-                locked->remove(src);
+                update.remove(src);
                 src->endp = dst_endp;
-                locked->insert(src);
+                update.insert(src);
             }
             else
             {
                 const auto total_pages = new_len / npsize;
 
-                anon_map::ptr merged_amap { new anon_map { } };
-                merged_amap->nslots = total_pages;
-                merged_amap->slots = std::make_unique<anon::ptr []>(total_pages);
+                anon_map::ptr merged_amap { new anon_map { total_pages } };
 
                 if (src->amap)
                 {
                     const std::unique_lock _ { src->amap->lock };
-                    for (std::size_t i = 0; i < src_pages; i++)
-                    {
-                        auto &slot = src->amap->slots[src->anon_idx + i];
-                        if (!slot)
-                            continue;
-
+                    src->amap->for_each(src->anon_idx, src_pages, [&](std::size_t idx, anon::ptr &slot) {
                         auto *pg = slot->pg;
+                        if (!pg)
+                        {
+                            // shared like after fork, copied when written to
+                            merged_amap->get(idx - src->anon_idx) = slot;
+                            return;
+                        }
                         pg->ref();
-                        merged_amap->slots[i] = new anon {
+                        merged_amap->get(idx - src->anon_idx) = new anon {
                             .pg = pg,
                             .hook = { }
                         };
-                    }
+                    });
                 }
 
-                locked->remove(src);
+                update.remove(src);
                 src->amap = std::move(merged_amap);
                 src->anon_idx = 0;
                 src->endp = dst_endp;
-                locked->insert(src);
+                update.insert(src);
             }
         }
 
@@ -1258,19 +2497,22 @@ namespace vmm
         const auto psize = default_psize();
         const auto npsize = pagemap::from_page_size(psize);
 
-        auto ret = std::make_shared<vmspace>();
-        ret->pmap = std::move(cpmap);
+        auto ret = std::make_shared<vmspace>(std::move(cpmap));
         ret->brk_start = brk_start;
         ret->current_brk = current_brk;
 
         auto locked = tree.lock();
         auto clocked = ret->tree.lock();
 
-        for (const auto &ent : *locked)
+        tree_update update { *this, locked };
+        tree_update cupdate { *ret, clocked };
+        mmu_gather tlb { *pmap };
+
+        for (auto &ent : *locked)
         {
             if (ent.flags & flag::shared)
             {
-                clocked->insert(new entry {
+                cupdate.insert(new entry {
                     .startp = ent.startp,
                     .endp = ent.endp,
                     .obj = ent.obj,
@@ -1281,48 +2523,32 @@ namespace vmm
                     .max_prot = ent.max_prot,
                     .flags = ent.flags,
                     .hook = { },
-                    .interval = { }
+                    .interval = { },
+                    .policy = ent.policy
                 });
                 continue;
             }
 
-            anon_map::ptr camap;
-            if (ent.amap)
-            {
-                const auto span = ent.endp - ent.startp;
-
-                camap = new anon_map { };
-                camap->nslots = span;
-                camap->slots = std::make_unique<anon::ptr[]>(camap->nslots);
-
-                const std::unique_lock _ { ent.amap->lock };
-                for (std::size_t i = 0; i < span; i++)
-                {
-                    auto &slot = ent.amap->slots[ent.anon_idx + i];
-                    if (!slot)
-                        continue;
+            // no fault may map a page writable past this point
+            update.lock(std::addressof(ent));
 
-                    auto *pg = slot->pg;
-                    pg->ref();
-                    camap->slots[i] = new anon {
-                        .pg = pg,
-                        .hook = { }
-                    };
-                }
-            }
+            // the child shares the amap until either side changes a slot
+            if (ent.amap)
+                ent.amap->cow.store(true, std::memory_order_release);
 
-            clocked->insert(new entry {
+            cupdate.insert(new entry {
                 .startp = ent.startp,
                 .endp = ent.endp,
                 .obj = ent.obj,
                 .offp = ent.offp,
-                .amap = camap,
-                .anon_idx = 0,
+                .amap = ent.amap,
+                .anon_idx = ent.anon_idx,
                 .prot = ent.prot,
                 .max_prot = ent.max_prot,
                 .flags = ent.flags,
                 .hook = { },
-                .interval = { }
+                .interval = { },
+                .policy = ent.policy
             });
 
             if (ent.prot & prot::write)
@@ -1331,16 +2557,67 @@ namespace vmm
                 const auto length = (ent.endp - ent.startp) * npsize;
 
                 const auto pflags = prot_to_pflags(ent.prot & ~prot::write);
-                lib::unused(pmap->protect(vaddr, length, pflags, psize));
+                lib::unused(tlb.protect(vaddr, length, pflags, psize));
             }
         }
 
         return ret;
     }
 
+    void mmu_gather::finish()
+    {
+        if (_full)
+            _pmap.invalidate_all();
+        else
+        {
+            if (_fr.valid())
+                _pmap.invalidate(_fr.start, _fr.length());
+            if (_lfr.valid())
+                _pmap.invalidate(_lfr.start, _lfr.length(), true);
+        }
+
+        _fr = { };
+        _lfr = { };
+        _full = false;
+
+        for (std::size_t i = 0; i < _nr_anons; i++)
+            _anons[i] = nullptr;
+        _nr_anons = 0;
+    }
+
+    vmspace::vmspace(std::shared_ptr<pagemap> pmap) : pmap { std::move(pmap) }
+    {
+        vmspaces.lock()->push_back(this);
+    }
+
+    vmspace::~vmspace()
+    {
+        vmspaces.lock()->remove(this);
+
+        lib::panic_if(pmap.use_count() != 1);
+        {
+            // one flush of the whole asid before any page goes
+            mmu_gather tlb { *pmap };
+            tlb.flush_all();
+        }
+        tree.lock()->clear([](entry *x) {
+            // object and anon free their pages
+            delete x;
+        });
+
+        // nobody can look this vmspace up any more
+        delete index.unsafe_load();
+    }
+
     anon::~anon()
     {
-        lib::bug_on(!pg);
+        if (!pg)
+        {
+            if (swap != 0)
+                zram::release(swap);
+            return;
+        }
+
         if (pg->unref())
         {
             const auto npsize = default_npsize();
@@ -1349,6 +2626,121 @@ namespace vmm
         }
     }
 
+    anon_map::anon_map(std::size_t nslots) : _height { 0 }, nslots { nslots }
+    {
+        while (nslots > (1uz << ((_height + 1) * radix_bits)))
+            _height++;
+    }
+
+    anon_map::~anon_map()
+    {
+        if (_root)
+            destroy(_root, _height);
+    }
+
+    void anon_map::destroy(void *ptr, std::size_t level)
+    {
+        if (level == 0)
+        {
+            delete static_cast<leaf *>(ptr);
+            return;
+        }
+
+        auto *nd = static_cast<node *>(ptr);
+        for (auto *child : nd->children)
+        {
+            if (child)
+                destroy(child, level - 1);
+        }
+        delete nd;
+    }
+
+    anon::ptr *anon_map::find(std::size_t idx) const
+    {
+        if (idx >= nslots)
+            return nullptr;
+
+        auto *ptr = _root;
+        for (auto level = _height; level > 0 && ptr; level--)
+            ptr = static_cast<node *>(ptr)->children[(idx >> (level * radix_bits)) & (radix - 1)];
+
+        if (!ptr)
+            return nullptr;
+        return &static_cast<leaf *>(ptr)->slots[idx & (radix - 1)];
+    }
+
+    anon::ptr &anon_map::get(std::size_t idx)
+    {
+        lib::bug_on(idx >= nslots);
+
+        auto **ptr = &_root;
+        for (auto level = _height; level > 0; level--)
+        {
+            if (!*ptr)
+                *ptr = new node { };
+            ptr = &static_cast<node *>(*ptr)->children[(idx >> (level * radix_bits)) & (radix - 1)];
+        }
+
+        if (!*ptr)
+            *ptr = new leaf { };
+        return static_cast<leaf *>(*ptr)->slots[idx & (radix - 1)];
+    }
+
+    bool anon_map::clear(void *ptr, std::size_t level, std::size_t base, std::size_t first, std::size_t last)
+    {
+        const auto shift = level * radix_bits;
+
+        bool empty = true;
+        for (std::size_t i = 0; i < radix; i++)
+        {
+            const auto cbase = base + (i << shift);
+            const bool inside = cbase < last && cbase + (1uz << shift) > first;
+
+            if (level == 0)
+            {
+                auto &slot = static_cast<leaf *>(ptr)->slots[i];
+                if (inside)
+                    slot = nullptr;
+                else if (slot)
+                    empty = false;
+                continue;
+            }
+
+            auto &child = static_cast<node *>(ptr)->children[i];
+            if (!child)
+                continue;
+
+            if (inside && clear(child, level - 1, cbase, first, last))
+            {
+                destroy(child, level - 1);
+                child = nullptr;
+            }
+            else empty = false;
+        }
+        return empty;
+    }
+
+    anon_map::ptr anon_map::copy(std::size_t first, std::size_t count)
+    {
+        ptr ret { new anon_map { count } };
+        for_each(first, count, [&](std::size_t idx, anon::ptr &slot) {
+            ret->get(idx - first) = slot;
+        });
+        return ret;
+    }
+
+    void anon_map::clear(std::size_t first, std::size_t count)
+    {
+        if (!_root || count == 0 || first >= nslots)
+            return;
+
+        if (clear(_root, _height, 0, first, std::min(first + count, nslots)))
+        {
+            destroy(_root, _height);
+            _root = nullptr;
+        }
+    }
+
     bool handle_spurious_pfault(const pfault_state &state)
     {
         if (!state.is_present || (!state.is_write && !state.is_exec))
@@ -1410,20 +2802,88 @@ namespace vmm
         std::uintptr_t endp = 0;
         std::uint64_t obj_offp;
         std::uint64_t anon_idx;
+        numa::mempolicy policy;
+
+        entry_ref held = hold_entry(*vmspace, aligned / npsize);
+        if (!held)
+            return false;
+
+        // first change to an amap shared by fork. the last holder keeps it
+        const auto needs_copy = [&](const entry *ent) {
+            if (!ent->amap || !ent->amap->cow.load(std::memory_order_acquire))
+                return false;
+            if (state.is_write)
+                return true;
+
+            // a read only adds slots when it populates a huge page, the
+            // zero page is mapped without one
+            if (!(ent->flags & flag::anonymous) || psize != page_size::small || !thp_allowed(ent->flags))
+                return false;
+
+            const auto nsub = pagemap::from_page_size(page_size::medium) / npsize;
+            const auto hstartp = lib::align_down(state.address, nsub * npsize) / npsize;
+            if (hstartp < ent->startp || hstartp + nsub > ent->endp)
+                return false;
+
+            const std::unique_lock _ { ent->amap->lock };
+            const auto hidx = ent->anon_idx + (hstartp - ent->startp);
+            for (std::size_t i = 0; i < nsub; i++)
+            {
+                if (ent->amap->lookup(hidx + i))
+                    return false;
+            }
+            return true;
+        };
+
+        if (needs_copy(held.get()))
+        {
+            // locking the entry waits for every fault holding it, this one too
+            held.reset();
+
+            auto locked = vmspace->tree.lock();
+            const auto ret = locked->overlapping(aligned / npsize, (aligned / npsize) + 1);
+            if (ret.empty())
+                return false;
+
+            auto *ent = ret.begin().value();
+            {
+                tree_update update { *vmspace, locked };
+                update.lock(ent);
+
+                if (needs_copy(ent))
+                {
+                    if (ent->amap.use_count() == 1)
+                        ent->amap->cow.store(false, std::memory_order_release);
+                    else
+                    {
+                        anon_map::ptr copy;
+                        {
+                            const std::unique_lock _ { ent->amap->lock };
+                            copy = ent->amap->copy(ent->anon_idx, ent->endp - ent->startp);
+                        }
+                        ent->amap = std::move(copy);
+                        ent->anon_idx = 0;
+                    }
+                }
+            }
 
-        {
-            const auto locked = vmspace->tree.lock();
-            const auto ret = locked->overlapping(aligned / npsize, (aligned / npsize) + 1);
-            if (ret.empty())
+            if (!entry_get(ent))
                 return false;
+            held = entry_ref { ent };
+        }
 
-            auto &entry = ret.front();
+        {
+            const auto &entry = *held.get();
 
             prot = entry.prot;
             flags = entry.flags;
             startp = entry.startp;
             endp = entry.endp;
 
+            policy = entry.policy;
+            if (policy.mode == numa::policy_mode::default_)
+                policy = thread->mempolicy;
+
             if (entry.obj)
             {
                 obj = entry.obj;
@@ -1465,6 +2925,13 @@ namespace vmm
 
         std::uintptr_t paddr = 0;
 
+        // set when a whole huge page was populated for this fault
+        const auto hnpsize = pagemap::from_page_size(page_size::medium);
+        const auto nsub = hnpsize / npsize;
+        std::uintptr_t huge_vaddr = 0;
+        std::uintptr_t huge_paddr = 0;
+        std::uint64_t huge_idx = 0;
+
         page *pinned = nullptr;
         const auto check_pinned = [&] {
             if (pinned && pinned->unref())
@@ -1473,18 +2940,49 @@ namespace vmm
 
         bool from_amap = false;
 
+        // resident neighbours of a file read fault, referenced until mapped
+        page *around[object::max_readahead] { };
+        std::uint64_t around_start = 0;
+        std::size_t around_count = 0;
+
+        const auto drop_around = [&] {
+            for (std::size_t i = 0; i < around_count; i++)
+            {
+                if (around[i] && around[i]->unref())
+                    pmm::free(paddr_from(around[i]), num_alloc_pages);
+            }
+            around_count = 0;
+        };
+
         const auto fetch = [&](std::uint64_t want) -> page * {
             page *chunk[object::max_readahead] { };
 
             auto start = want;
             auto end = start + 1;
 
-            if (obj->type == object_type::file)
+            // madvise picks the readahead window: none for random access,
+            // forward from the fault for sequential and the aligned chunk otherwise
+            if (obj->type == object_type::file && !(flags & flag::rand_read))
             {
-                start = std::max(lib::align_down(want, object::max_readahead), obj_offp);
+                if (flags & flag::seq_read)
+                    start = want;
+                else
+                    start = std::max(lib::align_down(want, object::max_readahead), obj_offp);
                 end = std::min(start + object::max_readahead, obj_offp + (endp - startp));
             }
 
+            // a sequential mapping that misses, or reaches the marker, has
+            // the next window read in the background while this one is read
+            if (obj->type == object_type::file && (flags & flag::seq_read) && end < obj_offp + (endp - startp))
+            {
+                const auto [missing, marker] = obj->probe(want, 1);
+                if (missing || marker)
+                {
+                    const auto ahead = std::min<std::size_t>(readahead_pages(), obj_offp + (endp - startp) - end);
+                    force_readahead(obj, end, ahead, true);
+                }
+            }
+
             std::span<page *> pages { chunk, end - start };
             if (const auto ret = obj->read_pages(start, pages, want - start); !ret.has_value())
             {
@@ -1496,17 +2994,51 @@ namespace vmm
                 return nullptr;
             }
 
+            // keep the window around the fault that read_pages brought in
+            auto wstart = want;
+            auto wend = want + 1;
+            if (obj->type == object_type::file && !state.is_write)
+            {
+                const auto window = fault_around_bytes.load(std::memory_order_relaxed) / npsize;
+                if (window > 1)
+                {
+                    const auto vpage = aligned / npsize;
+                    wstart = want - std::min(vpage - lib::align_down(vpage, window), want - start);
+                    wend = std::min(wstart + window, end);
+                }
+            }
+
             auto *wanted = chunk[want - start];
-            for (auto *pg : pages)
+            for (std::size_t i = 0; i < pages.size(); i++)
             {
-                if (pg && pg != wanted && pg->unref())
+                auto *pg = pages[i];
+                if (!pg || pg == wanted)
+                    continue;
+
+                const auto idx = start + i;
+                if (idx >= wstart && idx < wend)
+                {
+                    if (around_count == 0)
+                        around_start = idx;
+                    around[idx - around_start] = pg;
+                    around_count = idx - around_start + 1;
+                    continue;
+                }
+
+                if (pg->unref())
                     pmm::free(paddr_from(pg), num_alloc_pages);
             }
             return wanted;
         };
 
+        // interleave goes by the page's index in the mapping
+        const auto alloc_for = [&](std::size_t count, bool clear, std::uintptr_t vaddr) {
+            const auto [node, mask] = numa::resolve(policy, vaddr / npsize - startp);
+            return pmm::try_alloc_node(count, clear, node, mask);
+        };
+
         const auto copy_old = [&](page *opg, anon::ptr &slot, bool is_file) {
-            paddr = pmm::alloc(num_alloc_pages, false);
+            paddr = alloc_for(num_alloc_pages, false, aligned);
             if (paddr == 0)
                 return false;
 
@@ -1535,6 +3067,55 @@ namespace vmm
             return true;
         };
 
+        // called with amap->lock held
+        const auto alloc_huge = [&] {
+            const auto hvaddr = lib::align_down(state.address, hnpsize);
+            const auto hstartp = hvaddr / npsize;
+            if (hstartp < startp || hstartp + nsub > endp)
+                return false;
+
+            const auto hidx = anon_idx + (hstartp - startp);
+            for (std::size_t i = 0; i < nsub; i++)
+            {
+                if (amap->lookup(hidx + i))
+                    return false;
+            }
+
+            const auto hpaddr = alloc_for(nsub, true, hvaddr);
+            if (hpaddr == 0 || hpaddr % hnpsize)
+            {
+                if (hpaddr != 0)
+                    pmm::free(hpaddr, nsub);
+                vmstat::add(vmstat::item::thp_fault_fallback);
+                return false;
+            }
+
+            // every subpage is its own anon, so splitting the mapping later
+            // is purely a page table operation
+            pmm::split(hpaddr, nsub);
+            for (std::size_t i = 0; i < nsub; i++)
+            {
+                auto *pg = page_for(hpaddr + i * npsize);
+                pg->refcount.store(1, std::memory_order_relaxed);
+                pg->flags.store(page::flag::anonymous, std::memory_order_relaxed);
+
+                amap->get(hidx + i) = pg->anon_ptr = new anon {
+                    .pg = pg,
+                    .hook = { }
+                };
+            }
+
+            huge_vaddr = hvaddr;
+            huge_paddr = hpaddr;
+            huge_idx = hidx;
+
+            paddr = hpaddr + (aligned - hvaddr);
+            from_amap = true;
+
+            vmstat::add(vmstat::item::thp_fault_alloc);
+            return true;
+        };
+
         if (flags & flag::anonymous)
         {
             if (flags & flag::private_)
@@ -1542,24 +3123,43 @@ namespace vmm
                 lib::bug_on(!amap);
                 const std::unique_lock _ { amap->lock };
 
-                if (auto &slot = amap->slots[anon_idx + offp])
+                if (auto *slot = amap->find(anon_idx + offp); slot && *slot)
                 {
-                    auto *opg = slot->pg;
-                    if (state.is_write && opg->refcount.load(std::memory_order_acquire) != 1)
+                    if (!swap_in(**slot))
+                        return false;
+
+                    auto *opg = (*slot)->pg;
+                    // the anon may still be shared with the other side of a fork
+                    const bool shared = slot->use_count() != 1 ||
+                        opg->refcount.load(std::memory_order_acquire) != 1;
+                    if (state.is_write && shared)
                     {
-                        if (!copy_old(opg, slot, false))
+                        if (!copy_old(opg, *slot, false))
                             return false;
                         goto end;
                     }
 
+                    // written again after MADV_FREE, so the contents matter
+                    if (state.is_write)
+                        opg->flags.fetch_and(~page::flag::lazyfree, std::memory_order_relaxed);
+
                     opg->ref();
                     pinned = opg;
                     paddr = paddr_from(opg);
                     from_amap = true;
                 }
+                else if (psize == page_size::small && thp_allowed(flags) && alloc_huge())
+                    goto end;
+                else if (!state.is_write)
+                {
+                    // read only like every private pte, so the first store
+                    // faults again and gets a real page below
+                    paddr = zero_page();
+                    vmstat::add(vmstat::item::zero_page_map);
+                }
                 else // not present or not in anon
                 {
-                    paddr = pmm::alloc(num_alloc_pages, true);
+                    paddr = alloc_for(num_alloc_pages, true, aligned);
                     if (paddr == 0)
                         return false;
 
@@ -1567,7 +3167,7 @@ namespace vmm
                     pg->refcount.store(1, std::memory_order_relaxed);
                     pg->flags.store(page::flag::anonymous, std::memory_order_relaxed);
 
-                    amap->slots[anon_idx + offp] = pg->anon_ptr = new anon {
+                    amap->get(anon_idx + offp) = pg->anon_ptr = new anon {
                         .pg = pg,
                         .hook = { }
                     };
@@ -1598,7 +3198,7 @@ namespace vmm
                 if (!state.is_present)
                 {
                     page *opg = nullptr;
-                    if (!amap->slots[anon_idx + offp])
+                    if (!amap->lookup(anon_idx + offp))
                     {
                         lib::bug_on(!obj);
                         opg = fetch(obj_offp + offp);
@@ -1607,7 +3207,11 @@ namespace vmm
                     }
                     else
                     {
-                        opg = amap->slots[anon_idx + offp]->pg;
+                        auto *an = amap->lookup(anon_idx + offp);
+                        if (!swap_in(*an))
+                            return false;
+
+                        opg = an->pg;
                         opg->ref();
                         from_amap = true;
                     }
@@ -1619,7 +3223,7 @@ namespace vmm
                     }
                     else
                     {
-                        if (!copy_old(opg, amap->slots[anon_idx + offp], true))
+                        if (!copy_old(opg, amap->get(anon_idx + offp), true))
                         {
                             if (opg->unref())
                                 pmm::free(paddr_from(opg), num_alloc_pages);
@@ -1631,10 +3235,13 @@ namespace vmm
                 else // write
                 {
                     page *opg = nullptr;
-                    if (amap->slots[anon_idx + offp])
+                    if (const auto *slot = amap->find(anon_idx + offp); slot && *slot)
                     {
-                        opg = amap->slots[anon_idx + offp]->pg;
-                        if (opg->refcount.load(std::memory_order_acquire) == 1)
+                        if (!swap_in(**slot))
+                            return false;
+
+                        opg = (*slot)->pg;
+                        if (slot->use_count() == 1 && opg->refcount.load(std::memory_order_acquire) == 1)
                         {
                             opg->ref();
                             pinned = opg;
@@ -1652,7 +3259,7 @@ namespace vmm
                             return false;
                     }
 
-                    if (!copy_old(opg, amap->slots[anon_idx + offp], true))
+                    if (!copy_old(opg, amap->get(anon_idx + offp), true))
                     {
                         if (opg->unref())
                             pmm::free(paddr_from(opg), num_alloc_pages);
@@ -1673,65 +3280,493 @@ namespace vmm
                 paddr = paddr_from(fetched);
 
                 if (state.is_write)
-                    fetched->flags.fetch_or(page::flag::dirty, std::memory_order_relaxed);
+                    obj->set_dirty(fetched);
             }
         }
 
         end:
 
         {
-            const auto locked = vmspace->tree.lock();
-            const auto ret = locked->overlapping(aligned / npsize, (aligned / npsize) + 1);
-
-            if (ret.empty())
-                goto fail;
-
-            auto &entry = ret.front();
-
-            if (entry.flags != flags)
-                goto fail;
-
-            if (!(entry.prot & prot::read))
-                goto fail;
-            if (state.is_write && !(entry.prot & prot::write))
-                goto fail;
-            if (state.is_exec && !(entry.prot & prot::exec))
-                goto fail;
-
-            const auto new_offp = (aligned / npsize) - entry.startp;
-
-            if (obj && (entry.obj != obj || (entry.offp + new_offp) != (obj_offp + offp)))
-                goto fail;
-            if (amap && (entry.amap != amap || (entry.anon_idx + new_offp) != (anon_idx + offp)))
-                goto fail;
+            // held all along, so the entry is exactly what the fault started with
+            const auto &entry = *held.get();
 
             prot = entry.prot;
-            if ((flags & flag::private_) && (entry.prot & prot::write) && !state.is_write)
+            if (needs_write_fault(entry) && (entry.prot & prot::write) && !state.is_write)
                 prot &= ~prot::write;
 
             const auto map = [&] {
+                if (pinned && !from_amap && paddr == paddr_from(pinned))
+                    mark_mapped(pinned);
                 return !!vmspace->pmap->map(aligned, paddr, npsize, prot_to_pflags(prot), psize);
             };
 
+            // called with amap->lock held
+            const auto map_huge = [&] {
+                const auto hstartp = huge_vaddr / npsize;
+                if (hstartp < entry.startp || hstartp + nsub > entry.endp)
+                    return false;
+
+                for (std::size_t i = 0; i < nsub; i++)
+                {
+                    const auto *an = amap->lookup(huge_idx + i);
+                    if (!an || an->pg != page_for(huge_paddr + i * npsize))
+                        return false;
+                }
+
+                // fresh private pages are not shared with anyone yet
+                return !!vmspace->pmap->map(
+                    huge_vaddr, huge_paddr, hnpsize,
+                    prot_to_pflags(entry.prot), page_size::medium
+                );
+            };
+
             const auto mapped = [&] {
                 if (!amap)
                     return map();
 
                 const std::unique_lock _ { amap->lock };
 
-                const auto &slot = amap->slots[anon_idx + offp];
-                if (from_amap ? (!slot || slot->pg != page_for(paddr)) : static_cast<bool>(slot))
+                const auto *an = amap->lookup(anon_idx + offp);
+                if (from_amap ? (!an || an->pg != page_for(paddr)) : an != nullptr)
+                    return true;
+
+                if (huge_vaddr != 0 && map_huge())
                     return true;
 
                 return map();
             } ();
 
+            // neighbours go in read only, so that private mappings still copy
+            // on write and shared ones still get dirtied on the first store
+            const auto map_around = [&] {
+                if (!obj || entry.obj != obj)
+                    return;
+
+                std::unique_lock<sched::mutex_t> alock;
+                if (amap)
+                    alock = std::unique_lock { amap->lock };
+
+                const auto pflags = prot_to_pflags(entry.prot & ~prot::write);
+                for (std::size_t i = 0; i < around_count; i++)
+                {
+                    const auto objp = around_start + i;
+                    if (!around[i] || objp < entry.offp)
+                        continue;
+
+                    const auto vpage = entry.startp + (objp - entry.offp);
+                    if (vpage >= entry.endp)
+                        continue;
+
+                    // a private copy already replaced this page
+                    if (amap && amap->lookup(entry.anon_idx + (vpage - entry.startp)))
+                        continue;
+
+                    const auto vaddr = vpage * npsize;
+                    if (vmspace->pmap->is_mapped(vaddr))
+                        continue;
+
+                    mark_mapped(around[i]);
+                    if (!vmspace->pmap->map(vaddr, paddr_from(around[i]), npsize, pflags, psize))
+                        break;
+                }
+            };
+
+            if (mapped && around_count != 0)
+                map_around();
+
+            drop_around();
             check_pinned();
             return mapped;
         }
-
-        fail:
-        check_pinned();
-        return false;
     }
+
+    namespace
+    {
+        struct thp_enabled_attr_t : dev::attribute_t
+        {
+            thp_enabled_attr_t() : dev::attribute_t { "enabled", 0644 } { }
+
+            lib::expect<std::string> show(dev::kobject_t &) override
+            {
+                switch (thp_enabled.load(std::memory_order_relaxed))
+                {
+                    case thp_mode::always:
+                        return "[always] madvise never\n";
+                    case thp_mode::madvise:
+                        return "always [madvise] never\n";
+                    default:
+                        return "always madvise [never]\n";
+                }
+            }
+
+            lib::expect<void> store(dev::kobject_t &, std::string_view data) override
+            {
+                const auto value = lib::trim(data);
+                if (value == "always")
+                    thp_enabled.store(thp_mode::always, std::memory_order_relaxed);
+                else if (value == "madvise")
+                    thp_enabled.store(thp_mode::madvise, std::memory_order_relaxed);
+                else if (value == "never")
+                    thp_enabled.store(thp_mode::never, std::memory_order_relaxed);
+                else
+                    return std::unexpected { lib::err::invalid_argument };
+                return { };
+            }
+        };
+
+        struct thp_ktype_t : dev::ktype_t
+        {
+            std::span<const dev::attribute_group_t> groups() const override
+            {
+                static thp_enabled_attr_t enabled { };
+
+                static dev::attribute_t *attrs[] {
+                    &enabled
+                };
+                static const dev::attribute_group_t group_list[] {
+                    { .attributes = attrs }
+                };
+                return group_list;
+            }
+        };
+
+        lib::initgraph::task thp_sysfs_task
+        {
+            "vmm.thp.sysfs.register",
+            lib::initgraph::postsched_init_engine,
+            lib::initgraph::require { dev::core_registered_stage() },
+            [] {
+                static thp_ktype_t ktype { };
+                const auto kobj = dev::kobject_t::create(
+                    "transparent_hugepage", ktype, dev::root("/kernel/mm")
+                );
+                lib::bug_on(!dev::register_kobject(kobj));
+            }
+        };
+
+        // clean, unmapped file pages from the tail of the inactive list
+        struct page_cache_shrinker : reclaim::shrinker
+        {
+            static constexpr std::size_t batch = 32;
+
+            page_cache_shrinker() : reclaim::shrinker { "page_cache" } { }
+
+            std::size_t count() override
+            {
+                const std::unique_lock _ { lru_lock };
+                return lru_inactive.count + lru_active.count;
+            }
+
+            // takes up to batch pages off the inactive list, each with a
+            // reference of its own and its object pinned
+            std::size_t isolate(std::span<std::pair<page *, object::ptr>> out, std::size_t &budget)
+            {
+                const std::unique_lock _ { lru_lock };
+
+                std::size_t num = 0;
+                while (num < out.size() && budget > 0)
+                {
+                    if (lru_active.count > lru_inactive.count)
+                    {
+                        auto *pg = pfn_page(lru_active.tail);
+                        lru_unlink(pg);
+                        pg->flags.fetch_and(~page::flag::referenced, std::memory_order_relaxed);
+                        lru_link(pg, false);
+                        continue;
+                    }
+
+                    auto *pg = pfn_page(lru_inactive.tail);
+                    if (!pg)
+                        break;
+
+                    budget--;
+                    lru_unlink(pg);
+
+                    const auto flags = pg->flags.load(std::memory_order_relaxed);
+                    if (flags & page::flag::mapped)
+                        continue;
+
+                    if (flags & page::flag::referenced)
+                    {
+                        pg->flags.fetch_and(~page::flag::referenced, std::memory_order_relaxed);
+                        lru_link(pg, true);
+                        continue;
+                    }
+
+                    // the object is being destroyed and takes its pages off
+                    // the list under lru_lock, so obj_ptr is still valid here
+                    auto obj = object::ptr::try_from(pg->obj_ptr);
+                    if ((flags & page::flag::busy) || !obj)
+                    {
+                        lru_link(pg, false);
+                        continue;
+                    }
+
+                    pg->ref();
+                    out[num++] = { pg, std::move(obj) };
+                }
+                return num;
+            }
+
+            // back on the list unless it left the cache or got mapped meanwhile
+            void putback(page *pg, object *obj)
+            {
+                const std::unique_lock _ { lru_lock };
+
+                const auto flags = pg->flags.load(std::memory_order_relaxed);
+                if (pg->obj_ptr != obj || (flags & (page::flag::lru | page::flag::mapped)))
+                    return;
+
+                lru_link(pg, flags & page::flag::referenced);
+            }
+
+            std::size_t scan(std::size_t nr, bool may_block) override
+            {
+                const auto num_alloc_pages = default_npsize() / pmm::page_size;
+
+                std::size_t budget = nr;
+                std::size_t freed = 0;
+
+                std::pair<page *, object::ptr> isolated[batch];
+                while (budget > 0)
+                {
+                    const auto num = isolate(isolated, budget);
+                    if (num == 0)
+                        break;
+
+                    for (auto &[pg, obj] : std::span { isolated, num })
+                    {
+                        // only kswapd and drop_caches can wait on the filesystem
+                        const auto flags = pg->flags.load(std::memory_order_acquire);
+                        if (may_block && (flags & page::flag::dirty) && !(flags & page::flag::mapped))
+                            lib::unused(obj->write_back(pg->offp, 1));
+
+                        if (obj->evict(pg, may_block))
+                            freed++;
+                        else
+                            putback(pg, obj.get());
+
+                        if (pg->unref())
+                            pmm::free(paddr_from(pg), num_alloc_pages);
+                        obj = nullptr;
+                    }
+                }
+
+                const auto scanned = nr - budget;
+                vmstat::add(may_block ? vmstat::item::pgscan_kswapd : vmstat::item::pgscan_direct, scanned);
+                vmstat::add(may_block ? vmstat::item::pgsteal_kswapd : vmstat::item::pgsteal_direct, freed);
+                return freed;
+            }
+        };
+
+        lib::initgraph::task page_cache_shrinker_task
+        {
+            "vmm.page-cache.shrinker.register",
+            lib::initgraph::postsched_init_engine,
+            [] {
+                static page_cache_shrinker shrinker { };
+                reclaim::register_shrinker(&shrinker);
+            }
+        };
+
+        bool is_zero_page(std::uintptr_t paddr, std::size_t size)
+        {
+            const auto *words = reinterpret_cast<const std::uint64_t *>(lib::tohh(paddr));
+            return std::all_of(words, words + size / sizeof(std::uint64_t), [](auto word) { return word == 0; });
+        }
+
+        // private anonymous pages nobody touched since the last pass go to
+        // zram. without reverse mappings only anons with one owner qualify
+        struct anon_shrinker : reclaim::shrinker
+        {
+            anon_shrinker() : reclaim::shrinker { "anon" } { }
+
+            std::size_t count() override
+            {
+                return zram::free_pages();
+            }
+
+            std::size_t swap_out(vmspace &vms, std::size_t &budget, bool may_block)
+            {
+                const auto npsize = default_npsize();
+                const auto num_alloc_pages = npsize / pmm::page_size;
+
+                auto locked = may_block ? vms.tree.lock() : vms.tree.try_lock();
+                if (!locked.owns_lock())
+                    return 0;
+
+                std::size_t freed = 0;
+                for (auto &ent : *locked)
+                {
+                    if (budget == 0)
+                        break;
+
+                    if (!ent.amap || ent.amap.use_count() != 1 || ent.amap->cow)
+                        continue;
+                    if (ent.flags & flag::untouchable)
+                        continue;
+
+                    const auto first = ent.anon_idx;
+                    const auto count = ent.endp - ent.startp;
+
+                    // a leaf of slots at a time. its unmaps go in one
+                    // shootdown and faults get the amap lock in between
+                    for (std::size_t off = 0; off < count && budget > 0; off += anon_map::radix)
+                    {
+                        std::unique_lock alock { ent.amap->lock, std::defer_lock };
+                        if (may_block)
+                            alock.lock();
+                        else if (!alock.try_lock())
+                            break;
+
+                        std::array<anon *, anon_map::radix> victims;
+                        std::size_t nr = 0;
+
+                        mmu_gather tlb { *vms.pmap };
+                        const auto len = std::min(anon_map::radix, count - off);
+                        ent.amap->for_each(first + off, len, [&](std::size_t idx, anon::ptr &slot) {
+                            auto *pg = slot->pg;
+                            if (budget == 0 || !pg || slot.use_count() != 1)
+                                return;
+                            if (pg->refcount.load(std::memory_order_acquire) != 1)
+                                return;
+
+                            budget--;
+
+                            const auto vaddr = (ent.startp + (idx - first)) * npsize;
+                            if (vms.pmap->test_and_clear_young(vaddr))
+                                return;
+
+                            // refaults block on the amap lock until we are done
+                            lib::unused(tlb.unmap(vaddr, npsize, page_size::small));
+                            victims[nr++] = slot.get();
+                        });
+                        tlb.finish();
+
+                        for (std::size_t i = 0; i < nr; i++)
+                        {
+                            auto *an = victims[i];
+                            auto *pg = an->pg;
+
+                            const auto paddr = paddr_from(pg);
+                            std::uint64_t swap = 0;
+                            const bool lazy = pg->flags.load(std::memory_order_relaxed) & page::flag::lazyfree;
+                            if (!lazy && !is_zero_page(paddr, npsize))
+                            {
+                                const auto hdl = zram::store(paddr, may_block);
+                                if (!hdl)
+                                    continue;
+                                swap = *hdl;
+                                vmstat::add(vmstat::item::pswpout);
+                            }
+
+                            an->pg = nullptr;
+                            an->swap = swap;
+                            if (pg->unref())
+                                pmm::free(paddr, num_alloc_pages);
+                            freed++;
+                        }
+                    }
+                }
+                return freed;
+            }
+
+            std::size_t scan(std::size_t nr, bool may_block) override
+            {
+                auto locked = may_block ? vmspaces.lock() : vmspaces.try_lock();
+                if (!locked.owns_lock())
+                    return 0;
+
+                std::size_t budget = nr;
+                std::size_t freed = 0;
+                for (std::size_t i = locked->size(); i > 0 && budget > 0; i--)
+                {
+                    // rotate so that the next pass starts somewhere else
+                    auto *vms = locked->front();
+                    locked->remove(vms);
+                    locked->push_back(vms);
+
+                    if (vms->pmap)
+                        freed += swap_out(*vms, budget, may_block);
+                }
+                return freed;
+            }
+        };
+
+        lib::initgraph::task anon_shrinker_task
+        {
+            "vmm.anon.shrinker.register",
+            lib::initgraph::postsched_init_engine,
+            [] {
+                static anon_shrinker shrinker { };
+                reclaim::register_shrinker(&shrinker);
+            }
+        };
+
+        // boot with forkbench to time fork against how much the parent has
+        // resident. with amaps shared at fork it should stay flat
+        void fork_bench()
+        {
+            const auto psize = default_psize();
+            const auto npsize = pagemap::from_page_size(psize);
+            const auto prot = prot::read | prot::write;
+            constexpr std::size_t rounds = 16;
+
+            for (const std::size_t mib : { 1uz, 16uz, 64uz, 256uz })
+            {
+                const auto length = mib * 1024 * 1024;
+                if (length > pmm::info().free / 4)
+                    break;
+
+                auto vms = std::make_shared<vmspace>(std::make_shared<pagemap>());
+                const auto addr = vms->map(0, length, prot, prot, flag::private_ | flag::anonymous, nullptr, 0);
+                if (!addr.has_value())
+                {
+                    lib::warn("vmm: fork-bench: could not map {} MiB", mib);
+                    return;
+                }
+
+                // what a parent that has written all of it looks like
+                {
+                    const auto locked = vms->tree.lock();
+                    auto *ent = locked->overlapping(*addr / npsize, *addr / npsize + 1).begin().value();
+
+                    const std::unique_lock _ { ent->amap->lock };
+                    for (std::size_t i = 0; i < length / npsize; i++)
+                    {
+                        const auto paddr = pmm::alloc(npsize / pmm::page_size, true);
+
+                        auto *pg = page_for(paddr);
+                        pg->refcount.store(1, std::memory_order_relaxed);
+                        pg->flags.store(page::flag::anonymous, std::memory_order_relaxed);
+
+                        ent->amap->get(ent->anon_idx + i) = pg->anon_ptr = new anon {
+                            .pg = pg,
+                            .hook = { }
+                        };
+                        lib::bug_on(!vms->pmap->map(*addr + i * npsize, paddr, npsize, prot_to_pflags(prot), psize));
+                    }
+                }
+
+                std::uint64_t total = 0;
+                for (std::size_t i = 0; i < rounds; i++)
+                {
+                    const auto start = chrono::now(chrono::monotonic).to_ns();
+                    const auto child = vms->fork(std::make_shared<pagemap>());
+                    total += chrono::now(chrono::monotonic).to_ns() - start;
+                }
+                lib::info("vmm: fork-bench: {} MiB resident, {} us per fork", mib, total / rounds / 1000);
+            }
+        }
+
+        lib::initgraph::task fork_bench_task
+        {
+            "vmm.fork-bench",
+            lib::initgraph::postsched_init_engine,
+            [] {
+                if (cmdline::has("forkbench"))
+                    fork_bench();
+            }
+        };
+    } // namespace
 } // namespace vmm
@@ -0,0 +1,54 @@
+// Copyright (C) 2024-2026  ilobilo
+
+module system.memory.vmstat;
+
+import drivers.fs.procfs;
+import magic_enum;
+import lib;
+import fmt;
+
+namespace vmstat
+{
+    namespace
+    {
+        constexpr auto num_items = std::to_underlying(item::count);
+        constinit std::array<std::atomic_size_t, num_items> counters { };
+    } // namespace
+
+    void add(item it, std::size_t num)
+    {
+        counters[std::to_underlying(it)].fetch_add(num, std::memory_order_relaxed);
+    }
+
+    void sub(item it, std::size_t num)
+    {
+        counters[std::to_underlying(it)].fetch_sub(num, std::memory_order_relaxed);
+    }
+
+    std::size_t get(item it)
+    {
+        return counters[std::to_underlying(it)].load(std::memory_order_relaxed);
+    }
+
+    lib::initgraph::task procfs_register_task
+    {
+        "vmstat.procfs.register",
+        lib::initgraph::postsched_init_engine,
+        lib::initgraph::require { fs::procfs::registered_stage() },
+        [] {
+            using namespace ::fs::procfs;
+            lib::bug_on(!register_global("vmstat",
+                make_file_ops([](auto) {
+                    std::string out;
+                    auto it = std::back_inserter(out);
+                    for (std::size_t i = 0; i < num_items; i++)
+                    {
+                        const auto entry = static_cast<item>(i);
+                        fmt::format_to(it, "{} {}\n", magic_enum::enum_name(entry), get(entry));
+                    }
+                    return out;
+                }), node_type::file, 0444
+            ));
+        }
+    };
+} // namespace vmstat
@@ -0,0 +1,317 @@
+// Copyright (C) 2024-2026  ilobilo
+
+module system.memory.virt;
+
+import system.memory.vmstat;
+import system.memory.phys;
+import system.sysctl;
+import system.chrono;
+import system.sched;
+import arch;
+import lib;
+
+namespace vmm
+{
+    struct backing_dev
+    {
+        std::string name;
+
+        lib::spinlock lock;
+        // oldest first
+        lib::intrusive_list<object, &object::wb_hook> dirty;
+
+        sched::wait_queue_t wq;
+        std::atomic_bool wanted = false;
+        std::atomic_bool started = false;
+
+        explicit backing_dev(std::string_view name) : name { name } { }
+    };
+
+    namespace
+    {
+        constinit std::atomic<std::size_t> dirty_ratio = 20;
+        constinit std::atomic<std::size_t> dirty_background_ratio = 10;
+        constinit std::atomic<std::size_t> dirty_expire_cs = 3000;
+        constinit std::atomic<std::size_t> dirty_writeback_cs = 500;
+
+        // longest a writer sleeps at once, and how many times in a row it
+        // waits for the flushers past the limit before giving up, like linux
+        constexpr std::uint64_t max_pause_ns = 200'000'000;
+        constexpr std::size_t max_pauses = 50;
+
+        // objects taken off a dirty list at once
+        constexpr std::size_t flush_batch = 16;
+
+        // never freed, objects point at them
+        lib::locker<std::vector<backing_dev *>, sched::mutex_t> bdis;
+        constinit std::atomic_bool can_start = false;
+
+        std::uint64_t now_ns()
+        {
+            return chrono::now(chrono::monotonic).to_ns();
+        }
+
+        bool can_sleep()
+        {
+            if (!sched::is_ready() || sched::is_preempt_disabled())
+                return false;
+            return arch::int_status() && !sched::in_hard_irq();
+        }
+
+        struct thresholds
+        {
+            std::size_t background;
+            std::size_t limit;
+        };
+
+        // in pages of what could be dirty, free memory and the page cache
+        thresholds get_thresholds()
+        {
+            const auto mem = pmm::info();
+            const auto avail = (mem.usable - mem.used) / pmm::page_size + lru_pages(true) + lru_pages(false);
+
+            const auto limit = avail * dirty_ratio.load(std::memory_order_relaxed) / 100;
+            auto background = avail * dirty_background_ratio.load(std::memory_order_relaxed) / 100;
+            if (background >= limit)
+                background = limit / 2;
+            return { background, limit };
+        }
+
+        void list_dirty(object *obj, std::uint64_t when)
+        {
+            auto *bdi = obj->bdi;
+            const std::unique_lock _ { bdi->lock };
+            if (obj->wb_listed)
+                return;
+
+            obj->wb_listed = true;
+            obj->dirtied_when = when;
+            bdi->dirty.push_back(obj);
+        }
+
+        // takes objects off the list, each pinned. all of them when all is
+        // set, otherwise only those dirty since before expired
+        std::size_t isolate(backing_dev *bdi, std::span<object::ptr> out, bool all, std::uint64_t expired)
+        {
+            const std::unique_lock _ { bdi->lock };
+
+            std::size_t num = 0;
+            auto it = bdi->dirty.begin();
+            while (num < out.size() && it != bdi->dirty.end())
+            {
+                auto *obj = it.value();
+                if (!all && obj->dirtied_when > expired)
+                    break;
+
+                ++it;
+                bdi->dirty.remove(obj);
+                obj->wb_listed = false;
+
+                // the destructor is waiting for the lock
+                if (auto ptr = object::ptr::try_from(obj))
+                    out[num++] = std::move(ptr);
+            }
+            return num;
+        }
+
+        void writeback(backing_dev *bdi, bool background)
+        {
+            const auto expire_ns = dirty_expire_cs.load(std::memory_order_relaxed) * 10'000'000;
+
+            while (true)
+            {
+                const auto now = now_ns();
+                const bool all = background && dirty_pages() > get_thresholds().background;
+
+                object::ptr batch[flush_batch];
+                const auto num = isolate(bdi, batch, all, now > expire_ns ? now - expire_ns : 0);
+                if (num == 0)
+                    return;
+
+                bool failed = false;
+                for (auto &obj : std::span { batch, num })
+                {
+                    if (const auto ret = obj->write_back(0, ~0ul); !ret)
+                    {
+                        // try again once it expires again
+                        lib::warn(
+                            "writeback: {}: could not write back: {}",
+                            bdi->name, lib::error_name(ret.error())
+                        );
+                        list_dirty(obj.get(), now);
+                        failed = true;
+                    }
+                    else obj->written_back();
+                    obj = nullptr;
+                }
+
+                if (failed)
+                    return;
+            }
+        }
+
+        [[noreturn]] void flusher(backing_dev *bdi)
+        {
+            while (true)
+            {
+                const auto gen = bdi->wq.snapshot_gen();
+                const bool kicked = bdi->wanted.exchange(false, std::memory_order_acq_rel);
+
+                writeback(bdi, kicked || dirty_pages() > get_thresholds().background);
+
+                if (bdi->wanted.load(std::memory_order_acquire))
+                    continue;
+
+                // 0 turns the periodic passes off
+                const auto interval = dirty_writeback_cs.load(std::memory_order_relaxed) * 10'000'000;
+                lib::unused(bdi->wq.wait_prepared(gen, interval));
+            }
+        }
+
+        void start(backing_dev *bdi)
+        {
+            if (!bdi->started.exchange(true, std::memory_order_acq_rel))
+                sched::spawn(flusher, bdi);
+        }
+
+        void wake(backing_dev *bdi)
+        {
+            if (!bdi->wanted.exchange(true, std::memory_order_acq_rel))
+                bdi->wq.wake_one();
+        }
+
+        void wake_all()
+        {
+            const auto locked = bdis.lock();
+            for (auto *bdi : *locked)
+                wake(bdi);
+        }
+
+        void register_knob(std::string_view name, std::atomic<std::size_t> &val, std::size_t max)
+        {
+            lib::bug_on(!sysctl::register_int(name,
+                [&val] { return static_cast<int>(val.load(std::memory_order_relaxed)); },
+                [&val, max](int nval) -> lib::expect<void> {
+                    if (nval < 0 || static_cast<std::size_t>(nval) > max)
+                        return std::unexpected { lib::err::invalid_argument };
+                    val.store(static_cast<std::size_t>(nval), std::memory_order_relaxed);
+                    return { };
+                }
+            ));
+        }
+
+        lib::initgraph::task writeback_init_task
+        {
+            "vmm.writeback.init",
+            lib::initgraph::postsched_init_engine,
+            [] {
+                {
+                    const auto locked = bdis.lock();
+                    can_start.store(true, std::memory_order_release);
+                    for (auto *bdi : *locked)
+                        start(bdi);
+                }
+
+                register_knob("vm/dirty_ratio", dirty_ratio, 100);
+                register_knob("vm/dirty_background_ratio", dirty_background_ratio, 100);
+                // in hundredths of a second, up to a day
+                register_knob("vm/dirty_expire_centisecs", dirty_expire_cs, 8'640'000);
+                register_knob("vm/dirty_writeback_centisecs", dirty_writeback_cs, 8'640'000);
+            }
+        };
+    } // namespace
+
+    backing_dev *bdi_get(std::string_view name)
+    {
+        auto locked = bdis.lock();
+        for (auto *bdi : *locked)
+        {
+            if (bdi->name == name)
+                return bdi;
+        }
+
+        auto *bdi = new backing_dev { name };
+        locked->push_back(bdi);
+        if (can_start.load(std::memory_order_acquire))
+            start(bdi);
+        return bdi;
+    }
+
+    std::size_t dirty_pages()
+    {
+        return vmstat::get(vmstat::item::nr_dirty);
+    }
+
+    void object::set_dirty(page *pg)
+    {
+        if (pg->flags.load(std::memory_order_relaxed) & page::flag::dirty)
+            return;
+        if (pg->flags.fetch_or(page::flag::dirty, std::memory_order_relaxed) & page::flag::dirty)
+            return;
+
+        if (!bdi)
+            return;
+
+        vmstat::add(vmstat::item::nr_dirty);
+        vmstat::add(vmstat::item::nr_dirtied);
+        list_dirty(this, now_ns());
+    }
+
+    void object::dirty_cleared(std::size_t num)
+    {
+        if (bdi)
+            vmstat::sub(vmstat::item::nr_dirty, num);
+    }
+
+    void object::bdi_forget()
+    {
+        if (!bdi)
+            return;
+
+        const std::unique_lock _ { bdi->lock };
+        if (wb_listed)
+        {
+            bdi->dirty.remove(this);
+            wb_listed = false;
+        }
+    }
+
+    void balance_dirty_pages(object &obj)
+    {
+        if (!obj.bdi)
+            return;
+
+        for (std::size_t pauses = 0; pauses < max_pauses; pauses++)
+        {
+            const auto [background, limit] = get_thresholds();
+            const auto dirty = dirty_pages();
+            if (dirty <= background)
+                return;
+
+            const bool sleepable = can_sleep();
+            if (pauses == 0)
+            {
+                if (sleepable)
+                    wake_all();
+                else
+                    wake(obj.bdi);
+            }
+
+            // free running up to halfway between the two
+            const auto setpoint = background + (limit - background) / 2;
+            if (dirty <= setpoint || !sleepable)
+                return;
+
+            vmstat::add(vmstat::item::dirty_throttle);
+            if (dirty < limit)
+            {
+                const auto pause = max_pause_ns * (dirty - setpoint) / (limit - setpoint);
+                lib::unused(sched::sleep_for_ns(pause));
+                return;
+            }
+
+            // past the limit, wait for the flushers to catch up
+            lib::unused(sched::sleep_for_ns(max_pause_ns));
+        }
+    }
+} // namespace vmm
@@ -0,0 +1,254 @@
+// Copyright (C) 2024-2026  ilobilo
+
+module system.memory.zram;
+
+import drivers.fs.procfs;
+import system.memory.phys;
+import system.sysctl;
+import system.sched;
+import lib;
+import fmt;
+
+namespace zram
+{
+    namespace
+    {
+        // pages that compress worse than this stay where they are
+        constexpr std::size_t max_compressed = pmm::page_size * 3 / 4;
+
+        // every object starts with its compressed length
+        using length_t = std::uint16_t;
+
+        constexpr std::size_t class_step = 32;
+        constexpr std::size_t num_classes = (max_compressed + sizeof(length_t) + class_step - 1) / class_step;
+
+        // pool pages start with this, the slots follow. a handle is the
+        // page address with the slot index in the low bits
+        struct zpage
+        {
+            lib::intrusive_list_hook<zpage> hook;
+            std::uint16_t cls;
+            std::uint16_t used;
+            std::uint16_t nslots;
+            // set bits are free slots
+            std::uint64_t free_map[2];
+        };
+        constexpr std::size_t header_size = lib::align_up(sizeof(zpage), class_step);
+        static_assert((pmm::page_size - header_size) / class_step <= 128);
+
+        constexpr std::size_t class_size(std::size_t cls) { return (cls + 1) * class_step; }
+
+        struct size_class
+        {
+            // pages with at least one free slot
+            lib::intrusive_list<zpage, &zpage::hook> partial;
+        };
+
+        constinit lib::spinlock pool_lock;
+        constinit std::array<size_class, num_classes> classes { };
+
+        constinit std::atomic<std::size_t> disksize = 0;
+        constinit std::atomic<std::size_t> stored_pages = 0;
+        constinit std::atomic<std::size_t> compr_bytes = 0;
+        constinit std::atomic<std::size_t> pool_pages = 0;
+
+        // one compressor and its output buffer. kswapd does most of the work
+        sched::mutex_t comp_lock;
+        std::optional<lib::compressor> comp;
+        std::byte comp_buf[max_compressed];
+
+        zpage *zpage_of(handle hdl)
+        {
+            return reinterpret_cast<zpage *>(lib::tohh(hdl & ~(pmm::page_size - 1)));
+        }
+
+        std::byte *slot_data(zpage *zp, std::size_t slot)
+        {
+            const auto base = reinterpret_cast<std::byte *>(zp) + header_size;
+            return base + slot * class_size(zp->cls);
+        }
+
+        std::optional<handle> alloc_slot(std::size_t cls)
+        {
+            auto &sc = classes[cls];
+
+            std::unique_lock lock { pool_lock };
+            if (sc.partial.empty())
+            {
+                lock.unlock();
+
+                const auto paddr = pmm::try_alloc(1, false);
+                if (paddr == 0)
+                    return std::nullopt;
+
+                auto *zp = new (reinterpret_cast<void *>(lib::tohh(paddr))) zpage { };
+                zp->cls = cls;
+                zp->nslots = (pmm::page_size - header_size) / class_size(cls);
+                for (std::size_t i = 0; i < zp->nslots; i++)
+                    zp->free_map[i / 64] |= 1ul << (i % 64);
+                pool_pages.fetch_add(1, std::memory_order_relaxed);
+
+                lock.lock();
+                sc.partial.push_back(zp);
+            }
+
+            auto *zp = sc.partial.front();
+            const auto word = zp->free_map[0] ? 0 : 1;
+            const auto bit = std::countr_zero(zp->free_map[word]);
+            zp->free_map[word] &= ~(1ul << bit);
+
+            if (++zp->used == zp->nslots)
+                sc.partial.remove(zp);
+
+            return lib::fromhh(reinterpret_cast<std::uintptr_t>(zp)) | (word * 64 + bit);
+        }
+    } // namespace
+
+    std::optional<handle> store(std::uintptr_t paddr, bool may_block)
+    {
+        if (stored_pages.load(std::memory_order_relaxed) >= disksize.load(std::memory_order_relaxed) / pmm::page_size)
+            return std::nullopt;
+
+        std::unique_lock lock { comp_lock, std::defer_lock };
+        if (may_block)
+            lock.lock();
+        else if (!lock.try_lock())
+            return std::nullopt;
+
+        if (!comp)
+            return std::nullopt;
+
+        const std::span src {
+            reinterpret_cast<const std::byte *>(lib::tohh(paddr)),
+            pmm::page_size
+        };
+        const auto len = (*comp)(src, comp_buf);
+        if (!len)
+            return std::nullopt;
+
+        const auto cls = (*len + sizeof(length_t) - 1) / class_step;
+        const auto hdl = alloc_slot(cls);
+        if (!hdl)
+            return std::nullopt;
+
+        auto *data = slot_data(zpage_of(*hdl), *hdl & (pmm::page_size - 1));
+        const auto length = static_cast<length_t>(*len);
+        std::memcpy(data, &length, sizeof(length));
+        std::memcpy(data + sizeof(length), comp_buf, *len);
+
+        stored_pages.fetch_add(1, std::memory_order_relaxed);
+        compr_bytes.fetch_add(*len, std::memory_order_relaxed);
+        return hdl;
+    }
+
+    bool load(handle hdl, std::uintptr_t paddr)
+    {
+        static auto decomp = lib::decompressor::create(lib::compression_format::lz4);
+        if (!decomp)
+            return false;
+
+        const auto *data = slot_data(zpage_of(hdl), hdl & (pmm::page_size - 1));
+
+        length_t length;
+        std::memcpy(&length, data, sizeof(length));
+
+        const std::span dst {
+            reinterpret_cast<std::byte *>(lib::tohh(paddr)),
+            pmm::page_size
+        };
+        const auto ret = (*decomp)({ data + sizeof(length), length }, dst);
+        return ret.has_value() && *ret == pmm::page_size;
+    }
+
+    void release(handle hdl)
+    {
+        auto *zp = zpage_of(hdl);
+        const auto slot = hdl & (pmm::page_size - 1);
+
+        length_t length;
+        std::memcpy(&length, slot_data(zp, slot), sizeof(length));
+
+        stored_pages.fetch_sub(1, std::memory_order_relaxed);
+        compr_bytes.fetch_sub(length, std::memory_order_relaxed);
+
+        {
+            const std::unique_lock _ { pool_lock };
+            auto &sc = classes[zp->cls];
+
+            lib::bug_on(zp->free_map[slot / 64] & (1ul << (slot % 64)), "zram: double free of {:#x}", hdl);
+            zp->free_map[slot / 64] |= 1ul << (slot % 64);
+
+            if (zp->used-- == zp->nslots)
+                sc.partial.push_back(zp);
+
+            if (zp->used != 0)
+                return;
+
+            sc.partial.remove(zp);
+        }
+
+        pool_pages.fetch_sub(1, std::memory_order_relaxed);
+        pmm::free(lib::fromhh(reinterpret_cast<std::uintptr_t>(zp)), 1);
+    }
+
+    stats get_stats()
+    {
+        return {
+            .disksize = disksize.load(std::memory_order_relaxed),
+            .stored_pages = stored_pages.load(std::memory_order_relaxed),
+            .compr_bytes = compr_bytes.load(std::memory_order_relaxed),
+            .pool_pages = pool_pages.load(std::memory_order_relaxed)
+        };
+    }
+
+    std::size_t free_pages()
+    {
+        const auto total = disksize.load(std::memory_order_relaxed) / pmm::page_size;
+        const auto stored = stored_pages.load(std::memory_order_relaxed);
+        return total > stored ? total - stored : 0;
+    }
+
+    lib::initgraph::task zram_init_task
+    {
+        "zram.init",
+        lib::initgraph::postsched_init_engine,
+        lib::initgraph::require { fs::procfs::registered_stage() },
+        [] {
+            if (auto ret = lib::compressor::create(lib::compression_format::lz4))
+                comp.emplace(std::move(*ret));
+            else
+            {
+                lib::error("zram: could not create the lz4 compressor");
+                return;
+            }
+
+            // half of ram, which compressed takes about a quarter
+            disksize.store(lib::align_down(pmm::info().usable / 2, pmm::page_size), std::memory_order_relaxed);
+            lib::info("zram: {} KiB of compressed swap", disksize.load(std::memory_order_relaxed) / 1024);
+
+            // 0 turns swapping off. pages already stored stay until used
+            lib::bug_on(!sysctl::register_int("vm/zram_kbytes",
+                [] { return static_cast<int>(disksize.load(std::memory_order_relaxed) / 1024); },
+                [](int val) -> lib::expect<void> {
+                    if (val < 0)
+                        return std::unexpected { lib::err::invalid_argument };
+                    const auto bytes = static_cast<std::size_t>(val) * 1024;
+                    disksize.store(lib::align_down(bytes, pmm::page_size), std::memory_order_relaxed);
+                    return { };
+                }
+            ));
+
+            using namespace ::fs::procfs;
+            lib::bug_on(!register_global("swaps",
+                make_file_ops([](auto) {
+                    const auto st = get_stats();
+                    return fmt::format(
+                        "Filename\t\t\t\tType\t\tSize\t\tUsed\t\tPriority\n"
+                        "/dev/zram0                              partition\t{}\t\t{}\t\t100\n",
+                        st.disksize / 1024, st.stored_pages * pmm::page_size / 1024
+                    );
+                }), node_type::file, 0444
+            ));
+        }
+    };
+} // namespace zram
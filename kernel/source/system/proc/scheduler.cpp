@@ -5,6 +5,9 @@ module system.sched;
 import drivers.fs.procfs;
 import drivers.timers;
 import system.syscall.vfs;
+import system.memory.slab;
+import system.memory.oom;
+import system.memory.tlb;
 import system.bin.exec;
 import system.chrono;
 import system.cpu;
@@ -34,6 +37,9 @@ namespace sched
         cpu_local(wait_queue_t, dead_bell);
         cpu_local(bool, need_reaper_wake);
         cpu_local(const vmm::pagemap *, loaded_pmap);
+        // held while in lazy tlb mode, and dropped outside the rq lock after
+        cpu_local(std::shared_ptr<vmm::pagemap>, lazy_pmap);
+        cpu_local(std::shared_ptr<vmm::pagemap>, lazy_put);
 
         lib::locker<
             lib::map::flat_hash<
@@ -51,6 +57,11 @@ namespace sched
 
         std::shared_ptr<process_t> kernel_proc;
 
+        std::shared_ptr<thread_t> new_thread()
+        {
+            return std::allocate_shared<thread_t>(slab::cache_allocator<thread_t> { "sched_thread" });
+        }
+
         void push_dead(std::shared_ptr<thread_t> thread)
         {
             dead_threads.unsafe_get().lock()->push_back(std::move(thread));
@@ -112,6 +123,60 @@ namespace sched
             return thread->affinity.get(cpu);
         }
 
+        // kernel threads and idle keep running on whatever user pagemap is
+        // loaded, its kernel half is the same as everyone else's. a cpu in
+        // that state gets no user shootdowns and flushes once on its way out
+        void switch_pmap(cpu::processor &self, const thread_t *prev, const thread_t *next)
+        {
+            auto &loaded = loaded_pmap.unsafe_get();
+            auto &lazy = lazy_pmap.unsafe_get();
+            const auto &next_pmap = next->proc->vmspace->pmap;
+
+            if (!next_pmap->has_asid_ctx())
+            {
+                if (lazy || loaded == next_pmap.get())
+                    return;
+
+                const auto &prev_vms = prev->proc->vmspace;
+                if (loaded && prev_vms && prev_vms->pmap.get() == loaded)
+                {
+                    lazy = prev_vms->pmap;
+                    self.tlb_lazy.store(true, std::memory_order_seq_cst);
+                    return;
+                }
+            }
+            else if (lazy)
+            {
+                // pairs with the check in tlb::shootdown
+                self.tlb_lazy.store(false, std::memory_order_seq_cst);
+                const bool stale = self.tlb_stale.exchange(false, std::memory_order_seq_cst);
+                lazy_put.unsafe_get() = std::move(lazy);
+
+                if (loaded == next_pmap.get())
+                {
+                    if (stale)
+                    {
+                        tlb::local_flush({
+                            .sc = tlb::scope::user_full,
+                            .start = 0,
+                            .pages = 0,
+                            .pmap = loaded
+                        });
+                    }
+                    return;
+                }
+                // unload drops our asid, the next load of it starts clean
+            }
+
+            if (loaded != next_pmap.get())
+            {
+                if (loaded)
+                    loaded->unload();
+                next_pmap->load();
+                loaded = next_pmap.get();
+            }
+        }
+
         std::size_t find_least_loaded(const thread_t *thread)
         {
             auto &self = cpu::self().unsafe_get();
@@ -365,7 +430,7 @@ namespace sched
         rq.load_update = (self.idx * balance_interval_ns) / cpu::count();
 
         lib::bug_on(!kernel_proc);
-        rq.idle = std::make_shared<thread_t>();
+        rq.idle = new_thread();
         rq.idle->kstack_base = allocate_kstack();
         rq.idle->kstack_top = rq.idle->kstack_base + kstack_size;
         rq.idle->self = rq.idle.get();
@@ -434,6 +499,13 @@ namespace sched
 
         rcu::note_context_switch();
 
+        // the last user of a pagemap may have been a lazy cpu
+        {
+            preempt_disable();
+            auto put = std::move(lazy_put.unsafe_get());
+            preempt_enable();
+        }
+
         preempt_disable();
         auto &self = cpu::self().unsafe_get();
         auto &rq = run_queue.unsafe_get();
@@ -534,15 +606,7 @@ namespace sched
             return;
         }
 
-        auto &loaded = loaded_pmap.unsafe_get();
-        const auto *next_pmap = next->proc->vmspace->pmap.get();
-        if (loaded != next_pmap)
-        {
-            if (loaded)
-                loaded->unload();
-            next_pmap->load();
-            loaded = next_pmap;
-        }
+        switch_pmap(self, prev, next);
 
         if (self.in_interrupt.load(std::memory_order_relaxed))
             next->was_in_interrupt = &self.in_interrupt;
@@ -624,7 +688,7 @@ namespace sched
         auto proc = get_process(0);
         lib::bug_on(!proc);
 
-        auto thread = std::make_shared<thread_t>();
+        auto thread = new_thread();
 
         thread->kstack_base = allocate_kstack();
         thread->kstack_top = thread->kstack_base + kstack_size;
@@ -662,7 +726,7 @@ namespace sched
         lib::bug_on(!proc);
         const std::unique_lock _ { proc->lock };
 
-        auto thread = std::make_shared<thread_t>();
+        auto thread = new_thread();
 
         thread->kstack_base = allocate_kstack();
         thread->kstack_top = thread->kstack_base + kstack_size;
@@ -816,6 +880,26 @@ namespace sched
         }
     }
 
+    bool try_for_each_process(std::function_ref<bool (const std::shared_ptr<process_t> &)> func)
+    {
+        std::vector<std::shared_ptr<process_t>> snapshot;
+        {
+            auto locked = processes.try_lock();
+            if (!locked.owns_lock())
+                return false;
+
+            snapshot.reserve(locked->size());
+            for (const auto &[_, proc] : *locked)
+                snapshot.push_back(proc);
+        }
+        for (auto &proc : snapshot)
+        {
+            if (!func(proc))
+                break;
+        }
+        return true;
+    }
+
     bool wake_up(thread_t *thread, bool preempt, bool force)
     {
         lib::bug_on(thread->self != thread);
@@ -1784,6 +1868,10 @@ namespace sched
                 caller_proc->dumpable.load(std::memory_order_relaxed),
                 std::memory_order_relaxed
             );
+            target_proc->oom_score_adj.store(
+                caller_proc->oom_score_adj.load(std::memory_order_relaxed),
+                std::memory_order_relaxed
+            );
 
             target_proc->pathname = caller_proc->pathname;
             target_proc->argv = caller_proc->argv;
@@ -1802,6 +1890,7 @@ namespace sched
         );
 
         target_thread->sigmask = caller_thread->sigmask;
+        target_thread->mempolicy = caller_thread->mempolicy;
 
         // TODO: set_tid array
 
@@ -2037,6 +2126,7 @@ namespace sched
             lib::bug_on(new_thread->tid != process->pid);
 
             new_thread->sigmask = old_thread->sigmask;
+            new_thread->mempolicy = old_thread->mempolicy;
             {
                 const std::unique_lock _ { old_thread->sigqueue.lock };
                 new_thread->sigqueue.pending = old_thread->sigqueue.pending;
@@ -2519,6 +2609,33 @@ namespace sched
                     ), node_type::file, 0644
                 ));
 
+                lib::bug_on(!register_per_pid("oom_score_adj",
+                    make_file_ops(
+                        [](process_t *proc) {
+                            return fmt::format("{}\n", proc->oom_score_adj.load(std::memory_order_relaxed));
+                        },
+                        [](process_t *proc, std::string_view data) -> lib::expect<void> {
+                            data = lib::trim(data);
+
+                            int val = 0;
+                            const auto end = data.data() + data.size();
+                            const auto [ptr, ec] = std::from_chars(data.data(), end, val);
+                            if (ec != std::errc { } || ptr != end)
+                                return std::unexpected { lib::err::invalid_argument };
+                            if (val < oom::score_adj_min || val > oom::score_adj_max)
+                                return std::unexpected { lib::err::invalid_argument };
+
+                            // making a process harder to kill is privileged
+                            if (val < proc->oom_score_adj.load(std::memory_order_relaxed) &&
+                                !capable(cap_t::sys_resource))
+                                return std::unexpected { lib::err::not_permitted };
+
+                            proc->oom_score_adj.store(val, std::memory_order_relaxed);
+                            return { };
+                        }
+                    ), node_type::file, 0644
+                ));
+
                 lib::bug_on(!register_per_pid("cmdline",
                     make_file_ops([](process_t *proc) {
                         const std::unique_lock _ { proc->lock };
@@ -3,6 +3,7 @@
 module system.syscall.memory;
 
 import system.memory.virt;
+import system.memory.numa;
 import system.sched;
 import system.vfs;
 
@@ -14,10 +15,77 @@ namespace syscall::memory
         {
             return reinterpret_cast<void *>(-static_cast<std::intptr_t>(err));
         }
+
+        // MPOL_F_STATIC_NODES, MPOL_F_RELATIVE_NODES and MPOL_F_NUMA_BALANCING
+        // ride in the top bits of the mode. node numbers are never remapped
+        // here, so they change nothing
+        constexpr int mpol_mode_flags = (1 << 15) | (1 << 14) | (1 << 13);
+
+        // the same limit linux has
+        constexpr unsigned long max_maxnode = 4096 * 8;
+
+        int read_policy(numa::mempolicy &pol, int mode, const unsigned long __user *nodemask, unsigned long maxnode)
+        {
+            mode &= ~mpol_mode_flags;
+            if (mode < 0 || mode > static_cast<int>(numa::policy_mode::local))
+                return -EINVAL;
+
+            if (maxnode > max_maxnode)
+                return -EINVAL;
+
+            // like linux, the last bit of maxnode is not looked at
+            numa::nodemask_t nodes = 0;
+            if (nodemask != nullptr && maxnode > 1)
+            {
+                constexpr std::size_t bits = sizeof(unsigned long) * 8;
+                const auto nbits = maxnode - 1;
+                for (std::size_t i = 0; i * bits < nbits; i++)
+                {
+                    unsigned long word = 0;
+                    if (!lib::copy_from_user(&word, nodemask + i, sizeof(word)))
+                        return -EFAULT;
+
+                    if (const auto left = nbits - i * bits; left < bits)
+                        word &= (1ul << left) - 1;
+
+                    if (i == 0)
+                        nodes = word;
+                    else if (word != 0)
+                        return -EINVAL;
+                }
+            }
+
+            if (nodes & ~((1ul << numa::num_nodes()) - 1))
+                return -EINVAL;
+
+            pol.mode = static_cast<numa::policy_mode>(mode);
+            pol.nodes = nodes;
+            switch (pol.mode)
+            {
+                case numa::policy_mode::default_:
+                case numa::policy_mode::local:
+                    if (nodes != 0)
+                        return -EINVAL;
+                    break;
+                case numa::policy_mode::preferred:
+                    // an empty preferred set means allocate locally
+                    if (nodes == 0)
+                        pol.mode = numa::policy_mode::local;
+                    break;
+                case numa::policy_mode::bind:
+                case numa::policy_mode::interleave:
+                    if (nodes == 0)
+                        return -EINVAL;
+                    break;
+            }
+            return 0;
+        }
     } // namespace
 
     void *mmap(void *addr, std::size_t length, int prot, int flags, int fd, off_t offset)
     {
+        flags = static_cast<int>(static_cast<vmm::flag_t>(flags) & ~vmm::advice_flags);
+
         const bool priv = (flags & vmm::flag::private_);
         const bool shared = (flags & vmm::flag::shared);
         const bool anon = (flags & vmm::flag::anonymous);
@@ -211,15 +279,81 @@ namespace syscall::memory
 
     int mincore(std::size_t start, std::size_t len, unsigned char __user *vec)
     {
-        // TODO
-        lib::unused(start, len, vec);
-        return -ENOSYS;
+        const auto npsize = vmm::default_npsize();
+        if (start & (npsize - 1))
+            return -EINVAL;
+
+        if (len > vmm::vmspace::vspace_top)
+            return -ENOMEM;
+
+        const auto proc = sched::current_process();
+        const auto &vmspace = proc->vmspace;
+
+        const auto num_pages = lib::div_roundup(len, npsize);
+
+        // filled under the tree lock, copied out without it
+        std::uint8_t chunk[512];
+        for (std::size_t i = 0; i < num_pages; )
+        {
+            const auto count = std::min(std::size(chunk), num_pages - i);
+            std::span<std::uint8_t> span { chunk, count };
+
+            if (const auto res = vmspace->resident(start + i * npsize, span); !res)
+                return -lib::map_error(res.error());
+
+            if (!lib::copy_to_user(vec + i, chunk, count))
+                return -EFAULT;
+
+            i += count;
+        }
+        return 0;
     }
 
     int madvise(void *addr, std::size_t length, int advice)
     {
-        // TODO
-        lib::unused(addr, length, advice);
+        const auto proc = sched::current_process();
+        const auto &vmspace = proc->vmspace;
+
+        const auto res = vmspace->advise(
+            reinterpret_cast<std::uintptr_t>(addr), length,
+            static_cast<vmm::madv_t>(advice)
+        );
+        return res ? 0 : -lib::map_error(res.error());
+    }
+
+    int mbind(void *addr, std::size_t len, int mode, const unsigned long __user *nodemask, unsigned long maxnode, unsigned flags)
+    {
+        // MPOL_MF_STRICT, MPOL_MF_MOVE and MPOL_MF_MOVE_ALL. pages are never
+        // migrated, the policy applies to what gets faulted in afterwards
+        constexpr unsigned mpol_mf_valid = 1 | 2 | 4;
+        if (flags & ~mpol_mf_valid)
+            return -EINVAL;
+
+        if (reinterpret_cast<std::uintptr_t>(addr) & (vmm::default_npsize() - 1))
+            return -EINVAL;
+
+        numa::mempolicy pol;
+        if (const auto ret = read_policy(pol, mode, nodemask, maxnode); ret != 0)
+            return ret;
+
+        // an empty range is fine
+        if (len == 0)
+            return 0;
+
+        const auto proc = sched::current_process();
+        const auto &vmspace = proc->vmspace;
+
+        const auto res = vmspace->mbind(reinterpret_cast<std::uintptr_t>(addr), len, pol);
+        return res ? 0 : -lib::map_error(res.error());
+    }
+
+    int set_mempolicy(int mode, const unsigned long __user *nodemask, unsigned long maxnode)
+    {
+        numa::mempolicy pol;
+        if (const auto ret = read_policy(pol, mode, nodemask, maxnode); ret != 0)
+            return ret;
+
+        sched::current_thread()->mempolicy = pol;
         return 0;
     }
 
@@ -239,9 +373,14 @@ namespace syscall::memory
         if (reinterpret_cast<std::uintptr_t>(addr) & (npsize - 1))
             return -EINVAL;
 
-        // TODO
-        lib::unused(length);
-        return 0;
+        const auto proc = sched::current_process();
+        const auto &vmspace = proc->vmspace;
+
+        const auto res = vmspace->sync(
+            reinterpret_cast<std::uintptr_t>(addr), length,
+            (flags & ms_sync) != 0, (flags & ms_invalidate) != 0
+        );
+        return res ? 0 : -lib::map_error(res.error());
     }
 
     int mlock(void *addr, std::size_t length)
@@ -2,6 +2,7 @@
 
 module system.syscall.vfs;
 
+import system.memory.slab;
 import system.chrono;
 
 namespace syscall::vfs
@@ -447,7 +448,7 @@ namespace syscall::vfs
                 if (present)
                     return -EEXIST;
 
-                auto ent = std::make_shared<epoll_entry_t>();
+                auto ent = std::allocate_shared<epoll_entry_t>(slab::cache_allocator<epoll_entry_t> { "epoll_entry" });
                 ent->wepi = epi;
                 ent->fd = fd;
                 ent->wfile = desc->file;
@@ -2,6 +2,8 @@
 
 module system.syscall.vfs;
 
+import system.memory.virt;
+
 namespace syscall::vfs
 {
     using namespace ::vfs;
@@ -744,8 +746,17 @@ namespace syscall::vfs
 
     int fadvise64(int fd, loff_t offset, std::size_t len, int advice)
     {
-        // TODO
-        if (advice < 0 || advice > 5)
+        enum : int
+        {
+            posix_fadv_normal = 0,
+            posix_fadv_random = 1,
+            posix_fadv_sequential = 2,
+            posix_fadv_willneed = 3,
+            posix_fadv_dontneed = 4,
+            posix_fadv_noreuse = 5
+        };
+
+        if (advice < posix_fadv_normal || advice > posix_fadv_noreuse)
             return -EINVAL;
 
         if (offset < 0)
@@ -756,7 +767,41 @@ namespace syscall::vfs
         if (!fdesc_res)
             return -lib::map_error(fdesc_res.error());
 
-        lib::unused(len);
+        const auto &file = (*fdesc_res)->file;
+        if (!file->ops || !file->ops->seekable())
+            return -ESPIPE;
+
+        using hint = vmm::ra_state::hint;
+        const auto set_hint = [&](hint mode) {
+            auto locked = file->ra.lock();
+            locked->mode = mode;
+            locked->size = locked->async_size = 0;
+        };
+
+        lib::expect<void> ret { };
+        switch (advice)
+        {
+            case posix_fadv_normal:
+                set_hint(hint::normal);
+                break;
+            case posix_fadv_random:
+                set_hint(hint::random);
+                break;
+            case posix_fadv_sequential:
+                set_hint(hint::sequential);
+                break;
+            case posix_fadv_willneed:
+                ret = file->willneed(offset, len);
+                break;
+            case posix_fadv_dontneed:
+                ret = file->dontneed(offset, len);
+                break;
+            default:
+                break;
+        }
+
+        if (!ret)
+            return -lib::map_error(ret.error());
         return 0;
     }
 } // namespace syscall::vfs
@@ -11,6 +11,10 @@ namespace vfs
             sched::mutex_t lock;
             std::shared_ptr<file_t> backing;
 
+            // buffered writes, so that growing the file and filling the
+            // new pages is not interleaved with another writer
+            sched::mutex_t write_lock;
+
             file_object(std::shared_ptr<file_t> file)
                 : vmm::object { vmm::object_type::file }, backing { std::move(file) } { }
 
@@ -26,6 +30,22 @@ namespace vfs
                 backing.reset();
             }
 
+            // the inode follows its pages
+            void written_back() override
+            {
+                auto file = get_backing();
+                if (!file || !file->path.mnt)
+                    return;
+
+                auto &inode = file->path.dentry->inode;
+                const std::unique_lock _ { inode->lock };
+                if (!inode->dirty)
+                    return;
+
+                if (const auto ret = file->path.mnt->fs.lock()->write_inode(inode); !ret)
+                    lib::warn("pcache: could not write back inode: {}", lib::error_name(ret.error()));
+            }
+
             private:
             lib::expect<void> fetch_pages(std::size_t idx, std::span<vmm::page *> pages) override
             {
@@ -33,21 +53,8 @@ namespace vfs
                 if (!file)
                     return std::unexpected { lib::err::not_found };
 
-                const auto npsize = vmm::default_npsize();
-
-                for (std::size_t i = 0; i < pages.size(); i++)
-                {
-                    auto span = lib::maybe_uspan<std::byte>::create(
-                        reinterpret_cast<std::byte *>(lib::tohh(vmm::paddr_from(pages[i]))),
-                        npsize
-                    );
-                    lib::bug_on(!span.has_value());
-
-                    const auto ret = file->pread((idx + i) * npsize, *span);
-                    if (!ret.has_value())
-                        return std::unexpected { ret.error() };
-                }
-                return { };
+                // not through the file, that would come back to the cache
+                return file->ops->read_pages(file, idx, pages);
             }
 
             lib::expect<void> write_pages(std::size_t idx, std::span<vmm::page *> pages) override
@@ -55,56 +62,310 @@ namespace vfs
                 auto file = get_backing();
                 if (!file)
                     return std::unexpected { lib::err::not_found };
-
-                const auto npsize = vmm::default_npsize();
-
-                const auto &inode = file->path.dentry->inode;
-                const std::size_t size = inode->stat.st_size;
-
-                for (std::size_t i = 0; i < pages.size(); i++)
-                {
-                    const auto offset = (idx + i) * npsize;
-                    if (offset >= size)
-                        continue;
-
-                    const auto len = std::min(npsize, size - offset);
-                    auto span = lib::maybe_uspan<std::byte>::create(
-                        reinterpret_cast<std::byte *>(lib::tohh(vmm::paddr_from(pages[i]))),
-                        len
-                    );
-                    lib::bug_on(!span.has_value());
-
-                    const auto ret = file->pwrite(offset, *span);
-                    if (!ret.has_value())
-                        return std::unexpected { ret.error() };
-                    if (*ret != len)
-                        return std::unexpected { lib::err::io_error };
-                }
-                return { };
+                return file->ops->write_pages(file, idx, pages);
             }
         };
+
+        lib::expect<vmm::object::ptr> mapping_for(const std::shared_ptr<file_t> &file)
+        {
+            const auto &dentry = file->path.dentry;
+            if (!dentry || !dentry->inode)
+                return std::unexpected { lib::err::no_such_device };
+
+            auto &inode = dentry->inode;
+            if (inode->stat.type() != stat::type::s_ifreg)
+                return std::unexpected { lib::err::no_such_device };
+
+            const std::unique_lock _ { inode->lock };
+            if (!inode->mapping)
+            {
+                auto backing = file_t::create(file->path, 0, 0);
+                if (const auto ret = backing->open(0, 0); !ret.has_value())
+                    return std::unexpected { ret.error() };
+
+                auto *obj = new file_object { std::move(backing) };
+                if (file->path.mnt)
+                    obj->bdi = vmm::bdi_get(file->path.mnt->source);
+                inode->mapping = obj;
+            }
+            return inode->mapping;
+        }
+
+        bool is_cached(const file_t &file)
+        {
+            if (!file.ops->page_cached())
+                return false;
+
+            const auto &dentry = file.path.dentry;
+            return dentry && dentry->inode && dentry->inode->stat.type() == stat::type::s_ifreg;
+        }
+
+        std::size_t file_size(const std::shared_ptr<inode_t> &inode)
+        {
+            const std::unique_lock _ { inode->lock };
+            return static_cast<std::size_t>(inode->stat.st_size);
+        }
+
+        // the data changed, ops only ever see writeback
+        void touch(const path_t &path)
+        {
+            auto &inode = path.dentry->inode;
+            {
+                const std::unique_lock _ { inode->lock };
+                inode->stat.update_time(kstat::time::modify | kstat::time::status);
+            }
+
+            if (const auto ret = dirty_inode(path); !ret)
+                lib::warn("pcache: could not dirty inode: {}", lib::error_name(ret.error()));
+        }
+
+        // dirty pages in the range are newer than the backing file
+        lib::expect<void> write_back_range(vmm::object &obj, std::uint64_t offset, std::size_t length)
+        {
+            if (length == 0)
+                return { };
+
+            const auto npsize = vmm::default_npsize();
+
+            const auto startp = offset / npsize;
+            const auto endp = lib::div_roundup(offset + length, npsize);
+            return obj.write_back(startp, endp - startp);
+        }
     } // namespace
 
     lib::expect<vmm::object::ptr> ops_t::map(const std::shared_ptr<file_t> &file)
     {
-        const auto &dentry = file->path.dentry;
-        if (!dentry || !dentry->inode)
-            return std::unexpected { lib::err::no_such_device };
+        return mapping_for(file);
+    }
 
-        auto &inode = dentry->inode;
-        if (inode->stat.type() != stat::type::s_ifreg)
-            return std::unexpected { lib::err::no_such_device };
+    lib::expect<void> ops_t::read_pages(
+        const std::shared_ptr<file_t> &file, std::size_t idx,
+        std::span<vmm::page *> pages
+    )
+    {
+        const auto npsize = vmm::default_npsize();
 
-        const std::unique_lock _ { inode->lock };
-        if (!inode->mapping)
+        for (std::size_t i = 0; i < pages.size(); i++)
         {
-            auto backing = file_t::create(file->path, 0, 0);
-            if (const auto ret = backing->open(0, 0); !ret.has_value())
+            auto data = reinterpret_cast<std::byte *>(lib::tohh(vmm::paddr_from(pages[i])));
+            auto span = lib::maybe_uspan<std::byte>::create(data, npsize);
+            lib::bug_on(!span.has_value());
+
+            const auto ret = read(file, (idx + i) * npsize, *span);
+            if (!ret.has_value())
                 return std::unexpected { ret.error() };
 
-            inode->mapping = new file_object { std::move(backing) };
+            // past the end of the file
+            if (*ret < npsize)
+                std::memset(data + *ret, 0, npsize - *ret);
+        }
+        return { };
+    }
+
+    lib::expect<void> ops_t::write_pages(
+        const std::shared_ptr<file_t> &file, std::size_t idx,
+        std::span<vmm::page *> pages
+    )
+    {
+        const auto npsize = vmm::default_npsize();
+        const std::size_t size = file->path.dentry->inode->stat.st_size;
+
+        for (std::size_t i = 0; i < pages.size(); i++)
+        {
+            const auto offset = (idx + i) * npsize;
+            if (offset >= size)
+                break;
+
+            const auto len = std::min(npsize, size - offset);
+            auto span = lib::maybe_uspan<std::byte>::create(
+                reinterpret_cast<std::byte *>(lib::tohh(vmm::paddr_from(pages[i]))),
+                len
+            );
+            lib::bug_on(!span.has_value());
+
+            const auto ret = write(file, offset, *span);
+            if (!ret.has_value())
+                return std::unexpected { ret.error() };
+            if (*ret != len)
+                return std::unexpected { lib::err::io_error };
         }
-        return inode->mapping;
+        return { };
+    }
+
+    lib::expect<std::size_t> file_t::do_read(std::uint64_t offset, lib::maybe_uspan<std::byte> buffer)
+    {
+        const auto self = shared_from_this();
+        if (!is_cached(*this))
+            return ops->read(self, offset, buffer);
+
+        const auto obj = mapping_for(self);
+        if (!obj.has_value())
+            return std::unexpected { obj.error() };
+
+        if (flags & o_direct)
+        {
+            if (const auto ret = write_back_range(**obj, offset, buffer.size()); !ret)
+                return std::unexpected { ret.error() };
+            return ops->read(self, offset, buffer);
+        }
+
+        const auto size = file_size(path.dentry->inode);
+        if (offset >= size || buffer.empty())
+            return 0;
+
+        const auto len = std::min(buffer.size(), size - offset);
+
+        const auto npsize = vmm::default_npsize();
+        const auto first = offset / npsize;
+        vmm::readahead(
+            *obj, ra, first,
+            lib::div_roundup(offset + len, npsize) - first,
+            lib::div_roundup(size, npsize)
+        );
+
+        const auto ret = (*obj)->read(offset, buffer.subspan(0, len));
+        if (ret == 0)
+            return std::unexpected { lib::err::io_error };
+        return ret;
+    }
+
+    lib::expect<std::size_t> file_t::do_write(std::uint64_t offset, lib::maybe_uspan<std::byte> buffer)
+    {
+        const auto self = shared_from_this();
+        if (!is_cached(*this))
+        {
+            const auto ret = ops->write(self, offset, buffer);
+            if (ret.has_value() && path.dentry && path.dentry->inode)
+                path.dentry->inode->invalidate_pcache(offset, *ret);
+            return ret;
+        }
+
+        auto &inode = path.dentry->inode;
+
+        const auto obj = mapping_for(self);
+        if (!obj.has_value())
+            return std::unexpected { obj.error() };
+
+        if (flags & o_direct)
+        {
+            if (const auto ret = write_back_range(**obj, offset, buffer.size()); !ret)
+                return std::unexpected { ret.error() };
+
+            const auto ret = ops->write(self, offset, buffer);
+            if (ret.has_value())
+            {
+                inode->invalidate_pcache(offset, *ret);
+                touch(path);
+            }
+            return ret;
+        }
+
+        auto &fobj = static_cast<file_object &>(**obj);
+        std::unique_lock wlock { fobj.write_lock };
+
+        const auto old_size = file_size(inode);
+        if (flags & o_append)
+        {
+            offset = old_size;
+            this->offset = offset;
+        }
+
+        if (buffer.empty())
+            return 0;
+
+        // the filesystem allocates and zeroes the new blocks, the data
+        // itself only reaches them on writeback
+        const auto end = offset + buffer.size();
+        if (end > old_size)
+        {
+            if (!ops->truncable())
+                return std::unexpected { lib::err::not_supported };
+            if (const auto ret = ops->trunc(self, end); !ret)
+                return std::unexpected { ret.error() };
+        }
+
+        const auto ret = fobj.write(offset, buffer);
+        if (ret < buffer.size() && end > old_size)
+        {
+            const auto size = std::max(old_size, offset + ret);
+            if (ops->trunc(self, size).has_value())
+                inode->trunc_pcache(size);
+        }
+        wlock.unlock();
+
+        if (ret == 0)
+            return std::unexpected { lib::err::io_error };
+
+        touch(path);
+        vmm::balance_dirty_pages(fobj);
+        return ret;
+    }
+
+    lib::expect<void> file_t::willneed(std::uint64_t offset, std::size_t length)
+    {
+        if (!is_cached(*this))
+            return { };
+
+        const auto obj = mapping_for(shared_from_this());
+        if (!obj.has_value())
+            return std::unexpected { obj.error() };
+
+        const auto size = file_size(path.dentry->inode);
+        if (offset >= size)
+            return { };
+
+        const auto npsize = vmm::default_npsize();
+        const auto end = length == 0 ? size : std::min<std::uint64_t>(size, offset + length);
+        const auto first = offset / npsize;
+        vmm::force_readahead(*obj, first, lib::div_roundup(end, npsize) - first);
+        return { };
+    }
+
+    lib::expect<void> file_t::dontneed(std::uint64_t offset, std::size_t length)
+    {
+        if (!is_cached(*this))
+            return { };
+
+        vmm::object::ptr obj;
+        {
+            auto &inode = path.dentry->inode;
+            const std::unique_lock _ { inode->lock };
+            obj = inode->mapping;
+        }
+        if (!obj)
+            return { };
+
+        // 0 is up to the end of the file
+        if (length == 0)
+        {
+            const auto size = file_size(path.dentry->inode);
+            length = offset < size ? size - offset : 0;
+        }
+
+        // dirty pages are written first so that only clean ones are dropped
+        if (const auto ret = write_back_range(*obj, offset, length); !ret)
+            return ret;
+        path.dentry->inode->invalidate_pcache(offset, length);
+        return { };
+    }
+
+    lib::expect<void> file_t::sync_pcache()
+    {
+        if (!is_cached(*this))
+            return { };
+
+        vmm::object::ptr obj;
+        {
+            auto &inode = path.dentry->inode;
+            const std::unique_lock _ { inode->lock };
+            obj = inode->mapping;
+        }
+        if (!obj)
+            return { };
+
+        const auto npsize = vmm::default_npsize();
+        const auto pages = lib::div_roundup(file_size(path.dentry->inode), npsize);
+        return obj->write_back(0, pages);
     }
 
     void inode_t::invalidate_pcache(std::uint64_t offset, std::size_t length)
@@ -140,7 +401,15 @@ namespace vfs
 
         const auto npsize = vmm::default_npsize();
 
-        obj->drop_cached(size / npsize, ~0ul);
+        // the page the new end falls in stays, past the end it reads as zeroes
+        if (const auto tail = size % npsize; tail != 0)
+        {
+            std::uint8_t cached = 0;
+            obj->resident(size / npsize, { &cached, 1 });
+            if (cached)
+                lib::unused(obj->clear(size, 0, npsize - tail));
+        }
+        obj->drop_cached(lib::div_roundup(size, npsize), ~0ul);
     }
 
     void inode_t::orphan_pcache()
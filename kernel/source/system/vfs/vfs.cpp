@@ -2,6 +2,7 @@
 
 module system.vfs;
 
+import system.memory.reclaim;
 import system.cpu.local;
 import system.vfs.socket;
 import system.vfs.pipe;
@@ -483,9 +484,24 @@ namespace vfs
         return vfs::root;
     }
 
+    namespace
+    {
+        constinit std::atomic<std::size_t> nr_dentries = 0;
+    } // namespace
+
+    dentry_t::dentry_t()
+    {
+        nr_dentries.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    dentry_t::~dentry_t()
+    {
+        nr_dentries.fetch_sub(1, std::memory_order_relaxed);
+    }
+
     std::shared_ptr<dentry_t> dentry_t::create()
     {
-        return std::make_shared<dentry_t>();
+        return std::allocate_shared<dentry_t>(slab::cache_allocator<dentry_t> { "vfs_dentry" });
     }
 
     std::string pathname_from(path_t path, std::shared_ptr<dentry_t> boundary)
@@ -1903,6 +1919,115 @@ namespace vfs
 
     namespace
     {
+        // leaf dentries that only their parent still references
+        struct dentry_shrinker : reclaim::shrinker
+        {
+            dentry_shrinker() : reclaim::shrinker { "dentry" } { }
+
+            std::size_t count() override
+            {
+                return nr_dentries.load(std::memory_order_relaxed);
+            }
+
+            // everything is only try_locked, so the parent to child order
+            // used here can't deadlock against rename
+            static void prune(
+                std::shared_ptr<dentry_t> root, std::size_t nr, bool may_block,
+                std::vector<std::shared_ptr<dentry_t>> &victims
+            )
+            {
+                std::vector<std::shared_ptr<dentry_t>> stack { std::move(root) };
+                while (!stack.empty() && victims.size() < nr)
+                {
+                    const auto dir = std::move(stack.back());
+                    stack.pop_back();
+
+                    auto locked = may_block ? dir->children.lock() : dir->children.try_lock();
+                    if (!locked.owns_lock())
+                        continue;
+
+                    const auto first = victims.size();
+                    for (const auto &node : *locked)
+                    {
+                        const auto &child = node.dentry;
+                        if (child.use_count() != 1)
+                            continue;
+
+                        {
+                            const auto cm_locked = child->child_mounts.try_lock();
+                            if (!cm_locked.owns_lock() || !cm_locked->empty())
+                                continue;
+                        }
+
+                        bool leaf = false;
+                        {
+                            const auto ch_locked = child->children.try_lock();
+                            if (!ch_locked.owns_lock())
+                                continue;
+                            leaf = ch_locked->empty();
+                        }
+
+                        if (!leaf)
+                            stack.push_back(child);
+                        else if (victims.size() < nr)
+                            victims.push_back(child);
+                    }
+
+                    for (auto i = first; i < victims.size(); i++)
+                        lib::bug_on(!locked->erase(victims[i]->name));
+                }
+            }
+
+            std::size_t scan(std::size_t nr, bool may_block) override
+            {
+                std::vector<std::shared_ptr<struct mount_t>> mnts;
+                {
+                    auto locked = may_block ? mounts.lock() : mounts.try_lock();
+                    if (!locked.owns_lock())
+                        return 0;
+
+                    mnts.reserve(locked->size());
+                    for (const auto &[_, mnt] : *locked)
+                        mnts.push_back(mnt);
+                }
+
+                // released after every lock above is dropped
+                std::vector<std::shared_ptr<dentry_t>> victims;
+                for (const auto &mnt : mnts)
+                {
+                    if (victims.size() >= nr)
+                        break;
+
+                    {
+                        const auto fs = may_block ? mnt->fs.lock() : mnt->fs.try_lock();
+                        if (!fs.owns_lock() || fs.get() == nullptr || !fs->can_drop_dentries())
+                            continue;
+                    }
+
+                    if (mnt->root)
+                        prune(mnt->root, nr, may_block, victims);
+                }
+
+                // the last reference to an inode may go with its dentry and
+                // filesystems take their own locks to forget it. an allocating
+                // caller could be holding those, so let a worker do it
+                const auto freed = victims.size();
+                if (!may_block && freed != 0)
+                    sched::schedule_work([victims = std::move(victims)] { });
+                return freed;
+            }
+        };
+
+        lib::initgraph::task dentry_shrinker_task
+        {
+            "vfs.dentry.shrinker.register",
+            lib::initgraph::postsched_init_engine,
+            [] {
+                static dentry_shrinker shrinker { };
+                reclaim::register_shrinker(&shrinker);
+            }
+        };
+
         lib::initgraph::task root_task
         {
             "vfs.mount-root",
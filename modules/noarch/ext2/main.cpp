@@ -1,5 +1,7 @@
 // Copyright (C) 2024-2026  ilobilo
 
+import drivers.dev.block;
+import system.memory.reclaim;
 import system.memory.virt;
 import system.sched;
 import system.chrono;
@@ -130,6 +132,30 @@ namespace ext2
             return makedev((val >> 8) & 0xFFF, (val & 0xFF) | ((val >> 12) & ~0xFFu));
         }
 
+        using pieces_t = std::span<const lib::maybe_uspan<std::byte>>;
+
+        // at..at + len of pieces laid end to end
+        std::vector<lib::maybe_uspan<std::byte>> slice(pieces_t pieces, std::uint64_t at, std::uint64_t len)
+        {
+            std::vector<lib::maybe_uspan<std::byte>> out;
+            for (const auto &piece : pieces)
+            {
+                if (len == 0)
+                    break;
+                if (at >= piece.size())
+                {
+                    at -= piece.size();
+                    continue;
+                }
+
+                const auto take = std::min<std::uint64_t>(piece.size() - at, len);
+                out.push_back(piece.subspan(at, take));
+                len -= take;
+                at = 0;
+            }
+            return out;
+        }
+
         struct instance_t;
         using instance_ptr = lib::locked_ptr<instance_t, sched::mutex_t>;
 
@@ -137,6 +163,8 @@ namespace ext2
         struct instance_t : vfs::filesystem_t::instance_t
         {
             std::shared_ptr<vfs::file_t> src;
+            // metadata goes through its buffer cache
+            std::shared_ptr<dev::block::ops_t> bdev;
             lib::buffer<superblock_t> sb_buf;
             lib::buffer<group_desc_t> gds;
 
@@ -151,11 +179,14 @@ namespace ext2
 
             sched::mutex_t io_lock;
 
+            std::unique_ptr<reclaim::shrinker> shrinker;
+
             instance_t(
-                std::shared_ptr<vfs::file_t> src,
+                std::shared_ptr<vfs::file_t> src, std::shared_ptr<dev::block::ops_t> bdev,
                 lib::buffer<superblock_t> sb, lib::buffer<group_desc_t> gds,
                 std::uint32_t block_size, std::uint16_t inode_size, std::uint64_t flags
-            ) : src { std::move(src) }, sb_buf { std::move(sb) }, gds { std::move(gds) },
+            ) : src { std::move(src) }, bdev { std::move(bdev) },
+                sb_buf { std::move(sb) }, gds { std::move(gds) },
                 block_size { block_size }, inode_size { inode_size }, flags { flags },
                 block_hints (this->gds.size(), 0), inode_hints (this->gds.size(), 0) { }
 
@@ -193,11 +224,32 @@ namespace ext2
                 superblock()->state |= state_clean;
             }
 
-            template<typename Type>
-            auto read_at(std::uint64_t offset, std::size_t count = 1)
-                -> lib::expect<lib::buffer<Type>>
+            auto bread(std::uint32_t blk) -> lib::expect<dev::block::buffer_ref>
+            {
+                return dev::block::bread(*bdev, blk, block_size);
+            }
+
+            // for what is not block aligned, the superblock and the group
+            // descriptors
+            auto write_meta(std::uint64_t offset, std::span<const std::byte> data)
+                -> lib::expect<void>
             {
-                return src->read_obj<Type>(offset, count);
+                while (!data.empty())
+                {
+                    const auto boff = offset % block_size;
+                    const auto len = std::min<std::size_t>(block_size - boff, data.size());
+
+                    auto buf = bread(offset / block_size);
+                    if (!buf.has_value())
+                        return std::unexpected { buf.error() };
+
+                    std::memcpy(buf->data().data() + boff, data.data(), len);
+                    buf->mark_dirty();
+
+                    offset += len;
+                    data = data.subspan(len);
+                }
+                return { };
             }
 
             std::uint64_t inode_offset(std::uint32_t ino) const
@@ -211,7 +263,12 @@ namespace ext2
 
             auto read_ino(ino_t ino) -> lib::expect<lib::buffer<inode_t>>
             {
-                return read_at<inode_t>(inode_offset(ino));
+                const auto off = inode_offset(ino);
+                auto buf = bread(off / block_size);
+                if (!buf.has_value())
+                    return std::unexpected { buf.error() };
+
+                return lib::buffer<inode_t> { buf->as<inode_t>(off % block_size), 1 };
             }
 
             auto iget(const instance_ptr &handle, ino_t ino)
@@ -228,12 +285,10 @@ namespace ext2
                     if (blk == 0)
                         return 0;
 
-                    auto res = read_at<std::uint32_t>(
-                        static_cast<std::uint64_t>(blk) * block_size, ppb
-                    );
-                    if (!res.has_value())
-                        return std::unexpected { res.error() };
-                    return res->at(idx);
+                    auto buf = bread(blk);
+                    if (!buf.has_value())
+                        return std::unexpected { buf.error() };
+                    return *buf->as<std::uint32_t>(idx * sizeof(std::uint32_t));
                 };
 
                 auto run_from = [&](std::span<const std::uint32_t> leaf, std::uint64_t idx)
@@ -247,6 +302,15 @@ namespace ext2
                     return { phys, count };
                 };
 
+                auto leaf = [&](std::uint32_t blk, std::uint64_t idx)
+                    -> lib::expect<std::pair<std::uint32_t, std::uint32_t>>
+                {
+                    auto buf = bread(blk);
+                    if (!buf.has_value())
+                        return std::unexpected { buf.error() };
+                    return run_from({ buf->as<std::uint32_t>(), ppb }, idx);
+                };
+
                 if (num < ndir_blocks)
                     return run_from({ inode->block, ndir_blocks }, num);
                 num -= ndir_blocks;
@@ -255,13 +319,7 @@ namespace ext2
                 {
                     if (inode->block[ind_block] == 0)
                         return std::make_pair(0, ppb - num);
-
-                    auto buf = read_at<std::uint32_t>(
-                        static_cast<std::uint64_t>(inode->block[ind_block]) * block_size, ppb
-                    );
-                    if (!buf.has_value())
-                        return std::unexpected { buf.error() };
-                    return run_from(buf->span(), num);
+                    return leaf(inode->block[ind_block], num);
                 }
                 num -= ppb;
 
@@ -274,13 +332,7 @@ namespace ext2
                     const auto idx = num % ppb;
                     if (*l1 == 0)
                         return std::make_pair(0, ppb - idx);
-
-                    auto buf = read_at<std::uint32_t>(
-                        static_cast<std::uint64_t>(*l1) * block_size, ppb
-                    );
-                    if (!buf.has_value())
-                        return std::unexpected { buf.error() };
-                    return run_from(buf->span(), idx);
+                    return leaf(*l1, idx);
                 }
                 num -= ppb * ppb;
 
@@ -297,13 +349,7 @@ namespace ext2
                     const auto idx = num % ppb;
                     if (*l2 == 0)
                         return std::make_pair(0, ppb - idx);
-
-                    auto buf = read_at<std::uint32_t>(
-                        static_cast<std::uint64_t>(*l2) * block_size, ppb
-                    );
-                    if (!buf.has_value())
-                        return std::unexpected { buf.error() };
-                    return run_from(buf->span(), idx);
+                    return leaf(*l2, idx);
                 }
 
                 return std::unexpected { lib::err::invalid_argument };
@@ -358,11 +404,11 @@ namespace ext2
                             return { };
                         }
 
-                        auto blk = read_at<std::byte>(src, len);
-                        if (!blk.has_value())
-                            return std::unexpected { blk.error() };
-                        if (!out.copy_from(blk->span()))
-                            return std::unexpected { lib::err::invalid_address };
+                        const auto ret = this->src->pread(src, out);
+                        if (!ret.has_value())
+                            return std::unexpected { ret.error() };
+                        if (*ret != len)
+                            return std::unexpected { lib::err::io_error };
                         return { };
                     }
                 );
@@ -375,37 +421,25 @@ namespace ext2
 
             auto walk_dir(fs_inode_t *dir, std::uint64_t start, auto &&fn) -> lib::expect<void>;
 
-            auto write_bytes(std::uint64_t offset, std::span<const std::byte> data)
-                -> lib::expect<void>
+            auto zero_block(std::uint32_t blk) -> lib::expect<void>
             {
-                const auto uspan = lib::maybe_uspan<std::byte>::create(
-                    const_cast<std::byte *>(data.data()), data.size()
-                );
-                lib::bug_on(!uspan.has_value());
+                auto buf = bread(blk);
+                if (!buf.has_value())
+                    return std::unexpected { buf.error() };
 
-                const auto ret = src->pwrite(offset, *uspan);
-                if (!ret.has_value())
-                    return std::unexpected { ret.error() };
-                if (*ret != data.size())
-                    return std::unexpected { lib::err::io_error };
+                std::ranges::fill(buf->data(), std::byte { 0 });
+                buf->mark_dirty();
                 return { };
             }
 
-            auto zero_block(std::uint32_t blk) -> lib::expect<void>
-            {
-                const lib::membuffer buf { block_size, lib::zeroed };
-                return write_bytes(static_cast<std::uint64_t>(blk) * block_size, buf.span());
-            }
-
             auto bitmap_alloc(std::uint32_t bitmap_blk, std::uint32_t count, std::uint32_t &hint)
                 -> lib::expect<std::optional<std::uint32_t>>
             {
-                const auto off = static_cast<std::uint64_t>(bitmap_blk) * block_size;
-                auto bm = read_at<std::byte>(off, block_size);
+                auto bm = bread(bitmap_blk);
                 if (!bm.has_value())
                     return std::unexpected { bm.error() };
 
-                auto bits = reinterpret_cast<std::uint8_t *>(bm->data());
+                auto bits = bm->as<std::uint8_t>();
 
                 const auto scan = [&](std::uint32_t from, std::uint32_t to) -> std::optional<std::uint32_t>
                 {
@@ -435,9 +469,7 @@ namespace ext2
 
                 const auto bit = *found;
                 bits[bit >> 3] |= (1u << (bit & 7));
-
-                if (const auto ret = write_bytes(off, bm->span()); !ret.has_value())
-                    return std::unexpected { ret.error() };
+                bm->mark_dirty();
 
                 hint = bit + 1;
                 return bit;
@@ -445,25 +477,27 @@ namespace ext2
 
             auto bitmap_free(std::uint32_t bitmap_blk, std::uint32_t bit) -> lib::expect<bool>
             {
-                const auto off = static_cast<std::uint64_t>(bitmap_blk) * block_size;
-                auto bm = read_at<std::byte>(off, block_size);
+                auto bm = bread(bitmap_blk);
                 if (!bm.has_value())
                     return std::unexpected { bm.error() };
 
-                auto bits = reinterpret_cast<std::uint8_t *>(bm->data());
+                auto bits = bm->as<std::uint8_t>();
                 if (!(bits[bit >> 3] & (1u << (bit & 7))))
                     return false;
                 bits[bit >> 3] &= ~(1u << (bit & 7));
-
-                if (const auto ret = write_bytes(off, bm->span()); !ret.has_value())
-                    return std::unexpected { ret.error() };
+                bm->mark_dirty();
                 return true;
             }
 
+            // the free counts change with the group's, both go to the
+            // buffer cache and from there to the flusher
             auto commit_group(std::uint32_t group) -> lib::expect<void>
             {
                 const auto off = gdt_offset() + group * sizeof(group_desc_t);
-                return write_bytes(off, std::as_bytes(gds.span().subspan(group, 1)));
+                if (const auto ret = write_meta(off, std::as_bytes(gds.span().subspan(group, 1)));
+                    !ret.has_value())
+                    return ret;
+                return write_meta(superblock_start, std::as_bytes(sb_buf.span()));
             }
 
             auto alloc_block(std::uint32_t target_group) -> lib::expect<std::uint32_t>
@@ -590,11 +624,24 @@ namespace ext2
 
             auto write_inode_raw(std::uint32_t ino, const ext2::inode_t &disk) -> lib::expect<void>
             {
-                return write_bytes(inode_offset(ino), std::as_bytes(std::span { &disk, 1 }));
+                const auto off = inode_offset(ino);
+                auto buf = bread(off / block_size);
+                if (!buf.has_value())
+                    return std::unexpected { buf.error() };
+
+                std::memcpy(buf->as<ext2::inode_t>(off % block_size), &disk, sizeof(disk));
+                buf->mark_dirty();
+                return { };
             }
 
             auto bmap_alloc(fs_inode_t *finode, std::uint32_t lblk)
                 -> lib::expect<std::pair<std::uint32_t, bool>>;
+            // regular file data goes around the device's page cache, the
+            // file's own is the only one it lives in
+            auto read_file(fs_inode_t *finode, std::uint64_t offset, pieces_t dst)
+                -> lib::expect<void>;
+            auto write_file(fs_inode_t *finode, std::uint64_t offset, pieces_t src)
+                -> lib::expect<void>;
             auto free_indirect(
                 std::uint32_t blk, std::size_t level, std::uint64_t base,
                 std::uint64_t from, fs_inode_t *finode
@@ -714,14 +761,49 @@ namespace ext2
                 return std::unexpected { lib::err::not_supported };
             }
 
+            bool can_drop_dentries() const override { return true; }
+
+            // icache entries whose inode is gone, and forgetting up to nr of them
+            std::size_t expired_inodes();
+            std::size_t prune_icache(std::size_t nr);
+
             bool sync() override;
             bool unmount(std::shared_ptr<vfs::mount_t> mnt) override;
             bool remount(std::uint64_t new_flags) override;
         };
 
+        // unmount unregisters this with the instance locked, so scans
+        // must never wait for that lock
+        struct shrinker_t : reclaim::shrinker
+        {
+            instance_ptr handle;
+
+            shrinker_t(instance_ptr handle)
+                : reclaim::shrinker { "ext2" }, handle { std::move(handle) } { }
+
+            std::size_t count() override
+            {
+                const auto locked = handle.try_lock();
+                if (!locked.owns_lock())
+                    return 0;
+                return locked->expired_inodes();
+            }
+
+            std::size_t scan(std::size_t nr, bool may_block) override
+            {
+                lib::unused(may_block);
+
+                auto locked = handle.try_lock();
+                if (!locked.owns_lock())
+                    return 0;
+                return locked->prune_icache(nr);
+            }
+        };
+
         struct ops_t : vfs::ops_t
         {
             bool truncable() const override { return true; }
+            bool page_cached() const override { return true; }
 
             lib::expect<std::size_t> read(
                 const std::shared_ptr<vfs::file_t> &file, std::uint64_t offset,
@@ -733,9 +815,17 @@ namespace ext2
                 lib::maybe_uspan<std::byte> buffer
             ) override;
 
-            lib::expect<void> trunc(const std::shared_ptr<vfs::file_t> &file, std::size_t size) override;
+            lib::expect<void> read_pages(
+                const std::shared_ptr<vfs::file_t> &file, std::size_t idx,
+                std::span<vmm::page *> pages
+            ) override;
 
-            lib::expect<vmm::object::ptr> map(const std::shared_ptr<vfs::file_t> &file) override;
+            lib::expect<void> write_pages(
+                const std::shared_ptr<vfs::file_t> &file, std::size_t idx,
+                std::span<vmm::page *> pages
+            ) override;
+
+            lib::expect<void> trunc(const std::shared_ptr<vfs::file_t> &file, std::size_t size) override;
 
             lib::expect<void> sync(const std::shared_ptr<vfs::file_t> &file, bool datasync) override;
 
@@ -754,7 +844,6 @@ namespace ext2
 
             std::weak_ptr<fs_inode_t> self;
 
-            vmm::object::ptr data;
             bool destroy = false;
 
             ext2::inode_t *inode() { return ino_buf.data(); }
@@ -851,11 +940,11 @@ namespace ext2
                 if (phys == 0)
                     continue;
 
-                auto blk = read_at<std::byte>(phys * block_size, block_size);
-                if (!blk.has_value())
-                    return std::unexpected { blk.error() };
+                auto buf = bread(phys);
+                if (!buf.has_value())
+                    return std::unexpected { buf.error() };
 
-                const auto cont = fn(phys, blk->span());
+                const auto cont = fn(*buf);
                 if (!cont.has_value())
                     return std::unexpected { cont.error() };
                 if (!*cont)
@@ -879,11 +968,11 @@ namespace ext2
 
                 if (const std::uint64_t phys = res->first; phys != 0)
                 {
-                    auto blk = read_at<std::byte>(phys * block_size, block_size);
-                    if (!blk.has_value())
-                        return std::unexpected { blk.error() };
+                    auto buf = bread(phys);
+                    if (!buf.has_value())
+                        return std::unexpected { buf.error() };
 
-                    const auto cont = for_each_dirent(blk->span(),
+                    const auto cont = for_each_dirent(buf->data(),
                         [&](dir_entry_2_t *de, std::uint32_t i) -> lib::expect<bool>
                         {
                             const auto abs = block_start + i;
@@ -908,141 +997,33 @@ namespace ext2
             return { };
         }
 
-        struct object_t : vmm::object
+        // pages of the file's page cache as pieces
+        std::vector<lib::maybe_uspan<std::byte>> page_pieces(std::span<vmm::page *> pages)
         {
-            std::weak_ptr<fs_inode_t> finode;
+            const auto npsize = vmm::default_npsize();
 
-            lib::expect<void> fetch_pages(std::size_t idx, std::span<vmm::page *> pages) override
+            std::vector<lib::maybe_uspan<std::byte>> out;
+            out.reserve(pages.size());
+            for (auto *pg : pages)
             {
-                auto inode = finode.lock();
-                if (!inode)
-                    return std::unexpected { lib::err::invalid_device_or_address };
-
-                const auto npsize = vmm::default_npsize();
-
-                auto fs = inode->owner;
-                const std::unique_lock _ { fs->io_lock };
-
-                const std::uint64_t file_size = inode->stat.st_size;
-                const std::uint64_t base = static_cast<std::uint64_t>(idx) * npsize;
-                const std::uint64_t total = static_cast<std::uint64_t>(pages.size()) * npsize;
-
-                const auto fill = [&](std::uint64_t at, std::uint64_t len, const std::byte *src) {
-                    while (len != 0)
-                    {
-                        const auto poff = at % npsize;
-                        const auto take = std::min<std::uint64_t>(npsize - poff, len);
-                        auto dst = reinterpret_cast<std::byte *>(
-                            lib::tohh(vmm::paddr_from(pages[at / npsize]))
-                        ) + poff;
-
-                        if (src)
-                        {
-                            std::memcpy(dst, src, take);
-                            src += take;
-                        }
-                        else std::memset(dst, 0, take);
-
-                        at += take;
-                        len -= take;
-                    }
-                };
-
-                const auto valid = base < file_size
-                    ? std::min(total, file_size - base) : 0ul;
-                if (valid != total)
-                    fill(valid, total - valid, nullptr);
-
-                return fs->for_each_run(inode->inode(), base, valid,
-                    [&](std::uint64_t at, std::uint64_t src, std::uint64_t len) -> lib::expect<void>
-                    {
-                        if (src == 0)
-                        {
-                            fill(at, len, nullptr);
-                            return { };
-                        }
-
-                        auto blk = fs->read_at<std::byte>(src, len);
-                        if (!blk.has_value())
-                            return std::unexpected { blk.error() };
-
-                        fill(at, len, blk->data());
-                        return { };
-                    }
+                auto span = lib::maybe_uspan<std::byte>::create(
+                    reinterpret_cast<std::byte *>(lib::tohh(vmm::paddr_from(pg))), npsize
                 );
+                lib::bug_on(!span.has_value());
+                out.push_back(*span);
             }
-
-            lib::expect<void> write_pages(std::size_t idx, std::span<vmm::page *> pages) override
-            {
-                auto inode = finode.lock();
-                if (!inode)
-                    return std::unexpected { lib::err::invalid_device_or_address };
-
-                const auto npsize = vmm::default_npsize();
-
-                auto fs = inode->owner;
-                if (fs->read_only())
-                    return std::unexpected { lib::err::read_only_fs };
-
-                const std::unique_lock _ { fs->io_lock };
-
-                const std::uint64_t file_size = inode->stat.st_size;
-                const std::uint64_t bs = fs->block_size;
-                bool allocated_any = false;
-
-                for (std::size_t i = 0; i < pages.size(); i++)
-                {
-                    const auto page_off = (idx + i) * npsize;
-                    if (page_off >= file_size)
-                        continue;
-
-                    auto base = reinterpret_cast<std::byte *>(lib::tohh(vmm::paddr_from(pages[i])));
-                    for (std::uint64_t bo = 0; bo < npsize; bo += bs)
-                    {
-                        const auto block_off = page_off + bo;
-                        if (block_off >= file_size)
-                            break;
-
-                        auto pr = fs->bmap_alloc(inode.get(), block_off / bs);
-                        if (!pr.has_value())
-                            return std::unexpected { pr.error() };
-                        allocated_any |= pr->second;
-
-                        const auto ret = fs->write_bytes(
-                            static_cast<std::uint64_t>(pr->first) * bs, { base + bo, bs }
-                        );
-                        if (!ret.has_value())
-                            return std::unexpected { ret.error() };
-                    }
-                }
-
-                if (allocated_any)
-                {
-                    inode->stat.st_blocks = inode->inode()->blocks;
-                    if (const auto ret = fs->write_inode_impl(inode.get()); !ret.has_value())
-                        return ret;
-                }
-                return { };
-            }
-
-            object_t(fs_inode_t *inode)
-                : vmm::object { vmm::object_type::file }, finode { inode->self } { }
-        };
-
-        vmm::object::ptr get_object(fs_inode_t *finode)
-        {
-            const std::unique_lock _ { finode->lock };
-            if (!finode->data)
-                finode->data = new object_t { finode };
-            return finode->data;
+            return out;
         }
 
+        // the page cache sits above these. read and write only see o_direct
         lib::expect<std::size_t> ops_t::read(
             const std::shared_ptr<vfs::file_t> &file, std::uint64_t offset,
             lib::maybe_uspan<std::byte> buffer
         )
         {
             const auto finode = inode_of(file);
+            const auto fs = finode->owner;
+            const std::unique_lock _ { fs->io_lock };
 
             const auto file_size = static_cast<std::uint64_t>(finode->stat.st_size);
             if (offset >= file_size)
@@ -1052,7 +1033,10 @@ namespace ext2
             if (real_size == 0)
                 return 0;
 
-            return get_object(finode)->read(offset, buffer.subspan(0, real_size));
+            const auto dst = buffer.subspan(0, real_size);
+            if (const auto ret = fs->read_file(finode, offset, { &dst, 1 }); !ret.has_value())
+                return std::unexpected { ret.error() };
+            return real_size;
         }
 
         lib::expect<std::size_t> ops_t::write(
@@ -1065,8 +1049,7 @@ namespace ext2
             if (fs->read_only())
                 return std::unexpected { lib::err::read_only_fs };
 
-            auto obj = get_object(finode);
-            const std::unique_lock _ { finode->lock };
+            const std::unique_lock _ { fs->io_lock };
 
             if (file->flags & vfs::o_append)
             {
@@ -1077,87 +1060,94 @@ namespace ext2
             if (buffer.size_bytes() == 0)
                 return 0;
 
-            const auto num = obj->write(offset, buffer);
-            if (num == 0)
-                return std::unexpected { lib::err::io_error };
+            if (const auto ret = fs->write_file(finode, offset, { &buffer, 1 }); !ret.has_value())
+                return std::unexpected { ret.error() };
 
-            const auto new_end = offset + num;
+            if (const auto end = offset + buffer.size_bytes();
+                end > static_cast<std::uint64_t>(finode->stat.st_size))
             {
-                const std::unique_lock _ { fs->io_lock };
+                fs->set_size(finode, end);
+                if (const auto ret = fs->write_inode_impl(finode); !ret.has_value())
+                    return std::unexpected { ret.error() };
+            }
+            return buffer.size_bytes();
+        }
 
-                if (new_end > static_cast<std::uint64_t>(finode->stat.st_size))
-                    fs->set_size(finode, new_end);
+        lib::expect<void> ops_t::read_pages(
+            const std::shared_ptr<vfs::file_t> &file, std::size_t idx,
+            std::span<vmm::page *> pages
+        )
+        {
+            const auto finode = inode_of(file);
+            const auto fs = finode->owner;
+            const auto npsize = vmm::default_npsize();
+            const std::unique_lock _ { fs->io_lock };
 
-                finode->stat.update_time(kstat::time::modify | kstat::time::status);
-                finode->dirty = true;
-            }
+            const std::uint64_t file_size = finode->stat.st_size;
+            const std::uint64_t base = static_cast<std::uint64_t>(idx) * npsize;
+            const std::uint64_t total = static_cast<std::uint64_t>(pages.size()) * npsize;
+            const auto valid = base < file_size ? std::min(total, file_size - base) : 0ul;
+
+            const auto dst = page_pieces(pages);
 
-            if (file->flags & vfs::o_direct)
+            // the block the file ends in is read whole, and cleared after
+            if (valid != 0)
             {
-                const auto npsize = vmm::default_npsize();
-                const auto ret = obj->write_back(
-                    offset / npsize,
-                    lib::div_roundup(new_end, npsize) - offset / npsize
-                );
-                if (!ret.has_value())
-                    return std::unexpected { ret.error() };
+                const auto len = std::min<std::uint64_t>(total, lib::align_up(valid, fs->block_size));
+                if (const auto ret = fs->read_file(finode, base, slice(dst, 0, len)); !ret.has_value())
+                    return ret;
             }
-            return num;
+
+            for (const auto &piece : slice(dst, valid, total - valid))
+                lib::unused(piece.fill(0, piece.size()));
+            return { };
         }
 
-        lib::expect<void> ops_t::trunc(const std::shared_ptr<vfs::file_t> &file, std::size_t size)
+        lib::expect<void> ops_t::write_pages(
+            const std::shared_ptr<vfs::file_t> &file, std::size_t idx,
+            std::span<vmm::page *> pages
+        )
         {
             const auto finode = inode_of(file);
             const auto fs = finode->owner;
             if (fs->read_only())
                 return std::unexpected { lib::err::read_only_fs };
 
-            const std::unique_lock _ { finode->lock };
-            const std::uint64_t old_size = finode->stat.st_size;
+            const auto npsize = vmm::default_npsize();
+            const std::unique_lock _ { fs->io_lock };
 
-            {
-                const std::unique_lock _ { fs->io_lock };
+            const std::uint64_t file_size = finode->stat.st_size;
+            const std::uint64_t base = static_cast<std::uint64_t>(idx) * npsize;
+            if (base >= file_size)
+                return { };
 
-                if (size < old_size)
-                {
-                    if (const auto ret = fs->truncate_blocks(finode, size); !ret.has_value())
-                        return ret;
-                }
+            // the block the file ends in goes whole, the page past the end
+            // of the file is zeroes
+            const std::uint64_t total = static_cast<std::uint64_t>(pages.size()) * npsize;
+            const auto len = std::min<std::uint64_t>(total, lib::align_up(file_size - base, fs->block_size));
+            return fs->write_file(finode, base, slice(page_pieces(pages), 0, len));
+        }
 
-                fs->set_size(finode, size);
-                finode->stat.st_blocks = finode->inode()->blocks;
-                finode->stat.update_time(kstat::time::modify | kstat::time::status);
+        lib::expect<void> ops_t::trunc(const std::shared_ptr<vfs::file_t> &file, std::size_t size)
+        {
+            const auto finode = inode_of(file);
+            const auto fs = finode->owner;
+            if (fs->read_only())
+                return std::unexpected { lib::err::read_only_fs };
 
-                if (const auto ret = fs->write_inode_impl(finode); !ret.has_value())
-                    return ret;
-            }
+            const std::unique_lock _ { fs->io_lock };
 
-            if (size < old_size && finode->data)
+            if (size < static_cast<std::uint64_t>(finode->stat.st_size))
             {
-                const auto npsize = vmm::default_npsize();
-                if (const auto tail = size % npsize; tail != 0)
-                {
-                    finode->data->clear(size, 0, npsize - tail);
-                    if (const auto ret = finode->data->write_back(size / npsize, 1);
-                        !ret.has_value())
-                        return ret;
-                }
-                finode->data->drop_cached(lib::div_roundup<std::uint64_t>(size, npsize), ~0ul);
+                if (const auto ret = fs->truncate_blocks(finode, size); !ret.has_value())
+                    return ret;
             }
-            return { };
-        }
 
-        lib::expect<vmm::object::ptr> ops_t::map(const std::shared_ptr<vfs::file_t> &file)
-        {
-            const auto &dentry = file->path.dentry;
-            if (!dentry || !dentry->inode)
-                return std::unexpected { lib::err::no_such_device };
-
-            const auto finode = inode_of(file);
-            if (finode->stat.type() != stat::s_ifreg)
-                return std::unexpected { lib::err::no_such_device };
+            fs->set_size(finode, size);
+            finode->stat.st_blocks = finode->inode()->blocks;
+            finode->stat.update_time(kstat::time::modify | kstat::time::status);
 
-            return get_object(finode);
+            return fs->write_inode_impl(finode);
         }
 
         lib::expect<void> ops_t::sync(const std::shared_ptr<vfs::file_t> &file, bool datasync)
@@ -1169,17 +1159,6 @@ namespace ext2
             if (owner->read_only())
                 return { };
 
-            if (finode->data)
-            {
-                const auto npsize = vmm::default_npsize();
-                const auto pages = lib::div_roundup<std::uint64_t>(finode->stat.st_size, npsize);
-                if (pages != 0)
-                {
-                    if (const auto ret = finode->data->write_back(0, pages); !ret.has_value())
-                        return ret;
-                }
-            }
-
             {
                 const std::unique_lock _ { owner->io_lock };
                 if (finode->dirty)
@@ -1331,25 +1310,20 @@ namespace ext2
             const auto ensure_slot = [&](std::uint32_t parent, std::uint32_t idx, bool child_meta)
                 -> lib::expect<std::pair<std::uint32_t, bool>>
             {
-                auto buf = read_at<std::uint32_t>(
-                    static_cast<std::uint64_t>(parent) * block_size, ppb
-                );
+                auto buf = bread(parent);
                 if (!buf.has_value())
                     return std::unexpected { buf.error() };
-                if (buf->at(idx) != 0)
-                    return std::make_pair(buf->at(idx), false);
+
+                const auto slot = buf->as<std::uint32_t>(idx * sizeof(std::uint32_t));
+                if (*slot != 0)
+                    return std::make_pair(*slot, false);
 
                 const auto blk = alloc_one(child_meta);
                 if (!blk.has_value())
                     return std::unexpected { blk.error() };
-                buf->at(idx) = *blk;
 
-                const auto ret = write_bytes(
-                    static_cast<std::uint64_t>(parent) * block_size,
-                    std::as_bytes(buf->span())
-                );
-                if (!ret.has_value())
-                    return std::unexpected { ret.error() };
+                *slot = *blk;
+                buf->mark_dirty();
                 return std::make_pair(*blk, true);
             };
 
@@ -1395,6 +1369,173 @@ namespace ext2
             return std::unexpected { lib::err::invalid_argument };
         }
 
+        auto instance_t::read_file(fs_inode_t *finode, std::uint64_t offset, pieces_t dst)
+            -> lib::expect<void>
+        {
+            const std::uint64_t bs = block_size;
+
+            std::uint64_t total = 0;
+            for (const auto &piece : dst)
+                total += piece.size();
+
+            // a block that is only partly wanted goes through a bounce buffer
+            std::vector<std::byte> bounce;
+            const auto partial = [&](std::uint64_t blk_off, std::uint64_t skip, std::uint64_t at, std::uint64_t len)
+                -> lib::expect<void>
+            {
+                bounce.resize(bs);
+                const auto span = lib::maybe_uspan<std::byte>::create(bounce.data(), bs);
+                lib::bug_on(!span.has_value());
+
+                if (const auto ret = bdev->direct_rw(false, blk_off, { &*span, 1 }); !ret.has_value())
+                    return ret;
+
+                for (const auto &piece : slice(dst, at, len))
+                {
+                    if (!piece.copy_from(std::span<const std::byte> { bounce.data() + skip, piece.size() }))
+                        return std::unexpected { lib::err::invalid_address };
+                    skip += piece.size();
+                }
+                return { };
+            };
+
+            return for_each_run(finode->inode(), offset, total,
+                [&](std::uint64_t at, std::uint64_t src, std::uint64_t len) -> lib::expect<void>
+                {
+                    if (src == 0)
+                    {
+                        for (const auto &piece : slice(dst, at, len))
+                        {
+                            if (!piece.fill(0, piece.size()))
+                                return std::unexpected { lib::err::invalid_address };
+                        }
+                        return { };
+                    }
+
+                    if (const auto skip = src % bs; skip != 0)
+                    {
+                        const auto head = std::min(bs - skip, len);
+                        if (const auto ret = partial(src - skip, skip, at, head); !ret.has_value())
+                            return ret;
+                        at += head;
+                        src += head;
+                        len -= head;
+                    }
+
+                    // the whole blocks of the run in one read
+                    if (const auto whole = len / bs * bs; whole != 0)
+                    {
+                        if (const auto ret = bdev->direct_rw(false, src, slice(dst, at, whole));
+                            !ret.has_value())
+                            return ret;
+                        at += whole;
+                        src += whole;
+                        len -= whole;
+                    }
+
+                    if (len != 0)
+                        return partial(src, 0, at, len);
+                    return { };
+                }
+            );
+        }
+
+        auto instance_t::write_file(fs_inode_t *finode, std::uint64_t offset, pieces_t src)
+            -> lib::expect<void>
+        {
+            const std::uint64_t bs = block_size;
+
+            std::uint64_t total = 0;
+            for (const auto &piece : src)
+                total += piece.size();
+
+            bool allocated = false;
+
+            // physically contiguous whole blocks go down in one write
+            std::vector<lib::maybe_uspan<std::byte>> run;
+            std::uint64_t run_phys = 0, run_len = 0;
+            const auto put_run = [&] -> lib::expect<void>
+            {
+                if (run_len == 0)
+                    return { };
+
+                const auto ret = bdev->direct_rw(true, run_phys, run);
+                run.clear();
+                run_len = 0;
+                return ret;
+            };
+
+            std::vector<std::byte> bounce;
+            const auto copy = [&] -> lib::expect<void>
+            {
+                for (std::uint64_t progress = 0; progress < total; )
+                {
+                    const auto pos = offset + progress;
+                    const auto boff = pos % bs;
+                    const auto len = std::min(bs - boff, total - progress);
+
+                    auto pr = bmap_alloc(finode, pos / bs);
+                    if (!pr.has_value())
+                        return std::unexpected { pr.error() };
+                    allocated |= pr->second;
+
+                    const auto phys = static_cast<std::uint64_t>(pr->first) * bs;
+                    if (len == bs)
+                    {
+                        if (run_len != 0 && run_phys + run_len != phys)
+                        {
+                            if (const auto ret = put_run(); !ret.has_value())
+                                return ret;
+                        }
+                        if (run_len == 0)
+                            run_phys = phys;
+
+                        std::ranges::copy(slice(src, progress, len), std::back_inserter(run));
+                        run_len += len;
+                    }
+                    else
+                    {
+                        if (const auto ret = put_run(); !ret.has_value())
+                            return ret;
+
+                        // the rest of the block is what the disk has, or
+                        // zeroes in a new one
+                        bounce.assign(bs, std::byte { 0 });
+                        const auto span = lib::maybe_uspan<std::byte>::create(bounce.data(), bs);
+                        lib::bug_on(!span.has_value());
+
+                        if (!pr->second)
+                        {
+                            if (const auto ret = bdev->direct_rw(false, phys, { &*span, 1 }); !ret.has_value())
+                                return ret;
+                        }
+
+                        auto at = boff;
+                        for (const auto &piece : slice(src, progress, len))
+                        {
+                            if (!piece.copy_to(std::span<std::byte> { bounce.data() + at, piece.size() }))
+                                return std::unexpected { lib::err::invalid_address };
+                            at += piece.size();
+                        }
+
+                        if (const auto ret = bdev->direct_rw(true, phys, { &*span, 1 }); !ret.has_value())
+                            return ret;
+                    }
+                    progress += len;
+                }
+                return put_run();
+            };
+            const auto res = copy();
+
+            if (allocated)
+            {
+                finode->stat.st_blocks = finode->inode()->blocks;
+                if (const auto ret = write_inode_impl(finode); !ret.has_value())
+                    return ret;
+            }
+            return res;
+        }
+
         auto instance_t::free_indirect(
             std::uint32_t blk, std::size_t level, std::uint64_t base,
             std::uint64_t from, fs_inode_t *finode
@@ -1404,11 +1545,10 @@ namespace ext2
             const auto ppb = ptrs_per_block();
             const auto spb = sectors_per_block();
 
-            auto buf = read_at<std::uint32_t>(
-                static_cast<std::uint64_t>(blk) * block_size, ppb
-            );
+            auto buf = bread(blk);
             if (!buf.has_value())
                 return std::unexpected { buf.error() };
+            const std::span slots { buf->as<std::uint32_t>(), ppb };
 
             std::uint64_t span = 1;
             for (std::size_t i = 1; i < level; i++)
@@ -1419,7 +1559,7 @@ namespace ext2
 
             for (std::uint64_t i = 0; i < ppb; i++)
             {
-                const auto child = buf->at(i);
+                const auto child = slots[i];
                 const auto slot_base = base + i * span;
 
                 if (slot_base + span <= from)
@@ -1437,7 +1577,7 @@ namespace ext2
                         return std::unexpected { ret.error() };
 
                     ino->blocks -= std::min(ino->blocks, spb);
-                    buf->at(i) = 0;
+                    slots[i] = 0;
                     modified = true;
                 }
                 else
@@ -1452,7 +1592,7 @@ namespace ext2
                             return std::unexpected { ret.error() };
 
                         ino->blocks -= std::min(ino->blocks, spb);
-                        buf->at(i) = 0;
+                        slots[i] = 0;
                         modified = true;
                     }
                     else all_empty = false;
@@ -1460,15 +1600,7 @@ namespace ext2
             }
 
             if (modified)
-            {
-                const auto ret = write_bytes(
-                    static_cast<std::uint64_t>(blk) * block_size,
-                    std::as_bytes(buf->span())
-                );
-                if (!ret.has_value())
-                    return std::unexpected { ret.error() };
-            }
-
+                buf->mark_dirty();
             return all_empty;
         }
 
@@ -1527,16 +1659,14 @@ namespace ext2
                 if (!res.has_value())
                     return std::unexpected { res.error() };
 
-                if (const std::uint64_t phys = res->first; phys != 0)
+                if (const auto phys = res->first; phys != 0)
                 {
-                    const auto base = phys * block_size;
-                    auto blk = read_at<std::byte>(base, block_size);
-                    if (!blk.has_value())
-                        return std::unexpected { blk.error() };
+                    auto buf = bread(phys);
+                    if (!buf.has_value())
+                        return std::unexpected { buf.error() };
 
-                    std::memset(blk->data() + tail, 0, block_size - tail);
-                    if (const auto ret = write_bytes(base, blk->span()); !ret.has_value())
-                        return ret;
+                    std::ranges::fill(buf->data().subspan(tail), std::byte { 0 });
+                    buf->mark_dirty();
                 }
             }
 
@@ -1586,10 +1716,10 @@ namespace ext2
         {
             superblock()->wtime = now_secs();
 
-            if (const auto ret = write_bytes(gdt_offset(), std::as_bytes(gds.span()));
+            if (const auto ret = write_meta(gdt_offset(), std::as_bytes(gds.span()));
                 !ret.has_value())
                 return ret;
-            return write_bytes(superblock_start, std::as_bytes(sb_buf.span()));
+            return write_meta(superblock_start, std::as_bytes(sb_buf.span()));
         }
 
         auto instance_t::collect_live() -> std::vector<std::shared_ptr<fs_inode_t>>
@@ -1623,14 +1753,23 @@ namespace ext2
             }
         }
 
+        // down to the disk. the data and the metadata reach the block layer
+        // as one plugged burst, so that neighbouring blocks are merged
         void instance_t::flush_all()
         {
+            const dev::block::plug_t plug;
+
             const auto npsize = vmm::default_npsize();
             const auto live = collect_live();
 
             for (const auto &finode : live)
             {
-                if (!finode->data)
+                vmm::object::ptr obj;
+                {
+                    const std::unique_lock _ { finode->lock };
+                    obj = finode->mapping;
+                }
+                if (!obj)
                     continue;
 
                 const auto pages = lib::div_roundup(
@@ -1639,7 +1778,7 @@ namespace ext2
                 if (pages == 0)
                     continue;
 
-                if (const auto ret = finode->data->write_back(0, pages); !ret.has_value())
+                if (const auto ret = obj->write_back(0, pages); !ret.has_value())
                 {
                     lib::error(
                         "ext2: could not write back inode {}: {}",
@@ -1648,10 +1787,15 @@ namespace ext2
                 }
             }
 
-            const std::unique_lock _ { io_lock };
-            flush_dirty_inodes(live);
-            if (const auto ret = flush_metadata(); !ret.has_value())
-                lib::error("ext2: could not flush metadata: {}", lib::error_name(ret.error()));
+            {
+                const std::unique_lock _ { io_lock };
+                flush_dirty_inodes(live);
+                if (const auto ret = flush_metadata(); !ret.has_value())
+                    lib::error("ext2: could not flush metadata: {}", lib::error_name(ret.error()));
+            }
+
+            if (const auto ret = src->sync(); !ret.has_value())
+                lib::error("ext2: could not sync: {}", lib::error_name(ret.error()));
         }
 
         auto instance_t::free_everything(fs_inode_t *finode) -> lib::expect<void>
@@ -1669,9 +1813,9 @@ namespace ext2
         {
             std::optional<std::uint32_t> found;
             const auto ret = for_each_dir_block(dir,
-                [&](std::uint64_t, std::span<std::byte> data)
+                [&](const dev::block::buffer_ref &buf)
                 {
-                    return for_each_dirent(data,
+                    return for_each_dirent(buf.data(),
                         [&](dir_entry_2_t *de, std::uint32_t) -> lib::expect<bool>
                         {
                             if (de->inode == 0 || dirent_name(de) != name)
@@ -1695,8 +1839,9 @@ namespace ext2
         {
             bool done = false;
             const auto ret = for_each_dir_block(dir,
-                [&](std::uint64_t phys, std::span<std::byte> data) -> lib::expect<bool>
+                [&](const dev::block::buffer_ref &buf) -> lib::expect<bool>
                 {
+                    const auto data = buf.data();
                     const auto scanned = for_each_dirent(data,
                         [&](dir_entry_2_t *de, std::uint32_t) -> lib::expect<bool>
                         {
@@ -1713,8 +1858,7 @@ namespace ext2
                     if (*scanned)
                         return true;
 
-                    if (const auto w = write_bytes(phys * block_size, data); !w.has_value())
-                        return std::unexpected { w.error() };
+                    buf.mark_dirty();
 
                     done = true;
                     return false;
@@ -1745,8 +1889,9 @@ namespace ext2
 
             bool placed = false;
             const auto ret = for_each_dir_block(dir,
-                [&](std::uint64_t phys, std::span<std::byte> data) -> lib::expect<bool>
+                [&](const dev::block::buffer_ref &buf) -> lib::expect<bool>
                 {
+                    const auto data = buf.data();
                     const auto scanned = for_each_dirent(data,
                         [&](dir_entry_2_t *de, std::uint32_t i) -> lib::expect<bool>
                         {
@@ -1769,8 +1914,7 @@ namespace ext2
                     if (*scanned)
                         return true;
 
-                    if (const auto w = write_bytes(phys * block_size, data); !w.has_value())
-                        return std::unexpected { w.error() };
+                    buf.mark_dirty();
 
                     placed = true;
                     return false;
@@ -1786,15 +1930,13 @@ namespace ext2
             if (!pr.has_value())
                 return std::unexpected { pr.error() };
 
-            lib::membuffer blk { block_size, lib::zeroed };
-            place(blk.data(), block_size);
+            auto buf = bread(pr->first);
+            if (!buf.has_value())
+                return std::unexpected { buf.error() };
 
-            const auto res = write_bytes(
-                static_cast<std::uint64_t>(pr->first) * block_size,
-                blk.span()
-            );
-            if (!res.has_value())
-                return res;
+            std::ranges::fill(buf->data(), std::byte { 0 });
+            place(buf->data().data(), block_size);
+            buf->mark_dirty();
 
             set_size(dir, size + block_size);
             dir->stat.st_blocks = dir->inode()->blocks;
@@ -1806,10 +1948,10 @@ namespace ext2
         {
             bool removed = false;
             const auto ret = for_each_dir_block(dir,
-                [&](std::uint64_t phys, std::span<std::byte> data) -> lib::expect<bool>
+                [&](const dev::block::buffer_ref &buf) -> lib::expect<bool>
                 {
                     dir_entry_2_t *prev = nullptr;
-                    const auto scanned = for_each_dirent(data,
+                    const auto scanned = for_each_dirent(buf.data(),
                         [&](dir_entry_2_t *de, std::uint32_t) -> lib::expect<bool>
                         {
                             if (de->inode == 0 || dirent_name(de) != name)
@@ -1832,8 +1974,7 @@ namespace ext2
                     if (*scanned)
                         return true;
 
-                    if (const auto w = write_bytes(phys * block_size, data); !w.has_value())
-                        return std::unexpected { w.error() };
+                    buf.mark_dirty();
 
                     removed = true;
                     return false;
@@ -1899,7 +2040,12 @@ namespace ext2
                     if (!pr.has_value())
                         return std::unexpected { pr.error() };
 
-                    lib::membuffer blk { block_size, lib::zeroed };
+                    auto buf = bread(pr->first);
+                    if (!buf.has_value())
+                        return std::unexpected { buf.error() };
+
+                    const auto blk = buf->data();
+                    std::ranges::fill(blk, std::byte { 0 });
 
                     const auto dot = reinterpret_cast<dir_entry_2_t *>(blk.data());
                     dot->inode = ino_num;
@@ -1918,10 +2064,7 @@ namespace ext2
                     dotdot->name[0] = '.';
                     dotdot->name[1] = '.';
 
-                    if (const auto ret = write_bytes(
-                            static_cast<std::uint64_t>(pr->first) * block_size, blk.span()
-                        ); !ret.has_value())
-                        return ret;
+                    buf->mark_dirty();
 
                     set_size(finode.get(), block_size);
                     finode->stat.st_blocks = finode->inode()->blocks;
@@ -2006,13 +2149,14 @@ namespace ext2
                     if (!pr.has_value())
                         return std::unexpected { pr.error() };
 
-                    lib::membuffer blk { block_size, lib::zeroed };
-                    std::memcpy(blk.data(), tstr.data(), tstr.size());
+                    auto buf = bread(pr->first);
+                    if (!buf.has_value())
+                        return std::unexpected { buf.error() };
 
-                    if (const auto ret = write_bytes(
-                            static_cast<std::uint64_t>(pr->first) * block_size, blk.span()
-                        ); !ret.has_value())
-                        return ret;
+                    const auto blk = buf->data();
+                    std::ranges::fill(blk, std::byte { 0 });
+                    std::memcpy(blk.data(), tstr.data(), tstr.size());
+                    buf->mark_dirty();
 
                     finode->stat.st_blocks = finode->inode()->blocks;
                 }
@@ -2224,31 +2368,69 @@ namespace ext2
             return write_inode_impl(inode_of(inode));
         }
 
+        // into the inode table block right away, which the device's flusher
+        // writes back once it expires
         auto instance_t::dirty_inode(std::shared_ptr<vfs::inode_t> &inode) -> lib::expect<void>
         {
             const std::unique_lock _ { io_lock };
-            inode->dirty = true;
-            return { };
+            if (read_only())
+            {
+                inode->dirty = true;
+                return { };
+            }
+            return write_inode_impl(inode_of(inode));
         }
 
         bool instance_t::sync()
         {
             if (!read_only())
-            {
                 flush_all();
-                lib::unused(src->sync());
-            }
             return true;
         }
 
+        std::size_t instance_t::expired_inodes()
+        {
+            const std::unique_lock lock { io_lock, std::try_to_lock };
+            if (!lock.owns_lock())
+                return 0;
+
+            return std::ranges::count_if(icache, [](const auto &entry) {
+                return entry.second.expired();
+            });
+        }
+
+        std::size_t instance_t::prune_icache(std::size_t nr)
+        {
+            const std::unique_lock lock { io_lock, std::try_to_lock };
+            if (!lock.owns_lock())
+                return 0;
+
+            std::vector<ino_t> expired;
+            for (const auto &[ino, weak] : icache)
+            {
+                if (expired.size() >= nr)
+                    break;
+                if (weak.expired())
+                    expired.push_back(ino);
+            }
+            for (const auto ino : expired)
+                icache.erase(ino);
+            return expired.size();
+        }
+
         bool instance_t::unmount(std::shared_ptr<vfs::mount_t> mnt)
         {
             lib::unused(mnt);
+            if (shrinker)
+            {
+                reclaim::unregister_shrinker(shrinker.get());
+                shrinker.reset();
+            }
+
             if (!read_only())
             {
                 mark_clean();
                 flush_all();
-                lib::unused(src->sync());
             }
             return true;
         }
@@ -2265,7 +2447,6 @@ namespace ext2
             {
                 mark_clean();
                 flush_all();
-                lib::unused(src->sync());
             }
 
             flags = new_flags;
@@ -2280,7 +2461,6 @@ namespace ext2
                     sb->mtime = now_secs();
                 }
                 flush_all();
-                lib::unused(src->sync());
             }
             return true;
         }
@@ -2319,9 +2499,16 @@ namespace ext2
 
             const bool rw = !(flags & vfs::ms_rdonly);
 
+            // every block device's ops are the block layer's
+            if (src->inode->stat.type() != stat::s_ifblk)
+                return std::unexpected { lib::err::not_a_block };
+
             auto file = vfs::file_t::create({ nullptr, src }, 0, 0);
             if (const auto ret = file->open(0, sched::current_process()->pid); !ret.has_value())
                 return std::unexpected { ret.error() };
+            auto bdev = std::static_pointer_cast<dev::block::ops_t>(file->ops);
+            if (!bdev)
+                return std::unexpected { lib::err::no_such_device };
 
             auto sbres = file->read_obj<superblock_t>(superblock_start);
             if (!sbres.has_value())
@@ -2372,7 +2559,7 @@ namespace ext2
             std::shared_ptr<vfs::dentry_t> root;
 
             auto instance = lib::make_locked<ext2::instance_t, sched::mutex_t>(
-                std::move(file), std::move(sbuf), std::move(*gdres),
+                std::move(file), std::move(bdev), std::move(sbuf), std::move(*gdres),
                 block_size, inode_size, flags
             );
             {
@@ -2397,6 +2584,9 @@ namespace ext2
                     if (const auto ret = locked->flush_metadata(); !ret.has_value())
                         return std::unexpected { ret.error() };
                 }
+
+                locked->shrinker = std::make_unique<shrinker_t>(instance);
+                reclaim::register_shrinker(locked->shrinker.get());
             }
 
             return std::make_shared<struct vfs::mount_t>(std::move(instance), root);
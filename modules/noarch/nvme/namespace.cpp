@@ -21,6 +21,15 @@ namespace nvme
         bool write, bool sync, std::uint64_t lba, arch::dma_buffer &buffer,
         std::function<void (lib::expect<void>)> cb
     )
+    {
+        const auto idx = cpu::self().read<std::size_t, &cpu::processor::idx>();
+        rw(idx % _io_queues.size(), write, sync, lba, buffer, std::move(cb));
+    }
+
+    void namespace_t::rw(
+        std::size_t hwq, bool write, bool sync, std::uint64_t lba,
+        arch::dma_buffer &buffer, std::function<void (lib::expect<void>)> cb
+    )
     {
         auto cmd = std::make_shared<command_t>(_pool);
         cmd->setup(buffer);
@@ -38,7 +47,7 @@ namespace nvme
                 : std::unexpected { lib::err::io_error }
             );
         });
-        submit(cmd);
+        _io_queues[hwq % _io_queues.size()]->submit(cmd);
     }
 
     lib::expect<void> namespace_t::flush()
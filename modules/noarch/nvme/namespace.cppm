@@ -26,13 +26,23 @@ export namespace nvme
             std::function<void (lib::expect<void>)> cb
         ) override;
 
+        void rw(
+            std::size_t hwq, bool write, bool sync, std::uint64_t lba,
+            arch::dma_buffer &buffer, std::function<void (lib::expect<void>)> cb
+        ) override;
+
         public:
         namespace_t(
             std::uint32_t nsid, std::uint8_t lba_shift, std::uint64_t lba_count,
             arch::dma_pool &pool, std::span<std::unique_ptr<queue_t>> io_queues,
             std::size_t max_transfer_lba, bool vwc
         ) : drive_t { lba_shift, lba_count, std::min(max_transfer_lba, 0x10000zu), pool },
-            _nsid { nsid }, _io_queues { io_queues }, _vwc { vwc } { }
+            _nsid { nsid }, _io_queues { io_queues }, _vwc { vwc }
+        {
+            // one submission slot is always left empty
+            _nr_hw_queues = io_queues.size();
+            _queue_depth = io_queues.front()->depth() - 1;
+        }
 
         std::uint32_t nsid() const { return _nsid; }
 
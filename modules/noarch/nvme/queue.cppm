@@ -39,6 +39,8 @@ export namespace nvme
         queue_t(std::uint16_t depth, arch::mem_space sq_db, arch::mem_space cq_db);
         ~queue_t();
 
+        std::uint32_t depth() const { return _depth; }
+
         std::uintptr_t sq_paddr() const { return _sq; }
         std::uintptr_t cq_paddr() const { return _cq; }
 
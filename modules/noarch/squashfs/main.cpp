@@ -1,5 +1,6 @@
 // Copyright (C) 2024-2026  ilobilo
 
+import system.memory.reclaim;
 import system.memory.virt;
 import system.sched;
 import system.vfs;
@@ -64,6 +65,8 @@ namespace squashfs
                 std::weak_ptr<fs_inode_t>
             > icache;
 
+            std::unique_ptr<reclaim::shrinker> shrinker;
+
             instance_t(
                 std::shared_ptr<vfs::file_t> src, lib::buffer<superblock_t> sb,
                 lib::decompressor decomp
@@ -454,14 +457,75 @@ namespace squashfs
                 return std::unexpected { lib::err::not_supported };
             }
 
+            bool can_drop_dentries() const override { return true; }
+
+            // cached metadata blocks, oldest first, then forgotten inodes
+            std::size_t shrink(std::size_t nr)
+            {
+                std::size_t freed = 0;
+                while (freed < nr && !metadata.empty())
+                {
+                    mcache.erase(metadata.back().location);
+                    metadata.pop_back();
+                    freed++;
+                }
+
+                if (freed < nr)
+                {
+                    std::vector<std::uint64_t> expired;
+                    for (const auto &[ref, weak] : icache)
+                    {
+                        if (weak.expired())
+                            expired.push_back(ref);
+                    }
+                    for (const auto ref : expired)
+                        icache.erase(ref);
+                    freed += expired.size();
+                }
+                return freed;
+            }
+
             bool sync() override { return true; }
             bool unmount(std::shared_ptr<vfs::mount_t> mnt) override
             {
                 lib::unused(mnt);
+                if (shrinker)
+                {
+                    reclaim::unregister_shrinker(shrinker.get());
+                    shrinker.reset();
+                }
                 return true;
             }
         };
 
+        // unmount unregisters this with the instance locked, so scans
+        // must never wait for that lock
+        struct shrinker_t : reclaim::shrinker
+        {
+            instance_ptr handle;
+
+            shrinker_t(instance_ptr handle)
+                : reclaim::shrinker { "squashfs" }, handle { std::move(handle) } { }
+
+            std::size_t count() override
+            {
+                const auto locked = handle.try_lock();
+                if (!locked.owns_lock())
+                    return 0;
+                return locked->metadata.size() + locked->icache.size();
+            }
+
+            std::size_t scan(std::size_t nr, bool may_block) override
+            {
+                lib::unused(may_block);
+
+                auto locked = handle.try_lock();
+                if (!locked.owns_lock())
+                    return 0;
+                return locked->shrink(nr);
+            }
+        };
+
         struct ops_t : vfs::ops_t
         {
             lib::expect<std::size_t> read(
@@ -1194,6 +1258,9 @@ namespace squashfs
                 root->name = "squashfs root";
                 root->inode = std::move(*rres);
                 root->parent = root;
+
+                locked->shrinker = std::make_unique<shrinker_t>(instance);
+                reclaim::register_shrinker(locked->shrinker.get());
             }
 
             auto mount = std::make_shared<struct vfs::mount_t>(std::move(instance), root);